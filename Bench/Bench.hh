@@ -0,0 +1,94 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <time.h>
+
+using namespace std;
+
+/* Percentiles of a set of samples, in the unit they were taken */
+typedef struct latencyStats
+{
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} latencyStats_t;
+
+/*********************************************************************
+ * @fn      		  - nowNs
+ * @brief             - This function reads the monotonic clock
+ * @param[in]         - none
+ * @return            - uint64_t (nanoseconds)
+ * @Note              - vDSO call, about 20ns
+ *********************************************************************/
+static inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/*********************************************************************
+ * @fn      		  - summarise
+ * @brief             - This function computes the percentiles of samples
+ * @param[in]         - vector<uint64_t> &samples
+ * @return            - latencyStats_t
+ * @Note              - Sorts samples in place
+ *********************************************************************/
+static inline latencyStats_t summarise(vector<uint64_t> &samples)
+{
+    latencyStats_t stats = {0, 0, 0, 0};
+    if (samples.empty())
+        return stats;
+
+    sort(samples.begin(), samples.end());
+    size_t last = samples.size() - 1;
+    stats.p50 = samples[last * 50 / 100];
+    stats.p99 = samples[last * 99 / 100];
+    stats.p999 = samples[last * 999 / 1000];
+    stats.max = samples[last];
+    return stats;
+}
+
+/*********************************************************************
+ * @fn      		  - cpuCount
+ * @brief             - This function returns the number of online CPUs
+ * @param[in]         - none
+ * @return            - unsigned
+ * @Note              - Printed by every bench, results depend on it
+ *********************************************************************/
+static inline unsigned cpuCount()
+{
+    unsigned count = thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+/*********************************************************************
+ * @fn      		  - argCount
+ * @brief             - This function reads an optional numeric argument
+ * @param[in]         - int argc, char **argv, int index, size_t fallback
+ * @return            - size_t
+ * @Note              - Accepts k and M suffixes (1k = 1000)
+ *********************************************************************/
+static inline size_t argCount(int argc, char **argv, int index, size_t fallback)
+{
+    if (index >= argc)
+        return fallback;
+
+    char *end;
+    size_t value = strtoull(argv[index], &end, 10);
+    if (*end == 'k')
+        value *= 1000;
+    else if (*end == 'M')
+        value *= 1000000;
+    return value ? value : fallback;
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * /proc/net address decoding benchmark, on the tables NetFixture writes.
+ * First decodes only the address columns: with from_chars as the parser
+ * did before HexDecode, then with the kernels HexDecode picks by column
+ * width ("auto") and with each kernel this CPU can run forced for every
+ * width. Then parses the whole tables with SocketTable::parse() once per
+ * kernel, which is what get-ports-used and who-listens pay.
+ *
+ * Usage: HexDecodeBench <fixture dir> [passes, default 7]
+ */
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <cstring>
+#include "Bench.hh"
+#include "HexDecode.hh"
+#include "PortResolver.hh"
+
+#define HEX_BENCH_PASSES    7
+
+/* PortResolver reads the server options; the bench never turns sock_diag on */
+serverConfig_t serverConfig = {};
+
+static const char *const kernels[] = {"auto", "scalar", "sse2"};
+
+/*********************************************************************
+ * @fn      		  - addressColumns
+ * @brief             - This function finds the local and remote address
+ *                      of every row of a table
+ * @param[in]         - const string &table, vector<string_view> &columns
+ * @return            - none
+ * @Note              - Each view runs to the end of its line, like the one
+ *                      scanAddress() hands to decodeHexWords()
+ *********************************************************************/
+static void addressColumns(const string &table, vector<string_view> &columns)
+{
+    string_view content(table);
+    content.remove_prefix(content.find('\n') + 1);
+
+    while (!content.empty())
+    {
+        size_t eol = content.find('\n');
+        string_view line = content.substr(0, eol);
+        content.remove_prefix(eol == string_view::npos ? content.size() : eol + 1);
+
+        if (!scanSkipFields(line, 1))
+            continue;
+        for (int column = 0; column < 2; column++)
+        {
+            scanSpaces(line);
+            columns.push_back(line);
+            line.remove_prefix(min(line.size(), line.find(' ')));
+        }
+    }
+}
+
+/* The address loop of scanAddress() before HexDecode */
+static bool decodeFromChars(string_view in, int words, uint32_t *out)
+{
+    for (int i = 0; i < words; i++)
+    {
+        const char *hex = in.data() + i * HEX_WORD_CHARS;
+        auto result = from_chars(hex, hex + HEX_WORD_CHARS, out[i], 16);
+        if (result.ec != errc() || result.ptr != hex + HEX_WORD_CHARS)
+            return false;
+    }
+    return true;
+}
+
+typedef bool (*decodeFn_t)(string_view in, int words, uint32_t *out);
+
+/* One way of decoding, with its timings and the checksum of what it decoded */
+typedef struct decoder
+{
+    const char *name;
+    const char *kernel;         /* HexDecode kernel, nullptr for from_chars */
+    decodeFn_t decode;
+    vector<uint64_t> decodeNs;
+    vector<uint64_t> parseNs;
+    uint32_t checksum;
+    size_t sockets;
+} decoder_t;
+
+/*********************************************************************
+ * @fn      		  - decodeColumns
+ * @brief             - This function decodes every address column
+ * @param[in]         - const vector<string_view> &columns, int words,
+ *                      decodeFn_t decode
+ * @return            - uint32_t (checksum of the decoded words, 0 if a
+ *                      column did not decode)
+ * @Note              -
+ *********************************************************************/
+static uint32_t decodeColumns(const vector<string_view> &columns, int words, decodeFn_t decode)
+{
+    uint32_t checksum = 0;
+    for (string_view column : columns)
+    {
+        uint32_t out[HEX_MAX_WORDS];
+        if (!decode(column, words, out))
+            return 0;
+        for (int i = 0; i < words; i++)
+            checksum = checksum * 31 + out[i];
+    }
+    return checksum;
+}
+
+/*********************************************************************
+ * @fn      		  - runTable
+ * @brief             - This function runs the decoders over one table
+ *                      and prints their rates
+ * @param[in]         - const string &path, bool v6, int passes
+ * @return            - bool (false if the file is missing or the
+ *                      decoders disagree)
+ * @Note              - Decoders take turns within a pass, so drift of the
+ *                      machine hits all of them alike; median pass
+ *********************************************************************/
+static bool runTable(const string &path, bool v6, int passes)
+{
+    ifstream file(path);
+    if (!file.is_open())
+    {
+        fprintf(stderr, "%s is missing, run NetFixture first\n", path.c_str());
+        return false;
+    }
+    stringstream read;
+    read << file.rdbuf();
+    string table = read.str();
+
+    vector<string_view> columns;
+    addressColumns(table, columns);
+    int words = v6 ? 4 : 1;
+    size_t rows = columns.size() / 2;
+    printf("%s: %zu rows, %zu MB\n", path.c_str(), rows, table.size() >> 20);
+
+    vector<decoder_t> decoders = {{"from_chars", nullptr, decodeFromChars, {}, {}, 0, 0}};
+    for (const char *kernel : kernels)
+    {
+        if (useHexDecoder(kernel))
+            decoders.push_back({kernel, kernel, decodeHexWords, {}, {}, 0, 0});
+        else
+            printf("  %-12s not supported by this CPU\n", kernel);
+    }
+
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (decoder_t &decoder : decoders)
+        {
+            if (decoder.kernel)
+                useHexDecoder(decoder.kernel);
+
+            uint64_t start = nowNs();
+            decoder.checksum = decodeColumns(columns, words, decoder.decode);
+            decoder.decodeNs.push_back(nowNs() - start);
+            if (!decoder.kernel)
+                continue;
+
+            SocketTable sockTable;
+            start = nowNs();
+            sockTable.parse(table, SOCK_PROTO_TCP, v6, SOCK_STATES_ALL);
+            decoder.parseNs.push_back(nowNs() - start);
+            decoder.sockets = sockTable.size();
+        }
+    }
+
+    bool agree = true;
+    printf("  %-12s %16s %16s\n", "decoder", "M addresses/s", "M rows/s parsed");
+    for (decoder_t &decoder : decoders)
+    {
+        agree &= decoder.checksum != 0 && decoder.checksum == decoders[0].checksum;
+        double decodeRate = columns.size() * 1e3 / summarise(decoder.decodeNs).p50;
+        if (decoder.kernel)
+            printf("  %-12s %16.2f %16.2f\n", decoder.name, decodeRate, rows * 1e3 / summarise(decoder.parseNs).p50);
+        else
+            printf("  %-12s %16.2f %16s\n", decoder.name, decodeRate, "-");
+    }
+    printf("  %zu sockets kept\n", decoders.back().sockets);
+
+    if (!agree)
+        fprintf(stderr, "  kernels disagree with from_chars\n");
+    return agree;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <fixture dir> [passes]\n", argv[0]);
+        return 1;
+    }
+
+    string dir = argv[1];
+    int passes = static_cast<int>(argCount(argc, argv, 2, HEX_BENCH_PASSES));
+    printf("%d passes, median, %u CPUs, auto picks %s for tcp and %s for tcp6\n", passes, cpuCount(),
+           hexDecoderName(1), hexDecoderName(HEX_MAX_WORDS));
+
+    bool agree = runTable(dir + "/tcp", false, passes);
+    agree &= runTable(dir + "/tcp6", true, passes);
+    return agree ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+/*
+ * Fixture generator: writes <dir>/tcp and <dir>/tcp6 laid out like
+ * /proc/net/tcp and /proc/net/tcp6, with the same seed every time so runs
+ * compare. Most rows are established connections on private addresses,
+ * some listeners and some TIME_WAIT rows without an inode; a quarter of
+ * the IPv6 rows are IPv4 mapped.
+ *
+ * Usage: NetFixture <dir> [rows, default 1M]
+ */
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include "Bench.hh"
+
+#define NET_FIXTURE_ROWS        1000000
+#define NET_FIXTURE_SEED        0x9E3779B97F4A7C15ull
+#define NET_FIXTURE_BUF_SIZE    (1 << 20)
+
+/* Header lines as the kernel prints them */
+static const char tcpHeader[] =
+    "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode";
+static const char tcp6Header[] =
+    "  sl  local_address                         remote_address                        st tx_queue rx_queue "
+    "tr tm->when retrnsmt   uid  timeout inode\n";
+
+static uint64_t rngState = NET_FIXTURE_SEED;
+
+/* xorshift64*, enough to spread addresses and ports */
+static inline uint32_t nextRandom()
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return static_cast<uint32_t>((rngState * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+/* Row state: 80% ESTABLISHED, 10% LISTEN, 10% TIME_WAIT */
+static inline unsigned nextState()
+{
+    unsigned pick = nextRandom() % 10;
+    return pick < 8 ? 0x01 : pick == 8 ? 0x0A : 0x06;
+}
+
+/* An address in 10.0.0.0/8, as the kernel prints it: the word in host order */
+static inline uint32_t nextV4()
+{
+    return 0x0000000Au | (nextRandom() & 0xFFFFFF00u);
+}
+
+/*********************************************************************
+ * @fn      		  - writeTcp
+ * @brief             - This function writes a /proc/net/tcp like table
+ * @param[in]         - const string &path, size_t rows
+ * @return            - bool
+ * @Note              - Lines are padded to 149 characters like the kernel's
+ *********************************************************************/
+static bool writeTcp(const string &path, size_t rows)
+{
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out)
+        return false;
+    setvbuf(out, nullptr, _IOFBF, NET_FIXTURE_BUF_SIZE);
+
+    fprintf(out, "%-149s\n", tcpHeader);
+    for (size_t i = 0; i < rows; i++)
+    {
+        char line[160];
+        unsigned state = nextState();
+        unsigned long inode = state == 0x06 ? 0 : 10000 + i;
+        snprintf(line, sizeof(line),
+                 "%4zu: %08X:%04X %08X:%04X %02X %08X:%08X %02X:%08lX %08X %5u %8d %lu %d %016llx %lu %lu %u %u %d",
+                 i, nextV4(), nextRandom() & 0xFFFF, state == 0x0A ? 0 : nextV4(),
+                 state == 0x0A ? 0 : nextRandom() & 0xFFFF, state, 0, 0, 0, 0ul, 0, 1000, 0, inode, 1,
+                 0xffff888000000000ull + i * 64, 20ul, 4ul, 30u, 10u, -1);
+        fprintf(out, "%-149s\n", line);
+    }
+    return fclose(out) == 0;
+}
+
+/*********************************************************************
+ * @fn      		  - writeTcp6
+ * @brief             - This function writes a /proc/net/tcp6 like table
+ * @param[in]         - const string &path, size_t rows
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+static bool writeTcp6(const string &path, size_t rows)
+{
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out)
+        return false;
+    setvbuf(out, nullptr, _IOFBF, NET_FIXTURE_BUF_SIZE);
+
+    fputs(tcp6Header, out);
+    for (size_t i = 0; i < rows; i++)
+    {
+        uint32_t local[4], remote[4];
+        bool mapped = (nextRandom() & 3) == 0;
+        unsigned state = nextState();
+        unsigned long inode = state == 0x06 ? 0 : 10000 + i;
+
+        for (uint32_t *addr : {local, remote})
+        {
+            if (mapped)
+            {
+                // ::ffff:a.b.c.d, words in host order
+                addr[0] = addr[1] = 0;
+                addr[2] = 0xFFFF0000u;
+                addr[3] = nextV4();
+            }
+            else
+            {
+                // 2001:db8::/32 with random low bits
+                addr[0] = 0xB80D0120u;
+                addr[1] = nextRandom();
+                addr[2] = nextRandom();
+                addr[3] = nextRandom();
+            }
+        }
+        if (state == 0x0A)
+            memset(remote, 0, sizeof(remote));
+
+        fprintf(out, "%4zu: %08X%08X%08X%08X:%04X %08X%08X%08X%08X:%04X %02X %08X:%08X %02X:%08lX %08X %5u %8d %lu %d "
+                     "%016llx %lu %lu %u %u %d\n",
+                i, local[0], local[1], local[2], local[3], nextRandom() & 0xFFFF,
+                remote[0], remote[1], remote[2], remote[3], state == 0x0A ? 0 : nextRandom() & 0xFFFF,
+                state, 0, 0, 0, 0ul, 0, 1000, 0, inode, 1, 0xffff888000000000ull + i * 64, 20ul, 4ul, 30u, 10u, -1);
+    }
+    return fclose(out) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <dir> [rows]\n", argv[0]);
+        return 1;
+    }
+
+    string dir = argv[1];
+    size_t rows = argCount(argc, argv, 2, NET_FIXTURE_ROWS);
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        perror(dir.c_str());
+        return 1;
+    }
+
+    if (!writeTcp(dir + "/tcp", rows) || !writeTcp6(dir + "/tcp6", rows))
+    {
+        perror(dir.c_str());
+        return 1;
+    }
+    printf("Wrote %zu rows to %s/tcp and %s/tcp6\n", rows, dir.c_str(), dir.c_str());
+    return 0;
+}
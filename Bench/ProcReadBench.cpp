@@ -0,0 +1,207 @@
+/*
+ * Per-process /proc read cost: reads state, times, memory and command line
+ * of every process, three ways. The old commands opened each file by path
+ * through ifstream and split it with istringstream; the openat path opens
+ * /proc/<pid> per process and parses the read buffer in place; the cached
+ * path is readProcEntry(), reusing the /proc/<pid> descriptor kept open
+ * across scans. Idle children are forked first so the scan has a steady
+ * population.
+ *
+ * Usage: ProcReadBench [children, default 1000] [passes, default 30]
+ */
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "Bench.hh"
+#include "ProcReader.hh"
+#include "ProcScanner.hh"
+#include "ProcessTable.hh"
+
+#define PROC_READ_BENCH_CHILDREN    1000
+#define PROC_READ_BENCH_PASSES      30
+
+/* What the old get-cpu-usage, get-memory-usage and get-process read per pid */
+typedef struct legacyEntry
+{
+    long utime;
+    long stime;
+    long vmRss;
+    long vmSize;
+    string cmdline;
+} legacyEntry_t;
+
+/*********************************************************************
+ * @fn      		  - readLegacy
+ * @brief             - This function reads one process the way the
+ *                      commands did before ProcReader
+ * @param[in]         - int pid, legacyEntry_t &entry
+ * @return            - bool (false if the process is gone)
+ * @Note              - Leaves out the /proc/stat read get-cpu-usage also
+ *                      did per pid, it is not per process work
+ *********************************************************************/
+static bool readLegacy(int pid, legacyEntry_t &entry)
+{
+    string base = "/proc/" + to_string(pid);
+    ifstream statFile(base + "/stat");
+    if (!statFile.is_open())
+        return false;
+
+    string line;
+    getline(statFile, line);
+    statFile.close();
+
+    istringstream iss(line);
+    string token;
+    vector<string> tokens;
+    while (iss >> token)
+        tokens.push_back(token);
+    if (tokens.size() < 15)
+        return false;
+    entry.utime = stol(tokens[13]);
+    entry.stime = stol(tokens[14]);
+
+    ifstream statusFile(base + "/status");
+    entry.vmRss = entry.vmSize = -1;
+    while (getline(statusFile, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+        {
+            stringstream ss(line.substr(6));
+            ss >> entry.vmRss;
+        }
+        else if (line.compare(0, 7, "VmSize:") == 0)
+        {
+            stringstream ss(line.substr(7));
+            ss >> entry.vmSize;
+        }
+    }
+
+    ifstream cmdlineFile(base + "/cmdline");
+    getline(cmdlineFile, entry.cmdline, '\0');
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - readOpenat
+ * @brief             - This function reads one process opening its
+ *                      /proc/<pid> directory for this read only
+ * @param[in]         - int pid, procEntry_t &entry
+ * @return            - bool (false if the process is gone)
+ * @Note              - Same fields and parsing as readProcEntry()
+ *********************************************************************/
+static bool readOpenat(int pid, procEntry_t &entry)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "%d", pid);
+    int dirFd = openat(procRootFd(), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0)
+        return false;
+
+    string_view content;
+    procStat_t stat;
+    bool found = readProcFile(dirFd, "stat", content) && parseProcStat(content, stat);
+    if (found)
+    {
+        entry.pid = pid;
+        entry.comm.assign(stat.comm.data(), stat.comm.size());
+        entry.state = stat.state;
+        entry.utime = stat.utime;
+        entry.stime = stat.stime;
+        entry.rssKb = stat.rss;
+        entry.vsizeKb = static_cast<long>(stat.vsize / 1024);
+        if (readProcFile(dirFd, "cmdline", content))
+        {
+            entry.cmdline.assign(content.data(), content.size());
+            replace(entry.cmdline.begin(), entry.cmdline.end(), '\0', ' ');
+        }
+    }
+    close(dirFd);
+    return found;
+}
+
+/* One way of reading a process, and its cost per process in each pass */
+typedef struct procReader
+{
+    const char *name;
+    function<bool(int pid)> read;
+    vector<uint64_t> perProcess;
+    size_t found;
+} procReader_t;
+
+/*********************************************************************
+ * @fn      		  - runReaders
+ * @brief             - This function reads every pid once per pass with
+ *                      each reader and prints the cost per process
+ * @param[in]         - vector<procReader_t> &readers,
+ *                      const vector<int> &pids, int passes
+ * @return            - none
+ * @Note              - Readers take turns within a pass, so drift of the
+ *                      machine hits all of them alike. Median and worst
+ *                      pass, after one warm up pass
+ *********************************************************************/
+static void runReaders(vector<procReader_t> &readers, const vector<int> &pids, int passes)
+{
+    for (int pass = 0; pass <= passes; pass++)
+    {
+        for (procReader_t &reader : readers)
+        {
+            reader.found = 0;
+            uint64_t start = nowNs();
+            for (int pid : pids)
+                reader.found += reader.read(pid);
+            uint64_t elapsed = nowNs() - start;
+            if (pass > 0)
+                reader.perProcess.push_back(elapsed / pids.size());
+        }
+    }
+
+    for (procReader_t &reader : readers)
+    {
+        latencyStats_t stats = summarise(reader.perProcess);
+        printf("%-26s %8zu %10.2f %10.2f\n", reader.name, reader.found, stats.p50 / 1e3, stats.max / 1e3);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t children = argCount(argc, argv, 1, PROC_READ_BENCH_CHILDREN);
+    int passes = static_cast<int>(argCount(argc, argv, 2, PROC_READ_BENCH_PASSES));
+    vector<pid_t> forked;
+
+    for (size_t i = 0; i < children; i++)
+    {
+        pid_t child = fork();
+        if (child == 0)
+        {
+            pause();
+            _exit(0);
+        }
+        if (child < 0)
+            break;
+        forked.push_back(child);
+    }
+
+    vector<int> pids;
+    listProcPids(pids);
+    printf("%zu processes (%zu forked), %d passes, %u CPUs\n", pids.size(), forked.size(), passes, cpuCount());
+    printf("%-26s %8s %10s %10s\n", "reader", "found", "p50 us", "max us");
+
+    legacyEntry_t legacy;
+    procEntry_t entry;
+    vector<procReader_t> readers = {
+        {"ifstream by path (old)", [&](int pid) { return readLegacy(pid, legacy); }, {}, 0},
+        {"openat /proc/<pid>", [&](int pid) { return readOpenat(pid, entry); }, {}, 0},
+        {"readProcEntry, cached dir", [&](int pid) { return readProcEntry(pid, entry); }, {}, 0},
+    };
+    runReaders(readers, pids, passes);
+    printf("cached /proc/<pid> descriptors: %zu\n", procDirCache.size());
+
+    for (pid_t child : forked)
+        kill(child, SIGKILL);
+    for (pid_t child : forked)
+        waitpid(child, nullptr, 0);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * /proc scan scaling benchmark on synthetic process trees of 1k, 10k and
+ * 100k entries, each <pid>/stat and <pid>/cmdline laid out like /proc.
+ * Times the getdents64 listing, then the work-stealing ProcScanner reading
+ * and parsing every entry, at 1, 2, 4, ... threads up to the number of
+ * CPUs (at least 4). The trees are built once under the fixture directory
+ * and reused by later runs.
+ *
+ * Usage: ProcScanBench <fixture dir> [passes, default 5]
+ */
+#include <charconv>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Bench.hh"
+#include "ProcReader.hh"
+#include "ProcScanner.hh"
+
+#define PROC_SCAN_BENCH_PASSES  5
+#define PROC_SCAN_BENCH_PID0    300         /* first synthetic pid */
+
+static const size_t treeSizes[] = {1000, 10000, 100000};
+
+/* What the visitor keeps of each process, per scanner slot */
+typedef struct scanResult
+{
+    int pid;
+    int ppid;
+    unsigned long cpuTime;
+    size_t cmdlineLen;
+} scanResult_t;
+
+/*********************************************************************
+ * @fn      		  - writeFile
+ * @brief             - This function writes a small file below dirFd
+ * @param[in]         - int dirFd, const char *name, const char *data, size_t len
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+static bool writeFile(int dirFd, const char *name, const char *data, size_t len)
+{
+    int fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = write(fd, data, len) == static_cast<ssize_t>(len);
+    return close(fd) == 0 && written;
+}
+
+/*********************************************************************
+ * @fn      		  - buildTree
+ * @brief             - This function creates a /proc like tree of count
+ *                      processes, unless an earlier run completed it
+ * @param[in]         - const string &path, size_t count
+ * @return            - int (descriptor of the tree, -1 on error)
+ * @Note              - A "complete" file is written last, so a tree left
+ *                      half built by an interrupted run is filled in again
+ *********************************************************************/
+static int buildTree(const string &path, size_t count)
+{
+    if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)
+        return -1;
+    int rootFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd < 0 || faccessat(rootFd, "complete", F_OK, 0) == 0)
+        return rootFd;
+
+    uint64_t start = nowNs();
+    for (size_t i = 0; i < count; i++)
+    {
+        int pid = PROC_SCAN_BENCH_PID0 + static_cast<int>(i);
+        char name[16];
+        *to_chars(name, name + sizeof(name) - 1, pid).ptr = '\0';
+        if (mkdirat(rootFd, name, 0755) < 0 && errno != EEXIST)
+            return -1;
+        int dirFd = openat(rootFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0)
+            return -1;
+
+        // Field for field what the kernel prints for a sleeping process
+        char stat[512];
+        int len = snprintf(stat, sizeof(stat),
+                           "%d (worker-%zu) S %d %d %d 0 -1 4194560 %zu 0 12 0 %zu %zu 0 0 20 0 1 0 %zu "
+                           "%zu %zu 18446744073709551615 94779432460288 94779432871117 140728898420144 0 0 0 0 "
+                           "4096 16386 0 0 0 17 0 0 0 0 0 0 94779433011784 94779433032608 94779458818048 "
+                           "140728898422613 140728898422648 140728898422648 140728898424814 0\n",
+                           pid, i % 97, 1 + static_cast<int>(i % 50), pid, pid, 200 + i % 1000, i % 5000,
+                           i % 700, 1000 + i * 13, 230000000 + i * 4096, 1200 + i % 4000);
+        char cmdline[128];
+        int cmdLen = snprintf(cmdline, sizeof(cmdline), "/usr/lib/example/worker-%zu%c--instance%c%zu%c",
+                              i % 97, '\0', '\0', i, '\0');
+        bool written = writeFile(dirFd, "stat", stat, len) && writeFile(dirFd, "cmdline", cmdline, cmdLen);
+        close(dirFd);
+        if (!written)
+            return -1;
+    }
+    if (!writeFile(rootFd, "complete", "", 0))
+        return -1;
+    printf("built %s in %.1f s\n", path.c_str(), (nowNs() - start) / 1e9);
+    return rootFd;
+}
+
+/*********************************************************************
+ * @fn      		  - scanTree
+ * @brief             - This function reads and parses every process of
+ *                      the tree with the scanner
+ * @param[in]         - ProcScanner &scanner, int rootFd, const vector<int> &pids,
+ *                      vector<vector<scanResult_t>> &results
+ * @return            - size_t (processes parsed)
+ * @Note              - Same work per process as readProcEntry(): open the
+ *                      pid directory, read and parse stat, read cmdline
+ *********************************************************************/
+static size_t scanTree(ProcScanner &scanner, int rootFd, const vector<int> &pids,
+                       vector<vector<scanResult_t>> &results)
+{
+    for (vector<scanResult_t> &slot : results)
+        slot.clear();
+
+    scanner.run(pids, [&](int slot, int pid) {
+        char name[16];
+        *to_chars(name, name + sizeof(name) - 1, pid).ptr = '\0';
+        int dirFd = openat(rootFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0)
+            return;
+
+        string_view content;
+        procStat_t stat;
+        if (readProcFile(dirFd, "stat", content) && parseProcStat(content, stat))
+        {
+            scanResult_t result = {pid, stat.ppid, stat.utime + stat.stime, 0};
+            if (readProcFile(dirFd, "cmdline", content))
+                result.cmdlineLen = content.size();
+            results[slot].push_back(result);
+        }
+        close(dirFd);
+    });
+
+    size_t parsed = 0;
+    for (vector<scanResult_t> &slot : results)
+        parsed += slot.size();
+    return parsed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <fixture dir> [passes]\n", argv[0]);
+        return 1;
+    }
+
+    string dir = argv[1];
+    int passes = static_cast<int>(argCount(argc, argv, 2, PROC_SCAN_BENCH_PASSES));
+    int maxThreads = max(static_cast<int>(cpuCount()), 4);
+    printf("%d passes, median, %u CPUs\n", passes, cpuCount());
+
+    for (size_t count : treeSizes)
+    {
+        int rootFd = buildTree(dir + "/proc-" + to_string(count), count);
+        if (rootFd < 0)
+        {
+            perror(dir.c_str());
+            return 1;
+        }
+
+        vector<int> pids;
+        vector<uint64_t> listNs;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            uint64_t start = nowNs();
+            listPids(rootFd, pids);
+            listNs.push_back(nowNs() - start);
+        }
+        printf("%zu processes: listed in %.3f ms\n", pids.size(), summarise(listNs).p50 / 1e6);
+        printf("  %7s %10s %12s %8s\n", "threads", "scan ms", "K procs/s", "speedup");
+
+        double single = 0;
+        for (int threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            ProcScanner scanner;
+            scanner.start(threads);
+            vector<vector<scanResult_t>> results(scanner.concurrency());
+            vector<uint64_t> scanNs;
+            size_t parsed = 0;
+
+            for (int pass = 0; pass < passes; pass++)
+            {
+                uint64_t start = nowNs();
+                parsed = scanTree(scanner, rootFd, pids, results);
+                scanNs.push_back(nowNs() - start);
+            }
+            scanner.stop();
+
+            double ms = summarise(scanNs).p50 / 1e6;
+            if (threads == 1)
+                single = ms;
+            printf("  %7d %10.3f %12.1f %7.2fx%s\n", threads, ms, parsed / ms, single / ms,
+                   parsed == pids.size() ? "" : "  MISSING PROCESSES");
+        }
+        close(rootFd);
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Outbound queue benchmark: producers push timestamped items, one consumer
+ * pops them. Compares MpscQueue, as the connection writers use it, with the
+ * deque + mutex the responses went through before: once with the consumer
+ * spinning on the lock like the old sendResponse loop, once sleeping on a
+ * condition variable.
+ *
+ * Usage: QueueBench [items per run, default 1M]
+ */
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <condition_variable>
+#include "Bench.hh"
+#include "MpscQueue.hh"
+#include "Connection.hh"
+
+#define QUEUE_BENCH_ITEMS   1000000
+
+typedef struct item
+{
+    uint64_t stamp;             /* nowNs() at push */
+    uint32_t producer;
+    uint32_t seq;
+} item_t;
+
+/* The queue the connection writers use */
+class RingQueue
+{
+private:
+    MpscQueue<item_t> queue{OUTBOUND_QUEUE_SIZE};
+
+public:
+    static constexpr const char *name = "MpscQueue";
+
+    void push(item_t &&item) { queue.pushOrSpill(move(item)); }
+    void pop(item_t &item)
+    {
+        while (!queue.popWait(item))
+            ;
+    }
+};
+
+/* The response deque before MpscQueue: the sender retried the lock until it got an item */
+class SpinDeque
+{
+private:
+    mutex mtx;
+    deque<item_t> items;
+
+public:
+    static constexpr const char *name = "deque+mutex spin";
+
+    void push(item_t &&item)
+    {
+        lock_guard<mutex> guard(mtx);
+        items.push_back(item);
+    }
+    void pop(item_t &item)
+    {
+        while (true)
+        {
+            lock_guard<mutex> guard(mtx);
+            if (!items.empty())
+            {
+                item = items.front();
+                items.pop_front();
+                return;
+            }
+        }
+    }
+};
+
+/* Same deque with a sleeping consumer, the usual blocking queue */
+class CondDeque
+{
+private:
+    mutex mtx;
+    condition_variable ready;
+    deque<item_t> items;
+
+public:
+    static constexpr const char *name = "deque+mutex+condvar";
+
+    void push(item_t &&item)
+    {
+        {
+            lock_guard<mutex> guard(mtx);
+            items.push_back(item);
+        }
+        ready.notify_one();
+    }
+    void pop(item_t &item)
+    {
+        unique_lock<mutex> lock(mtx);
+        ready.wait(lock, [this] { return !items.empty(); });
+        item = items.front();
+        items.pop_front();
+    }
+};
+
+/*********************************************************************
+ * @fn      		  - runQueue
+ * @brief             - This function runs one queue with n producers and
+ *                      prints throughput and latency percentiles
+ * @param[in]         - unsigned producers, size_t items
+ * @return            - none
+ * @Note              - Push latency is the time spent in push(), end to
+ *                      end latency runs from push() to the consumer
+ *********************************************************************/
+template <typename Q>
+static void runQueue(unsigned producers, size_t items)
+{
+    Q queue;
+    atomic<bool> go(false);
+    size_t perProducer = items / producers;
+    size_t total = perProducer * producers;
+    vector<vector<uint64_t>> pushLatency(producers);
+    vector<uint64_t> endToEnd;
+    vector<thread> threads;
+    size_t outOfOrder = 0;
+
+    endToEnd.reserve(total);
+    for (unsigned p = 0; p < producers; p++)
+    {
+        pushLatency[p].reserve(perProducer);
+        threads.emplace_back([&, p] {
+            while (!go.load(memory_order_acquire))
+                this_thread::yield();
+            for (size_t i = 0; i < perProducer; i++)
+            {
+                uint64_t start = nowNs();
+                queue.push(item_t{start, p, static_cast<uint32_t>(i)});
+                pushLatency[p].push_back(nowNs() - start);
+            }
+        });
+    }
+
+    vector<uint32_t> nextSeq(producers, 0);
+    uint64_t start = nowNs();
+    go.store(true, memory_order_release);
+    for (size_t i = 0; i < total; i++)
+    {
+        item_t item;
+        queue.pop(item);
+        endToEnd.push_back(nowNs() - item.stamp);
+        if (item.seq != nextSeq[item.producer])
+            outOfOrder++;
+        nextSeq[item.producer] = item.seq + 1;
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    for (thread &t : threads)
+        t.join();
+
+    vector<uint64_t> pushAll;
+    pushAll.reserve(total);
+    for (vector<uint64_t> &samples : pushLatency)
+        pushAll.insert(pushAll.end(), samples.begin(), samples.end());
+
+    latencyStats_t push = summarise(pushAll);
+    latencyStats_t e2e = summarise(endToEnd);
+    printf("%-20s %4u %9.2f %8llu %8llu %8llu %10.1f %10.1f %10.1f%s\n",
+           Q::name, producers, total * 1e3 / elapsed,
+           (unsigned long long)push.p50, (unsigned long long)push.p99, (unsigned long long)push.p999,
+           e2e.p50 / 1e3, e2e.p99 / 1e3, e2e.p999 / 1e3,
+           outOfOrder ? "  OUT OF ORDER" : "");
+}
+
+int main(int argc, char **argv)
+{
+    size_t items = argCount(argc, argv, 1, QUEUE_BENCH_ITEMS);
+    static const unsigned producerCounts[] = {1, 4, 16};
+
+    printf("%zu items per run, %u CPUs, ring of %d\n", items, cpuCount(), OUTBOUND_QUEUE_SIZE);
+    printf("%-20s %4s %9s %8s %8s %8s %10s %10s %10s\n", "queue", "prod", "Mitem/s",
+           "push p50", "p99 ns", "p999 ns", "e2e p50", "p99 us", "p999 us");
+    for (unsigned producers : producerCounts)
+    {
+        runQueue<RingQueue>(producers, items);
+        runQueue<SpinDeque>(producers, items);
+        runQueue<CondDeque>(producers, items);
+    }
+    return 0;
+}
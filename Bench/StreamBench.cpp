@@ -0,0 +1,235 @@
+/*
+ * Response streaming benchmark: sends a get-process listing of 5,000
+ * processes over TCP loopback to a draining receiver. Compares the old
+ * path, which cut the body in MESSAGE_SIZE chunks queued one by one and
+ * sent one struct per send(), with sendStream() and with appendStream()
+ * followed by sendAll(). send() and sendmsg() are interposed to count the
+ * calls each path makes.
+ *
+ * Usage: StreamBench [processes, default 5000] [runs, default 20]
+ */
+#include <mutex>
+#include <deque>
+#include <array>
+#include <atomic>
+#include <variant>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "Bench.hh"
+#include "MessageHandle.hh"
+
+#define STREAM_BENCH_PROCESSES  5000
+#define STREAM_BENCH_RUNS       20
+#define STREAM_BENCH_RECV_SIZE  (256 * 1024)
+
+static atomic<size_t> sendCalls(0);
+static atomic<size_t> sendBytes(0);
+
+/* Counting wrappers, the executable's definitions win over libc's */
+extern "C" ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    long sent = syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+    sendCalls.fetch_add(1, memory_order_relaxed);
+    if (sent > 0)
+        sendBytes.fetch_add(sent, memory_order_relaxed);
+    return sent;
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    long sent = syscall(SYS_sendmsg, fd, msg, flags);
+    sendCalls.fetch_add(1, memory_order_relaxed);
+    if (sent > 0)
+        sendBytes.fetch_add(sent, memory_order_relaxed);
+    return sent;
+}
+
+/* Layout of the MessageHeader the old sender copied to the socket as is */
+typedef struct legacyMessage
+{
+    appType_e selfInfo;
+    int messageSize;
+    msgType_e msgType;
+    command_e command;
+    bool isPid;
+    variant<int, array<char, MESSAGE_SIZE>> pidOrProccessNameVariant;
+    struct
+    {
+        int socket;
+        int sequenceNum;
+        char msg[MESSAGE_SIZE + 1];
+    } response;
+} legacyMessage_t;
+
+/*********************************************************************
+ * @fn      		  - sendLegacy
+ * @brief             - This function sends body the way prepareAndTx and
+ *                      sendResponse did
+ * @param[in]         - int sock, const string &body
+ * @return            - none
+ * @Note              - The producer queues one struct per MESSAGE_SIZE
+ *                      bytes under the mutex, the sender spins on the
+ *                      mutex and holds it across each send()
+ *********************************************************************/
+static void sendLegacy(int sock, const string &body)
+{
+    mutex mtx;
+    deque<legacyMessage_t> responseDeque;
+
+    thread sender([&] {
+        while (true)
+        {
+            lock_guard<mutex> guard(mtx);
+            if (!responseDeque.empty())
+            {
+                legacyMessage_t out = responseDeque.front();
+                responseDeque.pop_front();
+                send(sock, &out, sizeof(out), 0);
+                if (out.msgType == MSG_TYPE_END_OF_RESPONSE)
+                    return;
+            }
+        }
+    });
+
+    for (size_t i = 0; i < body.size(); i += MESSAGE_SIZE)
+    {
+        legacyMessage_t out = {};
+        string chunk = body.substr(i, MESSAGE_SIZE);
+        out.selfInfo = APPTYPE_SERVER;
+        out.msgType = MSG_TYPE_RESPONSE;
+        out.response.socket = sock;
+        out.response.sequenceNum = i / MESSAGE_SIZE + 1;
+        chunk.copy(out.response.msg, MESSAGE_SIZE);
+        lock_guard<mutex> guard(mtx);
+        responseDeque.push_back(out);
+    }
+    legacyMessage_t endout = {};
+    endout.selfInfo = APPTYPE_SERVER;
+    endout.msgType = MSG_TYPE_END_OF_RESPONSE;
+    endout.response.socket = sock;
+    endout.response.sequenceNum = -1;
+    {
+        lock_guard<mutex> guard(mtx);
+        responseDeque.push_back(endout);
+    }
+    sender.join();
+}
+
+/* Writer thread path: one gathered write per response */
+static void sendStreamed(int sock, const string &body)
+{
+    sendStream(sock, 0, body, DEFAULT_FRAME_SIZE);
+}
+
+/* Reactor path: frames staged in the connection buffer, then written out */
+static void sendStaged(int sock, const string &body)
+{
+    string out;
+    appendStream(out, 0, body, DEFAULT_FRAME_SIZE);
+    sendAll(sock, out.data(), out.size());
+}
+
+/*********************************************************************
+ * @fn      		  - connectedPair
+ * @brief             - This function opens a TCP loopback connection
+ * @param[in]         - int &client, int &server
+ * @return            - bool
+ * @Note              - Nagle is off like on the server sockets
+ *********************************************************************/
+static bool connectedPair(int &client, int &server)
+{
+    struct sockaddr_in addr = {};
+    socklen_t addrLen = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listener, 1) < 0 || getsockname(listener, (struct sockaddr *)&addr, &addrLen) < 0)
+        return false;
+
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return false;
+    server = accept(listener, nullptr, nullptr);
+    close(listener);
+
+    int one = 1;
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return server >= 0;
+}
+
+/*********************************************************************
+ * @fn      		  - runPath
+ * @brief             - This function streams body through one path and
+ *                      prints send calls and wall time
+ * @param[in]         - const char *name, void (*path)(int, const string &),
+ *                      const string &body, int runs
+ * @return            - none
+ * @Note              - Wall time runs until the receiver has read
+ *                      everything, median of the runs
+ *********************************************************************/
+static void runPath(const char *name, void (*path)(int, const string &), const string &body, int runs)
+{
+    vector<uint64_t> wall;
+    size_t calls = 0;
+    size_t bytes = 0;
+
+    for (int run = 0; run < runs; run++)
+    {
+        int client, server;
+        if (!connectedPair(client, server))
+        {
+            perror("loopback");
+            exit(1);
+        }
+
+        thread receiver([client] {
+            vector<char> buf(STREAM_BENCH_RECV_SIZE);
+            while (recv(client, buf.data(), buf.size(), 0) > 0)
+                ;
+        });
+
+        sendCalls.store(0);
+        sendBytes.store(0);
+        uint64_t start = nowNs();
+        path(server, body);
+        shutdown(server, SHUT_WR);
+        receiver.join();
+        wall.push_back(nowNs() - start);
+        calls = sendCalls.load();
+        bytes = sendBytes.load();
+
+        close(server);
+        close(client);
+    }
+
+    latencyStats_t stats = summarise(wall);
+    double bodyKb = body.size() / 1024.0;
+    printf("%-26s %9zu %10.3f %10zu %10.3f %10.3f\n", name, calls, calls / bodyKb, bytes,
+           stats.p50 / 1e6, stats.max / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    size_t processes = argCount(argc, argv, 1, STREAM_BENCH_PROCESSES);
+    int runs = static_cast<int>(argCount(argc, argv, 2, STREAM_BENCH_RUNS));
+
+    // Shaped like a get-process listing: "pid : command line"
+    string body;
+    for (size_t i = 0; i < processes; i++)
+        body += to_string(1000 + i * 7) + " : /usr/lib/example/worker-" + to_string(i % 97) +
+                " --config /etc/example/worker.conf --instance " + to_string(i) + "\n";
+
+    printf("%zu processes, %zu byte body, %d runs, %u CPUs, legacy struct %zu bytes\n",
+           processes, body.size(), runs, cpuCount(), sizeof(legacyMessage_t));
+    printf("%-26s %9s %10s %10s %10s %10s\n", "path", "sends", "sends/KB", "wire B", "p50 ms", "max ms");
+    runPath("100-byte chunks (old)", sendLegacy, body, runs);
+    runPath("sendStream", sendStreamed, body, runs);
+    runPath("appendStream + sendAll", sendStaged, body, runs);
+    return 0;
+}
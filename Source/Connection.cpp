@@ -0,0 +1,212 @@
+#include "Connection.hh"
+#include <deque>
+
+static atomic<uint64_t> nextConnId(1);
+
+/*********************************************************************
+ * @fn      		  - Connection() [parameterised constructor]
+ * @brief             - This constructor initialise the object of the class
+ *                      with the client socket and the negotiated session
+ * @param[in]         - int sock, const session_t &session
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+Connection::Connection(int sock, const session_t &session)
+    : sock(sock), id(nextConnId++), session(session), outbound(OUTBOUND_QUEUE_SIZE), closed(false), backlog(0),
+      readerWaiting(false)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - enqueue
+ * @brief             - This function adds a complete response to the outbound
+ *                      queue and wakes the writer
+ * @param[in]         - string resp, uint32_t requestId, cmdStatus_e status,
+ *                      int statRow
+ * @return            - none
+ * @Note              - Responses for a closed connection are dropped. Never
+ *                      blocks: while the queue is full (slow client) the
+ *                      response is parked in its spill list
+ *********************************************************************/
+void Connection::enqueue(string resp, uint32_t requestId, cmdStatus_e status, int statRow)
+{
+    if (closed.load(memory_order_relaxed))
+        return;
+    backlog.fetch_add(1, memory_order_relaxed);
+    outbound.pushOrSpill({requestId, status, move(resp), 0, statRow, 0});
+}
+
+/*********************************************************************
+ * @fn      		  - offer
+ * @brief             - This function adds a response to the outbound queue
+ *                      unless the queue is full
+ * @param[in]         - string resp, uint32_t requestId
+ * @return            - offerResult_e
+ * @Note              - Never blocks: used for watch updates, where a newer
+ *                      update follows the one dropped
+ *********************************************************************/
+offerResult_e Connection::offer(string resp, uint32_t requestId)
+{
+    if (closed.load(memory_order_relaxed))
+        return OFFER_GONE;
+    backlog.fetch_add(1, memory_order_relaxed);
+    if (outbound.push({requestId, CMD_STATUS_OK, move(resp), 0, STAT_ROW_IO, 0}))
+        return OFFER_DELIVERED;
+    releaseBacklog();
+    return OFFER_DROPPED;
+}
+
+/*********************************************************************
+ * @fn      		  - waitForRoom
+ * @brief             - This function blocks the connection's reader while
+ *                      the client has too many responses left to read
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Resumes once half the backlog is written, or on close.
+ *                      The unread requests stay in the socket, so the client
+ *                      is slowed down by TCP instead of growing our queues
+ *********************************************************************/
+void Connection::waitForRoom()
+{
+    if (backlog.load(memory_order_relaxed) < OUTBOUND_BACKLOG_MAX)
+        return;
+
+    unique_lock<mutex> lock(roomMtx);
+    readerWaiting.store(true);
+    roomCv.wait(lock, [this] { return backlog.load() < OUTBOUND_BACKLOG_MAX / 2 || closed.load(); });
+    readerWaiting.store(false);
+}
+
+/*********************************************************************
+ * @fn      		  - releaseBacklog
+ * @brief             - This function takes a written or dropped response off
+ *                      the backlog and wakes the reader once it dropped low
+ *                      enough
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Only takes the lock while the reader is waiting
+ *********************************************************************/
+void Connection::releaseBacklog()
+{
+    if (backlog.fetch_sub(1) <= OUTBOUND_BACKLOG_MAX / 2 && readerWaiting.load())
+    {
+        lock_guard<mutex> guard(roomMtx);
+        roomCv.notify_all();
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - writerLoop
+ * @brief             - This function sleeps until responses are queued and
+ *                      streams them to the client in negotiated size frames
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Returns once the connection is shut down and drained.
+ *                      Each round writes one frame of every tagged response
+ *                      in progress with a single send
+ *********************************************************************/
+void Connection::writerLoop()
+{
+    deque<outbound_t> active;
+    outbound_t item;
+    string frames;
+    size_t chunk = session.maxFrameSize - REQUEST_ID_SIZE;
+
+    while (true)
+    {
+        if (active.empty())
+        {
+            if (!outbound.popWait(item))
+            {
+                if (closed.load())
+                    return;
+                continue;
+            }
+            active.push_back(move(item));
+        }
+        while (outbound.tryPop(item))
+            active.push_back(move(item));
+
+        bool sent;
+        uint64_t start;
+        if (active.front().requestId == 0)
+        {
+            // Framed inside the gathered write, so it only counts as send
+            size_t count = statStreamFrames(active.front().body.size(), session.maxFrameSize, 0);
+            start = statNow();
+            sent = sendStream(sock, FRAME_FLAG_FROM_SERVER, active.front().body, session.maxFrameSize);
+            serverStats.record(STAT_ROW_IO, STAT_PHASE_SEND, statNow() - start);
+            serverStats.count(STAT_FRAMES_SENT, count);
+            serverStats.count(STAT_BYTES_SENT, active.front().body.size() + count * FRAME_HEADER_SIZE);
+            active.pop_front();
+            releaseBacklog();
+        }
+        else
+        {
+            frames.clear();
+            size_t count = 0;
+            size_t round = active.size();
+            for (size_t i = 0; i < round && active.front().requestId != 0; i++)
+            {
+                outbound_t resp = move(active.front());
+                active.pop_front();
+                start = statNow();
+                if (resp.offset < resp.body.size())
+                {
+                    size_t len = min(chunk, resp.body.size() - resp.offset);
+                    appendTaggedFrame(frames, MSG_TYPE_RESPONSE, FRAME_FLAG_FROM_SERVER, resp.requestId,
+                                      resp.body.data() + resp.offset, len);
+                    resp.offset += len;
+                    count++;
+                }
+                // The end frame goes out with the last chunk, not as a send of its own
+                if (resp.offset < resp.body.size())
+                {
+                    resp.serializeNs += statNow() - start;
+                    active.push_back(move(resp));
+                }
+                else
+                {
+                    appendTaggedEnd(frames, FRAME_FLAG_FROM_SERVER, resp.requestId, resp.status);
+                    count++;
+                    serverStats.record(resp.statRow, STAT_PHASE_SERIALIZE, resp.serializeNs + statNow() - start);
+                    releaseBacklog();
+                }
+            }
+            start = statNow();
+            sent = sendAll(sock, frames.data(), frames.size());
+            serverStats.record(STAT_ROW_IO, STAT_PHASE_SEND, statNow() - start);
+            serverStats.count(STAT_FRAMES_SENT, count);
+            serverStats.count(STAT_BYTES_SENT, frames.size());
+        }
+
+        if (!sent)
+        {
+            // Wake the reader blocked in recv() so the connection is torn down
+            ::shutdown(sock, SHUT_RDWR);
+            shutdownConn();
+            return;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - shutdownConn
+ * @brief             - This function stops accepting responses and lets the
+ *                      writer exit
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Connection::shutdownConn()
+{
+    closed.store(true);
+    outbound.wake();
+    lock_guard<mutex> guard(roomMtx);
+    roomCv.notify_all();
+}
+
+/* In Destructor De-initialise variables of class */
+Connection::~Connection()
+{
+}
@@ -0,0 +1,73 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <atomic>
+#include <condition_variable>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+#include "MpscQueue.hh"
+#include "ServerStats.hh"
+
+#define OUTBOUND_QUEUE_SIZE 1024
+#define OUTBOUND_BACKLOG_MAX OUTBOUND_QUEUE_SIZE    /* responses pending before the reader stops */
+
+/* What became of a response offered to a connection */
+typedef enum
+{
+    OFFER_DELIVERED,        /* queued, it will be written */
+    OFFER_DROPPED,          /* no room, the client did not get it */
+    OFFER_GONE,             /* the connection is closed */
+} offerResult_e;
+
+/* A finished response waiting to be written */
+typedef struct
+{
+    uint32_t requestId;     /* 0 for clients not using request IDs */
+    cmdStatus_e status;     /* reported in the end frame of tagged responses */
+    string body;
+    size_t offset;          /* bytes of body already framed */
+    int statRow;            /* histogram row of the command answered */
+    uint64_t serializeNs;   /* spent framing body so far */
+} outbound_t;
+
+/*
+ * One client of the thread-per-client server. Workers append finished
+ * responses to the connection's own lock-free outbound queue and the
+ * connection's writer thread sleeps on the queue's eventfd until there is
+ * something to send, so an idle client costs no CPU and clients never
+ * share a lock. Workers never wait for a slow client: once the queue is
+ * full their responses are parked in its spill list, and it is the
+ * connection's reader that stops taking requests until the client has
+ * read its backlog.
+ * Responses tagged with a request ID are written one frame each in turn,
+ * so a short response is not stuck behind a long one; untagged responses
+ * are written whole, in completion order.
+ */
+class Connection
+{
+private:
+    int sock;
+    uint64_t id;
+    session_t session;
+    MpscQueue<outbound_t> outbound;
+    atomic<bool> closed;
+    atomic<size_t> backlog;     /* responses queued and not completely written */
+    mutex roomMtx;
+    condition_variable roomCv;
+    atomic<bool> readerWaiting;
+
+    void releaseBacklog();
+
+public:
+    Connection(int sock, const session_t &session);
+    void enqueue(string resp, uint32_t requestId, cmdStatus_e status = CMD_STATUS_OK, int statRow = STAT_ROW_IO);
+    offerResult_e offer(string resp, uint32_t requestId);
+    void waitForRoom();
+    void writerLoop();
+    void shutdownConn();
+    inline int getSocket() { return sock; }
+    inline uint64_t getId() { return id; }
+    ~Connection();
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "CpuSampler.hh"
+#include "ProcessTable.hh"
+#include "ProcReader.hh"
+
+CpuSampler cpuSampler;
+
+/* In Constructor initialise variables of class */
+CpuSampler::CpuSampler() : sampleCount(0), stopping(false), sampleNow(false)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - start
+ * @brief             - This function takes the first sample and starts the
+ *                      background sampler
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void CpuSampler::start()
+{
+    sample();
+    sampler = thread(&CpuSampler::samplerLoop, this);
+}
+
+/*********************************************************************
+ * @fn      		  - stop
+ * @brief             - This function stops the background sampler
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void CpuSampler::stop()
+{
+    {
+        lock_guard<mutex> guard(stopMtx);
+        stopping = true;
+    }
+    stopCv.notify_all();
+    if (sampler.joinable())
+        sampler.join();
+}
+
+/*********************************************************************
+ * @fn      		  - sample
+ * @brief             - This function records the ticks of the queried
+ *                      processes and of the whole machine as the next ring slot
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - /proc is read before taking the lock so queries are only
+ *                      blocked while the ring is updated
+ *********************************************************************/
+void CpuSampler::sample()
+{
+    typedef struct
+    {
+        int pid;
+        unsigned long long starttime;
+        unsigned long ticks;
+    } row_t;
+
+    // Aggregate "cpu" line: user nice system idle iowait irq softirq steal
+    string_view cpuLine;
+    unsigned long long total = 0;
+    if (!readProcFile(procRootFd(), "stat", cpuLine) || !scanSkipFields(cpuLine, 1))
+        return;
+    for (int field = 0; field < 8; field++)
+    {
+        unsigned long long value = 0;
+        if (!scanNumber(cpuLine, value))
+            return;
+        total += value;
+    }
+
+    // Only sampleCount's writer runs here, it is stable without mtx
+    vector<int> pids;
+    {
+        lock_guard<mutex> guard(interestMtx);
+        for (auto it = interest.begin(); it != interest.end();)
+        {
+            if (sampleCount - it->second > CPU_HISTORY_SAMPLES)
+            {
+                it = interest.erase(it);
+                continue;
+            }
+            pids.push_back(it->first);
+            ++it;
+        }
+    }
+
+    vector<row_t> rows;
+    rows.reserve(pids.size());
+    for (int pid : pids)
+    {
+        procEntry_t current;
+        if (readProcStat(pid, current))
+            rows.push_back({pid, current.starttime, current.utime + current.stime});
+    }
+
+    unique_lock<shared_mutex> lock(mtx);
+    uint64_t index = sampleCount;
+    size_t slot = index % CPU_HISTORY_SAMPLES;
+    sampleTimes[slot] = chrono::steady_clock::now();
+    totalTicks[slot] = total;
+    sampleCores[slot] = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (const row_t &row : rows)
+    {
+        auto it = history.find(row.pid);
+        if (it == history.end() || it->second.starttime != row.starttime || it->second.lastSample + 1 != index)
+        {
+            // New process, reused pid or a gap in its samples: start over
+            cpuHistory_t fresh;
+            fresh.starttime = row.starttime;
+            fresh.firstSample = index;
+            it = history.insert_or_assign(row.pid, fresh).first;
+        }
+        it->second.ticks[slot] = row.ticks;
+        it->second.lastSample = index;
+    }
+
+    for (auto it = history.begin(); it != history.end();)
+    {
+        if (it->second.lastSample != index)
+            it = history.erase(it);
+        else
+            ++it;
+    }
+    sampleCount = index + 1;
+}
+
+/*********************************************************************
+ * @fn      		  - usage
+ * @brief             - This function computes the CPU usage of pid over the
+ *                      last windowMs milliseconds
+ * @param[in]         - int pid, uint32_t windowMs, cpuUsage_t &result
+ * @return            - cpuUsageStatus_e
+ * @Note              - The window is rounded to whole samples and capped by
+ *                      the history kept; result.seconds is what was covered.
+ *                      A pid of the process table not sampled yet is sampled
+ *                      from now on
+ *********************************************************************/
+cpuUsageStatus_e CpuSampler::usage(int pid, uint32_t windowMs, cpuUsage_t &result)
+{
+    shared_lock<shared_mutex> lock(mtx);
+    auto it = history.find(pid);
+    if (it == history.end())
+    {
+        if (!findProcess(*processTable.snapshot(), pid))
+            return sampleCount == 0 ? CPU_USAGE_WARMING_UP : CPU_USAGE_NO_PROCESS;
+        bool added;
+        {
+            lock_guard<mutex> guard(interestMtx);
+            added = interest.insert_or_assign(pid, sampleCount).second;
+        }
+        if (added)
+        {
+            {
+                lock_guard<mutex> guard(stopMtx);
+                sampleNow = true;
+            }
+            stopCv.notify_all();
+        }
+        return CPU_USAGE_WARMING_UP;
+    }
+    {
+        lock_guard<mutex> guard(interestMtx);
+        interest[pid] = sampleCount;
+    }
+
+    const cpuHistory_t &proc = it->second;
+    uint64_t newest = proc.lastSample;
+    uint64_t oldest = max(proc.firstSample, newest >= CPU_HISTORY_SAMPLES - 1 ? newest - (CPU_HISTORY_SAMPLES - 1) : 0);
+    if (newest == oldest)
+        return CPU_USAGE_WARMING_UP;
+
+    // Newest sample at least windowMs older than the latest one, or the oldest kept
+    auto target = sampleTimes[newest % CPU_HISTORY_SAMPLES] - chrono::milliseconds(windowMs);
+    uint64_t from = newest - 1;
+    while (from > oldest && sampleTimes[from % CPU_HISTORY_SAMPLES] > target)
+        from--;
+
+    size_t newSlot = newest % CPU_HISTORY_SAMPLES;
+    size_t oldSlot = from % CPU_HISTORY_SAMPLES;
+    double procTicks = static_cast<double>(proc.ticks[newSlot] - proc.ticks[oldSlot]);
+    double allTicks = static_cast<double>(totalTicks[newSlot] - totalTicks[oldSlot]);
+
+    result.cores = sampleCores[newSlot];
+    result.totalPercent = allTicks > 0 ? 100.0 * procTicks / allTicks : 0.0;
+    result.corePercent = result.totalPercent * result.cores;
+    result.seconds = chrono::duration<double>(sampleTimes[newSlot] - sampleTimes[oldSlot]).count();
+    return CPU_USAGE_OK;
+}
+
+/*********************************************************************
+ * @fn      		  - samplerLoop
+ * @brief             - This function samples every CPU_SAMPLE_INTERVAL_MS,
+ *                      and at once when a pid is queried the first time
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void CpuSampler::samplerLoop()
+{
+    unique_lock<mutex> lock(stopMtx);
+    while (true)
+    {
+        stopCv.wait_for(lock, chrono::milliseconds(CPU_SAMPLE_INTERVAL_MS),
+                        [this] { return stopping.load() || sampleNow.load(); });
+        if (stopping)
+            break;
+        sampleNow = false;
+        lock.unlock();
+        sample();
+        lock.lock();
+    }
+}
+
+/* In Destructor stop the sampler thread */
+CpuSampler::~CpuSampler()
+{
+    stop();
+}
@@ -0,0 +1,82 @@
+#ifndef CPU_SAMPLER_H
+#define CPU_SAMPLER_H
+
+#include <array>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include "RemoteManagement.hh"
+
+#define CPU_SAMPLE_INTERVAL_MS  1000
+#define CPU_HISTORY_SAMPLES     61      /* one minute of history at 1 s */
+#define DEFAULT_CPU_WINDOW_MS   1000
+
+/* Tick history of one process; slot i holds sample number i % CPU_HISTORY_SAMPLES */
+typedef struct
+{
+    unsigned long long starttime;       /* tells a reused pid from the original */
+    uint64_t firstSample;
+    uint64_t lastSample;
+    array<unsigned long, CPU_HISTORY_SAMPLES> ticks;
+} cpuHistory_t;
+
+typedef struct
+{
+    double corePercent;     /* 100 means one core fully busy */
+    double totalPercent;    /* share of all online cores */
+    double seconds;         /* window actually covered */
+    int cores;
+} cpuUsage_t;
+
+typedef enum
+{
+    CPU_USAGE_OK,
+    CPU_USAGE_NO_PROCESS,
+    CPU_USAGE_WARMING_UP,   /* fewer than two samples so far */
+} cpuUsageStatus_e;
+
+/*
+ * Background sampler recording utime+stime of the processes clients ask
+ * about and the total ticks of /proc/stat once per CPU_SAMPLE_INTERVAL_MS
+ * into fixed size rings. Queries compute the rate between the newest
+ * sample and the one closest to the requested window, so any number of
+ * clients can ask for any pid without reading /proc themselves. A pid is
+ * sampled from its first query until it has not been asked about for
+ * CPU_HISTORY_SAMPLES samples; the first query of a pid takes a sample
+ * right away, so it only warms up for one interval.
+ */
+class CpuSampler
+{
+private:
+    shared_mutex mtx;
+    uint64_t sampleCount;
+    array<chrono::steady_clock::time_point, CPU_HISTORY_SAMPLES> sampleTimes;
+    array<unsigned long long, CPU_HISTORY_SAMPLES> totalTicks;
+    array<int, CPU_HISTORY_SAMPLES> sampleCores;
+    unordered_map<int, cpuHistory_t> history;
+    mutex interestMtx;
+    unordered_map<int, uint64_t> interest;     /* pid -> sample count when last queried */
+    mutex stopMtx;
+    condition_variable stopCv;
+    atomic<bool> stopping;
+    atomic<bool> sampleNow;
+    thread sampler;
+
+    void sample();
+    void samplerLoop();
+
+public:
+    CpuSampler();
+    void start();
+    void stop();
+    cpuUsageStatus_e usage(int pid, uint32_t windowMs, cpuUsage_t &result);
+    ~CpuSampler();
+};
+
+extern CpuSampler cpuSampler;
+
+#endif
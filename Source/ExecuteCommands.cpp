@@ -1,50 +1,216 @@
 
 #include "ExecuteCommands.hh"
-#include <dirent.h>
-#include <fstream>
+#include "WorkerPool.hh"
+#include "ProcessTable.hh"
+#include "ProcReader.hh"
+#include "CpuSampler.hh"
+#include "PortResolver.hh"
+#include "WatchHub.hh"
+#include "ServerStats.hh"
+#include <tuple>
+#include <mutex>
 
-extern deque<MessageHeader> responseDeque;
-extern mutex mtx;
 extern string msgStr[MSG_TYPE_MAX];
+extern WorkerPool *workerPool;
 
 /*********************************************************************
  * @fn      		  - executeCmd
- * @brief             - This function handles the different command execution 
- *                      requested by client
- * @param[in]         - int clientSocket, MessageHeader in
+ * @brief             - This function hands the command requested by client to
+ *                      the worker pool; the worker queues the response on the
+ *                      client's connection
+ * @param[in]         - shared_ptr<Connection> conn, MessageHeader in
  * @return            - none
+ * @Note              - Blocks while the worker queue is full, which stops the
+ *                      caller from reading more requests (backpressure).
+ *                      watch and unwatch are answered by the watch hub
+ *********************************************************************/
+void executeCmd(shared_ptr<Connection> conn, MessageHeader in)
+{
+        if(!cmdNeedsResponse(in))
+            return;
+
+        uint32_t requestId = in.getRequestId();
+        if(in.getOptions() & CMD_OPT_WATCH)
+        {
+            weak_ptr<Connection> weak = conn;
+            string error = watchHub.subscribe(conn->getId(), in, [weak, requestId](string &&update)
+            {
+                shared_ptr<Connection> owner = weak.lock();
+                return owner ? owner->offer(move(update), requestId) : OFFER_GONE;
+            });
+            if(!error.empty())
+                prepareAndTx(*conn, move(error), requestId, CMD_STATUS_INVALID);
+            return;
+        }
+        if(CMD_UNWATCH == in.getCommand())
+        {
+            prepareAndTx(*conn, watchHub.unsubscribe(conn->getId(), in.getWatchId()), requestId);
+            return;
+        }
+
+        int row = statRow(in);
+        workerPool->submit({move(in), [conn, requestId, row](string &&resp, cmdStatus_e status)
+        {
+            prepareAndTx(*conn, move(resp), requestId, status, row);
+        }});
+}
+
+/*********************************************************************
+ * @fn      		  - cmdNeedsResponse
+ * @brief             - This function tells whether the incoming message is a
+ *                      command the client waits a response for (heartbeats
+ *                      and invalid commands are not answered)
+ * @param[in]         - MessageHeader &in
+ * @return            - bool
  * @Note              -
  *********************************************************************/
-void executeCmd(int clientSocket, MessageHeader in)
+bool cmdNeedsResponse(MessageHeader &in)
+{
+        return (MSG_TYPE_CMD == in.getMsgType() && CMD_MAX != in.getCommand()) ||
+               (MSG_TYPE_BATCH == in.getMsgType() && !in.getBatch().empty());
+}
+
+/*********************************************************************
+ * @fn      		  - cmdNeedsSnapshot
+ * @brief             - This function tells whether the command reads the
+ *                      process table, directly or to resolve a name
+ * @param[in]         - MessageHeader &in
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool cmdNeedsSnapshot(MessageHeader &in)
+{
+        command_e receivedCommand = in.getCommand();
+        return receivedCommand == CMD_GET_PROCESS || receivedCommand == CMD_GET_MEMORY || receivedCommand == CMD_WHO_LISTENS ||
+               (cmdHasPID(receivedCommand) && !in.checkIsPid());
+}
+
+/*********************************************************************
+ * @fn      		  - dispatchCmd
+ * @brief             - This function handles the different command execution 
+ *                      requested by client
+ * @param[in]         - MessageHeader &in, metricList_t *metrics,
+ *                      cmdStatus_e *status
+ * @return            - string
+ * @Note              - metrics, when given, receives the numeric result of
+ *                      get-mem and get-cpu-usage; status, when given, the
+ *                      outcome of the command
+ *********************************************************************/
+string dispatchCmd(MessageHeader &in, metricList_t *metrics, cmdStatus_e *status)
+{
+        cmdStatus_e outcome;
+        if(!status)
+            status = &outcome;
+
+        if(MSG_TYPE_BATCH == in.getMsgType())
+            return dispatchBatch(in, *status);
+
+        // Commands reading the process table share the collector's snapshot
+        // unless the client asked for a fresh read
+        snapshotPtr_t snap;
+        if(cmdNeedsSnapshot(in))
+            snap = (in.getOptions() & CMD_OPT_FRESH) ? processTable.refresh() : processTable.snapshot();
+
+        return runCmd(in, snap, *status, metrics);
+}
+
+/*********************************************************************
+ * @fn      		  - dispatchBatch
+ * @brief             - This function runs every command of a batch and
+ *                      returns their outputs as one response, each headed by
+ *                      "[i/n] <command>: <status>"
+ * @param[in]         - MessageHeader &in, cmdStatus_e &status
+ * @return            - string
+ * @Note              - All commands see the same process table snapshot, so
+ *                      names resolve to the same PIDs throughout; it is fresh
+ *                      if any command asked for --fresh. status is the worst
+ *                      outcome of the commands
+ *********************************************************************/
+string dispatchBatch(MessageHeader &in, cmdStatus_e &status)
+{
+        vector<MessageHeader> &items = in.getBatch();
+
+        bool needSnapshot = false;
+        bool fresh = false;
+        for (MessageHeader &item : items)
+        {
+            if (cmdNeedsSnapshot(item))
+            {
+                needSnapshot = true;
+                fresh = fresh || (item.getOptions() & CMD_OPT_FRESH);
+            }
+        }
+        snapshotPtr_t snap;
+        if (needSnapshot)
+            snap = fresh ? processTable.refresh() : processTable.snapshot();
+
+        string resp = msgStr[MSG_INVALID];
+        status = CMD_STATUS_OK;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            cmdStatus_e itemStatus = CMD_STATUS_INVALID;
+            string out;
+            if (cmdNeedsResponse(items[i]))
+                out = runCmd(items[i], snap, itemStatus);
+            status = max(status, itemStatus);
+
+            resp += "[" + to_string(i + 1) + "/" + to_string(items.size()) + "] " + items[i].describe() + ": " +
+                    cmdStatusStr[itemStatus] + "\n" + out;
+            if (!out.empty() && out.back() != '\n')
+                resp += "\n";
+        }
+        return resp;
+}
+
+/*********************************************************************
+ * @fn      		  - runCmd
+ * @brief             - This function executes one command
+ * @param[in]         - MessageHeader &in, const snapshotPtr_t &snap,
+ *                      cmdStatus_e &status, metricList_t *metrics
+ * @return            - string
+ * @Note              - snap must be set when cmdNeedsSnapshot(in) is true
+ *********************************************************************/
+string runCmd(MessageHeader &in, const snapshotPtr_t &snap, cmdStatus_e &status, metricList_t *metrics)
 {
         command_e receivedCommand = in.getCommand();
         string resp = "";
         vector<int> pids;
+        status = CMD_STATUS_OK;
 
         if(cmdHasPID(receivedCommand))
         {
-            if(in.checkIsPid())
-                pids.push_back(in.getProcessId());
+            if(!in.getTargets().empty())
+                pids = findTargets(*snap, in.getTargets());
+            else if(in.checkIsPid())
+            {
+                if(in.getProcessId() > 0)
+                    pids.push_back(in.getProcessId());
+            }
             else
-                pids = getPIDsByName(in.getProcessName()); 
+                pids = getPIDsByName(*snap, in.getProcessName()); 
+            if(pids.empty())
+                status = CMD_STATUS_NOT_FOUND;
         }
 
         switch (receivedCommand)
         {
             case CMD_GET_PROCESS:
             {//get-process
-                resp = execGetProcess();
+                if(in.getOptions() & CMD_OPT_DELTA)
+                    resp = execGetProcessDelta(*snap, in.getSince());
+                else
+                    resp = execGetProcess(*snap);
                 break;
             }
             case CMD_GET_MEMORY:
             {//get-mem
-                resp = execGetMemoryUsage(pids);
+                resp = execGetMemoryUsage(*snap, pids, metrics);
                 break;
             }
 
             case CMD_GET_CPU_USAGE:
             {//get-cpu-usage
-                resp = execgetCPUUsage(pids);
+                resp = execgetCPUUsage(pids, in.getWindowMs(), metrics);
                 break;
             }
 
@@ -64,10 +230,25 @@ void executeCmd(int clientSocket, MessageHeader in)
                 resp = execRestartProcess(pids);
                 break;
             }
+            case CMD_WHO_LISTENS:
+            {//who-listens
+                resp = execWhoListens(*snap, in.getPort());
+                break;
+            }
 
+            case CMD_STATS:
+            {//stats
+                resp = serverStats.report(workerPool);
+                break;
+            }
+
+            case CMD_UNWATCH:
+            case CMD_HELP:
             case CMD_EXIT:
             {
-                //future-use
+                //client-side only, or answered by the watch hub
+                status = CMD_STATUS_INVALID;
+                break;
             }
 
             case CMD_MAX:
@@ -87,70 +268,96 @@ void executeCmd(int clientSocket, MessageHeader in)
 
         }
 
-        if(CMD_MAX != receivedCommand)
-            prepareAndTx(clientSocket, resp);
+        return resp;
 }
 
 /*********************************************************************
  * @fn      		  - execGetProcess()
- * @brief             - This function reads the list of all the running process
- * @param[in]         - none
+ * @brief             - This function lists all the running process
+ * @param[in]         - const procSnapshot_t &snap
  * @return            - string
  * @Note              -
  *********************************************************************/
-string execGetProcess()
+string execGetProcess(const procSnapshot_t &snap)
 {
-    DIR* proc_dir = opendir("/proc");
     string resp = msgStr[MSG_INVALID];
-    if (!proc_dir) {
-#ifdef DEBUG    
-        cerr << "Failed to open /proc directory." << endl;
-#endif
+    if (snap.procs.empty())
+    {
         resp += "No process available\n";
         return resp;
     }
-    
-    dirent* entry;
-    
-    while ((entry = readdir(proc_dir)) != nullptr) 
+
+    for (const procEntry_t &proc : snap.procs)
     {
-        if (isdigit(entry->d_name[0])) {
-            string pid_str = entry->d_name;
-            string cmdline_path = "/proc/" + pid_str + "/cmdline";
-            ifstream cmdline_file(cmdline_path);
-            string cmdline;
+        resp += to_string(proc.pid) + " : " + proc.argv0 + "\n";
+    }
+    return resp;
+}
 
-            
-             // Get the command line
-            getline(cmdline_file, cmdline, '\0');
-            
-            string temp = pid_str + " : " + cmdline + "\n";
-            resp += temp;
-            cout.flush();
+/*********************************************************************
+ * @fn      		  - execGetProcessDelta()
+ * @brief             - This function lists the running processes as changes
+ *                      to the listing version the client already holds
+ * @param[in]         - const procSnapshot_t &snap, uint64_t since
+ * @return            - string
+ * @Note              - The first line is "#not-modified <version>",
+ *                      "#delta <since> <version>" or, when since is 0 or no
+ *                      longer in the history, "#full <version>". Then one
+ *                      line per process: "+pid : argv0" added, "~pid : argv0"
+ *                      changed, "-pid" removed
+ *********************************************************************/
+string execGetProcessDelta(const procSnapshot_t &snap, uint64_t since)
+{
+    string version = to_string(snap.version);
+    if (since == snap.version)
+        return "#not-modified " + version + "\n";
+
+    procDeltaList_t changes;
+    string resp;
+    if (since && processTable.changesSince(since, snap, changes))
+    {
+        resp = "#delta " + to_string(since) + " " + version + "\n";
+        for (const auto &change : changes)
+        {
+            if (change.second == PROC_DELTA_REMOVED)
+            {
+                resp += "-" + to_string(change.first) + "\n";
+                continue;
+            }
+            const procEntry_t *proc = findProcess(snap, change.first);
+            resp += (change.second == PROC_DELTA_ADDED ? "+" : "~") + to_string(proc->pid) + " : " + proc->argv0 + "\n";
         }
+        return resp;
     }
 
-    closedir(proc_dir);
+    resp = "#full " + version + "\n";
+    for (const procEntry_t &proc : snap.procs)
+        resp += "+" + to_string(proc.pid) + " : " + proc.argv0 + "\n";
     return resp;
 }
 
 /*********************************************************************
  * @fn      		  - execGetMemoryUsage()
- * @brief             - This function calculates the memory used by the pid given in
+ * @brief             - This function reports the memory used by the pid given in
  *                      argument
- * @param[in]         - vector<int> pids
+ * @param[in]         - const procSnapshot_t &snap, vector<int> pids,
+ *                      metricList_t *metrics
  * @return            - string
  * @Note              -
  *********************************************************************/
-string execGetMemoryUsage(vector<int> pids)
+string execGetMemoryUsage(const procSnapshot_t &snap, vector<int> pids, metricList_t *metrics)
 {
     string resp = msgStr[MSG_INVALID];
     for(int pid : pids)
     {
-        string path = "/proc/" + to_string(pid) + "/status";
-        ifstream status_file(path);
-        
-        if (!status_file.is_open()) 
+        const procEntry_t *proc = findProcess(snap, pid);
+
+        // Event-driven snapshots track membership, the counters are read now
+        procEntry_t current;
+        if (proc && snap.eventDriven)
+            proc = readProcStat(pid, current) ? &current : nullptr;
+
+        if (!proc) 
         {
 #ifdef DEBUG
             cerr << "Process with PID " << pid << " not found or access denied" << endl;
@@ -159,58 +366,14 @@ string execGetMemoryUsage(vector<int> pids)
             continue;
         }
 
-        string line;
-        long vm_rss = -1, vm_size = -1;
-
-        while (getline(status_file, line)) 
-        {
-            if (line.compare(0, 6, "VmRSS:") == 0) 
-            {
-                stringstream ss(line.substr(6));
-                ss >> vm_rss;
-            } 
-            else if (line.compare(0, 7, "VmSize:") == 0) 
-            {
-                stringstream ss(line.substr(7));
-                ss >> vm_size;
-            }
-        }
+        if (metrics)
+            metrics->emplace_back(pid, static_cast<double>(proc->rssKb));
         resp += "Memory usage for PID " + to_string(pid) + ":\n";
-#ifdef DEBUG
-        cout << "Memory usage for PID " << pid << ":" << endl;
-#endif
-        if (vm_rss != -1) 
-        {
-            resp += "Physical Memory (VmRSS): " + to_string(vm_rss) + " KB (" + to_string(vm_rss / 1024.0) + " MB)\n";
-#ifdef DEBUG
-            cout << "Physical Memory (VmRSS): " << vm_rss << " KB (" 
-                << vm_rss / 1024.0 << " MB)" << endl;
-#endif   
-        } 
-        else 
-        {
-            resp += "VmRSS information not available\n";
-#ifdef DEBUG
-            cout << "VmRSS information not available" << endl;
-#endif
-        }
-
-        if (vm_size != -1) 
-        {
-            resp += "Virtual Memory (VmSize): " + to_string(vm_size) + " KB (" + to_string(vm_size / 1024.0) + " MB)\n";
-#ifdef DEBUG            
-            cout << "Virtual Memory (VmSize): " << vm_size << " KB (" 
-                << vm_size / 1024.0 << " MB)" << endl;
-#endif
-        } 
-        else 
-        {
-            resp += "VmSize information not available\n";
-#ifdef DEBUG
-            cout << "VmSize information not available" << endl;
-#endif
-        }
-        resp += "\n\0";
+        char line[96];
+        snprintf(line, sizeof(line), MEM_RSS_LINE_FMT, proc->rssKb, proc->rssKb / 1024.0);
+        resp += line;
+        resp += "Virtual Memory (VmSize): " + to_string(proc->vsizeKb) + " KB (" + to_string(proc->vsizeKb / 1024.0) + " MB)\n";
+        resp += "\n";
     }
     return resp;
 }
@@ -220,283 +383,233 @@ string execGetMemoryUsage(vector<int> pids)
  * @fn      		  - getPIDsByName()
  * @brief             - This function is used to get PIDs associated 
  *                      with a process name*                     
- * @param[in]         - const string& processName
+ * @param[in]         - const procSnapshot_t &snap, const string& processName
  * @return            - vector<int>
- * @Note              -
+ * @Note              - Matches comm or the executable name, so names longer
+ *                      than the 15 characters of comm are found too
  *********************************************************************/
-vector<int> getPIDsByName(const string& processName) 
+vector<int> getPIDsByName(const procSnapshot_t &snap, const string& processName) 
 {
-    vector<int> pids;
-    DIR* dir = opendir("/proc");
-    if (!dir) 
-    {
-#ifdef DEBUG
-        cerr << "Failed to open /proc directory." << endl;
-#endif
-        return pids;
-    }
+    return findByName(snap, processName);
+}
 
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != nullptr) 
+/*********************************************************************
+ * @fn      		  - execgetCPUUsage()
+ * @brief             - This function is used to get CPU 
+ *                      usage of a process by PID
+ * @param[in]         - vector<int> pids, uint32_t windowMs,
+ *                      metricList_t *metrics
+ * @return            - string
+ * @Note              - Answered from the CPU sampler's history, 0 windowMs
+ *                      means DEFAULT_CPU_WINDOW_MS
+ *********************************************************************/
+string execgetCPUUsage(vector<int> pids, uint32_t windowMs, metricList_t *metrics) 
+{
+    string resp = msgStr[MSG_INVALID];
+    if (windowMs == 0)
+        windowMs = DEFAULT_CPU_WINDOW_MS;
+
+    for(int pid:pids)
     {
-        // Check if the entry is a directory and represents a PID
-        if(entry->d_type == DT_DIR && isdigit(entry->d_name[0])) 
+        cpuUsage_t usage;
+        switch (cpuSampler.usage(pid, windowMs, usage))
         {
-            int pid = stoi(entry->d_name);
-
-            // Read the process name from /proc/[PID]/comm
-            string commPath = string("/proc/") + entry->d_name + "/comm";
-            ifstream commFile(commPath);
-            if (commFile.is_open()) 
+            case CPU_USAGE_OK:
             {
-                string name;
-                getline(commFile, name);
-                if (name == processName) 
-                {
-                    pids.push_back(pid);
-                }
-                commFile.close();
+                char line[160];
+                snprintf(line, sizeof(line), CPU_USAGE_LINE_FMT, pid, usage.corePercent, usage.totalPercent,
+                         usage.cores, usage.seconds);
+                resp += line;
+                if (metrics)
+                    metrics->emplace_back(pid, usage.corePercent);
+                break;
             }
+            case CPU_USAGE_WARMING_UP:
+                resp += "PID[" + to_string(pid) + "]: Not sampled long enough yet, retry in a second.\n";
+                break;
+            default:
+#ifdef DEBUG
+                cerr << "No CPU samples for PID " << pid << ". Process may not exist or access denied." << endl;
+#endif
+                resp += "PID[" + to_string(pid) + "]: Process may not exist or access denied.\n";
+                break;
         }
     }
-    closedir(dir);
-    return pids;
+    return resp;
 }
 
 /*********************************************************************
- * @fn      		  - execgetCPUUsage()
- * @brief             - This function is used to get CPU 
- *                      usage of a process by PID
+ * @fn      		  - execUsedPorts()
+ * @brief             - This function is used to get the ports used  
+ *                      by process associated with a PID
  * @param[in]         - vector<int> pids
  * @return            - string
- * @Note              -
+ * @Note              - The socket:[inode] links of each process are joined
+ *                      with one socket table per network namespace, built
+ *                      once for all pids of the request
  *********************************************************************/
-string execgetCPUUsage(vector<int> pids) 
+string execUsedPorts(vector<int> pids) 
 {
-
     string resp = msgStr[MSG_INVALID];
+    unordered_map<string, SocketTable> tables;
+
     for(int pid:pids)
     {
-        string statPath = "/proc/" + to_string(pid) + "/stat";
-        ifstream statFile(statPath);
-
-        if (!statFile.is_open()) 
+        ProcDir dir(pid);
+        vector<unsigned long> inodes;
+        if (!dir.isOpen() || !collectSocketInodes(dir, inodes))
         {
 #ifdef DEBUG
-            cerr << "Failed to open /proc/" << pid << "/stat. Process may not exist or access denied." << endl;
+            cerr << "Failed to read /proc/" << pid << "/fd" << endl;
 #endif
             resp += "PID[" + to_string(pid) + "]: Process may not exist or access denied.\n";
             continue;
         }
 
-        // Read the entire line from /proc/[PID]/stat
-        string line;
-        getline(statFile, line);
-        statFile.close();
-
-        // Extract process CPU times (utime and stime)
-        istringstream iss(line);
-        string token;
-        vector<string> tokens;
-        while (iss >> token) 
+        string netns = netNamespaceOf(dir);
+        auto table = tables.find(netns);
+        if (table == tables.end())
         {
-            tokens.push_back(token);
+            table = tables.emplace(netns, SocketTable()).first;
+            table->second.load(dir);
         }
 
-        // utime (14th field) and stime (15th field) in /proc/[PID]/stat
-        long utime = stol(tokens[13]);
-        long stime = stol(tokens[14]);
-
-        // Total process CPU time (in clock ticks)
-        long processTime = utime + stime;
-
-        // Read total CPU time from /proc/stat
-        ifstream statGlobalFile("/proc/stat");
-        if (!statGlobalFile.is_open()) 
+        vector<const socketEntry_t *> socks;
+        for (unsigned long inode : inodes)
         {
-            resp += "PID[" + to_string(pid) + "]: access denied.\n";
-            continue;;
+            const socketEntry_t *sock = table->second.find(inode);
+            if (sock)
+                socks.push_back(sock);
         }
+        sort(socks.begin(), socks.end(), [](const socketEntry_t *a, const socketEntry_t *b) {
+            return make_tuple(a->proto, a->v6, a->localPort, a->inode) < make_tuple(b->proto, b->v6, b->localPort, b->inode);
+        });
 
-        string cpuLine;
-        getline(statGlobalFile, cpuLine);
-        statGlobalFile.close();
-
-        // Extract total CPU time from /proc/stat
-        istringstream cpuIss(cpuLine);
-        string cpuLabel;
-        cpuIss >> cpuLabel; // Skip the "cpu" label
-        long user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice;
-        cpuIss >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal >> guest >> guest_nice;
-
-        // Total system CPU time (in clock ticks)
-        long totalCPUTime = user + nice + system + idle + iowait + irq + softirq + steal;
-
-        // Calculate CPU usage percentage
-        static long prevProcessTime = 0;
-        static long prevTotalCPUTime = 0;
-
-        long processTimeDiff = processTime - prevProcessTime;
-        long totalCPUTimeDiff = totalCPUTime - prevTotalCPUTime;
-
-        prevProcessTime = processTime;
-        prevTotalCPUTime = totalCPUTime;
-
-        if (totalCPUTimeDiff == 0) 
-        {
-           resp += "Memory usage for PID " + to_string(pid) + ": " +  to_string(0.0) + "\n";
-        }
-        else
+        resp += "Used ports for PID " + to_string(pid) + ":\n";
+        bool hasTcp = false, hasUdp = false;
+        for (const socketEntry_t *sock : socks)
         {
-            double cpuUsage = 100.0 * processTimeDiff / totalCPUTimeDiff;
-            resp += "Memory usage for PID " + to_string(pid) + ": " +  to_string(cpuUsage) + "\n";
+            (sock->proto == SOCK_PROTO_TCP ? hasTcp : hasUdp) = true;
+            resp += formatSocket(*sock) + "\n";
         }
+        if (!hasTcp)
+            resp += "No TCP port Present\n";
+        if (!hasUdp)
+            resp += "No UDP port Present\n";
+        resp += "\n";
     }
-    resp += "\0";
     return resp;
 }
 
 /*********************************************************************
- * @fn      		  - getPIDsByName()
- * @brief             - This function is used to convert a hexadecimal
- *                      IP address to a human-readable format
- * @param[in]         - const string& hex
- * @return            - string
- * @Note              -
+ * @fn      		  - socketOwners()
+ * @brief             - This function returns the processes holding each
+ *                      bound socket, walking every fd directory only once
+ *                      per snapshot version
+ * @param[in]         - const procSnapshot_t &snap, const SocketTable &table,
+ *                      const vector<const socketEntry_t *> &socks
+ * @return            - shared_ptr<const socketOwners_t>
+ * @Note              - The index is reused while the snapshot has not moved
+ *                      on. A socket bound since then is missing from it, so
+ *                      a miss rebuilds it, but at most once per
+ *                      SOCKET_OWNERS_MAX_AGE_MS: a socket whose owner is not
+ *                      visible misses every time. Built under the lock, so
+ *                      concurrent requests wait for one walk instead of
+ *                      each making their own
  *********************************************************************/
-string hexToIP(const string& hex) 
+static shared_ptr<const socketOwners_t> socketOwners(const procSnapshot_t &snap, const SocketTable &table,
+                                                     const vector<const socketEntry_t *> &socks)
 {
-    if (hex.size() != 8) 
+    static mutex ownersMtx;
+    static shared_ptr<const socketOwners_t> owners;
+    static uint64_t ownersVersion = 0;
+    static chrono::steady_clock::time_point ownersBuiltAt;
+
+    lock_guard<mutex> guard(ownersMtx);
+    auto now = chrono::steady_clock::now();
+    if (owners && ownersVersion >= snap.version)
     {
-        return "Invalid IP";
+        bool complete = all_of(socks.begin(), socks.end(), [](const socketEntry_t *sock) {
+            return owners->count(sock->inode) != 0;
+        });
+        if (complete || now - ownersBuiltAt < chrono::milliseconds(SOCKET_OWNERS_MAX_AGE_MS))
+            return owners;
     }
 
-    // Convert hex to 32-bit integer
-    unsigned int ipInt = stoul(hex, nullptr, 16);
-
-    // Convert to network byte order
-    ipInt = ntohl(ipInt);
-
-    // Convert to dotted-decimal notation
-    struct in_addr addr;
-    addr.s_addr = ipInt;
-    return string(inet_ntoa(addr));
-}
+    // Only bound sockets are kept, connections would make it as large as the socket tables
+    auto built = make_shared<socketOwners_t>();
+    vector<unsigned long> inodes;
+    for (const procEntry_t &proc : snap.procs)
+    {
+        ProcDir dir(proc.pid);
+        inodes.clear();
+        if (!dir.isOpen() || !collectSocketInodes(dir, inodes))
+            continue;
+        for (unsigned long inode : inodes)
+        {
+            if (!table.find(inode))
+                continue;
+            vector<int> &pids = (*built)[inode];
+            if (pids.empty() || pids.back() != proc.pid)
+                pids.push_back(proc.pid);
+        }
+    }
+#ifdef DEBUG
+    cout << "who-listens: indexed " << built->size() << " bound sockets of snapshot " << snap.version << endl;
+#endif
 
-/*********************************************************************
- * @fn      		  - hexToPort()
- * @brief             - This function is used to convert a hexadecimal 
- *                      port to a decimal port
- * @param[in]         - const string& hex
- * @return            - int
- * @Note              -
- *********************************************************************/
-int hexToPort(const string& hex) 
-{
-    return stoul(hex, nullptr, 16);
+    owners = move(built);
+    ownersVersion = max(ownersVersion, snap.version);
+    ownersBuiltAt = now;
+    return owners;
 }
 
 /*********************************************************************
- * @fn      		  - execUsedPorts()
- * @brief             - This function is used to get the ports used  
- *                      by process associated with a PID
- * @param[in]         - vector<int> pids
+ * @fn      		  - execWhoListens()
+ * @brief             - This function is used to find the processes owning
+ *                      the sockets bound to a port
+ * @param[in]         - const procSnapshot_t &snap, uint16_t port
  * @return            - string
- * @Note              -
+ * @Note              - Only listening TCP and unconnected UDP sockets are
+ *                      loaded. A socket inherited across fork() belongs to
+ *                      every process holding it, so all owners are listed
  *********************************************************************/
-string execUsedPorts(vector<int> pids) 
+string execWhoListens(const procSnapshot_t &snap, uint16_t port)
 {
     string resp = msgStr[MSG_INVALID];
-    for(int pid:pids)
-    {
-        string tcpPath = "/proc/" + to_string(pid) + "/net/tcp";
-        string udpPath = "/proc/" + to_string(pid) + "/net/udp";
-#ifdef DEBUG
-        cout << "Used ports for PID " << pid << ":" << endl;
-#endif
-        resp += "Used ports for PID " + to_string(pid) + ":\n";
-        // Read TCP ports
-        ifstream tcpFile(tcpPath);
-        if (tcpFile.is_open()) 
-        {
-            string line;
-            getline(tcpFile, line); // Skip the header line
-            while (getline(tcpFile, line)) 
-            {
-                istringstream iss(line);
-                string token;
-                vector<string> tokens;
-                while (iss >> token) 
-                {
-                    tokens.push_back(token);
-                }
-
-                if (tokens.size() >= 10) 
-                {
-                    string localAddress = tokens[1];
-                    size_t colonPos = localAddress.find(':');
-                    string ipHex = localAddress.substr(0, colonPos);
-                    string portHex = localAddress.substr(colonPos + 1);
-
-                    string ip = hexToIP(ipHex);
-                    int port = hexToPort(portHex);
-#ifdef DEBUG
-                    cout << "TCP: " << ip << ":" << port << endl;
-#endif
-                    resp += "TCP: " + ip + ":" + to_string(port) + "\n";
-                }
-            }
-            tcpFile.close();
-        }
-        else 
-        {
-#ifdef DEBUG
-            cerr << "Failed to open " << tcpPath << endl;
-#endif
-            resp += "No TCP port Present\n";
-        }
+    ProcDir self(getpid());
+    SocketTable table;
+    table.load(self, SOCK_STATES_BOUND);
 
-        // Read UDP ports
-        ifstream udpFile(udpPath);
-        if (udpFile.is_open()) 
-        {
-            string line;
-            getline(udpFile, line); // Skip the header line
-            while (getline(udpFile, line)) 
-            {
-                istringstream iss(line);
-                string token;
-                vector<string> tokens;
-                while (iss >> token) 
-                {
-                    tokens.push_back(token);
-                }
+    vector<const socketEntry_t *> socks = table.boundTo(port);
+    if (socks.empty())
+    {
+        resp += "No process listens on port " + to_string(port) + "\n";
+        return resp;
+    }
 
-                if (tokens.size() >= 10) 
-                {
-                    string localAddress = tokens[1];
-                    size_t colonPos = localAddress.find(':');
-                    string ipHex = localAddress.substr(0, colonPos);
-                    string portHex = localAddress.substr(colonPos + 1);
+    shared_ptr<const socketOwners_t> owners = socketOwners(snap, table, socks);
 
-                    string ip = hexToIP(ipHex);
-                    int port = hexToPort(portHex);
-#ifdef DEBUG
-                    cout << "UDP: " << ip << ":" << port << endl;
-#endif
-                    resp += "UDP: " + ip + ":" + to_string(port) + "\n";
-                }
-            }
-            udpFile.close();
-        } 
-        else 
+    sort(socks.begin(), socks.end(), [](const socketEntry_t *a, const socketEntry_t *b) {
+        return make_tuple(a->proto, a->v6, a->inode) < make_tuple(b->proto, b->v6, b->inode);
+    });
+    for (const socketEntry_t *sock : socks)
+    {
+        resp += formatSocket(*sock) + "\n";
+        auto owner = owners->find(sock->inode);
+        bool shown = false;
+        for (size_t i = 0; owner != owners->end() && i < owner->second.size(); i++)
         {
-#ifdef DEBUG
-            cerr << "Failed to open " << udpPath << endl;
-#endif
-            resp += "No UDP port Present\n";
+            // An owner found by a newer index may not be in an older snapshot
+            int pid = owner->second[i];
+            const procEntry_t *proc = findProcess(snap, pid);
+            if (!proc)
+                continue;
+            resp += "    PID " + to_string(pid) + " (" + proc->comm + ")\n";
+            shown = true;
         }
-        resp += "\n";
+        if (!shown)
+            resp += "    owner not visible (access denied)\n";
     }
     return resp;
 }
@@ -512,11 +625,9 @@ string execUsedPorts(vector<int> pids)
 string getExecutablePath(int pid) 
 {
     char path[PATH_MAX];
-    string exePath = "/proc/" + to_string(pid) + "/exe";
-    ssize_t len = readlink(exePath.c_str(), path, sizeof(path) - 1);
-    if (len != -1) 
+    ProcDir dir(pid);
+    if (dir.readLink("exe", path, sizeof(path)) != -1) 
     {
-        path[len] = '\0';
         return string(path);
     } 
     else 
@@ -618,46 +729,18 @@ string execkillProcess(vector<int> pids)
 
 /*********************************************************************
  * @fn      		  - prepareAndTx()
- * @brief             - This function prepares the response according to 
- *                      MESSAGE_SIZE in cunks and adds into responseDeque to 
- *                      send to client
- * @param[in]         - int clientSocket,string resp
+ * @brief             - This function adds the complete response to the client's
+ *                      outbound queue as a single entry; its writer splits it into
+ *                      frames of the size negotiated with the client and
+ *                      terminates it with the end of response frame
+ * @param[in]         - Connection &conn, string resp, uint32_t requestId,
+ *                      cmdStatus_e status, int statRow
  * @return            - none
- * @Note              -
+ * @Note              - A non zero requestId tags the frames for the client,
+ *                      whose end frame then reports status. statRow is the
+ *                      histogram row its framing is recorded under
  *********************************************************************/
-void prepareAndTx(int clientSocket,string resp)
+void prepareAndTx(Connection &conn, string resp, uint32_t requestId, cmdStatus_e status, int statRow)
 {
-    if(msgStr[MSG_INVALID] == resp)
-    {
-//        cout << "No Responce " << endl;
-    }
-
-    for(size_t i = 0; i < resp.length(); i += MESSAGE_SIZE) 
-    {
-        MessageHeader out;
-        string chunk = resp.substr(i, MESSAGE_SIZE);
-        
-        out.setResponse(APPTYPE_SERVER, MSG_TYPE_RESPONSE, clientSocket ,(i/MESSAGE_SIZE + 1), chunk);
-        //out.printResponse();
-        lock_guard<mutex> guard(mtx);
-        responseDeque.push_back(out);
-    }
-    MessageHeader endout;
-    endout.setResponse(APPTYPE_SERVER, MSG_TYPE_END_OF_RESPONSE,clientSocket,-1, msgStr[MSG_INVALID]);
-    responseDeque.push_back(endout);
+    conn.enqueue(move(resp), requestId, status, statRow);
 }
-
-
-bool cmdHasPID(int receivedCommand)
-{
-     switch (receivedCommand)
-    {
-        case CMD_GET_MEMORY:
-        case CMD_GET_CPU_USAGE:
-        case CMD_GET_PORT_USED:
-        case CMD_KILL_PROCESS:
-        case CMD_RESTART_PROCESS:
-            return true;
-    }
-    return false;
-}
\ No newline at end of file
@@ -4,21 +4,37 @@
 
 #include "RemoteManagement.hh"
 #include "MessageHandle.hh"
+#include "Connection.hh"
+#include "ProcessTable.hh"
+#include <memory>
 
-string execGetProcess();
-string execGetMemoryUsage(vector<int> pids);
-string execgetCPUUsage(vector<int> pids);
+/* Main value of a command's result per PID (VmRSS in KB, CPU in percent of a core) */
+typedef vector<pair<int, double>> metricList_t;
+
+/* inode -> PIDs holding it, for the bound sockets of one snapshot version */
+typedef unordered_map<unsigned long, vector<int>> socketOwners_t;
+
+#define SOCKET_OWNERS_MAX_AGE_MS    1000    /* rebuild on a missing owner at most this often */
+
+string execGetProcess(const procSnapshot_t &snap);
+string execGetProcessDelta(const procSnapshot_t &snap, uint64_t since);
+string execGetMemoryUsage(const procSnapshot_t &snap, vector<int> pids, metricList_t *metrics = nullptr);
+string execgetCPUUsage(vector<int> pids, uint32_t windowMs, metricList_t *metrics = nullptr);
 string execUsedPorts(vector<int> pids);
 string execkillProcess(vector<int> pids);
 string execRestartProcess(vector<int> pids);
+string execWhoListens(const procSnapshot_t &snap, uint16_t port);
 string getExecutablePath(int pid);
 bool startProcess(const string& executablePath);
-bool cmdHasPID(int receivedCommand);
-string hexToIP(const string& hex);
-int hexToPort(const string& hex);
-vector<int> getPIDsByName(const string& processName);
-void executeCmd(int clientSocket, MessageHeader in);
-void prepareAndTx(int clientSocket,string resp);
+vector<int> getPIDsByName(const procSnapshot_t &snap, const string& processName);
+void executeCmd(shared_ptr<Connection> conn, MessageHeader in);
+bool cmdNeedsResponse(MessageHeader &in);
+bool cmdNeedsSnapshot(MessageHeader &in);
+string dispatchCmd(MessageHeader &in, metricList_t *metrics = nullptr, cmdStatus_e *status = nullptr);
+string dispatchBatch(MessageHeader &in, cmdStatus_e &status);
+string runCmd(MessageHeader &in, const snapshotPtr_t &snap, cmdStatus_e &status, metricList_t *metrics = nullptr);
+void prepareAndTx(Connection &conn, string resp, uint32_t requestId, cmdStatus_e status = CMD_STATUS_OK,
+                  int statRow = STAT_ROW_IO);
 
 
 #endif
\ No newline at end of file
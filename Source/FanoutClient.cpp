@@ -0,0 +1,718 @@
+#include "FanoutClient.hh"
+#include "NetworkValidator.hh"
+#include "ScriptRunner.hh"
+#include "History.hh"
+#include "NetworkSettings.hh"
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+
+extern appType_e appType;
+
+/* In Constructor initialise variables of class */
+FanoutClient::FanoutClient(uint32_t timeoutMs)
+    : timeoutMs(timeoutMs), sequence(0), command(CMD_MAX), aggregate(AGGREGATE_NONE), valueHosts(0),
+      interactive(false), result(SCRIPT_EXIT_OK)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - parseHostList
+ * @brief             - This function adds the servers of a comma separated
+ *                      list, or of a file named "@path" holding one per line
+ * @param[in]         - const string &list, uint16_t defaultPort,
+ *                      vector<fanoutHost_t> &hosts
+ * @return            - bool (false if the list is empty or unreadable)
+ * @Note              - Entries are "host" or "host:port". A host that cannot
+ *                      be resolved is kept and reported down
+ *********************************************************************/
+bool parseHostList(const string &list, uint16_t defaultPort, vector<fanoutHost_t> &hosts)
+{
+    vector<string> entries;
+    string entry;
+    if (!list.empty() && list[0] == '@')
+    {
+        ifstream file(list.substr(1));
+        if (!file)
+        {
+            cerr << "Cannot open host file " << list.substr(1) << endl;
+            return false;
+        }
+        while (getline(file, entry))
+        {
+            size_t start = entry.find_first_not_of(" \t\r");
+            if (start != string::npos && entry[start] != '#')
+                entries.push_back(entry.substr(start, entry.find_last_not_of(" \t\r") - start + 1));
+        }
+    }
+    else
+    {
+        stringstream items(list);
+        while (getline(items, entry, ','))
+        {
+            if (!entry.empty())
+                entries.push_back(entry);
+        }
+    }
+
+    for (const string &name : entries)
+    {
+        fanoutHost_t host = {};
+        host.name = name;
+        host.fd = -1;
+        host.state = HOST_CONNECTING;
+        host.addr.sin_family = AF_INET;
+        host.addr.sin_port = htons(defaultPort);
+
+        string address = name;
+        size_t colon = name.rfind(':');
+        if (colon != string::npos)
+        {
+            address = name.substr(0, colon);
+            string port = name.substr(colon + 1);
+            if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != string::npos ||
+                stoi(port) < 1 || stoi(port) > 65535)
+            {
+                host.state = HOST_DOWN;
+                host.error = "invalid port";
+            }
+            else
+                host.addr.sin_port = htons(static_cast<uint16_t>(stoi(port)));
+        }
+
+        struct addrinfo hints = {};
+        struct addrinfo *found = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (host.state != HOST_DOWN)
+        {
+            if (getaddrinfo(address.c_str(), nullptr, &hints, &found) != 0 || !found)
+            {
+                host.state = HOST_DOWN;
+                host.error = "cannot resolve host";
+            }
+            else
+                host.addr.sin_addr = reinterpret_cast<struct sockaddr_in *>(found->ai_addr)->sin_addr;
+            if (found)
+                freeaddrinfo(found);
+        }
+        hosts.push_back(move(host));
+    }
+    return !hosts.empty();
+}
+
+/*********************************************************************
+ * @fn      		  - connectHost
+ * @brief             - This function starts a non-blocking connection to a
+ *                      host
+ * @param[in]         - fanoutHost_t &host, string &error
+ * @return            - bool (false if it failed at once, error then says why)
+ * @Note              - serviceHost() completes it once poll() reports POLLOUT
+ *********************************************************************/
+bool connectHost(fanoutHost_t &host, string &error)
+{
+    host.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    host.state = HOST_CONNECTING;
+    host.rxBuf.clear();
+    host.txBuf.clear();
+    if (host.fd < 0 ||
+        (connect(host.fd, reinterpret_cast<struct sockaddr *>(&host.addr), sizeof(host.addr)) < 0 && errno != EINPROGRESS))
+    {
+        error = strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - flushHost
+ * @brief             - This function sends the buffered bytes of a host
+ *                      without blocking
+ * @param[in]         - fanoutHost_t &host
+ * @return            - bool (false if the connection failed)
+ * @Note              - What does not fit is sent once poll() reports POLLOUT
+ *********************************************************************/
+bool flushHost(fanoutHost_t &host)
+{
+    size_t offset = 0;
+    while (offset < host.txBuf.size())
+    {
+        ssize_t sent = send(host.fd, host.txBuf.data() + offset, host.txBuf.size() - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+            break;
+        }
+        offset += sent;
+    }
+    host.txBuf.erase(0, offset);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - serviceHost
+ * @brief             - This function handles what poll() reported for a host:
+ *                      it completes the connection and the hello exchange,
+ *                      sends what is buffered and hands every frame received,
+ *                      the server's hello included, to onFrame
+ * @param[in]         - fanoutHost_t &host, short revents,
+ *                      const function<void(MessageHeader &)> &onFrame,
+ *                      string &error
+ * @return            - bool (false if the host must be closed, error then
+ *                      says why)
+ * @Note              - Poll a host for POLLOUT while it is connecting or has
+ *                      bytes buffered
+ *********************************************************************/
+bool serviceHost(fanoutHost_t &host, short revents, const function<void(MessageHeader &)> &onFrame, string &error)
+{
+    if (host.state == HOST_CONNECTING)
+    {
+        int status = 0;
+        socklen_t len = sizeof(status);
+        if (getsockopt(host.fd, SOL_SOCKET, SO_ERROR, &status, &len) < 0 || status)
+        {
+            error = strerror(status ? status : errno);
+            return false;
+        }
+        host.state = HOST_HELLO;
+        MessageHeader hello;
+        hello.MessageHello(APPTYPE_CLIENT, SUPPORTED_CAPS, MAX_FRAME_PAYLOAD);
+        host.txBuf.insert(0, hello.encode());
+        revents |= POLLOUT;
+    }
+
+    if ((revents & POLLOUT) && !flushHost(host))
+    {
+        error = "send failed";
+        return false;
+    }
+    if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+        return true;
+
+    char buffer[64 * 1024];
+    ssize_t len = recv(host.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (len < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;
+    if (len <= 0)
+    {
+        error = "connection closed";
+        return false;
+    }
+    host.rxBuf.append(buffer, len);
+
+    size_t offset = 0;
+    frameHeader_t hdr;
+    string payload;
+    MessageHeader in;
+    while (true)
+    {
+        long consumed = decodeFrame(host.rxBuf.data() + offset, host.rxBuf.size() - offset, hdr, payload);
+        if (consumed == 0)
+            break;
+        if (consumed < 0 || !in.decode(hdr, payload))
+        {
+            error = "protocol error";
+            return false;
+        }
+        offset += consumed;
+
+        if (host.state == HOST_HELLO)
+        {
+            if (in.getMsgType() != MSG_TYPE_HELLO)
+            {
+                error = "handshake failed";
+                return false;
+            }
+            host.session.caps = in.getHelloCapabilities() & SUPPORTED_CAPS;
+            host.session.maxFrameSize = in.getHelloMaxFrame();
+            host.state = HOST_READY;
+        }
+        onFrame(in);
+    }
+    host.rxBuf.erase(0, offset);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - hostReport
+ * @brief             - This function prefixes every line of a host's result
+ *                      with the host name
+ * @param[in]         - const string &name, const string &output,
+ *                      cmdStatus_e status
+ * @return            - string
+ * @Note              - The status is added when it is not OK or the result is
+ *                      empty; blank lines are dropped
+ *********************************************************************/
+string hostReport(const string &name, const string &output, cmdStatus_e status)
+{
+    string report;
+    size_t start = 0;
+    while (start < output.size())
+    {
+        size_t end = output.find('\n', start);
+        if (end == string::npos)
+            end = output.size();
+        if (end > start)
+            report += name + ": " + output.substr(start, end - start) + "\n";
+        start = end + 1;
+    }
+    if (status != CMD_STATUS_OK || output.empty())
+        report += name + ": " + cmdStatusStr[status] + "\n";
+    return report;
+}
+
+/*********************************************************************
+ * @fn      		  - addHosts
+ * @brief             - This function adds the servers of a list, see
+ *                      parseHostList
+ * @param[in]         - const string &list, uint16_t defaultPort
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool FanoutClient::addHosts(const string &list, uint16_t defaultPort)
+{
+    return parseHostList(list, defaultPort, hosts);
+}
+
+/*********************************************************************
+ * @fn      		  - queue
+ * @brief             - This function adds bytes to the send buffer of a host
+ *                      and sends what the socket takes right away
+ * @param[in]         - fanoutHost_t &host, const string &bytes
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void FanoutClient::queue(fanoutHost_t &host, const string &bytes)
+{
+    host.txBuf += bytes;
+    if (host.state != HOST_CONNECTING && !flushHost(host))
+        markDown(host, "send failed");
+}
+
+/*********************************************************************
+ * @fn      		  - markDown
+ * @brief             - This function closes the connection of a host
+ * @param[in]         - fanoutHost_t &host, const string &reason
+ * @return            - none
+ * @Note              - Reported when the host owed an answer
+ *********************************************************************/
+void FanoutClient::markDown(fanoutHost_t &host, const string &reason)
+{
+    if (host.fd >= 0)
+        close(host.fd);
+    host.fd = -1;
+    host.state = HOST_DOWN;
+    host.error = reason;
+    host.rxBuf.clear();
+    host.txBuf.clear();
+    if (host.busy)
+    {
+        cout << host.name << ": DOWN (" << reason << ")\n";
+        result = max(result, SCRIPT_EXIT_ERROR);
+        host.busy = false;
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - aggregateOf
+ * @brief             - This function applies an aggregate to values
+ * @param[in]         - aggregate_e aggregate, const vector<double> &values
+ * @return            - double
+ * @Note              -
+ *********************************************************************/
+static double aggregateOf(aggregate_e aggregate, const vector<double> &values)
+{
+    if (values.empty())
+        return 0;
+    double value = (aggregate == AGGREGATE_MIN) ? INFINITY : (aggregate == AGGREGATE_MAX) ? -INFINITY : 0;
+    for (double v : values)
+    {
+        if (aggregate == AGGREGATE_MAX)
+            value = max(value, v);
+        else if (aggregate == AGGREGATE_MIN)
+            value = min(value, v);
+        else
+            value += v;
+    }
+    return (aggregate == AGGREGATE_AVG) ? value / values.size() : value;
+}
+
+/*********************************************************************
+ * @fn      		  - formatAggregate
+ * @brief             - This function prints an aggregate with its unit
+ * @param[in]         - aggregate_e aggregate, command_e command,
+ *                      const vector<double> &values
+ * @return            - string
+ * @Note              -
+ *********************************************************************/
+static string formatAggregate(aggregate_e aggregate, command_e command, const vector<double> &values)
+{
+    static const char *const names[] = {"", "sum", "avg", "max", "min"};
+    ostringstream text;
+    text << names[aggregate] << " " << fixed << setprecision(command == CMD_GET_MEMORY ? 0 : 2)
+         << aggregateOf(aggregate, values) << (command == CMD_GET_MEMORY ? " KB" : "%") << " over "
+         << values.size() << " process(es)";
+    return text.str();
+}
+
+/*********************************************************************
+ * @fn      		  - completeHost
+ * @brief             - This function prints the result of a host for the
+ *                      current command
+ * @param[in]         - fanoutHost_t &host, cmdStatus_e status
+ * @return            - none
+ * @Note              - Aggregates read VmRSS (KB) from get-mem and the share
+ *                      of one core from get-cpu-usage, with the scan formats
+ *                      kept next to the server's line formats
+ *********************************************************************/
+void FanoutClient::completeHost(fanoutHost_t &host, cmdStatus_e status)
+{
+    host.busy = false;
+    if (status != CMD_STATUS_OK)
+        result = max(result, SCRIPT_EXIT_FAILED);
+
+    if (aggregate != AGGREGATE_NONE && status == CMD_STATUS_OK)
+    {
+        vector<double> hostValues;
+        stringstream lines(host.output);
+        string line;
+        while (getline(lines, line))
+        {
+            double value;
+            int pid;
+            if (command == CMD_GET_MEMORY && sscanf(line.c_str(), MEM_RSS_SCAN_FMT, &value) == 1)
+                hostValues.push_back(value);
+            else if (command == CMD_GET_CPU_USAGE && sscanf(line.c_str(), CPU_USAGE_SCAN_FMT, &pid, &value) == 2)
+                hostValues.push_back(value);
+        }
+        cout << host.name << ": " << formatAggregate(aggregate, command, hostValues) << "\n";
+        values.insert(values.end(), hostValues.begin(), hostValues.end());
+        valueHosts++;
+    }
+    else
+        cout << hostReport(host.name, host.output, status);
+    string().swap(host.output);
+}
+
+/*********************************************************************
+ * @fn      		  - handleFrame
+ * @brief             - This function handles one frame received from a host
+ * @param[in]         - fanoutHost_t &host, MessageHeader &in
+ * @return            - none
+ * @Note              - Answers to a command that timed out carry an older
+ *                      request ID and are dropped
+ *********************************************************************/
+void FanoutClient::handleFrame(fanoutHost_t &host, MessageHeader &in)
+{
+    if (MSG_TYPE_HELLO == in.getMsgType())
+    {
+        host.busy = false;      // connected
+        return;
+    }
+
+    bool tagged = host.session.caps & CAP_REQUEST_ID;
+    if (!host.busy || (tagged && in.getRequestId() != sequence))
+        return;
+    if (MSG_TYPE_RESPONSE == in.getMsgType())
+        host.output += in.getResponseMsg();
+    else if (MSG_TYPE_END_OF_RESPONSE == in.getMsgType())
+        completeHost(host, in.getStatus());
+}
+
+/*********************************************************************
+ * @fn      		  - startCommand
+ * @brief             - This function sends a command line to every host
+ * @param[in]         - const string &line
+ * @return            - bool (true if answers are awaited)
+ * @Note              - Blank lines, comments and invalid commands send
+ *                      nothing; hosts already down are reported at once
+ *********************************************************************/
+bool FanoutClient::startCommand(const string &line)
+{
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == string::npos || line[start] == '#')
+        return false;
+    if (line.length() >= MAX_INPUT_SIZE - 1)
+    {
+        cerr << "Error: Command line too long" << endl;
+        result = max(result, SCRIPT_EXIT_FAILED);
+        return false;
+    }
+
+    vector<string> args = parse_input(line);
+    static const char *const aggregates[] = {"", "sum", "avg", "max", "min"};
+    aggregate = AGGREGATE_NONE;
+    for (int i = AGGREGATE_SUM; i <= AGGREGATE_MIN && !args.empty(); i++)
+    {
+        if (args[0] == aggregates[i])
+        {
+            aggregate = static_cast<aggregate_e>(i);
+            args.erase(args.begin());
+            break;
+        }
+    }
+    if (args.empty())
+    {
+        if (aggregate != AGGREGATE_NONE)
+            cerr << "Error: " << aggregates[aggregate] << " needs a get-mem or get-cpu-usage command" << endl;
+        return false;
+    }
+
+    MessageHeader request;
+    bool valid;
+    if (interactive)
+        valid = request.parseArgumentAndPrepareCommand(args);
+    else
+    {
+        // The usage text printed for unknown commands is not wanted in a script
+        streambuf *console = cout.rdbuf(nullptr);
+        valid = request.parseArgumentAndPrepareCommand(args);
+        cout.rdbuf(console);
+    }
+    if (valid && (request.getOptions() & CMD_OPT_WATCH))
+    {
+        cerr << "Error: watch is not available with several servers" << endl;
+        valid = false;
+    }
+    command = request.getCommand();
+    if (valid && aggregate != AGGREGATE_NONE &&
+        (request.getMsgType() != MSG_TYPE_CMD || (command != CMD_GET_MEMORY && command != CMD_GET_CPU_USAGE)))
+    {
+        cerr << "Error: " << aggregates[aggregate] << " needs a get-mem or get-cpu-usage command" << endl;
+        valid = false;
+    }
+    if (!valid)
+    {
+        if (!interactive)
+        {
+            cerr << "Error: Invalid command: " << line << endl;
+            result = max(result, SCRIPT_EXIT_FAILED);
+        }
+        return false;
+    }
+
+    sequence++;
+    values.clear();
+    valueHosts = 0;
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    bool awaited = false;
+    for (fanoutHost_t &host : hosts)
+    {
+        if (host.state != HOST_READY)
+        {
+            cout << host.name << ": DOWN (" << host.error << ")\n";
+            result = max(result, SCRIPT_EXIT_ERROR);
+            continue;
+        }
+        request.setRequestId((host.session.caps & CAP_REQUEST_ID) ? sequence : 0);
+        host.busy = true;
+        host.deadline = deadline;
+        host.output.clear();
+        queue(host, request.encode());
+        awaited = awaited || host.busy;
+    }
+    return awaited;
+}
+
+/*********************************************************************
+ * @fn      		  - finishCommand
+ * @brief             - This function prints the fleet wide aggregate once
+ *                      every host answered or timed out
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void FanoutClient::finishCommand()
+{
+    if (aggregate != AGGREGATE_NONE)
+        cout << "ALL: " << formatAggregate(aggregate, command, values) << " on " << valueHosts << "/"
+             << hosts.size() << " host(s)\n";
+    aggregate = AGGREGATE_NONE;
+}
+
+/*********************************************************************
+ * @fn      		  - sendHeartbeats
+ * @brief             - This function keeps the idle connections alive
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void FanoutClient::sendHeartbeats()
+{
+    MessageHeader heartbeat;
+    heartbeat.MessageHeartBeat(appType);
+    string frame = heartbeat.encode();
+    for (fanoutHost_t &host : hosts)
+    {
+        if (host.state == HOST_READY)
+            queue(host, frame);
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - run
+ * @brief             - This function connects to every host and runs the
+ *                      commands read from inputFd until its end or "exit"
+ * @param[in]         - int inputFd
+ * @return            - int (SCRIPT_EXIT_* code)
+ * @Note              - One command is in flight at a time, on all hosts at
+ *                      once; input is not read while it runs
+ *********************************************************************/
+int FanoutClient::run(int inputFd)
+{
+    interactive = isatty(inputFd);
+    auto now = chrono::steady_clock::now();
+    for (fanoutHost_t &host : hosts)
+    {
+        if (host.state == HOST_DOWN)
+            continue;
+        string error;
+        host.busy = true;
+        host.deadline = now + chrono::milliseconds(timeoutMs);
+        if (!connectHost(host, error))
+            markDown(host, error);
+    }
+
+    string input;
+    bool inputOpen = true;
+    bool running = true;        // connecting counts as the first command
+    auto nextHeartbeat = now + chrono::milliseconds(HEARTBEAT_INTERVAL_MS);
+    vector<struct pollfd> fds;
+    vector<size_t> owners;
+
+    while (true)
+    {
+        bool busy = any_of(hosts.begin(), hosts.end(), [](const fanoutHost_t &host) { return host.busy; });
+        if (running && !busy)
+        {
+            finishCommand();
+            running = false;
+            if (interactive && inputOpen)
+                cout << CMDPROMPT;
+            cout.flush();
+        }
+        while (!running)
+        {
+            size_t end = input.find('\n');
+            if (end == string::npos)
+                break;
+            string line = input.substr(0, end);
+            input.erase(0, end + 1);
+            vector<string> args = parse_input(line);
+            if (!args.empty() && args[0] == "exit")
+            {
+                inputOpen = false;
+                input.clear();
+                break;
+            }
+            running = startCommand(line);
+            if (!running && interactive)
+                cout << CMDPROMPT;
+            cout.flush();
+        }
+        if (!running && !inputOpen)
+            break;
+
+        fds.clear();
+        owners.clear();
+        if (!running)
+        {
+            fds.push_back({inputFd, POLLIN, 0});
+            owners.push_back(hosts.size());
+        }
+        now = chrono::steady_clock::now();
+        auto wakeAt = nextHeartbeat;
+        for (size_t i = 0; i < hosts.size(); i++)
+        {
+            fanoutHost_t &host = hosts[i];
+            if (host.fd < 0)
+                continue;
+            short events = POLLIN;
+            if (host.state == HOST_CONNECTING || !host.txBuf.empty())
+                events |= POLLOUT;
+            fds.push_back({host.fd, events, 0});
+            owners.push_back(i);
+            if (host.busy)
+                wakeAt = min(wakeAt, host.deadline);
+        }
+        int waitMs = static_cast<int>(max<long>(0, chrono::duration_cast<chrono::milliseconds>(wakeAt - now).count() + 1));
+
+        if (poll(fds.data(), fds.size(), waitMs) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return SCRIPT_EXIT_ERROR;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (!fds[i].revents)
+                continue;
+            if (owners[i] < hosts.size())
+            {
+                fanoutHost_t &host = hosts[owners[i]];
+                string error;
+                if (!serviceHost(host, fds[i].revents, [this, &host](MessageHeader &in) { handleFrame(host, in); }, error))
+                    markDown(host, error);
+                continue;
+            }
+            char buffer[4096];
+            ssize_t len = read(inputFd, buffer, sizeof(buffer));
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len <= 0)
+            {
+                // A last line without newline still runs
+                inputOpen = false;
+                if (!input.empty())
+                    input += "\n";
+            }
+            else
+                input.append(buffer, len);
+        }
+
+        now = chrono::steady_clock::now();
+        for (fanoutHost_t &host : hosts)
+        {
+            if (!host.busy || host.deadline > now)
+                continue;
+            if (host.state != HOST_READY)
+            {
+                markDown(host, "timed out connecting");
+                continue;
+            }
+            cout << host.name << ": TIMEOUT after " << timeoutMs << " ms\n";
+            result = max(result, SCRIPT_EXIT_ERROR);
+            host.busy = false;
+            string().swap(host.output);
+            // Without request IDs a late answer could not be told apart
+            if (!(host.session.caps & CAP_REQUEST_ID))
+                markDown(host, "timed out");
+        }
+        if (now >= nextHeartbeat)
+        {
+            sendHeartbeats();
+            nextHeartbeat = now + chrono::milliseconds(HEARTBEAT_INTERVAL_MS);
+        }
+        cout.flush();
+    }
+
+    cout.flush();
+    return result;
+}
+
+/* In Destructor close the connections */
+FanoutClient::~FanoutClient()
+{
+    for (fanoutHost_t &host : hosts)
+    {
+        if (host.fd >= 0)
+            close(host.fd);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef FANOUT_CLIENT_H
+#define FANOUT_CLIENT_H
+
+#include <chrono>
+#include <functional>
+#include <netinet/in.h>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+
+#define DEFAULT_HOST_TIMEOUT_MS 5000
+
+typedef enum
+{
+    HOST_CONNECTING,
+    HOST_HELLO,             /* connected, waiting for the server's hello */
+    HOST_READY,
+    HOST_DOWN,
+} hostState_e;
+
+/* Aggregate computed over the matched processes of every host */
+typedef enum
+{
+    AGGREGATE_NONE,
+    AGGREGATE_SUM,
+    AGGREGATE_AVG,
+    AGGREGATE_MAX,
+    AGGREGATE_MIN,
+} aggregate_e;
+
+/* One server of the fleet */
+typedef struct
+{
+    string name;                /* as given, "host" or "host:port" */
+    struct sockaddr_in addr;
+    int fd;
+    hostState_e state;
+    session_t session;
+    string rxBuf;
+    string txBuf;
+    chrono::steady_clock::time_point deadline;
+    bool busy;                  /* the current command is not answered yet */
+    string output;
+    string error;               /* why the host is down */
+} fanoutHost_t;
+
+bool parseHostList(const string &list, uint16_t defaultPort, vector<fanoutHost_t> &hosts);
+bool connectHost(fanoutHost_t &host, string &error);
+bool flushHost(fanoutHost_t &host);
+bool serviceHost(fanoutHost_t &host, short revents, const function<void(MessageHeader &)> &onFrame, string &error);
+string hostReport(const string &name, const string &output, cmdStatus_e status);
+
+/*
+ * Client of many servers at once: every command read from the script or
+ * the terminal is sent to all hosts over non-blocking connections driven
+ * by one poll() loop. Each host's result is printed as soon as it is
+ * complete, every line prefixed with the host name. A host that does not
+ * answer within the timeout is reported as TIMEOUT and no longer holds up
+ * the command; its late answer is dropped. Prefixing a get-mem or
+ * get-cpu-usage command with sum, avg, max or min prints that value over
+ * the matched processes per host and for the whole fleet instead.
+ */
+class FanoutClient
+{
+private:
+    vector<fanoutHost_t> hosts;
+    uint32_t timeoutMs;
+    uint32_t sequence;          /* request ID of the current command */
+    command_e command;
+    aggregate_e aggregate;
+    vector<double> values;      /* aggregated values of the current command */
+    size_t valueHosts;
+    bool interactive;           /* commands are typed at a terminal */
+    int result;                 /* SCRIPT_EXIT_* code so far */
+
+    void queue(fanoutHost_t &host, const string &bytes);
+    void markDown(fanoutHost_t &host, const string &reason);
+    void completeHost(fanoutHost_t &host, cmdStatus_e status);
+    void handleFrame(fanoutHost_t &host, MessageHeader &in);
+    bool startCommand(const string &line);
+    void finishCommand();
+    void sendHeartbeats();
+
+public:
+    FanoutClient(uint32_t timeoutMs);
+    bool addHosts(const string &list, uint16_t defaultPort);
+    int run(int inputFd);
+    ~FanoutClient();
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "HexDecode.hh"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define HEX_DECODE_X86
+#endif
+
+typedef bool (*hexDecodeFn_t)(const char *in, size_t avail, int words, uint32_t *out);
+
+typedef struct
+{
+    hexDecodeFn_t fn;
+    const char *name;
+} hexDecoder_t;
+
+typedef struct
+{
+    hexDecoder_t narrow;        /* one word columns: IPv4 addresses */
+    hexDecoder_t wide;          /* IPv6 addresses */
+} hexDecoderSet_t;
+
+/* Digit value of every byte, 0xFF for bytes that are not hex digits */
+static const array<uint8_t, 256> hexValue = [] {
+    array<uint8_t, 256> table;
+    table.fill(0xFF);
+    for (int i = 0; i < 10; i++)
+        table['0' + i] = i;
+    for (int i = 0; i < 6; i++)
+        table['A' + i] = table['a' + i] = 10 + i;
+    return table;
+}();
+
+/*********************************************************************
+ * @fn      		  - decodeScalar
+ * @brief             - This function decodes hex words one digit at a time
+ * @param[in]         - const char *in, size_t avail, int words, uint32_t *out
+ * @return            - bool (false on a non hex digit)
+ * @Note              - Also the tail of the vector kernels
+ *********************************************************************/
+static bool decodeScalar(const char *in, size_t avail, int words, uint32_t *out)
+{
+    (void)avail;
+    uint8_t bad = 0;
+    for (int i = 0; i < words; i++)
+    {
+        uint32_t word = 0;
+        for (int j = 0; j < HEX_WORD_CHARS; j++)
+        {
+            uint8_t digit = hexValue[static_cast<uint8_t>(in[i * HEX_WORD_CHARS + j])];
+            bad |= digit;
+            word = (word << 4) | (digit & 0x0F);
+        }
+        out[i] = word;
+    }
+    // Valid digits are below 0x10, so any 0xFF shows up in the high bits
+    return (bad & 0xF0) == 0;
+}
+
+#ifdef HEX_DECODE_X86
+
+/*********************************************************************
+ * @fn      		  - decodeSse2
+ * @brief             - This function decodes two hex words per 16 byte load
+ * @param[in]         - const char *in, size_t avail, int words, uint32_t *out
+ * @return            - bool (false on a non hex digit)
+ * @Note              - Bytes past the words are loaded but not checked, so a
+ *                      single word only needs 16 readable bytes
+ *********************************************************************/
+__attribute__((target("sse2")))
+static bool decodeSse2(const char *in, size_t avail, int words, uint32_t *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    while (words > 0 && avail >= 16)
+    {
+        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+
+        // Signed compares: bytes >= 0x80 fail both ranges
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), chars));
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+        int wanted = words >= 2 ? 0xFFFF : 0x00FF;
+        if ((_mm_movemask_epi8(_mm_or_si128(digit, alpha)) & wanted) != wanted)
+            return false;
+
+        __m128i nibbles = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+                                       _mm_andnot_si128(digit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+
+        // Each 16 bit lane holds the high digit in its low byte: merge them into one byte
+        __m128i bytes = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_epi16(nibbles, 8)),
+                                      _mm_set1_epi16(0x00FF));
+        uint8_t packed[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(packed), _mm_packus_epi16(bytes, zero));
+
+        int count = words >= 2 ? 2 : 1;
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t word;
+            memcpy(&word, packed + i * 4, sizeof(word));
+            out[i] = __builtin_bswap32(word);
+        }
+        in += count * HEX_WORD_CHARS;
+        avail -= count * HEX_WORD_CHARS;
+        out += count;
+        words -= count;
+    }
+    return words == 0 || decodeScalar(in, avail, words, out);
+}
+
+#endif
+
+/* The kernel called name, if this CPU can run it */
+static bool findDecoder(const char *name, hexDecoder_t &decoder)
+{
+#ifdef HEX_DECODE_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+    {
+        decoder = hexDecoder_t{decodeSse2, "sse2"};
+        return true;
+    }
+#endif
+    if (strcmp(name, "scalar") == 0)
+    {
+        decoder = hexDecoder_t{decodeScalar, "scalar"};
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Kernels per column width, chosen on first use. One 8 digit word is
+ * decoded fastest by the table; the SSE2 load only pays off on the four
+ * words of an IPv6 address (HexDecodeBench)
+ */
+static hexDecoderSet_t &hexDecoders()
+{
+    static hexDecoderSet_t chosen = [] {
+        hexDecoderSet_t set;
+        findDecoder("scalar", set.narrow);
+        if (!findDecoder("sse2", set.wide))
+            set.wide = set.narrow;
+        return set;
+    }();
+    return chosen;
+}
+
+/*********************************************************************
+ * @fn      		  - decodeHexWords
+ * @brief             - This function decodes 32 bit words printed as
+ *                      HEX_WORD_CHARS hex digits each, back to back
+ * @param[in]         - string_view in, int words, uint32_t *out
+ * @return            - bool (false if in is too short or not hex)
+ * @Note              - The vector kernels may read past the words, never
+ *                      past the end of in
+ *********************************************************************/
+bool decodeHexWords(string_view in, int words, uint32_t *out)
+{
+    if (words <= 0 || in.size() < static_cast<size_t>(words * HEX_WORD_CHARS))
+        return false;
+    const hexDecoderSet_t &decoders = hexDecoders();
+    return (words == 1 ? decoders.narrow : decoders.wide).fn(in.data(), in.size(), words, out);
+}
+
+/*********************************************************************
+ * @fn      		  - hexDecoderName
+ * @brief             - This function names the kernel used on this CPU for
+ *                      columns of the given width
+ * @param[in]         - int words
+ * @return            - const char *
+ * @Note              -
+ *********************************************************************/
+const char *hexDecoderName(int words)
+{
+    const hexDecoderSet_t &decoders = hexDecoders();
+    return (words == 1 ? decoders.narrow : decoders.wide).name;
+}
+
+/*********************************************************************
+ * @fn      		  - useHexDecoder
+ * @brief             - This function replaces the kernels chosen for this
+ *                      CPU with the one called name, for every width
+ * @param[in]         - const char *name ("scalar", "sse2", or "auto" to
+ *                      choose by width again)
+ * @return            - bool (false if this CPU cannot run it)
+ * @Note              - For benchmarks; not thread safe, call it while
+ *                      nothing is decoding
+ *********************************************************************/
+bool useHexDecoder(const char *name)
+{
+    hexDecoderSet_t &decoders = hexDecoders();
+    if (strcmp(name, "auto") == 0)
+    {
+        findDecoder("scalar", decoders.narrow);
+        if (!findDecoder("sse2", decoders.wide))
+            decoders.wide = decoders.narrow;
+        return true;
+    }
+    hexDecoder_t decoder;
+    if (!findDecoder(name, decoder))
+        return false;
+    decoders.narrow = decoders.wide = decoder;
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef HEX_DECODE_H
+#define HEX_DECODE_H
+
+#include <string_view>
+#include "RemoteManagement.hh"
+
+#define HEX_WORD_CHARS      8       /* one 32 bit word printed as %08X */
+#define HEX_MAX_WORDS       4       /* an IPv6 address */
+
+/*
+ * Decoder of the fixed width hex columns of /proc/net/{tcp,udp}[6]. An
+ * address is 1 or 4 words of exactly HEX_WORD_CHARS digits. The kernel
+ * goes by column width: the scalar table for single words, where it beats
+ * the vector loads, and SSE2 (two words per 16 char register) for IPv6
+ * addresses when the CPU has it, checked at run time so non x86 machines
+ * use the table throughout. useHexDecoder() forces one kernel for every
+ * width, to compare them.
+ */
+bool decodeHexWords(string_view in, int words, uint32_t *out);
+const char *hexDecoderName(int words);
+bool useHexDecoder(const char *name);
+
+#endif
@@ -0,0 +1,230 @@
+#include "LineEditor.hh"
+#include "History.hh"
+#include "NetworkSettings.hh"
+
+extern History commandHistory;
+extern int history_index;
+
+/* In Constructor initialise variables of class */
+LineEditor::LineEditor() : rawMode(false), echo(isatty(STDIN_FILENO)), cursor(0), escapeState(0)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - enableRawMode
+ * @brief             - This function switches the terminal to byte by byte
+ *                      input without echo
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Nothing to do when stdin is not a terminal
+ *********************************************************************/
+void LineEditor::enableRawMode()
+{
+    if (!echo || tcgetattr(STDIN_FILENO, &savedMode) != 0)
+        return;
+
+    struct termios mode = savedMode;
+    mode.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
+    mode.c_cc[VMIN] = 1;
+    mode.c_cc[VTIME] = 0;
+    rawMode = tcsetattr(STDIN_FILENO, TCSANOW, &mode) == 0;
+}
+
+/*********************************************************************
+ * @fn      		  - restoreMode
+ * @brief             - This function restores the terminal settings saved
+ *                      by enableRawMode
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void LineEditor::restoreMode()
+{
+    if (rawMode)
+        tcsetattr(STDIN_FILENO, TCSANOW, &savedMode);
+    rawMode = false;
+}
+
+/*********************************************************************
+ * @fn      		  - redraw
+ * @brief             - This function rewrites the prompt and the input and
+ *                      puts the cursor back where it was
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void LineEditor::redraw()
+{
+    if (!echo)
+        return;
+    cout << "\r\033[K" << CMDPROMPT << input;
+    for (int i = cursor; i < (int)input.size(); i++)
+        cout << "\b";
+    cout.flush();
+}
+
+/*********************************************************************
+ * @fn      		  - recallHistory
+ * @brief             - This function replaces the input with a history entry,
+ *                      or clears it past the newest one
+ * @param[in]         - int index
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void LineEditor::recallHistory(int index)
+{
+    history_index = index;
+    input = index < commandHistory.size() ? commandHistory.getCommand(index) : string();
+    cursor = input.size();
+    redraw();
+}
+
+/*********************************************************************
+ * @fn      		  - handleEscape
+ * @brief             - This function handles the bytes following ESC
+ * @param[in]         - char ch
+ * @return            - none
+ * @Note              - Only ESC [ A/B/C/D (arrow keys) do something
+ *********************************************************************/
+void LineEditor::handleEscape(char ch)
+{
+    if (escapeState == 1)
+    {
+        escapeState = (ch == '[') ? 2 : 0;
+        return;
+    }
+    escapeState = 0;
+
+    if (ch == 'A')
+    { // Up arrow - previous command
+        if (history_index > 0)
+            recallHistory(history_index - 1);
+    }
+    else if (ch == 'B')
+    { // Down arrow - next command
+        recallHistory(min(history_index + 1, commandHistory.size()));
+    }
+    else if (ch == 'C')
+    { // Right arrow
+        if (cursor < (int)input.size())
+        {
+            cursor++;
+            redraw();
+        }
+    }
+    else if (ch == 'D')
+    { // Left arrow
+        if (cursor > 0)
+        {
+            cursor--;
+            redraw();
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - feed
+ * @brief             - This function applies one byte typed by the user
+ * @param[in]         - char ch, string &line
+ * @return            - bool (true when Enter completed a line, then in line)
+ * @Note              -
+ *********************************************************************/
+bool LineEditor::feed(char ch, string &line)
+{
+    if (escapeState)
+    {
+        handleEscape(ch);
+        return false;
+    }
+
+    if (ch == '\n' || ch == '\r')
+    { // End of input
+        if (echo)
+            cout << endl;
+        line.swap(input);
+        input.clear();
+        cursor = 0;
+        return true;
+    }
+    else if (ch == 127 || ch == '\b')
+    { // Backspace
+        if (cursor > 0)
+        {
+            input.erase(cursor - 1, 1);
+            cursor--;
+            redraw();
+        }
+    }
+    else if (ch == 27)
+    { // ESC before Arrow key
+        escapeState = 1;
+    }
+    else if (input.size() < MAX_INPUT_SIZE)
+    {
+        // Regular character input
+        input.insert(cursor, 1, ch);
+        cursor++;
+        if (cursor < (int)input.size())
+            redraw();
+        else if (echo)
+        { // Appending needs no redraw
+            cout << ch;
+            cout.flush();
+        }
+    }
+    return false;
+}
+
+/*********************************************************************
+ * @fn      		  - showPrompt
+ * @brief             - This function prints the prompt and any pending input
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void LineEditor::showPrompt()
+{
+    redraw();
+}
+
+/*********************************************************************
+ * @fn      		  - printAbove
+ * @brief             - This function prints text without mixing it with the
+ *                      line being edited
+ * @param[in]         - const string &text
+ * @return            - none
+ * @Note              - The prompt and input are redrawn below the text
+ *********************************************************************/
+void LineEditor::printAbove(const string &text)
+{
+    if (echo)
+        cout << "\r\033[K";
+    cout << text;
+    if (!text.empty() && text.back() != '\n')
+        cout << "\n";
+    redraw();
+    cout.flush();
+}
+
+/*********************************************************************
+ * @fn      		  - discardInput
+ * @brief             - This function drops the line being edited (Ctrl-C)
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void LineEditor::discardInput()
+{
+    input.clear();
+    cursor = 0;
+    escapeState = 0;
+    if (echo)
+        cout << "\n";
+    redraw();
+}
+
+/* In Destructor give the terminal back in the state it was found */
+LineEditor::~LineEditor()
+{
+    restoreMode();
+}
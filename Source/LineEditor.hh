@@ -0,0 +1,41 @@
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+#include <string>
+#include <termios.h>
+#include "RemoteManagement.hh"
+
+/*
+ * Command line editing for the client's event loop. Input is fed one byte
+ * at a time as it arrives on stdin, so the loop never blocks on the
+ * keyboard and can print responses while a command is half typed: the
+ * line is erased, the response printed above it and the prompt redrawn.
+ * Supports backspace, left/right and the up/down history keys. When stdin
+ * is not a terminal nothing is echoed.
+ */
+class LineEditor
+{
+private:
+    struct termios savedMode;
+    bool rawMode;
+    bool echo;
+    string input;
+    int cursor;
+    int escapeState;        /* bytes of an ESC [ x sequence seen so far */
+
+    void redraw();
+    void recallHistory(int index);
+    void handleEscape(char ch);
+
+public:
+    LineEditor();
+    void enableRawMode();
+    void restoreMode();
+    bool feed(char ch, string &line);
+    void showPrompt();
+    void printAbove(const string &text);
+    void discardInput();
+    ~LineEditor();
+};
+
+#endif
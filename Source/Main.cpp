@@ -2,21 +2,230 @@
 #include "NetworkSettings.hh"
 #include "RemoteManagement.hh"
 #include "NetworkValidator.hh"
+#include "MessageHandle.hh"
+#include "Reactor.hh"
+#include "WorkerPool.hh"
+#include "ProcessTable.hh"
+#include "ScriptRunner.hh"
+#include "FanoutClient.hh"
+#include "Relay.hh"
+#include <fcntl.h>
 extern appType_e appType;
+extern serverConfig_t serverConfig;
 
+/*********************************************************************
+ * @fn      		  - parseServerOptions()
+ * @brief             - This function reads the optional server tunables
+ *                      given after -s into serverConfig
+ * @param[in]         - int argc, char *argv[]
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+static bool parseServerOptions(int argc, char *argv[])
+{
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frame-size") == 0 && i + 1 < argc)
+        {
+            long frameSize = atol(argv[++i]);
+            if (frameSize < MESSAGE_SIZE || frameSize > MAX_FRAME_PAYLOAD)
+            {
+                cerr << "Frame size must be between " << MESSAGE_SIZE << " and " << MAX_FRAME_PAYLOAD << endl;
+                return false;
+            }
+            serverConfig.maxFrameSize = static_cast<uint32_t>(frameSize);
+        }
+        else if (strcmp(argv[i], "--reactor") == 0)
+        {
+            serverConfig.reactor = true;
+        }
+        else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc)
+        {
+            serverConfig.ioThreads = atoi(argv[++i]);
+            if (serverConfig.ioThreads < 1)
+            {
+                cerr << "I/O thread count must be at least 1" << endl;
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            serverConfig.workers = atoi(argv[++i]);
+            if (serverConfig.workers < 1)
+            {
+                cerr << "Worker count must be at least 1" << endl;
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--queue-depth") == 0 && i + 1 < argc)
+        {
+            long depth = atol(argv[++i]);
+            if (depth < 1)
+            {
+                cerr << "Queue depth must be at least 1" << endl;
+                return false;
+            }
+            serverConfig.queueDepth = static_cast<size_t>(depth);
+        }
+        else if (strcmp(argv[i], "--snapshot-interval") == 0 && i + 1 < argc)
+        {
+            serverConfig.snapshotIntervalMs = atoi(argv[++i]);
+            if (serverConfig.snapshotIntervalMs < 1)
+            {
+                cerr << "Snapshot interval must be at least 1 ms" << endl;
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--proc-events") == 0)
+        {
+            serverConfig.procEvents = true;
+        }
+        else if (strcmp(argv[i], "--sock-diag") == 0)
+        {
+            serverConfig.sockDiag = true;
+        }
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+        {
+            int port = atoi(argv[++i]);
+            if (port < 1 || port > 65535)
+            {
+                cerr << "Port must be between 1 and 65535" << endl;
+                return false;
+            }
+            serverConfig.port = static_cast<uint16_t>(port);
+        }
+        else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc)
+        {
+            int port = atoi(argv[++i]);
+            if (port < 1 || port > 65535)
+            {
+                cerr << "Metrics port must be between 1 and 65535" << endl;
+                return false;
+            }
+            serverConfig.metricsPort = static_cast<uint16_t>(port);
+        }
+        else if (strcmp(argv[i], "--scan-threads") == 0 && i + 1 < argc)
+        {
+            serverConfig.scanThreads = atoi(argv[++i]);
+            if (serverConfig.scanThreads < 0)
+            {
+                cerr << "Scan threads must be 0 (one per CPU) or more" << endl;
+                return false;
+            }
+        }
+        else
+        {
+            cerr << "Unknown server option: " << argv[i] << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - parseClientOptions()
+ * @brief             - This function reads the options given after the port
+ *                      of -c
+ * @param[in]         - int argc, char *argv[], const char *&script,
+ *                      uint32_t &timeoutMs
+ * @return            - bool
+ * @Note              - --timeout only applies to several servers
+ *********************************************************************/
+static bool parseClientOptions(int argc, char *argv[], const char *&script, uint32_t &timeoutMs)
+{
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+            script = argv[++i];
+        }
+        else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+        {
+            if (!parseDuration(argv[++i], timeoutMs) || timeoutMs == 0)
+            {
+                cerr << "Timeout must be a duration such as 5s or 500ms" << endl;
+                return false;
+            }
+        }
+        else
+        {
+            cerr << "Unknown client option: " << argv[i] << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - parseRelayOptions()
+ * @brief             - This function reads the options given after the agent
+ *                      port of -r
+ * @param[in]         - int argc, char *argv[], uint32_t &ttlMs,
+ *                      uint32_t &timeoutMs
+ * @return            - bool
+ * @Note              - --port sets the port clients connect to
+ *********************************************************************/
+static bool parseRelayOptions(int argc, char *argv[], uint32_t &ttlMs, uint32_t &timeoutMs)
+{
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+        {
+            int port = atoi(argv[++i]);
+            if (port < 1 || port > 65535)
+            {
+                cerr << "Port must be between 1 and 65535" << endl;
+                return false;
+            }
+            serverConfig.port = static_cast<uint16_t>(port);
+        }
+        else if (strcmp(argv[i], "--ttl") == 0 && i + 1 < argc)
+        {
+            if (!parseDuration(argv[++i], ttlMs))
+            {
+                cerr << "TTL must be a duration such as 2s or 500ms" << endl;
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+        {
+            if (!parseDuration(argv[++i], timeoutMs) || timeoutMs == 0)
+            {
+                cerr << "Timeout must be a duration such as 5s or 500ms" << endl;
+                return false;
+            }
+        }
+        else
+        {
+            cerr << "Unknown relay option: " << argv[i] << endl;
+            return false;
+        }
+    }
+    return true;
+}
 
 int main(int argc, char *argv[])
 {
     // To start application must receive the parameter to define behaviour of application as it can act as either server or client.
     /*
-     *  To run application as server : ./tcpapp -s
-     *  To run application as client : ./tcpapp -c ipaddress_of_server
+     *  To run application as server : ./tcpapp -s [--port n] [--frame-size bytes] [--reactor [--io-threads n]] [--workers n] [--queue-depth n] [--snapshot-interval ms] [--proc-events] [--sock-diag] [--scan-threads n] [--metrics-port n]
+     *  To run application as client : ./tcpapp -c ipaddress_of_server port [-f script]
+     *  (commands are read from stdin as a script when it is not a terminal)
+     *  To run commands on several servers : ./tcpapp -c host1,host2:port2,... port [-f script] [--timeout duration]
+     *  or ./tcpapp -c @hostfile port ...
+     *  To run as relay for agents : ./tcpapp -r host1,host2[:port],... | @hostfile agent_port [--port n] [--ttl duration] [--timeout duration]
      */
-    if (argc < 2 || (argc < 3 && (strcmp(argv[1], "-c") == 0 || strcmp(argv[1], "-b") == 0)))
+    if (argc < 2 || (argc < 3 && (strcmp(argv[1], "-c") == 0 || strcmp(argv[1], "-b") == 0 || strcmp(argv[1], "-r") == 0)))
     {
         cerr << "Usage:\n"
-             << argv[0] << " -s            (for server)\n"
-             << argv[0] << " -c server_ip  (for client) (port)" << endl;
+             << argv[0] << " -s [--port n] [--frame-size bytes] [--reactor [--io-threads n]]\n"
+             << "      [--workers n] [--queue-depth n] [--snapshot-interval ms] [--proc-events] [--sock-diag]\n"
+             << "      [--scan-threads n] [--metrics-port n]  (for server)\n"
+             << argv[0] << " -c server_ip  (for client) (port) [-f script]\n"
+             << argv[0] << " -c host1,host2[:port],... | @hostfile  (for several servers) (port) [-f script]\n"
+             << "      [--timeout duration]\n"
+             << argv[0] << " -r host1,host2[:port],... | @hostfile  (for relay) (agent port) [--port n]\n"
+             << "      [--ttl duration] [--timeout duration]" << endl;
         return 1;
     }
 
@@ -25,20 +234,66 @@ int main(int argc, char *argv[])
 
     if (mode == "-s")
     {
-        if (!network.initializeAsServer())
+        if (!parseServerOptions(argc, argv) || !network.initializeAsServer())
             return 1;
         appType = APPTYPE_SERVER;
         network.runServer();
     }
-    else if (mode == "-c" && argc == 4)
+    else if (mode == "-c" && argc >= 4)
     {
-        if (!network.initializeAsClient(argv[2]))
+        int port = atoi(argv[3]);
+        const char *script = nullptr;
+        uint32_t timeoutMs = DEFAULT_HOST_TIMEOUT_MS;
+        if (port < 1 || port > 65535)
+        {
+            cerr << "Port must be between 1 and 65535" << endl;
+            return 1;
+        }
+        if (!parseClientOptions(argc, argv, script, timeoutMs))
             return 1;
-        
-        
         appType = APPTYPE_CLIENT;
+
+        string target = argv[2];
+        if (target.find(',') != string::npos || target[0] == '@')
+        {
+            FanoutClient fleet(timeoutMs);
+            if (!fleet.addHosts(target, static_cast<uint16_t>(port)))
+                return SCRIPT_EXIT_ERROR;
+            int inputFd = script ? open(script, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+            if (inputFd < 0)
+            {
+                cerr << "Cannot open script " << script << endl;
+                return SCRIPT_EXIT_ERROR;
+            }
+            return fleet.run(inputFd);
+        }
+
+        bool interactive = !script && isatty(STDIN_FILENO);
+        if (!network.initializeAsClient(argv[2], static_cast<uint16_t>(port)))
+            return interactive ? 1 : SCRIPT_EXIT_ERROR;
+        if (!interactive)
+            return network.runScript(script);
         network.runClient();
     }
+    else if (mode == "-r" && argc >= 4)
+    {
+        int port = atoi(argv[3]);
+        uint32_t ttlMs = DEFAULT_RELAY_TTL_MS;
+        uint32_t timeoutMs = DEFAULT_HOST_TIMEOUT_MS;
+        if (port < 1 || port > 65535)
+        {
+            cerr << "Port must be between 1 and 65535" << endl;
+            return 1;
+        }
+        if (!parseRelayOptions(argc, argv, ttlMs, timeoutMs) || !network.initializeAsServer())
+            return 1;
+        appType = APPTYPE_CLIENT;     // towards the agents
+
+        Relay relay(network.getClientSocketId(), ttlMs, timeoutMs);
+        if (!relay.addAgents(argv[2], static_cast<uint16_t>(port)))
+            return 1;
+        relay.run();
+    }
     else
     {
         cerr << "Invalid arguments" << endl;
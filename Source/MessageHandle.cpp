@@ -1,4 +1,5 @@
 #include "MessageHandle.hh"
+#include <cmath>
 
 static string cmdStr[CMD_MAX] = 
 {
@@ -10,6 +11,8 @@ string msgStr[MSG_TYPE_MAX] =
     MSG_GENERATOR(STRING)
 };
 
+const char *const cmdStatusStr[] = {"OK", "NOT FOUND", "INVALID"};
+
 /* In Constructor initialise variables of class with default values*/
 MessageHeader::MessageHeader()
 {
@@ -17,7 +20,22 @@ MessageHeader::MessageHeader()
     messageSize = 0;
     command = CMD_MAX;
     isPid = 0;
+    msgType = MSG_INVALID;
     pidOrProccessNameVariant = 0;
+    response.socket = 0;
+    response.sequenceNum = 0;
+    helloVersion = PROTOCOL_VERSION;
+    helloCaps = 0;
+    helloMaxFrame = MESSAGE_SIZE;
+    options = 0;
+    windowMs = 0;
+    port = 0;
+    requestId = 0;
+    intervalMs = 0;
+    threshold = 0;
+    watchId = 0;
+    since = 0;
+    status = CMD_STATUS_OK;
 }
 
 /*********************************************************************
@@ -35,6 +53,38 @@ void MessageHeader::MessageHeartBeat(appType_e app)
     this->setMsgType(msgType_e::MSG_HEARTBEAT);
 }
 
+/*********************************************************************
+ * @fn      		  - MessageHello()
+ * @brief             - This function used to set value for object used to 
+ *                      negotiate protocol version and capabilities right
+ *                      after the connection is established
+ * @param[in]         - appType_e app, uint32_t capabilities, uint32_t maxFrameSize
+ * @return            - None
+ * @Note              -
+ *********************************************************************/
+void MessageHeader::MessageHello(appType_e app, uint32_t capabilities, uint32_t maxFrameSize)
+{
+    this->setSelfInfo(app);
+    this->setCommand(command_e::CMD_MAX);
+    this->setMsgType(msgType_e::MSG_TYPE_HELLO);
+    this->helloVersion = PROTOCOL_VERSION;
+    this->helloCaps = capabilities;
+    this->helloMaxFrame = maxFrameSize;
+}
+
+/*********************************************************************
+ * @fn      		  - getHelloCapabilities()
+ * @brief             - This function used to get the capabilities advertised
+ *                      by the peer in a hello message
+ * @param[in]         - none
+ * @return            - uint32_t
+ * @Note              -
+ *********************************************************************/
+uint32_t MessageHeader::getHelloCapabilities()
+{
+    return helloCaps;
+}
+
 /*********************************************************************
  * @fn      		  - checkIsPid()
  * @brief             - This function used to check the calue of isPid flag 
@@ -197,7 +247,7 @@ void MessageHeader::setResponse(appType_e type, msgType_e mType, int clientSocke
     this->msgType = mType;
     this->response.socket = clientSocket;
     this->response.sequenceNum = sequenceNum;
-    strcpy(this->response.msg, resp.c_str());
+    this->response.msg = resp;
 }
 
 /*********************************************************************
@@ -242,6 +292,24 @@ void MessageHeader::printHelp()
               << " <Process name || Process ID> - To kill the specific running process on the server\n";
      cout <<  left <<  setw(25) << cmdStr[CMD_RESTART_PROCESS] 
               << " <Process name> || Process ID> - To restart the process on the server\n";
+     cout <<  left <<  setw(25) << cmdStr[CMD_WHO_LISTENS] 
+              << " <Port> - To find the processes listening on a TCP or UDP port of the server\n";
+     cout <<  left <<  setw(25) << "watch"
+              << " <command> <target> [--every 500ms] [--threshold n] - To get the result pushed again every period while it changes\n";
+     cout <<  left <<  setw(25) << cmdStr[CMD_UNWATCH]
+              << " <n || all> - To stop the watch shown as [#n], or all of them\n";
+     cout <<  left <<  setw(25) << cmdStr[CMD_STATS]
+              << " - To get the server's traffic counters and latency percentiles per command and phase\n";
+     cout <<  left <<  setw(25) << "batch"
+              << " <command>; <command>; ... - To run several commands in one request, e.g. batch get-mem a; get-cpu-usage b\n";
+     cout << "\nTargets:\n";
+     cout <<  left <<  setw(25) << "<target> ..."
+              << " - Commands taking a process accept several PIDs, names, ranges (300-350) and globs ('java*')\n";
+     cout << "\nOptions:\n";
+     cout <<  left <<  setw(25) << "--fresh"
+              << " - Read /proc now instead of the server's periodic process snapshot\n";
+     cout <<  left <<  setw(25) << "--window <duration>"
+              << " - Averaging window of get-cpu-usage, e.g. 5s or 500ms (default 1s, at most 60s)\n";
 }
 
 
@@ -278,17 +346,90 @@ void MessageHeader::processIdentifier(const string &identifier)
     }
 }
 
+/*********************************************************************
+ * @fn      		  - parseDuration()
+ * @brief             - This function converts a duration such as "5s", "500ms"
+ *                      or "2m" into milliseconds; a bare number is seconds
+ * @param[in]         - const string &text, uint32_t &ms
+ * @return            - bool
+ * @Note              - Rejects negative, non finite and out of range values
+ *********************************************************************/
+bool parseDuration(const string &text, uint32_t &ms)
+{
+    char *unit = nullptr;
+    double value = strtod(text.c_str(), &unit);
+    // strtod also takes "nan" and "inf", which no range check below catches
+    if (unit == text.c_str() || !isfinite(value) || value < 0)
+        return false;
+
+    string suffix(unit);
+    double scale;
+    if (suffix.empty() || suffix == "s")
+        scale = 1000;
+    else if (suffix == "ms")
+        scale = 1;
+    else if (suffix == "m")
+        scale = 60 * 1000;
+    else
+        return false;
+
+    double total = value * scale;
+    if (total > UINT32_MAX)
+        return false;
+    ms = static_cast<uint32_t>(total);
+    return true;
+}
+
 /*********************************************************************
  * @fn      		  - parseArgumentAndPrepareCommand()
  * @brief             - This function used to parse the argument entered by the user
  *                      and prepare message accordingly to sent to server
- * @param[in]         - const vector<string> &args
+ * @param[in]         - const vector<string> &iArgs
  * @return            - bool
  * @Note              -
  *********************************************************************/
-bool MessageHeader::parseArgumentAndPrepareCommand(const vector<string> &args)
+bool MessageHeader::parseArgumentAndPrepareCommand(const vector<string> &iArgs)
 {
     bool returnStatus = false;
+
+    if (!iArgs.empty() && iArgs[0] == "batch")
+        return this->parseBatch(iArgs);
+    if (!iArgs.empty() && iArgs[0] == "watch")
+        return this->parseWatch(iArgs);
+
+    // Option flags may appear anywhere after the command name
+    vector<string> args;
+    this->options = 0;
+    this->windowMs = 0;
+    this->port = 0;
+    this->intervalMs = 0;
+    this->threshold = 0;
+    this->watchId = 0;
+    this->since = 0;
+    this->batch.clear();
+    this->targets.clear();
+    for (size_t i = 0; i < iArgs.size(); i++)
+    {
+        if (iArgs[i] == "--fresh")
+            this->options |= CMD_OPT_FRESH;
+        else if (iArgs[i] == "--window")
+        {
+            if (i + 1 >= iArgs.size() || !parseDuration(iArgs[i + 1], this->windowMs) || this->windowMs == 0)
+            {
+                cerr << "Error: --window needs a duration such as 5s or 500ms" << endl;
+                return false;
+            }
+            i++;
+        }
+        else
+            args.push_back(iArgs[i]);
+    }
+    if (args.empty())
+    {
+        printHelp();
+        return false;
+    }
+
     int argSize = args.size();
     // Check minimum arguments
 
@@ -304,31 +445,59 @@ bool MessageHeader::parseArgumentAndPrepareCommand(const vector<string> &args)
     else if (args[0] == cmdStr[CMD_GET_MEMORY] && !(argSize < 2))
     {
         this->setCommand(command_e::CMD_GET_MEMORY);
-        this->processIdentifier(args[1]);
-        returnStatus = true;
+        returnStatus = this->parseTargets(args);
     }
     else if (args[0] == cmdStr[CMD_GET_CPU_USAGE] && !(argSize < 2))
     {
         this->setCommand(command_e::CMD_GET_CPU_USAGE);
-        this->processIdentifier(args[1]);
-        returnStatus = true;
+        returnStatus = this->parseTargets(args);
     }
     else if (args[0] == cmdStr[CMD_GET_PORT_USED] && !(argSize < 2))
     {
         this->setCommand(command_e::CMD_GET_PORT_USED);
-        this->processIdentifier(args[1]);
-        returnStatus = true;
+        returnStatus = this->parseTargets(args);
     }
     else if (args[0] == cmdStr[CMD_KILL_PROCESS] && !(argSize < 2))
     {
         this->setCommand(command_e::CMD_KILL_PROCESS);
-        this->processIdentifier(args[1]);
-        returnStatus = true;
+        returnStatus = this->parseTargets(args);
     }
     else if (args[0] == cmdStr[CMD_RESTART_PROCESS] && !(argSize < 2))
     {
         this->setCommand(command_e::CMD_RESTART_PROCESS);
-        this->processIdentifier(args[1]);
+        returnStatus = this->parseTargets(args);
+    }
+    else if (args[0] == cmdStr[CMD_WHO_LISTENS] && !(argSize < 2))
+    {
+        int port = atoi(args[1].c_str());
+        if (port < 1 || port > 65535 || args[1].find_first_not_of("0123456789") != string::npos)
+        {
+            cerr << "Error: Port must be a number between 1 and 65535" << endl;
+            return false;
+        }
+        this->setCommand(command_e::CMD_WHO_LISTENS);
+        this->setPort(static_cast<uint16_t>(port));
+        returnStatus = true;
+    }
+    else if (args[0] == cmdStr[CMD_STATS])
+    {
+        this->setCommand(command_e::CMD_STATS);
+        returnStatus = true;
+    }
+    else if (args[0] == cmdStr[CMD_UNWATCH] && !(argSize < 2))
+    {
+        // "all" cancels every watch of this client
+        if (args[1] != "all")
+        {
+            if (args[1].empty() || args[1].find_first_not_of("0123456789") != string::npos ||
+                args[1].size() > 9 || stoul(args[1]) == 0)
+            {
+                cerr << "Error: unwatch needs the watch number shown as [#n], or all" << endl;
+                return false;
+            }
+            this->watchId = static_cast<uint32_t>(stoul(args[1]));
+        }
+        this->setCommand(command_e::CMD_UNWATCH);
         returnStatus = true;
     }
     else
@@ -340,6 +509,226 @@ bool MessageHeader::parseArgumentAndPrepareCommand(const vector<string> &args)
 }
 
 
+/*********************************************************************
+ * @fn      		  - parseTargets()
+ * @brief             - This function sets the processes a command applies to
+ *                      from args[1] onwards
+ * @param[in]         - const vector<string> &args
+ * @return            - bool
+ * @Note              - A single PID or name keeps the one-target encoding;
+ *                      several targets, PID ranges (300-350) and globs
+ *                      ('java*') are sent as a target set. Arguments
+ *                      starting with '-', such as kill's signal, are skipped
+ *********************************************************************/
+bool MessageHeader::parseTargets(const vector<string> &args)
+{
+    vector<string> found;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (!args[i].empty() && args[i][0] != '-')
+            found.push_back(args[i]);
+    }
+    if (found.empty())
+    {
+        printHelp();
+        return false;
+    }
+    if (found.size() > MAX_COMMAND_TARGETS)
+    {
+        cerr << "Error: At most " << MAX_COMMAND_TARGETS << " targets per command" << endl;
+        return false;
+    }
+
+    this->targets.clear();
+    bool single = found.size() == 1 && found[0].find_first_of("*?[") == string::npos &&
+                  !(isdigit(static_cast<unsigned char>(found[0][0])) && found[0].find('-') != string::npos);
+    if (single)
+    {
+        this->processIdentifier(found[0]);
+        return true;
+    }
+
+    this->setIsPid(false);
+    this->pidOrProccessNameVariant = 0;
+    this->targets = move(found);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - parseBatch()
+ * @brief             - This function parses "batch cmd args; cmd args; ..."
+ *                      into one message carrying all the commands
+ * @param[in]         - const vector<string> &args
+ * @return            - bool
+ * @Note              - Every command is validated as if entered alone; one
+ *                      invalid command rejects the whole batch
+ *********************************************************************/
+bool MessageHeader::parseBatch(const vector<string> &args)
+{
+    // ';' may stand alone or stick to the words around it
+    vector<vector<string>> commands(1);
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        string word;
+        for (char c : args[i])
+        {
+            if (c != ';')
+            {
+                word += c;
+                continue;
+            }
+            if (!word.empty())
+                commands.back().push_back(word);
+            word.clear();
+            commands.emplace_back();
+        }
+        if (!word.empty())
+            commands.back().push_back(word);
+    }
+
+    this->batch.clear();
+    for (const vector<string> &words : commands)
+    {
+        if (words.empty())
+            continue;
+        if (words[0] == "batch")
+        {
+            cerr << "Error: batch commands cannot be nested" << endl;
+            return false;
+        }
+        if (words[0] == "watch" || words[0] == cmdStr[CMD_UNWATCH])
+        {
+            cerr << "Error: watch and unwatch cannot be batched" << endl;
+            return false;
+        }
+        if (this->batch.size() == MAX_BATCH_COMMANDS)
+        {
+            cerr << "Error: A batch holds at most " << MAX_BATCH_COMMANDS << " commands" << endl;
+            return false;
+        }
+
+        MessageHeader item;
+        if (!item.parseArgumentAndPrepareCommand(words))
+        {
+            cerr << "Error: Invalid command in batch: " << words[0] << endl;
+            return false;
+        }
+        this->batch.push_back(move(item));
+    }
+    if (this->batch.empty())
+    {
+        cerr << "Error: batch needs at least one command, e.g. batch get-mem a; get-cpu-usage b" << endl;
+        return false;
+    }
+
+    this->setSelfInfo(appType_e::APPTYPE_CLIENT);
+    this->setMsgType(msgType_e::MSG_TYPE_BATCH);
+    this->setCommand(command_e::CMD_MAX);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - parseWatch()
+ * @brief             - This function parses "watch <command> <target>
+ *                      [--every <duration>] [--threshold <n>]" into a
+ *                      subscription to the command's result
+ * @param[in]         - const vector<string> &args
+ * @return            - bool
+ * @Note              - Only commands that read state can be watched. The
+ *                      threshold is in percentage points of one core for
+ *                      get-cpu-usage and in percent of VmRSS for get-mem;
+ *                      other commands are pushed whenever their output changes
+ *********************************************************************/
+bool MessageHeader::parseWatch(const vector<string> &args)
+{
+    uint32_t every = DEFAULT_WATCH_INTERVAL_MS;
+    double change = 0;
+    vector<string> words;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (args[i] == "--every")
+        {
+            if (i + 1 >= args.size() || !parseDuration(args[i + 1], every) ||
+                every < MIN_WATCH_INTERVAL_MS || every > MAX_WATCH_INTERVAL_MS)
+            {
+                cerr << "Error: --every needs a duration between " << MIN_WATCH_INTERVAL_MS << "ms and 1h" << endl;
+                return false;
+            }
+            i++;
+        }
+        else if (args[i] == "--threshold")
+        {
+            char *end = nullptr;
+            if (i + 1 < args.size())
+                change = strtod(args[i + 1].c_str(), &end);
+            if (i + 1 >= args.size() || end == args[i + 1].c_str() || *end != '\0' || !isfinite(change) ||
+                change < 0 || change > 1e6)
+            {
+                cerr << "Error: --threshold needs a non negative number" << endl;
+                return false;
+            }
+            i++;
+        }
+        else
+            words.push_back(args[i]);
+    }
+    if (words.empty() || words[0] == "watch" || words[0] == "batch")
+    {
+        cerr << "Error: Usage: watch <command> <target> [--every 500ms] [--threshold n]" << endl;
+        return false;
+    }
+    if (!this->parseArgumentAndPrepareCommand(words))
+        return false;
+
+    switch (this->command)
+    {
+        case CMD_GET_PROCESS:
+        case CMD_GET_MEMORY:
+        case CMD_GET_CPU_USAGE:
+        case CMD_GET_PORT_USED:
+        case CMD_WHO_LISTENS:
+            break;
+        default:
+            cerr << "Error: Only get-* and who-listens commands can be watched" << endl;
+            return false;
+    }
+
+    this->options |= CMD_OPT_WATCH;
+    this->intervalMs = every;
+    this->threshold = static_cast<uint32_t>(llround(change * 1000));
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - describe()
+ * @brief             - This function renders the command back as typed,
+ *                      e.g. "get-mem nginx"
+ * @param[in]         - none
+ * @return            - string
+ * @Note              - Used to label the results of a batch
+ *********************************************************************/
+string MessageHeader::describe()
+{
+    if (this->command >= CMD_MAX)
+        return "unknown command";
+
+    string text = cmdStr[this->command];
+    if (this->command == CMD_WHO_LISTENS)
+        text += " " + to_string(this->port);
+    else if (this->command == CMD_UNWATCH)
+        text += this->watchId ? " " + to_string(this->watchId) : string(" all");
+    else if (!this->targets.empty())
+    {
+        for (const string &target : this->targets)
+            text += " " + target;
+    }
+    else if (this->isPid)
+        text += " " + to_string(this->getProcessId());
+    else if (holds_alternative<array<char, MESSAGE_SIZE>>(this->pidOrProccessNameVariant))
+        text += " " + this->getProcessName();
+    return text;
+}
+
 /*********************************************************************
  * @fn      		  - getProcessName()
  * @brief             - This function used to get the process name entered by the user
@@ -350,6 +739,9 @@ bool MessageHeader::parseArgumentAndPrepareCommand(const vector<string> &args)
  *********************************************************************/
 string MessageHeader::getProcessName()
 {
+    // A command decoded from the wire may carry a PID or nothing instead
+    if (!holds_alternative<array<char, MESSAGE_SIZE>>(this->pidOrProccessNameVariant))
+        return string();
     const auto& charArray = get<array<char, MESSAGE_SIZE>>(this->pidOrProccessNameVariant);
     return string(charArray.data());
 }
@@ -364,10 +756,770 @@ string MessageHeader::getProcessName()
  *********************************************************************/
 int MessageHeader::getProcessId()
 {
+    if (!holds_alternative<int>(this->pidOrProccessNameVariant))
+        return 0;
     return get<int>(this->pidOrProccessNameVariant);
 }
 
+/* Helpers to append/read fixed width integers in network byte order */
+static void appendU16(string &out, uint16_t value)
+{
+    value = htons(value);
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void appendU32(string &out, uint32_t value)
+{
+    value = htonl(value);
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void appendU64(string &out, uint64_t value)
+{
+    appendU32(out, static_cast<uint32_t>(value >> 32));
+    appendU32(out, static_cast<uint32_t>(value));
+}
+
+static uint16_t readU16(const char *in)
+{
+    uint16_t value;
+    memcpy(&value, in, sizeof(value));
+    return ntohs(value);
+}
+
+static uint32_t readU32(const char *in)
+{
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return ntohl(value);
+}
+
+static uint64_t readU64(const char *in)
+{
+    return (static_cast<uint64_t>(readU32(in)) << 32) | readU32(in + 4);
+}
+
+/*********************************************************************
+ * @fn      		  - appendTlv()
+ * @brief             - This function appends one tag/length/value field
+ *                      to the payload
+ * @param[in]         - string &out, uint8_t tag, const string &value
+ * @return            - none
+ * @Note              - value is truncated to 64KB, the limit of the length field
+ *********************************************************************/
+static void appendTlv(string &out, uint8_t tag, const string &value)
+{
+    size_t len = min(value.size(), static_cast<size_t>(UINT16_MAX));
+    out.push_back(static_cast<char>(tag));
+    appendU16(out, static_cast<uint16_t>(len));
+    out.append(value, 0, len);
+}
+
+static void appendTlvU8(string &out, uint8_t tag, uint8_t value)
+{
+    appendTlv(out, tag, string(1, static_cast<char>(value)));
+}
+
+static void appendTlvU32(string &out, uint8_t tag, uint32_t value)
+{
+    string encoded;
+    appendU32(encoded, value);
+    appendTlv(out, tag, encoded);
+}
+
+static void appendTlvU64(string &out, uint8_t tag, uint64_t value)
+{
+    string encoded;
+    appendU64(encoded, value);
+    appendTlv(out, tag, encoded);
+}
+
+/*********************************************************************
+ * @fn      		  - forEachTlv()
+ * @brief             - This function walks the TLV fields of a payload and
+ *                      calls fn(tag, data, len) for each of them
+ * @param[in]         - const string &payload, Fn fn
+ * @return            - bool (false if the payload is malformed)
+ * @Note              -
+ *********************************************************************/
+template <typename Fn>
+static bool forEachTlv(const string &payload, Fn fn)
+{
+    size_t pos = 0;
+    while (pos < payload.size())
+    {
+        if (payload.size() - pos < 3)
+            return false;
+
+        uint8_t tag = static_cast<uint8_t>(payload[pos]);
+        uint16_t len = readU16(payload.data() + pos + 1);
+        pos += 3;
+
+        if (payload.size() - pos < len)
+            return false;
+
+        fn(tag, payload.data() + pos, len);
+        pos += len;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - cmdHasPID
+ * @brief             - This function tells whether a command acts on
+ *                      processes named by PID, name or targets
+ * @param[in]         - int receivedCommand
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool cmdHasPID(int receivedCommand)
+{
+    switch (receivedCommand)
+    {
+        case CMD_GET_MEMORY:
+        case CMD_GET_CPU_USAGE:
+        case CMD_GET_PORT_USED:
+        case CMD_KILL_PROCESS:
+        case CMD_RESTART_PROCESS:
+            return true;
+    }
+    return false;
+}
+
+/*********************************************************************
+ * @fn      		  - encodeCommand()
+ * @brief             - This function serialises the fields of a command
+ *                      into TLVs
+ * @param[in]         - none
+ * @return            - string
+ * @Note              - Payload of a command frame or of one batch item
+ *********************************************************************/
+string MessageHeader::encodeCommand()
+{
+    string payload;
+    appendTlvU8(payload, TLV_COMMAND, static_cast<uint8_t>(this->command));
+    if (this->isPid)
+        appendTlvU32(payload, TLV_PID, static_cast<uint32_t>(this->getProcessId()));
+    else if (holds_alternative<array<char, MESSAGE_SIZE>>(this->pidOrProccessNameVariant))
+        appendTlv(payload, TLV_NAME, this->getProcessName());
+    if (this->options)
+        appendTlvU32(payload, TLV_OPTIONS, this->options);
+    if (this->windowMs)
+        appendTlvU32(payload, TLV_WINDOW, this->windowMs);
+    if (this->port)
+        appendTlvU32(payload, TLV_PORT, this->port);
+    for (const string &target : this->targets)
+        appendTlv(payload, TLV_TARGET, target);
+    if (this->requestId)
+        appendTlvU32(payload, TLV_REQUEST_ID, this->requestId);
+    if (this->options & CMD_OPT_WATCH)
+    {
+        appendTlvU32(payload, TLV_INTERVAL, this->intervalMs);
+        appendTlvU32(payload, TLV_THRESHOLD, this->threshold);
+    }
+    if (this->command == CMD_UNWATCH)
+        appendTlvU32(payload, TLV_WATCH_ID, this->watchId);
+    if (this->options & CMD_OPT_DELTA)
+        appendTlvU64(payload, TLV_SINCE, this->since);
+    return payload;
+}
+
+/*********************************************************************
+ * @fn      		  - decodeCommand()
+ * @brief             - This function fills the command fields from TLVs
+ * @param[in]         - const string &payload
+ * @return            - bool (false if the payload is malformed)
+ * @Note              - A command taking processes without TLV_PID, TLV_NAME
+ *                      or TLV_TARGET is malformed
+ *********************************************************************/
+bool MessageHeader::decodeCommand(const string &payload)
+{
+    bool valid = forEachTlv(payload, [this](uint8_t tag, const char *data, uint16_t len)
+    {
+        if (tag == TLV_COMMAND && len == 1)
+            this->setCommand(static_cast<command_e>(static_cast<uint8_t>(data[0])));
+        else if (tag == TLV_PID && len == 4)
+        {
+            this->setIsPid(true);
+            this->setpidOrProccessName(static_cast<int>(readU32(data)), "");
+        }
+        else if (tag == TLV_NAME)
+        {
+            this->setIsPid(false);
+            this->setpidOrProccessName(-1, string(data, len));
+        }
+        else if (tag == TLV_OPTIONS && len == 4)
+            this->options = readU32(data);
+        else if (tag == TLV_WINDOW && len == 4)
+            this->windowMs = readU32(data);
+        else if (tag == TLV_PORT && len == 4)
+            this->port = static_cast<uint16_t>(readU32(data));
+        else if (tag == TLV_TARGET && len > 0 && this->targets.size() < MAX_COMMAND_TARGETS)
+            this->targets.emplace_back(data, len);
+        else if (tag == TLV_REQUEST_ID && len == 4)
+            this->requestId = readU32(data);
+        else if (tag == TLV_INTERVAL && len == 4)
+            this->intervalMs = readU32(data);
+        else if (tag == TLV_THRESHOLD && len == 4)
+            this->threshold = readU32(data);
+        else if (tag == TLV_WATCH_ID && len == 4)
+            this->watchId = readU32(data);
+        else if (tag == TLV_SINCE && len == 8)
+            this->since = readU64(data);
+    });
+
+    // Commands acting on processes must say which ones
+    bool named = this->isPid || !this->targets.empty() ||
+                 holds_alternative<array<char, MESSAGE_SIZE>>(this->pidOrProccessNameVariant);
+    return valid && (named || !cmdHasPID(this->command));
+}
+
+/*********************************************************************
+ * @fn      		  - encode()
+ * @brief             - This function serialises the message into a wire frame
+ *                      carrying only the fields relevant for its type
+ * @param[in]         - none
+ * @return            - string
+ * @Note              -
+ *********************************************************************/
+string MessageHeader::encode()
+{
+    string payload;
+    uint16_t flags = (this->selfInfo == APPTYPE_SERVER) ? FRAME_FLAG_FROM_SERVER : 0;
+
+    switch (this->msgType)
+    {
+        case MSG_TYPE_CMD:
+        {
+            payload = this->encodeCommand();
+            break;
+        }
+        case MSG_TYPE_BATCH:
+        {
+            for (MessageHeader &item : this->batch)
+                appendTlv(payload, TLV_BATCH_ITEM, item.encodeCommand());
+            if (this->requestId)
+                appendTlvU32(payload, TLV_REQUEST_ID, this->requestId);
+            break;
+        }
+        case MSG_TYPE_RESPONSE:
+        {
+            payload = this->response.msg;
+            break;
+        }
+        case MSG_TYPE_HELLO:
+        {
+            appendTlvU8(payload, TLV_VERSION, this->helloVersion);
+            appendTlvU32(payload, TLV_CAPABILITIES, this->helloCaps);
+            appendTlvU32(payload, TLV_MAX_FRAME, this->helloMaxFrame);
+            break;
+        }
+        default:
+            break;
+    }
+
+    return encodeFrame(this->msgType, flags, payload);
+}
+
+/*********************************************************************
+ * @fn      		  - decode()
+ * @brief             - This function fills the message from a received frame
+ * @param[in]         - const frameHeader_t &hdr, const string &payload
+ * @return            - bool (false if the frame is malformed)
+ * @Note              -
+ *********************************************************************/
+bool MessageHeader::decode(const frameHeader_t &hdr, const string &payload)
+{
+    if (hdr.type >= MSG_TYPE_MAX)
+        return false;
+
+    this->selfInfo = (hdr.flags & FRAME_FLAG_FROM_SERVER) ? APPTYPE_SERVER : APPTYPE_CLIENT;
+    this->msgType = static_cast<msgType_e>(hdr.type);
+    this->command = CMD_MAX;
+    this->isPid = false;
+    this->pidOrProccessNameVariant = 0;
+    this->options = 0;
+    this->windowMs = 0;
+    this->port = 0;
+    this->batch.clear();
+    this->targets.clear();
+    this->requestId = 0;
+    this->intervalMs = 0;
+    this->threshold = 0;
+    this->watchId = 0;
+    this->since = 0;
+    this->status = CMD_STATUS_OK;
+    this->response.msg.clear();
+
+    bool valid = true;
+    switch (this->msgType)
+    {
+        case MSG_TYPE_CMD:
+        {
+            valid = this->decodeCommand(payload);
+            break;
+        }
+        case MSG_TYPE_BATCH:
+        {
+            valid = forEachTlv(payload, [this, &valid](uint8_t tag, const char *data, uint16_t len)
+            {
+                if (tag == TLV_REQUEST_ID && len == 4)
+                    this->requestId = readU32(data);
+                if (tag != TLV_BATCH_ITEM)
+                    return;
+                MessageHeader item;
+                item.selfInfo = this->selfInfo;
+                item.msgType = MSG_TYPE_CMD;
+                if (!item.decodeCommand(string(data, len)) || this->batch.size() == MAX_BATCH_COMMANDS)
+                    valid = false;
+                else
+                    this->batch.push_back(move(item));
+            }) && valid;
+            break;
+        }
+        case MSG_TYPE_RESPONSE:
+        case MSG_TYPE_END_OF_RESPONSE:
+        {
+            size_t skip = 0;
+            if (hdr.flags & FRAME_FLAG_REQUEST_ID)
+            {
+                if (payload.size() < REQUEST_ID_SIZE)
+                    return false;
+                this->requestId = readU32(payload.data());
+                skip = REQUEST_ID_SIZE;
+            }
+            this->response.msg.assign(payload, skip, string::npos);
+            if (this->requestId && MSG_TYPE_END_OF_RESPONSE == this->msgType)
+            {
+                valid = forEachTlv(this->response.msg, [this](uint8_t tag, const char *data, uint16_t len)
+                {
+                    if (tag == TLV_STATUS && len == 1 && static_cast<uint8_t>(data[0]) <= CMD_STATUS_INVALID)
+                        this->status = static_cast<cmdStatus_e>(data[0]);
+                });
+                this->response.msg.clear();
+            }
+            break;
+        }
+        case MSG_TYPE_HELLO:
+        {
+            valid = forEachTlv(payload, [this](uint8_t tag, const char *data, uint16_t len)
+            {
+                if (tag == TLV_VERSION && len == 1)
+                    this->helloVersion = static_cast<uint8_t>(data[0]);
+                else if (tag == TLV_CAPABILITIES && len == 4)
+                    this->helloCaps = readU32(data);
+                else if (tag == TLV_MAX_FRAME && len == 4)
+                    this->helloMaxFrame = readU32(data);
+            });
+            break;
+        }
+        default:
+            break;
+    }
+    return valid;
+}
+
 /* In Destructor De-initialise variables of class */
 MessageHeader::~MessageHeader()
 {
 }
+
+/*********************************************************************
+ * @fn      		  - encodeFrameHeader()
+ * @brief             - This function writes the frame header into out in 
+ *                      network byte order
+ * @param[in]         - const frameHeader_t &hdr, uint8_t *out
+ * @return            - none
+ * @Note              - out must hold at least FRAME_HEADER_SIZE bytes
+ *********************************************************************/
+void encodeFrameHeader(const frameHeader_t &hdr, uint8_t *out)
+{
+    uint32_t magic = htonl(hdr.magic);
+    uint16_t flags = htons(hdr.flags);
+    uint32_t length = htonl(hdr.length);
+
+    memcpy(out, &magic, 4);
+    out[4] = hdr.version;
+    out[5] = hdr.type;
+    memcpy(out + 6, &flags, 2);
+    memcpy(out + 8, &length, 4);
+}
+
+/*********************************************************************
+ * @fn      		  - decodeFrameHeader()
+ * @brief             - This function reads and validates a frame header
+ * @param[in]         - const uint8_t *in, frameHeader_t &hdr
+ * @return            - bool (false on bad magic, version, type or length)
+ * @Note              -
+ *********************************************************************/
+bool decodeFrameHeader(const uint8_t *in, frameHeader_t &hdr)
+{
+    hdr.magic = readU32(reinterpret_cast<const char *>(in));
+    hdr.version = in[4];
+    hdr.type = in[5];
+    hdr.flags = readU16(reinterpret_cast<const char *>(in + 6));
+    hdr.length = readU32(reinterpret_cast<const char *>(in + 8));
+
+    return hdr.magic == PROTOCOL_MAGIC &&
+           hdr.version == PROTOCOL_VERSION &&
+           hdr.type < MSG_TYPE_MAX &&
+           hdr.length <= MAX_FRAME_PAYLOAD;
+}
+
+/*********************************************************************
+ * @fn      		  - encodeFrame()
+ * @brief             - This function builds a complete frame (header + payload)
+ * @param[in]         - msgType_e type, uint16_t flags, const string &payload
+ * @return            - string
+ * @Note              -
+ *********************************************************************/
+string encodeFrame(msgType_e type, uint16_t flags, const string &payload)
+{
+    frameHeader_t hdr = {PROTOCOL_MAGIC, PROTOCOL_VERSION, static_cast<uint8_t>(type),
+                         flags, static_cast<uint32_t>(payload.size())};
+
+    string frame(FRAME_HEADER_SIZE, '\0');
+    encodeFrameHeader(hdr, reinterpret_cast<uint8_t *>(&frame[0]));
+    frame += payload;
+    return frame;
+}
+
+/*********************************************************************
+ * @fn      		  - decodeFrame()
+ * @brief             - This function extracts one frame from a byte buffer
+ * @param[in]         - const char *buf, size_t len, frameHeader_t &hdr, string &payload
+ * @return            - long (bytes consumed, 0 if the frame is incomplete,
+ *                      -1 if the stream is corrupt)
+ * @Note              -
+ *********************************************************************/
+long decodeFrame(const char *buf, size_t len, frameHeader_t &hdr, string &payload)
+{
+    if (len < FRAME_HEADER_SIZE)
+        return 0;
+
+    if (!decodeFrameHeader(reinterpret_cast<const uint8_t *>(buf), hdr))
+        return -1;
+
+    if (len - FRAME_HEADER_SIZE < hdr.length)
+        return 0;
+
+    payload.assign(buf + FRAME_HEADER_SIZE, hdr.length);
+    return FRAME_HEADER_SIZE + hdr.length;
+}
+
+/*********************************************************************
+ * @fn      		  - sendAll()
+ * @brief             - This function writes the whole buffer to the socket,
+ *                      retrying on partial writes
+ * @param[in]         - int socket, const char *data, size_t len
+ * @return            - bool
+ * @Note              - MSG_NOSIGNAL so a closed peer does not raise SIGPIPE
+ *********************************************************************/
+bool sendAll(int socket, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(socket, data, len, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - recvAll()
+ * @brief             - This function reads exactly len bytes from the socket
+ * @param[in]         - int socket, char *data, size_t len
+ * @return            - bool (false on close, error or receive timeout)
+ * @Note              -
+ *********************************************************************/
+bool recvAll(int socket, char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t received = recv(socket, data, len, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        len -= received;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - sendIov()
+ * @brief             - This function performs a gathered write of all the
+ *                      buffers, retrying on partial writes
+ * @param[in]         - int socket, struct iovec *iov, size_t count
+ * @return            - bool
+ * @Note              - iov is modified while partial writes are consumed
+ *********************************************************************/
+bool sendIov(int socket, struct iovec *iov, size_t count)
+{
+    while (count > 0)
+    {
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = min(count, static_cast<size_t>(IOV_MAX));
+
+        ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        // Skip the buffers written completely, then trim the partial one
+        while (count > 0 && static_cast<size_t>(sent) >= iov->iov_len)
+        {
+            sent -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - sendFrame()
+ * @brief             - This function encodes and sends one frame
+ * @param[in]         - int socket, msgType_e type, uint16_t flags, const string &payload
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool sendFrame(int socket, msgType_e type, uint16_t flags, const string &payload)
+{
+    string frame = encodeFrame(type, flags, payload);
+    return sendAll(socket, frame.data(), frame.size());
+}
+
+/*********************************************************************
+ * @fn      		  - sendStream()
+ * @brief             - This function sends body as a sequence of response frames
+ *                      of at most frameSize bytes followed by the end of response
+ *                      frame, using gathered writes so the body is never copied
+ * @param[in]         - int socket, uint16_t flags, const string &body, size_t frameSize
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool sendStream(int socket, uint16_t flags, const string &body, size_t frameSize)
+{
+    size_t frames = (body.size() + frameSize - 1) / frameSize;
+    vector<uint8_t> headers((frames + 1) * FRAME_HEADER_SIZE);
+    vector<struct iovec> iov;
+    iov.reserve(frames * 2 + 1);
+
+    for (size_t i = 0; i < frames; i++)
+    {
+        size_t offset = i * frameSize;
+        size_t len = min(frameSize, body.size() - offset);
+        frameHeader_t hdr = {PROTOCOL_MAGIC, PROTOCOL_VERSION, MSG_TYPE_RESPONSE,
+                             flags, static_cast<uint32_t>(len)};
+
+        encodeFrameHeader(hdr, &headers[i * FRAME_HEADER_SIZE]);
+        iov.push_back({&headers[i * FRAME_HEADER_SIZE], FRAME_HEADER_SIZE});
+        iov.push_back({const_cast<char *>(body.data()) + offset, len});
+    }
+
+    frameHeader_t endHdr = {PROTOCOL_MAGIC, PROTOCOL_VERSION, MSG_TYPE_END_OF_RESPONSE, flags, 0};
+    encodeFrameHeader(endHdr, &headers[frames * FRAME_HEADER_SIZE]);
+    iov.push_back({&headers[frames * FRAME_HEADER_SIZE], FRAME_HEADER_SIZE});
+
+    return sendIov(socket, iov.data(), iov.size());
+}
+
+/*********************************************************************
+ * @fn      		  - appendStream()
+ * @brief             - This function appends body to out as a sequence of response
+ *                      frames of at most frameSize bytes followed by the end of
+ *                      response frame
+ * @param[in]         - string &out, uint16_t flags, const string &body, size_t frameSize,
+ *                      uint32_t requestId, cmdStatus_e status
+ * @return            - none
+ * @Note              - Used where frames are staged in a buffer (non-blocking sockets).
+ *                      A non zero requestId tags every frame with it; only
+ *                      tagged responses report the status
+ *********************************************************************/
+void appendStream(string &out, uint16_t flags, const string &body, size_t frameSize, uint32_t requestId,
+                  cmdStatus_e status)
+{
+    uint8_t rawHeader[FRAME_HEADER_SIZE];
+
+    if (requestId)
+    {
+        size_t chunk = frameSize - REQUEST_ID_SIZE;
+        for (size_t offset = 0; offset < body.size(); offset += chunk)
+            appendTaggedFrame(out, MSG_TYPE_RESPONSE, flags, requestId, body.data() + offset, min(chunk, body.size() - offset));
+        appendTaggedEnd(out, flags, requestId, status);
+        return;
+    }
+
+    for (size_t offset = 0; offset < body.size(); offset += frameSize)
+    {
+        size_t len = min(frameSize, body.size() - offset);
+        frameHeader_t hdr = {PROTOCOL_MAGIC, PROTOCOL_VERSION, MSG_TYPE_RESPONSE,
+                             flags, static_cast<uint32_t>(len)};
+
+        encodeFrameHeader(hdr, rawHeader);
+        out.append(reinterpret_cast<const char *>(rawHeader), FRAME_HEADER_SIZE);
+        out.append(body, offset, len);
+    }
+
+    frameHeader_t endHdr = {PROTOCOL_MAGIC, PROTOCOL_VERSION, MSG_TYPE_END_OF_RESPONSE, flags, 0};
+    encodeFrameHeader(endHdr, rawHeader);
+    out.append(reinterpret_cast<const char *>(rawHeader), FRAME_HEADER_SIZE);
+}
+
+/*********************************************************************
+ * @fn      		  - appendTaggedFrame()
+ * @brief             - This function appends one frame whose payload is the
+ *                      request ID followed by len bytes of data
+ * @param[in]         - string &out, msgType_e type, uint16_t flags,
+ *                      uint32_t requestId, const char *data, size_t len
+ * @return            - none
+ * @Note              - len must leave room for the ID within the frame size
+ *********************************************************************/
+void appendTaggedFrame(string &out, msgType_e type, uint16_t flags, uint32_t requestId, const char *data, size_t len)
+{
+    uint8_t rawHeader[FRAME_HEADER_SIZE];
+    frameHeader_t hdr = {PROTOCOL_MAGIC, PROTOCOL_VERSION, static_cast<uint8_t>(type),
+                         static_cast<uint16_t>(flags | FRAME_FLAG_REQUEST_ID),
+                         static_cast<uint32_t>(REQUEST_ID_SIZE + len)};
+
+    encodeFrameHeader(hdr, rawHeader);
+    out.append(reinterpret_cast<const char *>(rawHeader), FRAME_HEADER_SIZE);
+    appendU32(out, requestId);
+    if (len)
+        out.append(data, len);
+}
+
+/*********************************************************************
+ * @fn      		  - appendTaggedEnd()
+ * @brief             - This function appends the end of response frame of a
+ *                      tagged response
+ * @param[in]         - string &out, uint16_t flags, uint32_t requestId,
+ *                      cmdStatus_e status
+ * @return            - none
+ * @Note              - TLV_STATUS is left out for CMD_STATUS_OK
+ *********************************************************************/
+void appendTaggedEnd(string &out, uint16_t flags, uint32_t requestId, cmdStatus_e status)
+{
+    string fields;
+    if (status != CMD_STATUS_OK)
+        appendTlvU8(fields, TLV_STATUS, static_cast<uint8_t>(status));
+    appendTaggedFrame(out, MSG_TYPE_END_OF_RESPONSE, flags, requestId, fields.data(), fields.size());
+}
+
+/*********************************************************************
+ * @fn      		  - sendMessage()
+ * @brief             - This function encodes the message and sends it as one frame
+ * @param[in]         - int socket, MessageHeader &msg
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool sendMessage(int socket, MessageHeader &msg)
+{
+    string frame = msg.encode();
+    return sendAll(socket, frame.data(), frame.size());
+}
+
+/*********************************************************************
+ * @fn      		  - recvMessage()
+ * @brief             - This function receives one frame and decodes it into msg
+ * @param[in]         - int socket, MessageHeader &msg
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool recvMessage(int socket, MessageHeader &msg)
+{
+    uint8_t rawHeader[FRAME_HEADER_SIZE];
+    frameHeader_t hdr;
+
+    if (!recvAll(socket, reinterpret_cast<char *>(rawHeader), sizeof(rawHeader)) ||
+        !decodeFrameHeader(rawHeader, hdr))
+        return false;
+
+    string payload(hdr.length, '\0');
+    if (hdr.length > 0 && !recvAll(socket, &payload[0], hdr.length))
+        return false;
+
+    return msg.decode(hdr, payload);
+}
+
+/*********************************************************************
+ * @fn      		  - clientHandshake()
+ * @brief             - This function sends our hello and waits for the server's
+ *                      reply carrying the capabilities both sides support
+ * @param[in]         - int socket, session_t &session
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool clientHandshake(int socket, session_t &session)
+{
+    MessageHeader hello;
+    hello.MessageHello(APPTYPE_CLIENT, SUPPORTED_CAPS, MAX_FRAME_PAYLOAD);
+    if (!sendMessage(socket, hello))
+        return false;
+
+    MessageHeader reply;
+    if (!recvMessage(socket, reply) || reply.getMsgType() != MSG_TYPE_HELLO)
+        return false;
+
+    session.caps = reply.getHelloCapabilities() & SUPPORTED_CAPS;
+    session.maxFrameSize = reply.getHelloMaxFrame();
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - acceptHello()
+ * @brief             - This function validates the client's hello and prepares
+ *                      the reply with the intersection of both capability sets
+ *                      and the smaller of the two maximum frame sizes
+ * @param[in]         - MessageHeader &hello, uint32_t maxFrameSize,
+ *                      session_t &session, MessageHeader &reply
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool acceptHello(MessageHeader &hello, uint32_t maxFrameSize, session_t &session, MessageHeader &reply)
+{
+    if (hello.getMsgType() != MSG_TYPE_HELLO)
+        return false;
+
+    session.caps = hello.getHelloCapabilities() & SUPPORTED_CAPS;
+    session.maxFrameSize = max(static_cast<uint32_t>(MESSAGE_SIZE), min(maxFrameSize, hello.getHelloMaxFrame()));
+
+    reply.MessageHello(APPTYPE_SERVER, session.caps, session.maxFrameSize);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - serverHandshake()
+ * @brief             - This function waits for the client's hello and replies
+ *                      with the negotiated session parameters
+ * @param[in]         - int socket, uint32_t maxFrameSize, session_t &session
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool serverHandshake(int socket, uint32_t maxFrameSize, session_t &session)
+{
+    MessageHeader hello;
+    MessageHeader reply;
+    if (!recvMessage(socket, hello) || !acceptHello(hello, maxFrameSize, session, reply))
+        return false;
+
+    return sendMessage(socket, reply);
+}
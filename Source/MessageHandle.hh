@@ -8,6 +8,10 @@
 #include <unistd.h>
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
 #include "RemoteManagement.hh"
 
 #define		ENUM(ENUM, STRING)		ENUM,
@@ -20,6 +24,9 @@
     ARG(CMD_GET_PORT_USED,"get-ports-used")                             \
     ARG(CMD_KILL_PROCESS,"kill")                                        \
     ARG(CMD_RESTART_PROCESS,"restart-process")                          \
+    ARG(CMD_WHO_LISTENS,"who-listens")                                  \
+    ARG(CMD_UNWATCH,"unwatch")                                          \
+    ARG(CMD_STATS,"stats")                                              \
     ARG(CMD_HELP,"help")                                                \
     ARG(CMD_EXIT,"exit")                                                \
 
@@ -29,6 +36,8 @@
     ARG(MSG_TYPE_RESPONSE,"MSG_TYPE_RESPONSE")                          \
     ARG(MSG_TYPE_END_OF_RESPONSE,"MSG_TYPE_END_OF_RESPONSE")            \
     ARG(MSG_HEARTBEAT,"MSG_HEARTBEAT")                                  \
+    ARG(MSG_TYPE_HELLO,"MSG_TYPE_HELLO")                                \
+    ARG(MSG_TYPE_BATCH,"MSG_TYPE_BATCH")                                \
     ARG(MSG_INVALID,"")                                  \
 
 
@@ -44,13 +53,133 @@ typedef enum
     MSG_TYPE_MAX,
 } msgType_e;
 
+/*
+ * Wire frame layout (all integers in network byte order):
+ *
+ *   0      4        5     6       8        12
+ *   +------+--------+-----+-------+--------+-------------------+
+ *   | magic| version| type| flags | length | payload (length)  |
+ *   +------+--------+-----+-------+--------+-------------------+
+ *
+ * Command and hello payloads are a sequence of TLV fields
+ * (u8 tag, u16 length, value) so new fields can be added without
+ * breaking older peers; unknown tags are skipped on decode.
+ * A batch payload is a sequence of TLV_BATCH_ITEM fields, each holding
+ * the TLV fields of one command.
+ * Requests may carry a client chosen TLV_REQUEST_ID (when the server
+ * advertised CAP_REQUEST_ID); the response and end of response frames of
+ * such a request have FRAME_FLAG_REQUEST_ID set and their payload starts
+ * with the ID, so responses may complete out of order and interleave.
+ * A command with CMD_OPT_WATCH set (server advertised CAP_WATCH) is a
+ * subscription: the server answers it every TLV_INTERVAL ms, each update
+ * being a complete tagged response, until an unwatch command names its
+ * request ID in TLV_WATCH_ID or the connection closes.
+ * A get-process with CMD_OPT_DELTA (server advertised CAP_PROC_DELTA) names
+ * in TLV_SINCE the listing version the client holds, 0 for none, and is
+ * answered with only the entries changed since then; see execGetProcessDelta.
+ * The end of response frame of a tagged response that did not succeed
+ * carries TLV_STATUS after the ID (server advertised CAP_CMD_STATUS); no
+ * TLV means CMD_STATUS_OK.
+ */
+#define PROTOCOL_MAGIC          0x524D4754      /* "RMGT" */
+#define PROTOCOL_VERSION        1
+#define FRAME_HEADER_SIZE       12
+#define MAX_FRAME_PAYLOAD       (16 * 1024 * 1024)
+#define MAX_BATCH_COMMANDS      64
+#define MAX_COMMAND_TARGETS     1024
+#define DEFAULT_WATCH_INTERVAL_MS   1000
+#define MIN_WATCH_INTERVAL_MS       100
+#define MAX_WATCH_INTERVAL_MS       (60 * 60 * 1000)
+
+#define FRAME_FLAG_FROM_SERVER  0x0001
+#define FRAME_FLAG_REQUEST_ID   0x0002      /* payload starts with a u32 request ID */
+#define REQUEST_ID_SIZE         4
+
+typedef enum
+{
+    TLV_COMMAND = 1,
+    TLV_PID,
+    TLV_NAME,
+    TLV_VERSION,
+    TLV_CAPABILITIES,
+    TLV_MAX_FRAME,
+    TLV_OPTIONS,
+    TLV_WINDOW,
+    TLV_PORT,
+    TLV_BATCH_ITEM,
+    TLV_TARGET,             /* repeated; replaces TLV_PID/TLV_NAME for target sets */
+    TLV_REQUEST_ID,
+    TLV_INTERVAL,           /* watch period in ms */
+    TLV_THRESHOLD,          /* watch change threshold in thousandths */
+    TLV_WATCH_ID,           /* request ID of the watch to cancel, 0 for all */
+    TLV_SINCE,              /* u64 process listing version held by the client */
+    TLV_STATUS,             /* u8 cmdStatus_e of a tagged response */
+} tlvTag_e;
+
+/* Per-command option bits carried in TLV_OPTIONS */
+typedef enum
+{
+    CMD_OPT_FRESH = 1 << 0,     /* bypass the process table snapshot */
+    CMD_OPT_WATCH = 1 << 1,     /* subscribe to the command's result */
+    CMD_OPT_DELTA = 1 << 2,     /* get-process: changes since TLV_SINCE only */
+} cmdOption_e;
+
+typedef enum
+{
+    CAP_HEARTBEAT = 1 << 0,
+    CAP_REQUEST_ID = 1 << 1,    /* tagged, possibly out of order responses */
+    CAP_WATCH = 1 << 2,         /* server pushed subscriptions, needs CAP_REQUEST_ID */
+    CAP_PROC_DELTA = 1 << 3,    /* versioned get-process listing */
+    CAP_CMD_STATUS = 1 << 4,    /* tagged responses report a cmdStatus_e */
+} capability_e;
+
+#define SUPPORTED_CAPS  (CAP_HEARTBEAT | CAP_REQUEST_ID | CAP_WATCH | CAP_PROC_DELTA | CAP_CMD_STATUS)
+
+/* Outcome of one command, reported per command in batch responses and in
+ * the end of response frame of tagged responses */
+typedef enum
+{
+    CMD_STATUS_OK,
+    CMD_STATUS_NOT_FOUND,   /* no process matched the name */
+    CMD_STATUS_INVALID,
+} cmdStatus_e;
+
+extern const char *const cmdStatusStr[];
+
+/*
+ * Result lines of get-mem and get-cpu-usage holding the value of a PID
+ * (metricList_t on the server). The fanout client reads them back to
+ * aggregate across hosts, so each line and its scan format live together
+ * and must be changed together.
+ */
+#define MEM_RSS_LINE_FMT        "Physical Memory (VmRSS): %ld KB (%f MB)\n"
+#define MEM_RSS_SCAN_FMT        "Physical Memory (VmRSS): %lf KB"
+#define CPU_USAGE_LINE_FMT      "CPU usage for PID %d: %.2f%% of one core (%.2f%% of %d CPU(s)) over %.1f s\n"
+#define CPU_USAGE_SCAN_FMT      "CPU usage for PID %d: %lf%%"
+
+typedef struct
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+    uint32_t length;
+} frameHeader_t;
+
 typedef struct
 {
     int socket;
     int sequenceNum;
-    char msg[MESSAGE_SIZE+1];
+    string msg;
 } response_t;
 
+/* Parameters agreed with the peer during the hello exchange */
+typedef struct
+{
+    uint32_t caps;
+    uint32_t maxFrameSize;
+} session_t;
+
 struct MessageHeader
 {
 private:
@@ -61,6 +190,26 @@ private:
     bool isPid;
     variant<int, array<char, MESSAGE_SIZE>> pidOrProccessNameVariant;
     response_t response;
+    uint8_t helloVersion;
+    uint32_t helloCaps;
+    uint32_t helloMaxFrame;
+    uint32_t options;
+    uint32_t windowMs;
+    uint16_t port;
+    vector<MessageHeader> batch;
+    vector<string> targets;
+    uint32_t requestId;
+    uint32_t intervalMs;
+    uint32_t threshold;
+    uint32_t watchId;
+    uint64_t since;
+    cmdStatus_e status;
+
+    string encodeCommand();
+    bool decodeCommand(const string &payload);
+    bool parseBatch(const vector<string> &args);
+    bool parseTargets(const vector<string> &args);
+    bool parseWatch(const vector<string> &args);
 
 public:
     MessageHeader();
@@ -78,6 +227,22 @@ public:
     inline int getSocketIdToSendResponse() { return this->response.socket; }
     inline msgType_e getMsgType() { return this->msgType; }
     inline command_e getCommand() { return this->command; }
+    inline uint32_t getOptions() { return this->options; }
+    inline void setOptions(uint32_t iOptions) { this->options = iOptions; }
+    inline uint32_t getWindowMs() { return this->windowMs; }
+    inline void setWindowMs(uint32_t iWindowMs) { this->windowMs = iWindowMs; }
+    inline uint16_t getPort() { return this->port; }
+    inline void setPort(uint16_t iPort) { this->port = iPort; }
+    inline vector<MessageHeader> &getBatch() { return this->batch; }
+    inline const vector<string> &getTargets() { return this->targets; }
+    inline uint32_t getRequestId() { return this->requestId; }
+    inline void setRequestId(uint32_t iRequestId) { this->requestId = iRequestId; }
+    inline uint32_t getIntervalMs() { return this->intervalMs; }
+    inline uint32_t getThreshold() { return this->threshold; }
+    inline uint32_t getWatchId() { return this->watchId; }
+    inline uint64_t getSince() { return this->since; }
+    inline void setSince(uint64_t iSince) { this->since = iSince; }
+    string describe();
     bool checkIsPid();
 
     void printHeader();
@@ -85,10 +250,39 @@ public:
     void printHelp();
 
     void MessageHeartBeat(appType_e app);
+    void MessageHello(appType_e app, uint32_t capabilities, uint32_t maxFrameSize);
+    uint32_t getHelloCapabilities();
+    inline uint32_t getHelloMaxFrame() { return this->helloMaxFrame; }
+    inline const string &getResponseMsg() { return this->response.msg; }
+    inline cmdStatus_e getStatus() { return this->status; }
+
+    string encode();
+    bool decode(const frameHeader_t &hdr, const string &payload);
     string getProcessName();
     int getProcessId();
 
     ~MessageHeader();
 };
 
+bool parseDuration(const string &text, uint32_t &ms);
+bool cmdHasPID(int receivedCommand);
+void encodeFrameHeader(const frameHeader_t &hdr, uint8_t *out);
+bool decodeFrameHeader(const uint8_t *in, frameHeader_t &hdr);
+string encodeFrame(msgType_e type, uint16_t flags, const string &payload);
+long decodeFrame(const char *buf, size_t len, frameHeader_t &hdr, string &payload);
+bool sendAll(int socket, const char *data, size_t len);
+bool recvAll(int socket, char *data, size_t len);
+bool sendIov(int socket, struct iovec *iov, size_t count);
+bool sendFrame(int socket, msgType_e type, uint16_t flags, const string &payload);
+bool sendStream(int socket, uint16_t flags, const string &body, size_t frameSize);
+void appendStream(string &out, uint16_t flags, const string &body, size_t frameSize, uint32_t requestId = 0,
+                  cmdStatus_e status = CMD_STATUS_OK);
+void appendTaggedFrame(string &out, msgType_e type, uint16_t flags, uint32_t requestId, const char *data, size_t len);
+void appendTaggedEnd(string &out, uint16_t flags, uint32_t requestId, cmdStatus_e status);
+bool sendMessage(int socket, MessageHeader &msg);
+bool recvMessage(int socket, MessageHeader &msg);
+bool clientHandshake(int socket, session_t &session);
+bool acceptHello(MessageHeader &hello, uint32_t maxFrameSize, session_t &session, MessageHeader &reply);
+bool serverHandshake(int socket, uint32_t maxFrameSize, session_t &session);
+
 #endif
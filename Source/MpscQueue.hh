@@ -0,0 +1,257 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <cstdint>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+/*
+ * Bounded lock-free multi-producer/single-consumer ring queue.
+ *
+ * Each cell carries a sequence number telling whose turn it is: producers
+ * claim a slot with one CAS on enqueuePos and publish it by bumping the
+ * cell's sequence, the single consumer reads cells in order without any
+ * atomic read-modify-write. Producers never take a lock while there is
+ * room in the ring; pushOrSpill() parks items in a locked spill list while
+ * the ring is full, for producers that must neither block nor drop.
+ *
+ * The consumer may sleep on an eventfd when the queue is empty. A producer
+ * only writes the eventfd when the consumer announced it is about to sleep,
+ * so a busy queue costs no syscalls. The fd can also be watched by epoll
+ * (prepareWait() / finishWait() around the wait).
+ */
+template <typename T>
+class MpscQueue
+{
+private:
+    typedef struct
+    {
+        atomic<size_t> sequence;
+        T data;
+    } cell_t;
+
+    unique_ptr<cell_t[]> cells;
+    size_t mask;
+    int wakeFd;
+    alignas(64) atomic<size_t> enqueuePos;
+    alignas(64) atomic<bool> sleeping;
+    alignas(64) atomic<size_t> dequeuePos;     /* written by the consumer only */
+    alignas(64) atomic<bool> spilling;         /* spill holds items */
+    mutex spillMtx;
+    deque<T> spill;
+
+    /* Consumer side: next item of the ring */
+    bool popRing(T &value)
+    {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        cell_t *cell = &cells[pos & mask];
+        size_t seq = cell->sequence.load(memory_order_acquire);
+
+        if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0)
+            return false;
+
+        value = move(cell->data);
+        cell->sequence.store(pos + mask + 1, memory_order_release);
+        dequeuePos.store(pos + 1, memory_order_relaxed);
+        return true;
+    }
+
+public:
+    /* capacity is rounded up to a power of two */
+    explicit MpscQueue(size_t capacity) : enqueuePos(0), sleeping(false), dequeuePos(0), spilling(false)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        cells.reset(new cell_t[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, memory_order_relaxed);
+
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    ~MpscQueue()
+    {
+        if (wakeFd >= 0)
+            close(wakeFd);
+    }
+
+    /* Producer side: false when the queue is full, value is then left untouched */
+    bool tryPush(T &&value)
+    {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        cell_t *cell;
+
+        while (true)
+        {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+
+        cell->data = move(value);
+        cell->sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    /* Producer side: push and wake the consumer if it is asleep */
+    bool push(T &&value)
+    {
+        if (!tryPush(move(value)))
+            return false;
+
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleeping.exchange(false))
+            wake();
+        return true;
+    }
+
+    /*
+     * Producer side: push that never fails. While the ring is full, and
+     * until the consumer has taken everything parked, items go to the spill
+     * list so they still come out in order. Returns the number of items
+     * parked, 0 when the item went to the ring.
+     */
+    size_t pushOrSpill(T &&value)
+    {
+        if (!spilling.load(memory_order_acquire) && push(move(value)))
+            return 0;
+
+        size_t parked;
+        {
+            lock_guard<mutex> guard(spillMtx);
+            spill.push_back(move(value));
+            parked = spill.size();
+            spilling.store(true, memory_order_release);
+        }
+        // Same handshake as push(): prepareWait() sees spilling or we see sleeping
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleeping.exchange(false))
+            wake();
+        return parked;
+    }
+
+    /* Consumer side only: the ring first, then what was parked after it filled up */
+    bool tryPop(T &value)
+    {
+        if (popRing(value))
+            return true;
+        if (!spilling.load(memory_order_acquire))
+            return false;
+        // A slot claimed before the spill started may still be unpublished
+        if (enqueuePos.load(memory_order_acquire) != dequeuePos.load(memory_order_relaxed))
+            return false;
+
+        lock_guard<mutex> guard(spillMtx);
+        if (spill.empty())
+            return false;
+        value = move(spill.front());
+        spill.pop_front();
+        if (spill.empty())
+            spilling.store(false, memory_order_release);
+        return true;
+    }
+
+    /* Consumer side only */
+    bool empty()
+    {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        return cells[pos & mask].sequence.load(memory_order_acquire) != pos + 1 &&
+               !spilling.load(memory_order_acquire);
+    }
+
+    /* Approximate, may be called from any thread */
+    size_t size()
+    {
+        size_t tail = dequeuePos.load(memory_order_relaxed);
+        size_t head = enqueuePos.load(memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    inline size_t capacity() { return mask + 1; }
+    inline int getWakeFd() { return wakeFd; }
+
+    /* Unconditionally wake the consumer (e.g. to tell it to shut down) */
+    void wake()
+    {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    /*
+     * Consumer side: announce that we are about to sleep on getWakeFd().
+     * Returns false if items arrived meanwhile and the consumer must not sleep.
+     */
+    bool prepareWait()
+    {
+        sleeping.store(true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!empty())
+        {
+            sleeping.store(false);
+            return false;
+        }
+        return true;
+    }
+
+    /* Consumer side: called after waking up from getWakeFd() */
+    void finishWait()
+    {
+        uint64_t counter;
+        ssize_t ignored = read(wakeFd, &counter, sizeof(counter));
+        (void)ignored;
+        sleeping.store(false);
+    }
+
+    /* Consumer side: woke up for another reason, producers need not signal */
+    void cancelWait()
+    {
+        sleeping.store(false, memory_order_relaxed);
+    }
+
+    /* Consumer side: pop, sleeping while the queue is empty; false on wake() with nothing queued */
+    bool popWait(T &value)
+    {
+        if (tryPop(value))
+            return true;
+
+        if (prepareWait())
+        {
+            struct pollfd pfd = {wakeFd, POLLIN, 0};
+            while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+                ;
+            finishWait();
+        }
+        return tryPop(value);
+    }
+};
+
+#endif
@@ -3,6 +3,8 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <poll.h>
+#include <fstream>
 #include <thread>
 #include "NetworkSettings.hh"
 #include "RemoteManagement.hh"
@@ -10,23 +12,35 @@
 #include "MessageHandle.hh"
 #include "ExecuteCommands.hh"
 #include "NetworkValidator.hh"
+#include "Reactor.hh"
+#include "WorkerPool.hh"
+#include "Connection.hh"
+#include "LineEditor.hh"
+#include "ScriptRunner.hh"
+#include "ProcessTable.hh"
+#include "CpuSampler.hh"
+#include "HexDecode.hh"
+#include "WatchHub.hh"
+#include "ServerStats.hh"
 
 appType_e appType;
-extern deque<MessageHeader> responseDeque;
-extern deque<MessageHeader> requestDeque;
+serverConfig_t serverConfig = {DEFAULT_FRAME_SIZE, false, DEFAULT_IO_THREADS, DEFAULT_WORKERS, DEFAULT_QUEUE_DEPTH,
+                               DEFAULT_SNAPSHOT_INTERVAL_MS, false, false,
+                               DEFAULT_SCAN_THREADS, DEFAULT_PORT, 0};
+WorkerPool *workerPool = nullptr;
 extern History commandHistory;
 extern int history_index;
 
 
 /* In Constructor initialise variables of class */
-NetworkSettings::NetworkSettings() : sock(0)
+NetworkSettings::NetworkSettings() : sock(0), session{0, MESSAGE_SIZE}
 {
 }
 
 /*********************************************************************
  * @fn      		  - handleClient
- * @brief             - This function handles the receiving data from the client and
- *                      sends a response
+ * @brief             - This function handles the receiving data from the client;
+ *                      responses are sent by the connection's own writer thread
  * @param[in]         - int clientSocket
  * @return            - None
  * @Note              -
@@ -36,22 +50,59 @@ void NetworkSettings::handleClient(int clientSocket)
     MessageHeader incomingMessage;
     NetworkValidator validator(clientSocket);
     validator.initHeartBeatTimer();
+    session_t session;
 
+    if (!serverHandshake(clientSocket, serverConfig.maxFrameSize, session))
+    {
+#ifdef DEBUG
+        cerr << "Handshake failed with client " << clientSocket << endl;
+#endif
+        close(clientSocket);
+        return;
+    }
+
+    auto conn = make_shared<Connection>(clientSocket, session);
+    thread writer(&Connection::writerLoop, conn);
+    serverStats.connectionOpened();
+
+    uint8_t rawHeader[FRAME_HEADER_SIZE];
+    frameHeader_t hdr;
+    string payload;
     while (true)
     {
-        int bytesReceived = recv(clientSocket, &incomingMessage, sizeof(incomingMessage), 0);
-        // Check for timeout or error
-        if (bytesReceived <= 0) {  
+        // A client that does not read its responses stops being read
+        conn->waitForRoom();
+
+        // Waiting for the next header is idle time; receive counts from its arrival
+        bool received = recvAll(clientSocket, reinterpret_cast<char *>(rawHeader), sizeof(rawHeader)) &&
+                        decodeFrameHeader(rawHeader, hdr);
+        uint64_t start = statNow();
+        if (received)
+        {
+            payload.assign(hdr.length, '\0');
+            received = hdr.length == 0 || recvAll(clientSocket, &payload[0], hdr.length);
+        }
+        uint64_t parseStart = statNow();
+        // Check for timeout, error or a malformed frame
+        if (!received || !incomingMessage.decode(hdr, payload)) {
 #ifdef DEBUG
             cerr << "Connection Close by Client\n";
 #endif
+            serverStats.connectionClosed();
+            watchHub.dropClient(conn->getId());
+            conn->shutdownConn();
+            writer.join();
             close(clientSocket);  // Close client socket
             return;  // Exit the function
         }
+        serverStats.record(STAT_ROW_IO, STAT_PHASE_RECEIVE, parseStart - start);
+        serverStats.record(statRow(incomingMessage), STAT_PHASE_PARSE, statNow() - parseStart);
+        serverStats.count(STAT_FRAMES_RECEIVED);
+        serverStats.count(STAT_BYTES_RECEIVED, FRAME_HEADER_SIZE + hdr.length);
 #ifdef DEBUG
         incomingMessage.printHeader();
 #endif
-        executeCmd(clientSocket, incomingMessage);
+        executeCmd(conn, incomingMessage);
     }
     
 }
@@ -86,7 +137,7 @@ bool NetworkSettings::initializeAsServer()
 
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(serverConfig.port);
 
     if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0)
     {
@@ -104,16 +155,17 @@ bool NetworkSettings::initializeAsServer()
         return false;
     }
 #ifdef DEBUG
-    cout << "Server listening on port " << PORT << endl;
+    cout << "Server listening on port " << serverConfig.port << endl;
 #endif
     return true;
 }
 
 /*********************************************************************
- * @fn      		  - initializeAsServer
+ * @fn      		  - runServer
  * @brief             - This function accepts all the client conne ction
- *                      and runs a new thread for each of them and stores
- *                      thread details in clientThreads vector
+ *                      and runs a new detached thread for each of them, or hands the
+ *                      listening socket to the epoll reactor in reactor mode.
+ *                      In both modes commands are executed on the worker pool
  * @param[in]         - none
  * @return            - none
  * @Note              -
@@ -121,6 +173,24 @@ bool NetworkSettings::initializeAsServer()
 void NetworkSettings::runServer()
 {
     int addrlen = sizeof(address);
+    WorkerPool pool(serverConfig.workers, serverConfig.queueDepth);
+    workerPool = &pool;
+    processTable.start(serverConfig.snapshotIntervalMs, serverConfig.procEvents, serverConfig.scanThreads);
+    cpuSampler.start();
+    watchHub.start();
+    if (serverConfig.metricsPort)
+        serverStats.startEndpoint(serverConfig.metricsPort);
+#ifdef DEBUG
+    cout << "Decoding /proc/net addresses with the " << hexDecoderName(1) << " kernel for IPv4, "
+         << hexDecoderName(HEX_MAX_WORDS) << " for IPv6" << endl;
+#endif
+
+    if (serverConfig.reactor)
+    {
+        Reactor reactor(sock, serverConfig.ioThreads, pool);
+        reactor.run();
+        return;
+    }
 
     while (true)
     {
@@ -135,13 +205,9 @@ void NetworkSettings::runServer()
 #ifdef DEBUG
         cout << "New client connected: " << clientSocket << endl;
 #endif
-        // NOTE: emplace_back constructs the new element in place using the arguments provided. This avoids the extra copy or move operation required when using push_back.
-        clientThreads.emplace_back(&NetworkSettings::handleClient, this, clientSocket);
-        
-        thread sendResponseTh(sendResponse);
-        // To run thread in bqckground
-        sendResponseTh.detach();
-
+        // To run thread in bqckground; it cleans up after itself when the client leaves
+        thread clientTh(&NetworkSettings::handleClient, this, clientSocket);
+        clientTh.detach();
    }
 }
 
@@ -150,11 +216,11 @@ void NetworkSettings::runServer()
  * @brief             - This function initialise the application in
  *                      client mode with configured parameter and
  *                      tries to connect with server based on given serverIP
- * @param[in]         - const char *serverIP
+ * @param[in]         - const char *serverIP, uint16_t port
  * @return            - bool
  * @Note              -
  *********************************************************************/
-bool NetworkSettings::initializeAsClient(const char *serverIP)
+bool NetworkSettings::initializeAsClient(const char *serverIP, uint16_t port)
 {
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
@@ -163,7 +229,7 @@ bool NetworkSettings::initializeAsClient(const char *serverIP)
     }
 
     address.sin_family = AF_INET;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
 
     if (inet_pton(AF_INET, serverIP, &address.sin_addr) <= 0)
     {
@@ -177,91 +243,252 @@ bool NetworkSettings::initializeAsClient(const char *serverIP)
         return false;
     }
 
-    cout << "Connected to server" << endl;
-    // Set up signal handlers for SIGINT and SIGTERM
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGTSTP, signal_handler);
+    // Bound the wait for the server's hello, then restore blocking receives
+    struct timeval timeout = {HEARTBEAT_TIMEOUT, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (!clientHandshake(sock, session))
+    {
+        cerr << "Protocol handshake failed" << endl;
+        return false;
+    }
+    timeout = {0, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
     history_index = commandHistory.size();
     return true;
 }
 
+/*********************************************************************
+ * @fn      		  - submitCommand
+ * @brief             - This function parses a line typed by the user and
+ *                      sends the command to server
+ * @param[in]         - const string &messageStr
+ * @return            - bool (false when the user asked to exit)
+ * @Note              - Sent straight from the event loop; the answer is
+ *                      printed when it arrives
+ *********************************************************************/
+bool NetworkSettings::submitCommand(const string &messageStr)
+{
+    MessageHeader request;
+
+    // Check if input exceeds maximum allowed length
+    if (messageStr.length() >= MAX_INPUT_SIZE - 1)
+    {
+        cerr << "Error: Command line too long" << endl;
+        return true;
+    }
+
+    // Parse input into arguments
+    vector<string> args = parse_input(messageStr);
+
+    // Skip empty input
+    if (args.empty())
+    {
+        return true;
+    }
+
+    add_to_history(messageStr);
+
+    if (args[0] == "exit")
+    {
+        return false;
+    }
+
+    // Parse Input str to send data to server
+    if (!request.parseArgumentAndPrepareCommand(args))
+    {
+        return true;
+    }
+
+    bool watching = request.getOptions() & CMD_OPT_WATCH;
+    if (watching && !(session.caps & CAP_WATCH))
+    {
+        cerr << "Error: The server does not support watch" << endl;
+        return true;
+    }
+    if (request.getCommand() == CMD_UNWATCH)
+        forgetRequests(request.getWatchId());
+    // get-process only asks for the changes to the listing it holds
+    requestKind_e kind = watching ? REQUEST_WATCH : REQUEST_ONCE;
+    if (!watching && request.getMsgType() == MSG_TYPE_CMD && request.getCommand() == CMD_GET_PROCESS &&
+        (session.caps & CAP_REQUEST_ID) && (session.caps & CAP_PROC_DELTA))
+    {
+        request.setOptions(request.getOptions() | CMD_OPT_DELTA);
+        request.setSince(heldListingVersion());
+        kind = REQUEST_LISTING;
+    }
+    if (session.caps & CAP_REQUEST_ID)
+        request.setRequestId(trackRequest(messageStr, kind));
+    if (!sendMessage(sock, request))
+    {
+        cerr << "Error: Failed to send request" << endl;
+        if (request.getRequestId())
+            forgetRequests(request.getRequestId());
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - receiveResponses
+ * @brief             - This function reads what the server sent and prints
+ *                      every response it completes
+ * @param[in]         - LineEditor &editor
+ * @return            - bool (false once the connection is closed or corrupt)
+ * @Note              - Bytes of a frame not fully received yet are kept in
+ *                      rxBuf for the next call
+ *********************************************************************/
+bool NetworkSettings::receiveResponses(LineEditor &editor)
+{
+    char buffer[BUFFER_SIZE * 16];
+    ssize_t len = recv(sock, buffer, sizeof(buffer), 0);
+    if (len < 0 && errno == EINTR)
+        return true;
+    if (len <= 0)
+        return false;
+    rxBuf.append(buffer, len);
+
+    size_t offset = 0;
+    frameHeader_t hdr;
+    string payload;
+    string text;
+    while (true)
+    {
+        long consumed = decodeFrame(rxBuf.data() + offset, rxBuf.size() - offset, hdr, payload);
+        if (consumed < 0)
+            return false;
+        if (consumed == 0)
+            break;
+        offset += consumed;
+
+        MessageHeader incomingMessage;
+        if (!incomingMessage.decode(hdr, payload))
+            return false;
+        if (handleResponse(incomingMessage, text))
+            editor.printAbove(text);
+    }
+    rxBuf.erase(0, offset);
+    return true;
+}
+
 /*********************************************************************
  * @fn      		  - runClient
  * @brief             - This function handles the communication part on
  *                      client side
  * @param[in]         - none
  * @return            - none
- * @Note              -
+ * @Note              - One thread waits in poll() on the keyboard, the socket
+ *                      and the heartbeat timer, so an idle client uses no CPU
+ *                      and responses show up while a command is being typed
  *********************************************************************/
 void NetworkSettings::runClient()
 {
-    MessageHeader incomingMessage;
-    MessageHeader outgoingMessage;
-
-    thread sendRequestTh(sendRequest,sock);
-    thread receiveResponseTh(receiveResponse, sock);
+    cout << "Connected to server" << endl;
+    // Set up signal handlers for SIGINT and SIGTERM
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGTSTP, signal_handler);
 
-    // To run thread in bqckground
+    LineEditor editor;
     NetworkValidator validator(sock);
-    validator.StartValidator();
 
-    while (true)
-    {
-        cout << CMDPROMPT;
-        cout.flush();
+    struct pollfd fds[3];
+    fds[0] = {STDIN_FILENO, POLLIN, 0};
+    fds[1] = {sock, POLLIN, 0};
+    fds[2] = {validator.StartValidator(), POLLIN, 0};
 
-        // Read user input
-        string messageStr = read_input();
+    editor.enableRawMode();
+    editor.showPrompt();
 
-        // Check if input exceeds maximum allowed length
-        if (messageStr.length() >= MAX_INPUT_SIZE - 1)
+    bool running = true;
+    while (running)
+    {
+        if (poll(fds, 3, -1) < 0)
         {
-            cerr << "Error: Command line too long" << endl;
+            if (errno != EINTR)
+                break;
+            if (interruptPending)
+            {
+                interruptPending = 0;
+                editor.discardInput();
+            }
             continue;
         }
 
-        // Parse input into arguments
-        vector<string> args = parse_input(messageStr);
-
-        // Skip empty input
-        if (args.empty())
+        if (fds[1].revents)
         {
-            continue;
+            if (!receiveResponses(editor))
+            {
+                editor.restoreMode();
+                cerr << "\nConnection closed by server" << endl;
+                exit(EXIT_FAILURE);
+            }
         }
 
-        add_to_history(messageStr);
+        if (fds[2].revents & POLLIN)
+            validator.SendHeartbeat();
 
-        if (args[0] == "exit")
-        {
-            validator.StopValidator();
-            close(sock);
-            exit(atexit(exitFun));
-            break;
-        }
-        else
+        if (fds[0].revents)
         {
-            // Parse Input str to send data to server
-            if (outgoingMessage.parseArgumentAndPrepareCommand(args))
+            char buffer[BUFFER_SIZE];
+            ssize_t len = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (len < 0 && errno == EINTR)
+                continue;
+            // End of input works like exit
+            running = len > 0;
+            for (ssize_t i = 0; i < len && running; i++)
             {
-                requestDeque.emplace_back(outgoingMessage);
+                string line;
+                if (!editor.feed(buffer[i], line))
+                    continue;
+                running = submitCommand(line);
+                if (running)
+                    editor.showPrompt();
             }
         }
     }
-    sendRequestTh.join();
-    receiveResponseTh.join();
 
+    editor.restoreMode();
+    validator.StopValidator();
+    close(sock);
+    exit(atexit(exitFun));
 }
 
-/* In Destructor De-initialise variables of class */
-NetworkSettings::~NetworkSettings()
+/*********************************************************************
+ * @fn      		  - runScript
+ * @brief             - This function runs the commands of a script file, or
+ *                      of stdin when path is null, without a prompt
+ * @param[in]         - const char *path
+ * @return            - int (SCRIPT_EXIT_* code to exit with)
+ * @Note              - Only results go to stdout, so they can be parsed
+ *********************************************************************/
+int NetworkSettings::runScript(const char *path)
 {
-    for (auto &thread : clientThreads)
+    ScriptRunner runner(sock, session);
+    bool loaded;
+    if (path)
+    {
+        ifstream file(path);
+        if (!file)
+        {
+            cerr << "Cannot open script " << path << endl;
+            return SCRIPT_EXIT_ERROR;
+        }
+        loaded = runner.load(file);
+    }
+    else
+        loaded = runner.load(cin);
+    if (!loaded)
     {
-        if (thread.joinable())
-            thread.join();
+        cerr << "Cannot read script" << endl;
+        return SCRIPT_EXIT_ERROR;
     }
 
+    return runner.run();
+}
+
+/* In Destructor De-initialise variables of class */
+NetworkSettings::~NetworkSettings()
+{
     close(sock);
 }
 
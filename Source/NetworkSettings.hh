@@ -4,6 +4,9 @@
 #include <vector>
 #include <thread>
 #include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+
+class LineEditor;
 
 #define CMDPROMPT "RemoteManagement> "
 
@@ -11,18 +14,21 @@ class NetworkSettings
 {
 private:
     int sock;
+    session_t session;
     struct sockaddr_in address;
-    static const int PORT = 8080;
     static const int BUFFER_SIZE = 1024;
-    vector<thread> clientThreads;
+    string rxBuf;               /* client: bytes of a partly received frame */
     void handleClient(int clientSocket);
+    bool submitCommand(const string &messageStr);
+    bool receiveResponses(LineEditor &editor);
 
 public:
     NetworkSettings();
     bool initializeAsServer();
-    bool initializeAsClient(const char *serverIP);
+    bool initializeAsClient(const char *serverIP, uint16_t port);
     void runServer();
     void runClient();
+    int runScript(const char *path);
     inline int getClientSocketId() { return sock; }
     ~NetworkSettings();
 };
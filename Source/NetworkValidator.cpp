@@ -1,9 +1,8 @@
 #include "NetworkValidator.hh"
-#include <thread>
+#include <sys/timerfd.h>
 #include "MessageHandle.hh"
 
 extern appType_e appType;
-extern deque<MessageHeader> responseDeque;
 
 /*********************************************************************
  * @fn      		  - NetworkValidator() [parameterised constructor]
@@ -13,34 +12,48 @@ extern deque<MessageHeader> responseDeque;
  * @return            - none
  * @Note              - Constructor Overloading (by different number of arguments)
  *********************************************************************/
-NetworkValidator::NetworkValidator(int clientSocket) : clientSocket(clientSocket), heartbeatInterval(HEARTBEAT_TIMEOUT) ,status(false){}
+NetworkValidator::NetworkValidator(int clientSocket) : clientSocket(clientSocket), heartbeatInterval(HEARTBEAT_TIMEOUT), timerFd(-1){}
 
-/* In Constructor initialise variables of class */
-void NetworkValidator::StartValidator()
+/*********************************************************************
+ * @fn      		  - StartValidator() 
+ * @brief             - This function arms the heartbeat timer of the client
+ * @param[in]         - none
+ * @return            - int (timer fd to poll, -1 on error)
+ * @Note              - The first heartbeat goes out right away, then one
+ *                      every HEARTBEAT_INTERVAL_MS; the caller's event loop
+ *                      calls SendHeartbeat() when the fd is readable
+ *********************************************************************/
+int NetworkValidator::StartValidator()
 {
-    // Start the heartbeat thread
-    thread heartbeatThread(&NetworkValidator::SendHeartbeat, this);
-    heartbeatThread.detach();
-    this -> status = true;
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0)
+        return -1;
+
+    struct itimerspec period = {};
+    period.it_interval.tv_sec = HEARTBEAT_INTERVAL_MS / 1000;
+    period.it_interval.tv_nsec = (HEARTBEAT_INTERVAL_MS % 1000) * 1000000L;
+    period.it_value.tv_nsec = 1;
+    timerfd_settime(timerFd, 0, &period, nullptr);
+    return timerFd;
 }
 
 /*********************************************************************
  * @fn      		  - SendHeartbeat() 
- * @brief             - This function starts a thread to send heartbeat to server
+ * @brief             - This function sends a heartbeat to server once the
+ *                      heartbeat timer expired
  * @param[in]         - none
- * @return            - none
- * @Note              - 
+ * @return            - bool (false if the connection is lost)
+ * @Note              - Expirations missed while busy are sent as one
  *********************************************************************/
-void NetworkValidator::SendHeartbeat()
+bool NetworkValidator::SendHeartbeat()
 {
-    while (status)
-    {
-        MessageHeader HeartBeatMessage;
-        HeartBeatMessage.MessageHeartBeat(appType);
-        //responseDeque.push_back(HeartBeatMessage);
-        send(clientSocket, &HeartBeatMessage, sizeof(HeartBeatMessage), 0);
-        this_thread::sleep_for(chrono::milliseconds(HEARTBEAT_TIMEOUT*1000));
-    }
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return true;
+
+    MessageHeader HeartBeatMessage;
+    HeartBeatMessage.MessageHeartBeat(appType);
+    return sendMessage(clientSocket, HeartBeatMessage);
 }
 
 /*********************************************************************
@@ -61,12 +74,20 @@ void NetworkValidator::initHeartBeatTimer()
 
 /*********************************************************************
  * @fn      		  - StopValidator() 
- * @brief             - This function stops the heartbeat chcek thread
+ * @brief             - This function stops the heartbeat timer
  * @param[in]         - none
  * @return            - none
  * @Note              - 
  *********************************************************************/
 void NetworkValidator::StopValidator()
 {
-    status = false;
+    if (timerFd >= 0)
+        close(timerFd);
+    timerFd = -1;
+}
+
+/* In Destructor stop the heartbeat timer */
+NetworkValidator::~NetworkValidator()
+{
+    StopValidator();
 }
@@ -2,18 +2,20 @@
 
 
 #define HEARTBEAT_TIMEOUT 5
+#define HEARTBEAT_INTERVAL_MS (HEARTBEAT_TIMEOUT * 1000 / 2)   /* well inside the server's timeout */
 
 class NetworkValidator
 {
     int clientSocket;
     int heartbeatInterval;
-    bool status;
+    int timerFd;
 
     public:
     NetworkValidator(int clientSocket);
-    void StartValidator();
-    void SendHeartbeat();
+    int StartValidator();
+    bool SendHeartbeat();
     void initHeartBeatTimer();
     void StopValidator();
+    ~NetworkValidator();
 
 };
\ No newline at end of file
@@ -0,0 +1,345 @@
+#include "PortResolver.hh"
+#include "HexDecode.hh"
+#include <cstring>
+#include <climits>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+extern serverConfig_t serverConfig;
+
+static const char *const tcpStateStr[] = {
+    "", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2",
+    "TIME_WAIT", "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING",
+};
+
+/*********************************************************************
+ * @fn      		  - scanAddress
+ * @brief             - This function parses "ADDR:PORT" as printed in
+ *                      /proc/net/tcp
+ * @param[in]         - string_view &in, bool v6, uint8_t *addr, uint16_t &port
+ * @return            - bool
+ * @Note              - The kernel prints the address as 32 bit words in host
+ *                      order, so each word is copied back as it was in memory
+ *********************************************************************/
+static bool scanAddress(string_view &in, bool v6, uint8_t *addr, uint16_t &port)
+{
+    scanSpaces(in);
+    int words = v6 ? 4 : 1;
+    if (in.size() < static_cast<size_t>(words * HEX_WORD_CHARS + 1) || in[words * HEX_WORD_CHARS] != ':')
+        return false;
+
+    uint32_t decoded[HEX_MAX_WORDS];
+    if (!decodeHexWords(in, words, decoded))
+        return false;
+    memcpy(addr, decoded, words * sizeof(uint32_t));
+    if (!v6)
+        memset(addr + 4, 0, 12);
+
+    in.remove_prefix(words * HEX_WORD_CHARS + 1);
+    return scanNumber(in, port, 16);
+}
+
+/*********************************************************************
+ * @fn      		  - parse
+ * @brief             - This function adds the rows of one /proc/net table
+ * @param[in]         - string_view content, sockProto_e proto, bool v6,
+ *                      uint32_t stateMask
+ * @return            - none
+ * @Note              - Columns: sl local rem st tx:rx tr:when retrnsmt uid
+ *                      timeout inode
+ *********************************************************************/
+void SocketTable::parse(string_view content, sockProto_e proto, bool v6, uint32_t stateMask)
+{
+    // Skip the header line
+    size_t eol = content.find('\n');
+    if (eol == string_view::npos)
+        return;
+    content.remove_prefix(eol + 1);
+
+    while (!content.empty())
+    {
+        eol = content.find('\n');
+        string_view line = content.substr(0, eol);
+        content.remove_prefix(eol == string_view::npos ? content.size() : eol + 1);
+
+        socketEntry_t sock;
+        sock.proto = proto;
+        sock.v6 = v6;
+        if (!scanSkipFields(line, 1) ||
+            !scanAddress(line, v6, sock.localAddr, sock.localPort) ||
+            !scanAddress(line, v6, sock.remoteAddr, sock.remotePort) ||
+            !scanNumber(line, sock.state, 16) ||
+            !scanSkipFields(line, 5) ||
+            !scanNumber(line, sock.inode))
+            continue;
+
+        // Sockets being torn down have no owner any more
+        if (sock.inode != 0 && (stateMask & (1u << sock.state)))
+            byInode[sock.inode] = sock;
+    }
+}
+
+/* Network namespace of the server, the only one sock_diag can see */
+static string ownNetNamespace()
+{
+    char target[64];
+    ssize_t len = readlinkat(procRootFd(), "self/ns/net", target, sizeof(target) - 1);
+    return len > 0 ? string(target, len) : string();
+}
+
+/*********************************************************************
+ * @fn      		  - dump
+ * @brief             - This function adds the sockets of one family and
+ *                      protocol using an inet_diag dump
+ * @param[in]         - int family, sockProto_e proto, uint32_t stateMask
+ * @return            - bool (false if sock_diag is unavailable for them)
+ * @Note              - Covers the network namespace of the server only
+ *********************************************************************/
+bool SocketTable::dump(int family, sockProto_e proto, uint32_t stateMask)
+{
+    static thread_local vector<char> buf(SOCK_DIAG_BUF_SIZE);
+
+    int sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (sock < 0)
+        return false;
+
+    struct
+    {
+        struct nlmsghdr nlh;
+        struct inet_diag_req_v2 req;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.req.sdiag_family = family;
+    request.req.sdiag_protocol = proto == SOCK_PROTO_TCP ? IPPROTO_TCP : IPPROTO_UDP;
+    request.req.idiag_states = stateMask;
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(sock, &request, sizeof(request), 0, reinterpret_cast<struct sockaddr *>(&kernel), sizeof(kernel)) < 0)
+    {
+        close(sock);
+        return false;
+    }
+
+    bool v6 = family == AF_INET6;
+    size_t addrLen = v6 ? 16 : 4;
+    while (true)
+    {
+        ssize_t len = recv(sock, buf.data(), buf.size(), 0);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+
+        for (struct nlmsghdr *nlh = reinterpret_cast<struct nlmsghdr *>(buf.data());
+             len > 0 && NLMSG_OK(nlh, static_cast<size_t>(len)); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_type == NLMSG_DONE)
+            {
+                close(sock);
+                return true;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                // ENOENT when the diag module of this protocol is not loaded
+                close(sock);
+                return false;
+            }
+
+            const struct inet_diag_msg *msg = static_cast<const struct inet_diag_msg *>(NLMSG_DATA(nlh));
+            if (msg->idiag_inode == 0)
+                continue;
+
+            socketEntry_t entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.proto = proto;
+            entry.v6 = v6;
+            entry.state = msg->idiag_state;
+            memcpy(entry.localAddr, msg->id.idiag_src, addrLen);
+            memcpy(entry.remoteAddr, msg->id.idiag_dst, addrLen);
+            entry.localPort = ntohs(msg->id.idiag_sport);
+            entry.remotePort = ntohs(msg->id.idiag_dport);
+            entry.inode = msg->idiag_inode;
+            byInode[entry.inode] = entry;
+        }
+    }
+    close(sock);
+    return false;
+}
+
+/*********************************************************************
+ * @fn      		  - load
+ * @brief             - This function reads the TCP and UDP sockets of the
+ *                      network namespace of the process dir refers to
+ * @param[in]         - ProcDir &dir, uint32_t stateMask
+ * @return            - bool (false if none of the tables could be read)
+ * @Note              - tcp6/udp6 are missing when IPv6 is disabled
+ *********************************************************************/
+bool SocketTable::load(ProcDir &dir, uint32_t stateMask)
+{
+    static const struct
+    {
+        const char *name;
+        int family;
+        sockProto_e proto;
+    } tables[] = {
+        {"net/tcp", AF_INET, SOCK_PROTO_TCP},
+        {"net/tcp6", AF_INET6, SOCK_PROTO_TCP},
+        {"net/udp", AF_INET, SOCK_PROTO_UDP},
+        {"net/udp6", AF_INET6, SOCK_PROTO_UDP},
+    };
+    static const string ownNetns = ownNetNamespace();
+
+    bool useDiag = serverConfig.sockDiag && netNamespaceOf(dir) == ownNetns;
+    bool loaded = false;
+    byInode.clear();
+    for (const auto &table : tables)
+    {
+        if (useDiag && dump(table.family, table.proto, stateMask))
+        {
+            loaded = true;
+            continue;
+        }
+
+        string_view content;
+        if (!dir.read(table.name, content, true))
+            continue;
+        parse(content, table.proto, table.family == AF_INET6, stateMask);
+        loaded = true;
+    }
+    return loaded;
+}
+
+/*********************************************************************
+ * @fn      		  - find
+ * @brief             - This function looks a socket up by inode
+ * @param[in]         - unsigned long inode
+ * @return            - const socketEntry_t * (nullptr if not an INET socket)
+ * @Note              -
+ *********************************************************************/
+const socketEntry_t *SocketTable::find(unsigned long inode) const
+{
+    auto it = byInode.find(inode);
+    return it == byInode.end() ? nullptr : &it->second;
+}
+
+/*********************************************************************
+ * @fn      		  - boundTo
+ * @brief             - This function returns the sockets bound to a local port
+ * @param[in]         - uint16_t port
+ * @return            - vector<const socketEntry_t *>
+ * @Note              -
+ *********************************************************************/
+vector<const socketEntry_t *> SocketTable::boundTo(uint16_t port) const
+{
+    vector<const socketEntry_t *> socks;
+    for (const auto &entry : byInode)
+    {
+        if (entry.second.localPort == port)
+            socks.push_back(&entry.second);
+    }
+    return socks;
+}
+
+/*********************************************************************
+ * @fn      		  - collectSocketInodes
+ * @brief             - This function collects the inodes of the sockets the
+ *                      process has open from its /proc/<pid>/fd links
+ * @param[in]         - ProcDir &dir, vector<unsigned long> &inodes
+ * @return            - bool (false if the fd directory is not readable)
+ * @Note              - Unix, netlink etc. sockets are returned too, they are
+ *                      simply not found in the socket table
+ *********************************************************************/
+bool collectSocketInodes(ProcDir &dir, vector<unsigned long> &inodes)
+{
+    static const string_view prefix = "socket:[";
+
+    int fdDirFd = dir.openAt("fd", O_RDONLY | O_DIRECTORY);
+    if (fdDirFd < 0)
+        return false;
+    DIR *fdDir = fdopendir(fdDirFd);
+    if (!fdDir)
+    {
+        close(fdDirFd);
+        return false;
+    }
+
+    dirent *entry;
+    char target[64];
+    while ((entry = readdir(fdDir)) != nullptr)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        ssize_t len = readlinkat(fdDirFd, entry->d_name, target, sizeof(target) - 1);
+        if (len <= 0)
+            continue;
+
+        string_view link(target, len);
+        if (link.substr(0, prefix.size()) != prefix)
+            continue;
+        link.remove_prefix(prefix.size());
+
+        unsigned long inode;
+        if (scanNumber(link, inode))
+            inodes.push_back(inode);
+    }
+    closedir(fdDir);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - netNamespaceOf
+ * @brief             - This function returns the identity of the network
+ *                      namespace of the process, e.g. "net:[4026531840]"
+ * @param[in]         - ProcDir &dir
+ * @return            - string (empty if it cannot be read)
+ * @Note              - Used to share one socket table between processes
+ *********************************************************************/
+string netNamespaceOf(ProcDir &dir)
+{
+    char target[64];
+    return dir.readLink("ns/net", target, sizeof(target)) > 0 ? string(target) : string();
+}
+
+/* "1.2.3.4:80" or "[::1]:80" */
+static string formatEndpoint(const uint8_t *addr, uint16_t port, bool v6)
+{
+    char text[INET6_ADDRSTRLEN];
+    inet_ntop(v6 ? AF_INET6 : AF_INET, addr, text, sizeof(text));
+    return v6 ? "[" + string(text) + "]:" + to_string(port) : string(text) + ":" + to_string(port);
+}
+
+/*********************************************************************
+ * @fn      		  - formatSocket
+ * @brief             - This function describes a socket on one line
+ * @param[in]         - const socketEntry_t &sock
+ * @return            - string
+ * @Note              - e.g. "TCP: 0.0.0.0:8080 LISTEN" or
+ *                      "UDP6: [::1]:53"
+ *********************************************************************/
+string formatSocket(const socketEntry_t &sock)
+{
+    string line = sock.proto == SOCK_PROTO_TCP ? "TCP" : "UDP";
+    if (sock.v6)
+        line += "6";
+    line += ": " + formatEndpoint(sock.localAddr, sock.localPort, sock.v6);
+
+    bool connected = sock.proto == SOCK_PROTO_TCP ? sock.state != SOCK_STATE_LISTEN
+                                                  : sock.state == SOCK_STATE_ESTABLISHED;
+    if (connected)
+        line += " -> " + formatEndpoint(sock.remoteAddr, sock.remotePort, sock.v6);
+    if (sock.proto == SOCK_PROTO_TCP && sock.state < sizeof(tcpStateStr) / sizeof(tcpStateStr[0]))
+        line += string(" ") + tcpStateStr[sock.state];
+    return line;
+}
@@ -0,0 +1,68 @@
+#ifndef PORT_RESOLVER_H
+#define PORT_RESOLVER_H
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "RemoteManagement.hh"
+#include "ProcReader.hh"
+
+/* Values of the "st" column of /proc/net/tcp (include/net/tcp_states.h) */
+#define SOCK_STATE_ESTABLISHED  0x01
+#define SOCK_STATE_CLOSE        0x07
+#define SOCK_STATE_LISTEN       0x0A
+
+/* Bit masks of states, as in inet_diag_req_v2.idiag_states */
+#define SOCK_STATES_ALL         0xFFFFFFFFu
+#define SOCK_STATES_BOUND       ((1u << SOCK_STATE_LISTEN) | (1u << SOCK_STATE_CLOSE))
+#define SOCK_DIAG_BUF_SIZE      (64 * 1024)
+
+typedef enum
+{
+    SOCK_PROTO_TCP,
+    SOCK_PROTO_UDP,
+} sockProto_e;
+
+/* One row of /proc/net/{tcp,tcp6,udp,udp6}; addresses in network order */
+typedef struct
+{
+    sockProto_e proto;
+    bool v6;
+    uint8_t state;
+    uint8_t localAddr[16];
+    uint16_t localPort;
+    uint8_t remoteAddr[16];
+    uint16_t remotePort;
+    unsigned long inode;
+} socketEntry_t;
+
+/*
+ * Every socket of one network namespace, keyed by inode. It is built once
+ * per request and joined with the socket:[inode] links of each process,
+ * so resolving N processes costs one pass over the tables plus one fd
+ * walk per process.
+ * With serverConfig.sockDiag the sockets of the server's own namespace are
+ * dumped over NETLINK_SOCK_DIAG as binary records, filtered by state in
+ * the kernel; the /proc/net text tables remain the fallback for other
+ * namespaces and for kernels without tcp_diag/udp_diag.
+ */
+class SocketTable
+{
+private:
+    unordered_map<unsigned long, socketEntry_t> byInode;
+
+    bool dump(int family, sockProto_e proto, uint32_t stateMask);
+
+public:
+    void parse(string_view content, sockProto_e proto, bool v6, uint32_t stateMask);
+    bool load(ProcDir &dir, uint32_t stateMask = SOCK_STATES_ALL);
+    const socketEntry_t *find(unsigned long inode) const;
+    vector<const socketEntry_t *> boundTo(uint16_t port) const;
+    inline size_t size() const { return byInode.size(); }
+};
+
+bool collectSocketInodes(ProcDir &dir, vector<unsigned long> &inodes);
+string netNamespaceOf(ProcDir &dir);
+string formatSocket(const socketEntry_t &sock);
+
+#endif
@@ -0,0 +1,200 @@
+#include "ProcEvents.hh"
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+/* In Constructor initialise variables of class */
+ProcEvents::ProcEvents() : sock(-1)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - open
+ * @brief             - This function joins the proc connector multicast group
+ *                      and subscribes to process events
+ * @param[in]         - none
+ * @return            - bool (false if the kernel or our privileges do not allow it)
+ * @Note              - The kernel only acknowledges a successful subscription,
+ *                      so a missing ack within PROC_EVENTS_ACK_MS means failure
+ *********************************************************************/
+bool ProcEvents::open()
+{
+    sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (sock < 0)
+        return false;
+
+    // Bursts of forks must not overflow the socket before the collector runs
+    int rcvBuf = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0;
+
+    if (bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        !sendControl(PROC_CN_MCAST_LISTEN) || !waitAck())
+    {
+#ifdef DEBUG
+        cerr << "Proc connector subscription failed: " << strerror(errno) << endl;
+#endif
+        close();
+        return false;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - close
+ * @brief             - This function unsubscribes and closes the socket
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void ProcEvents::close()
+{
+    if (sock < 0)
+        return;
+    sendControl(PROC_CN_MCAST_IGNORE);
+    ::close(sock);
+    sock = -1;
+}
+
+/*********************************************************************
+ * @fn      		  - sendControl
+ * @brief             - This function sends a proc_cn_mcast_op to the connector
+ * @param[in]         - int op
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+bool ProcEvents::sendControl(int op)
+{
+    alignas(NLMSG_ALIGNTO) char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(int))];
+    memset(buf, 0, sizeof(buf));
+
+    struct nlmsghdr *nlh = reinterpret_cast<struct nlmsghdr *>(buf);
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(int));
+    nlh->nlmsg_type = NLMSG_DONE;
+
+    struct cn_msg *msg = static_cast<struct cn_msg *>(NLMSG_DATA(nlh));
+    msg->id.idx = CN_IDX_PROC;
+    msg->id.val = CN_VAL_PROC;
+    msg->len = sizeof(int);
+    memcpy(msg->data, &op, sizeof(op));
+
+    return send(sock, buf, nlh->nlmsg_len, 0) == static_cast<ssize_t>(nlh->nlmsg_len);
+}
+
+/*********************************************************************
+ * @fn      		  - waitAck
+ * @brief             - This function waits for the connector to acknowledge
+ *                      the subscription
+ * @param[in]         - none
+ * @return            - bool
+ * @Note              - Process events arriving before the ack are dropped; the
+ *                      caller takes a full snapshot right after subscribing
+ *********************************************************************/
+bool ProcEvents::waitAck()
+{
+    alignas(NLMSG_ALIGNTO) char buf[PROC_EVENTS_BUF_SIZE];
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(PROC_EVENTS_ACK_MS);
+
+    while (true)
+    {
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if (left <= 0 || poll(&pfd, 1, static_cast<int>(left)) <= 0)
+            return false;
+
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        if (len < 0)
+            return false;
+
+        for (struct nlmsghdr *nlh = reinterpret_cast<struct nlmsghdr *>(buf);
+             len > 0 && NLMSG_OK(nlh, static_cast<size_t>(len)); nlh = NLMSG_NEXT(nlh, len))
+        {
+            struct cn_msg *msg = static_cast<struct cn_msg *>(NLMSG_DATA(nlh));
+            struct proc_event *event = reinterpret_cast<struct proc_event *>(msg->data);
+            if (msg->id.idx == CN_IDX_PROC && event->what == proc_event::PROC_EVENT_NONE)
+                return event->event_data.ack.err == 0;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - drain
+ * @brief             - This function reads every pending event without blocking
+ *                      and folds it into changes
+ * @param[in]         - procChanges_t &changes
+ * @return            - bool (false if events were lost and a full rescan is needed)
+ * @Note              - A later event for the same pid overrides an earlier one
+ *********************************************************************/
+bool ProcEvents::drain(procChanges_t &changes)
+{
+    alignas(NLMSG_ALIGNTO) char buf[PROC_EVENTS_BUF_SIZE];
+    bool complete = true;
+
+    while (true)
+    {
+        ssize_t len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS)
+            {
+                // The socket overflowed, the kernel dropped events
+                complete = false;
+                continue;
+            }
+            return complete && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+
+        for (struct nlmsghdr *nlh = reinterpret_cast<struct nlmsghdr *>(buf);
+             len > 0 && NLMSG_OK(nlh, static_cast<size_t>(len)); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_NOOP)
+                continue;
+
+            struct cn_msg *msg = static_cast<struct cn_msg *>(NLMSG_DATA(nlh));
+            if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+                continue;
+
+            // Threads share their leader's /proc entry, only leaders are tracked
+            struct proc_event *event = reinterpret_cast<struct proc_event *>(msg->data);
+            switch (event->what)
+            {
+                case proc_event::PROC_EVENT_FORK:
+                    if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid)
+                        changes[event->event_data.fork.child_tgid] = PROC_CHANGED;
+                    break;
+                case proc_event::PROC_EVENT_EXEC:
+                    changes[event->event_data.exec.process_tgid] = PROC_CHANGED;
+                    break;
+                case proc_event::PROC_EVENT_COMM:
+                    if (event->event_data.comm.process_pid == event->event_data.comm.process_tgid)
+                        changes[event->event_data.comm.process_tgid] = PROC_CHANGED;
+                    break;
+                case proc_event::PROC_EVENT_EXIT:
+                    if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid)
+                        changes[event->event_data.exit.process_tgid] = PROC_EXITED;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+/* In Destructor unsubscribe */
+ProcEvents::~ProcEvents()
+{
+    close();
+}
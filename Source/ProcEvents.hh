@@ -0,0 +1,44 @@
+#ifndef PROC_EVENTS_H
+#define PROC_EVENTS_H
+
+#include <unordered_map>
+#include "RemoteManagement.hh"
+
+#define PROC_EVENTS_ACK_MS   500
+#define PROC_EVENTS_BUF_SIZE (64 * 1024)
+
+/* What happened to a process since the last drain */
+typedef enum
+{
+    PROC_CHANGED,       /* forked or exec'd: stat and cmdline must be re-read */
+    PROC_EXITED,
+} procChange_e;
+
+typedef unordered_map<int, procChange_e> procChanges_t;
+
+/*
+ * Subscription to the kernel proc connector (NETLINK_CONNECTOR, CN_IDX_PROC).
+ * The kernel multicasts one message per fork, exec and exit; only thread
+ * group leaders are kept since /proc lists processes, not threads.
+ * Events are only delivered in the initial network namespace and kernels
+ * before 6.6 require CAP_NET_ADMIN, so open() fails cleanly and the caller
+ * is expected to fall back to polling.
+ */
+class ProcEvents
+{
+private:
+    int sock;
+
+    bool sendControl(int op);
+    bool waitAck();
+
+public:
+    ProcEvents();
+    bool open();
+    void close();
+    inline int getFd() { return sock; }
+    bool drain(procChanges_t &changes);
+    ~ProcEvents();
+};
+
+#endif
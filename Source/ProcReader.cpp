@@ -0,0 +1,313 @@
+#include "ProcReader.hh"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+ProcDirCache procDirCache;
+
+/*********************************************************************
+ * @fn      		  - procRootFd
+ * @brief             - This function returns a descriptor of /proc opened
+ *                      once for the lifetime of the process
+ * @param[in]         - none
+ * @return            - int (-1 if /proc is not mounted)
+ * @Note              -
+ *********************************************************************/
+int procRootFd()
+{
+    static const int fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return fd;
+}
+
+/*********************************************************************
+ * @fn      		  - readProcFile
+ * @brief             - This function reads a whole file below dirFd into the
+ *                      calling thread's buffer
+ * @param[in]         - int dirFd, const char *name, string_view &content,
+ *                      bool untilEof
+ * @return            - bool
+ * @Note              - content stays valid until the thread's next read. The
+ *                      buffer only grows, so steady state reads do not allocate.
+ *                      Files generated in one go (per-pid stat, status,
+ *                      cmdline, /proc/stat) come whole in the first read that
+ *                      has room, so a short read ends them: reading on would
+ *                      make the kernel generate the file a second time.
+ *                      Record-based files such as /proc/net/tcp are handed out
+ *                      a page at a time and need untilEof.
+ *********************************************************************/
+bool readProcFile(int dirFd, const char *name, string_view &content, bool untilEof)
+{
+    static thread_local string buffer(PROC_READ_INITIAL_SIZE, '\0');
+
+    int fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    size_t used = 0;
+    while (true)
+    {
+        if (used == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        ssize_t len = pread(fd, &buffer[used], buffer.size() - used, used);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+        {
+            close(fd);
+            return false;
+        }
+        if (len == 0)
+            break;
+        used += len;
+        if (!untilEof && used < buffer.size())
+            break;
+    }
+
+    close(fd);
+    content = string_view(buffer.data(), used);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - parseProcStat
+ * @brief             - This function parses the content of /proc/<pid>/stat
+ * @param[in]         - string_view content, procStat_t &stat
+ * @return            - bool
+ * @Note              - comm may contain spaces and ')', so the fields after
+ *                      it are located from the last ')' of the line
+ *********************************************************************/
+bool parseProcStat(string_view content, procStat_t &stat)
+{
+    // memrchr is vectorised, string_view::rfind walks back one char at a time
+    size_t open = content.find('(');
+    const char *last = static_cast<const char *>(memrchr(content.data(), ')', content.size()));
+    if (open == string_view::npos || !last)
+        return false;
+    size_t close = last - content.data();
+    if (close < open)
+        return false;
+
+    stat.comm = content.substr(open + 1, close - open - 1);
+
+    // Field 3 (state) follows the comm; utime/stime are 14/15, starttime 22, vsize/rss 23/24
+    string_view rest = content.substr(close + 1);
+    scanSpaces(rest);
+    if (rest.empty())
+        return false;
+    stat.state = rest[0];
+    rest.remove_prefix(1);
+
+    return scanNumber(rest, stat.ppid) &&
+           scanSkipFields(rest, 9) &&
+           scanNumber(rest, stat.utime) &&
+           scanNumber(rest, stat.stime) &&
+           scanSkipFields(rest, 6) &&
+           scanNumber(rest, stat.starttime) &&
+           scanNumber(rest, stat.vsize) &&
+           scanNumber(rest, stat.rss);
+}
+
+/* In Constructor initialise variables of class; the limit leaves most
+   descriptors to client connections */
+ProcDirCache::ProcDirCache() : count(0), limit(PROC_DIR_CACHE_MAX)
+{
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY)
+        limit = min<size_t>(limit, files.rlim_cur / 2);
+}
+
+/*********************************************************************
+ * @fn      		  - open
+ * @brief             - This function returns the descriptor of /proc/<pid>,
+ *                      opening and caching it on first use
+ * @param[in]         - int pid, bool &cached
+ * @return            - procDirFdPtr_t (nullptr if the process is gone)
+ * @Note              - cached tells whether it was already open. Past the
+ *                      limit new descriptors are handed out uncached
+ *********************************************************************/
+procDirFdPtr_t ProcDirCache::open(int pid, bool &cached)
+{
+    shard_t &shard = shardOf(pid);
+    {
+        lock_guard<mutex> guard(shard.mtx);
+        auto it = shard.dirs.find(pid);
+        if (it != shard.dirs.end())
+        {
+            cached = true;
+            return it->second;
+        }
+    }
+
+    cached = false;
+    char name[16];
+    auto result = to_chars(name, name + sizeof(name) - 1, pid);
+    *result.ptr = '\0';
+    int fd = openat(procRootFd(), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    auto dir = make_shared<procDirFd_t>(fd);
+    if (count.load(memory_order_relaxed) >= limit)
+        return dir;
+
+    lock_guard<mutex> guard(shard.mtx);
+    auto inserted = shard.dirs.emplace(pid, dir);
+    if (!inserted.second)
+        return inserted.first->second;      // another thread opened it meanwhile
+    count.fetch_add(1, memory_order_relaxed);
+    return dir;
+}
+
+/*********************************************************************
+ * @fn      		  - evict
+ * @brief             - This function forgets the cached descriptor of pid
+ * @param[in]         - int pid, const procDirFd_t *stale
+ * @return            - none
+ * @Note              - Only if it still is stale, a thread may have replaced
+ *                      it already
+ *********************************************************************/
+void ProcDirCache::evict(int pid, const procDirFd_t *stale)
+{
+    shard_t &shard = shardOf(pid);
+    lock_guard<mutex> guard(shard.mtx);
+    auto it = shard.dirs.find(pid);
+    if (it != shard.dirs.end() && it->second.get() == stale)
+    {
+        shard.dirs.erase(it);
+        count.fetch_sub(1, memory_order_relaxed);
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - retain
+ * @brief             - This function closes the descriptors of processes that
+ *                      are gone or whose pid was reused
+ * @param[in]         - const procAliveFn_t &alive
+ * @return            - none
+ * @Note              - Called with each published snapshot. An entry learns
+ *                      its process' start time from the first snapshot that
+ *                      lists it
+ *********************************************************************/
+void ProcDirCache::retain(const procAliveFn_t &alive)
+{
+    for (shard_t &shard : shards)
+    {
+        lock_guard<mutex> guard(shard.mtx);
+        for (auto it = shard.dirs.begin(); it != shard.dirs.end();)
+        {
+            unsigned long long starttime = 0;
+            unsigned long long known = it->second->starttime.load(memory_order_relaxed);
+            if (!alive(it->first, starttime) || (known != 0 && known != starttime))
+            {
+                it = shard.dirs.erase(it);
+                count.fetch_sub(1, memory_order_relaxed);
+                continue;
+            }
+            it->second->starttime.store(starttime, memory_order_relaxed);
+            ++it;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - forget
+ * @brief             - This function closes the cached descriptor of pid
+ * @param[in]         - int pid
+ * @return            - none
+ * @Note              - For a process that exited or exec'd; the next read
+ *                      of the pid opens it again
+ *********************************************************************/
+void ProcDirCache::forget(int pid)
+{
+    shard_t &shard = shardOf(pid);
+    lock_guard<mutex> guard(shard.mtx);
+    if (shard.dirs.erase(pid))
+        count.fetch_sub(1, memory_order_relaxed);
+}
+
+/* In Constructor take /proc/<pid> from the descriptor cache */
+ProcDir::ProcDir(int pid) : pid(pid), cached(false)
+{
+    dir = procDirCache.open(pid, cached);
+}
+
+/*********************************************************************
+ * @fn      		  - reopen
+ * @brief             - This function replaces a cached descriptor whose
+ *                      process has died by a fresh one of the same pid
+ * @param[in]         - none
+ * @return            - bool (false if there is nothing to retry)
+ * @Note              - Only once, and only after ESRCH: the pid may have
+ *                      been reused since the descriptor was cached
+ *********************************************************************/
+bool ProcDir::reopen()
+{
+    if (!cached || errno != ESRCH)
+        return false;
+    cached = false;
+    procDirCache.evict(pid, dir.get());
+    bool ignored;
+    dir = procDirCache.open(pid, ignored);
+    return dir != nullptr;
+}
+
+/*********************************************************************
+ * @fn      		  - read
+ * @brief             - This function reads /proc/<pid>/<name>
+ * @param[in]         - const char *name, string_view &content, bool untilEof
+ * @return            - bool
+ * @Note              - See readProcFile() for the lifetime of content
+ *********************************************************************/
+bool ProcDir::read(const char *name, string_view &content, bool untilEof)
+{
+    if (!dir)
+        return false;
+    if (readProcFile(dir->fd, name, content, untilEof))
+        return true;
+    return reopen() && readProcFile(dir->fd, name, content, untilEof);
+}
+
+/*********************************************************************
+ * @fn      		  - readLink
+ * @brief             - This function reads the target of the link
+ *                      /proc/<pid>/<name> into buf, NUL terminated
+ * @param[in]         - const char *name, char *buf, size_t size
+ * @return            - ssize_t (length, or -1)
+ * @Note              -
+ *********************************************************************/
+ssize_t ProcDir::readLink(const char *name, char *buf, size_t size)
+{
+    if (!dir || size == 0)
+        return -1;
+    ssize_t len = readlinkat(dir->fd, name, buf, size - 1);
+    if (len < 0 && reopen())
+        len = readlinkat(dir->fd, name, buf, size - 1);
+    if (len >= 0)
+        buf[len] = '\0';
+    return len;
+}
+
+/*********************************************************************
+ * @fn      		  - openAt
+ * @brief             - This function opens /proc/<pid>/<name>
+ * @param[in]         - const char *name, int flags
+ * @return            - int (descriptor owned by the caller, or -1)
+ * @Note              - O_CLOEXEC is added to flags
+ *********************************************************************/
+int ProcDir::openAt(const char *name, int flags)
+{
+    if (!dir)
+        return -1;
+    int fd = openat(dir->fd, name, flags | O_CLOEXEC);
+    if (fd < 0 && reopen())
+        fd = openat(dir->fd, name, flags | O_CLOEXEC);
+    return fd;
+}
+
+/* In Destructor let go of the descriptor, the cache keeps it open */
+ProcDir::~ProcDir()
+{
+}
@@ -0,0 +1,162 @@
+#ifndef PROC_READER_H
+#define PROC_READER_H
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include "RemoteManagement.hh"
+
+#define PROC_READ_INITIAL_SIZE 4096
+#define PROC_DIR_CACHE_SHARDS  64
+#define PROC_DIR_CACHE_MAX     16384   /* at most half of RLIMIT_NOFILE is used */
+
+/* Fields of /proc/<pid>/stat used by the server */
+typedef struct
+{
+    string_view comm;       /* points into the read buffer */
+    char state;
+    int ppid;
+    unsigned long utime;
+    unsigned long stime;
+    unsigned long long starttime;
+    unsigned long vsize;    /* bytes */
+    long rss;               /* pages */
+} procStat_t;
+
+/* An open /proc/<pid>, closed once the cache and every ProcDir let go of it */
+typedef struct procDirFd
+{
+    int fd;
+    atomic<unsigned long long> starttime;   /* of the process it was opened for, 0 until known */
+    explicit procDirFd(int fd) : fd(fd), starttime(0) {}
+    ~procDirFd()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+} procDirFd_t;
+
+typedef shared_ptr<procDirFd_t> procDirFdPtr_t;
+
+/* Whether pid is still listed, and the start time of the process it is */
+typedef function<bool(int pid, unsigned long long &starttime)> procAliveFn_t;
+
+/*
+ * /proc/<pid> descriptors kept open across scans, so reading a process
+ * costs one openat() per file instead of also opening and closing its
+ * directory every time. Entries are keyed by pid and tagged with the start
+ * time of the process they were opened for; retain() drops those whose
+ * process left the snapshot or whose pid now belongs to another process,
+ * forget() drops one pid a batch of changes reported gone or replaced.
+ * A descriptor dropped while in use stays open until its last ProcDir goes.
+ * The map is sharded by pid so parallel scanner threads rarely meet on a
+ * lock.
+ */
+class ProcDirCache
+{
+private:
+    typedef struct
+    {
+        mutex mtx;
+        unordered_map<int, procDirFdPtr_t> dirs;
+    } shard_t;
+
+    shard_t shards[PROC_DIR_CACHE_SHARDS];
+    atomic<size_t> count;
+    size_t limit;
+
+    inline shard_t &shardOf(int pid) { return shards[static_cast<unsigned>(pid) % PROC_DIR_CACHE_SHARDS]; }
+
+public:
+    ProcDirCache();
+    procDirFdPtr_t open(int pid, bool &cached);
+    void evict(int pid, const procDirFd_t *stale);
+    void retain(const procAliveFn_t &alive);
+    void forget(int pid);
+    inline size_t size() { return count.load(memory_order_relaxed); }
+};
+
+extern ProcDirCache procDirCache;
+
+int procRootFd();
+bool readProcFile(int dirFd, const char *name, string_view &content, bool untilEof = false);
+
+/*
+ * Handle on /proc/<pid>, taken from the descriptor cache. Files below it
+ * are opened with openat() so the kernel resolves one path component per
+ * file instead of the whole "/proc/<pid>/..." path, and a pid reused while
+ * we hold the handle makes later reads fail instead of silently returning
+ * another process. A cached descriptor whose process died is replaced by
+ * a fresh one once, so a reused pid is read correctly.
+ */
+class ProcDir
+{
+private:
+    int pid;
+    bool cached;            /* dir came from the cache and was not reopened yet */
+    procDirFdPtr_t dir;
+
+    bool reopen();
+
+public:
+    explicit ProcDir(int pid);
+    ProcDir(const ProcDir &) = delete;
+    ProcDir &operator=(const ProcDir &) = delete;
+    inline bool isOpen() { return dir != nullptr; }
+    inline int getFd() { return dir ? dir->fd : -1; }
+    bool read(const char *name, string_view &content, bool untilEof = false);
+    ssize_t readLink(const char *name, char *buf, size_t size);
+    int openAt(const char *name, int flags);
+    ~ProcDir();
+};
+
+/*
+ * Scanners over a string_view, advancing it past what they consumed.
+ * They never allocate; callers parse straight out of the read buffer.
+ */
+inline void scanSpaces(string_view &in)
+{
+    const char *pos = in.data();
+    const char *end = pos + in.size();
+    while (pos < end && (*pos == ' ' || *pos == '\t'))
+        pos++;
+    in = string_view(pos, end - pos);
+}
+
+inline bool scanSkipFields(string_view &in, int count)
+{
+    const char *pos = in.data();
+    const char *end = pos + in.size();
+    for (int i = 0; i < count; i++)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+            pos++;
+        const char *field = pos;
+        while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\n')
+            pos++;
+        if (pos == field)
+            return false;
+    }
+    in = string_view(pos, end - pos);
+    return true;
+}
+
+template <typename T>
+inline bool scanNumber(string_view &in, T &value, int base = 10)
+{
+    scanSpaces(in);
+    auto result = from_chars(in.data(), in.data() + in.size(), value, base);
+    if (result.ec != errc())
+        return false;
+    in.remove_prefix(result.ptr - in.data());
+    return true;
+}
+
+bool parseProcStat(string_view content, procStat_t &stat);
+
+#endif
@@ -0,0 +1,250 @@
+#include "ProcScanner.hh"
+#include "ProcReader.hh"
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*********************************************************************
+ * @fn      		  - listPids
+ * @brief             - This function lists the numeric subdirectories of
+ *                      a /proc like directory
+ * @param[in]         - int rootFd, vector<int> &pids
+ * @return            - bool (false if the directory cannot be read)
+ * @Note              - Uses getdents64 with a PROC_DENTS_BUF_SIZE buffer,
+ *                      a few system calls for 100k processes where readdir
+ *                      needs one per 32 KiB. PIDs come in directory order,
+ *                      which is ascending for /proc
+ *********************************************************************/
+bool listPids(int rootFd, vector<int> &pids)
+{
+    static thread_local vector<char> buf(PROC_DENTS_BUF_SIZE);
+
+    // A descriptor of our own: the directory offset is per open file
+    int fd = openat(rootFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    pids.clear();
+    ssize_t len;
+    while ((len = getdents64(fd, buf.data(), buf.size())) > 0)
+    {
+        for (ssize_t offset = 0; offset < len;)
+        {
+            const struct dirent64 *entry = reinterpret_cast<const struct dirent64 *>(buf.data() + offset);
+            offset += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (entry->d_type != DT_DIR || name[0] < '1' || name[0] > '9')
+                continue;
+            int pid;
+            auto result = from_chars(name, name + strlen(name), pid);
+            if (result.ec == errc() && *result.ptr == '\0')
+                pids.push_back(pid);
+        }
+    }
+    close(fd);
+    return len == 0;
+}
+
+/*********************************************************************
+ * @fn      		  - listProcPids
+ * @brief             - This function lists the numeric entries of /proc
+ * @param[in]         - vector<int> &pids
+ * @return            - bool (false if /proc cannot be read)
+ * @Note              - PIDs come in ascending order
+ *********************************************************************/
+bool listProcPids(vector<int> &pids)
+{
+    return listPids(procRootFd(), pids);
+}
+
+/* In Constructor initialise variables of class */
+ProcScanner::ProcScanner() : jobPids(nullptr), jobVisit(nullptr), generation(0), busy(0), stopping(false)
+{
+    slots.reset(new scanSlot_t[1]);
+    slots[0].range = 0;
+}
+
+/*********************************************************************
+ * @fn      		  - start
+ * @brief             - This function starts the helper threads
+ * @param[in]         - int threadCount (total, caller included; 0 for one
+ *                      per online CPU)
+ * @return            - none
+ * @Note              - With one thread every scan runs on the caller
+ *********************************************************************/
+void ProcScanner::start(int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = max(1, static_cast<int>(thread::hardware_concurrency()));
+
+    slots.reset(new scanSlot_t[threadCount]);
+    for (int i = 0; i < threadCount; i++)
+        slots[i].range = 0;
+    for (int i = 1; i < threadCount; i++)
+        threads.emplace_back(&ProcScanner::workerLoop, this, i);
+}
+
+/*********************************************************************
+ * @fn      		  - stop
+ * @brief             - This function stops the helper threads
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void ProcScanner::stop()
+{
+    {
+        lock_guard<mutex> guard(mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread &helper : threads)
+    {
+        if (helper.joinable())
+            helper.join();
+    }
+    threads.clear();
+}
+
+/*********************************************************************
+ * @fn      		  - takeChunk
+ * @brief             - This function takes the next chunk of slot's own range,
+ *                      or steals the last chunk of another slot's range
+ * @param[in]         - int slot, uint32_t &chunk
+ * @return            - bool (false once every range is empty)
+ * @Note              - Owner and thieves both CAS the packed range, so a chunk
+ *                      is handed out exactly once
+ *********************************************************************/
+bool ProcScanner::takeChunk(int slot, uint32_t &chunk)
+{
+    int count = concurrency();
+    for (int i = 0; i < count; i++)
+    {
+        int victim = (slot + i) % count;
+        atomic<uint64_t> &range = slots[victim].range;
+        uint64_t current = range.load(memory_order_relaxed);
+        while (true)
+        {
+            uint32_t front = static_cast<uint32_t>(current >> 32);
+            uint32_t end = static_cast<uint32_t>(current);
+            if (front >= end)
+                break;
+
+            uint64_t next;
+            if (victim == slot)
+            {
+                chunk = front;
+                next = (static_cast<uint64_t>(front + 1) << 32) | end;
+            }
+            else
+            {
+                chunk = end - 1;
+                next = (static_cast<uint64_t>(front) << 32) | (end - 1);
+            }
+            if (range.compare_exchange_weak(current, next, memory_order_relaxed))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*********************************************************************
+ * @fn      		  - work
+ * @brief             - This function visits chunks until none are left
+ * @param[in]         - int slot
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void ProcScanner::work(int slot)
+{
+    const vector<int> &pids = *jobPids;
+    uint32_t chunk;
+    while (takeChunk(slot, chunk))
+    {
+        size_t first = static_cast<size_t>(chunk) * PROC_SCAN_CHUNK;
+        size_t last = min(first + PROC_SCAN_CHUNK, pids.size());
+        for (size_t i = first; i < last; i++)
+            (*jobVisit)(slot, pids[i]);
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - workerLoop
+ * @brief             - This function runs a helper thread: it joins every
+ *                      scan started by run()
+ * @param[in]         - int slot
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void ProcScanner::workerLoop(int slot)
+{
+    uint64_t seen = 0;
+    unique_lock<mutex> lock(mtx);
+    while (true)
+    {
+        wake.wait(lock, [this, &seen] { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+
+        lock.unlock();
+        work(slot);
+        lock.lock();
+
+        if (--busy == 0)
+            finished.notify_one();
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - run
+ * @brief             - This function calls visit for every PID of pids and
+ *                      returns once all calls are done
+ * @param[in]         - const vector<int> &pids, const pidVisitor_t &visit
+ * @return            - none
+ * @Note              - Concurrent callers are serialised. Small lists are
+ *                      visited on the calling thread only
+ *********************************************************************/
+void ProcScanner::run(const vector<int> &pids, const pidVisitor_t &visit)
+{
+    lock_guard<mutex> running(runMtx);
+    if (threads.empty() || pids.size() < PROC_SCAN_PARALLEL_MIN)
+    {
+        for (int pid : pids)
+            visit(0, pid);
+        return;
+    }
+
+    uint64_t chunks = (pids.size() + PROC_SCAN_CHUNK - 1) / PROC_SCAN_CHUNK;
+    int count = concurrency();
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t front = chunks * i / count;
+        uint64_t end = chunks * (i + 1) / count;
+        slots[i].range.store((front << 32) | end, memory_order_relaxed);
+    }
+
+    {
+        lock_guard<mutex> guard(mtx);
+        jobPids = &pids;
+        jobVisit = &visit;
+        busy = static_cast<int>(threads.size());
+        generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    unique_lock<mutex> lock(mtx);
+    finished.wait(lock, [this] { return busy == 0; });
+    jobPids = nullptr;
+    jobVisit = nullptr;
+}
+
+/* In Destructor stop the helper threads */
+ProcScanner::~ProcScanner()
+{
+    stop();
+}
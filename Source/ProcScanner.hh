@@ -0,0 +1,66 @@
+#ifndef PROC_SCANNER_H
+#define PROC_SCANNER_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include "RemoteManagement.hh"
+
+#define DEFAULT_SCAN_THREADS     0          /* one per online CPU */
+#define PROC_DENTS_BUF_SIZE      (128 * 1024)
+#define PROC_SCAN_CHUNK          32         /* PIDs handed out at a time */
+#define PROC_SCAN_PARALLEL_MIN   512        /* below this the caller scans alone */
+
+/* Called once per PID; slot identifies the calling thread, 0..concurrency()-1 */
+typedef function<void(int slot, int pid)> pidVisitor_t;
+
+bool listPids(int rootFd, vector<int> &pids);
+bool listProcPids(vector<int> &pids);
+
+/*
+ * Pool visiting a PID list in parallel. The list is cut in chunks of
+ * PROC_SCAN_CHUNK and every thread, the caller included, gets a contiguous
+ * range of them. A thread takes chunks from the front of its own range and,
+ * once it is empty, steals from the back of the others', so a few slow
+ * /proc reads do not hold the whole scan back. Ranges are packed into one
+ * atomic word each, so handing out work takes no lock; visitors keep their
+ * results per slot and the caller merges them after run() returns.
+ */
+class ProcScanner
+{
+private:
+    typedef struct alignas(64)
+    {
+        atomic<uint64_t> range;     /* front chunk << 32 | end chunk */
+    } scanSlot_t;
+
+    mutex runMtx;                   /* one scan at a time */
+    mutex mtx;
+    condition_variable wake;
+    condition_variable finished;
+    vector<thread> threads;
+    unique_ptr<scanSlot_t[]> slots;
+    const vector<int> *jobPids;
+    const pidVisitor_t *jobVisit;
+    uint64_t generation;
+    int busy;
+    bool stopping;
+
+    bool takeChunk(int slot, uint32_t &chunk);
+    void work(int slot);
+    void workerLoop(int slot);
+
+public:
+    ProcScanner();
+    void start(int threadCount);
+    void stop();
+    inline int concurrency() { return static_cast<int>(threads.size()) + 1; }
+    void run(const vector<int> &pids, const pidVisitor_t &visit);
+    ~ProcScanner();
+};
+
+#endif
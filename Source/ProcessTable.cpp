@@ -0,0 +1,834 @@
+#include "ProcessTable.hh"
+#include "ProcReader.hh"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <poll.h>
+#include <fnmatch.h>
+#include <sys/eventfd.h>
+
+ProcessTable processTable;
+
+/* Index of the chunk pid belongs in: the last one starting at or before it */
+size_t ProcList::chunkOf(int pid) const
+{
+    auto it = upper_bound(firstPids.begin(), firstPids.end(), pid);
+    return it == firstPids.begin() ? 0 : static_cast<size_t>(it - firstPids.begin()) - 1;
+}
+
+/*********************************************************************
+ * @fn      		  - assign
+ * @brief             - This function lays out a pid sorted list in chunks
+ *                      of PROC_CHUNK_SIZE entries
+ * @param[in]         - vector<procEntry_t> &&sorted
+ * @return            - none
+ * @Note              - Used by full scans
+ *********************************************************************/
+void ProcList::assign(vector<procEntry_t> &&sorted)
+{
+    chunks.clear();
+    firstPids.clear();
+    count = sorted.size();
+    for (size_t start = 0; start < sorted.size(); start += PROC_CHUNK_SIZE)
+    {
+        size_t stop = min(sorted.size(), start + PROC_CHUNK_SIZE);
+        auto chunk = make_shared<procChunk_t>(make_move_iterator(sorted.begin() + start),
+                                              make_move_iterator(sorted.begin() + stop));
+        firstPids.push_back(chunk->front().pid);
+        chunks.push_back(move(chunk));
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - apply
+ * @brief             - This function makes this list prev with changes
+ *                      applied, sharing every chunk no change falls in
+ * @param[in]         - const ProcList &prev,
+ *                      vector<pair<int, procEntry_t>> &changes
+ * @return            - none
+ * @Note              - changes are sorted by pid; an entry with pid 0
+ *                      removes the pid, any other replaces or adds it.
+ *                      The entries are moved out
+ *********************************************************************/
+void ProcList::apply(const ProcList &prev, vector<pair<int, procEntry_t>> &changes)
+{
+    chunks.clear();
+    firstPids.clear();
+    count = 0;
+
+    auto keep = [this](procChunkPtr_t chunk) {
+        count += chunk->size();
+        firstPids.push_back(chunk->front().pid);
+        chunks.push_back(move(chunk));
+    };
+
+    auto change = changes.begin();
+    for (size_t index = 0; index < prev.chunks.size() || change != changes.end(); index++)
+    {
+        // Changes past the last chunk go to a new one
+        bool last = index + 1 >= prev.chunks.size();
+        auto stop = last ? changes.end() : lower_bound(change, changes.end(), prev.firstPids[index + 1],
+            [](const pair<int, procEntry_t> &entry, int pid) { return entry.first < pid; });
+        if (change == stop)
+        {
+            keep(prev.chunks[index]);
+            continue;
+        }
+
+        procChunk_t merged;
+        const procChunk_t empty;
+        const procChunk_t &old = index < prev.chunks.size() ? *prev.chunks[index] : empty;
+        merged.reserve(old.size() + (stop - change));
+        auto oldIt = old.begin();
+        for (; change != stop; ++change)
+        {
+            while (oldIt != old.end() && oldIt->pid < change->first)
+                merged.push_back(*oldIt++);
+            if (oldIt != old.end() && oldIt->pid == change->first)
+                ++oldIt;
+            if (change->second.pid)
+                merged.push_back(move(change->second));
+        }
+        merged.insert(merged.end(), oldIt, old.end());
+
+        // A chunk grown by a fork storm is cut back to the scan size
+        size_t start = 0;
+        while (start < merged.size())
+        {
+            size_t left = merged.size() - start;
+            size_t take = left < 2 * PROC_CHUNK_SIZE ? left : PROC_CHUNK_SIZE;
+            keep(make_shared<procChunk_t>(make_move_iterator(merged.begin() + start),
+                                          make_move_iterator(merged.begin() + start + take)));
+            start += take;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - find
+ * @brief             - This function looks a pid up in the list
+ * @param[in]         - int pid
+ * @return            - const procEntry_t * (nullptr if not present)
+ * @Note              - Binary search on the chunks, then in the chunk
+ *********************************************************************/
+const procEntry_t *ProcList::find(int pid) const
+{
+    if (chunks.empty())
+        return nullptr;
+    const procChunk_t &chunk = *chunks[chunkOf(pid)];
+    auto it = lower_bound(chunk.begin(), chunk.end(), pid,
+                          [](const procEntry_t &entry, int value) { return entry.pid < value; });
+    if (it == chunk.end() || it->pid != pid)
+        return nullptr;
+    return &*it;
+}
+
+/*********************************************************************
+ * @fn      		  - findProcess
+ * @brief             - This function looks a pid up in a snapshot
+ * @param[in]         - const procSnapshot_t &snap, int pid
+ * @return            - const procEntry_t * (nullptr if not present)
+ * @Note              - Binary search, entries are sorted by pid
+ *********************************************************************/
+const procEntry_t *findProcess(const procSnapshot_t &snap, int pid)
+{
+    return snap.procs.find(pid);
+}
+
+/*********************************************************************
+ * @fn      		  - findByName
+ * @brief             - This function returns the PIDs whose comm or executable
+ *                      basename equals name
+ * @param[in]         - const procSnapshot_t &snap, const string &name
+ * @return            - vector<int> (sorted, no duplicates)
+ * @Note              - Two hash lookups, no /proc access
+ *********************************************************************/
+vector<int> findByName(const procSnapshot_t &snap, const string &name)
+{
+    vector<int> pids;
+    const vector<int> *comm = snap.byComm.find(name);
+    const vector<int> *exe = snap.byExe.find(name);
+
+    if (comm)
+        pids = *comm;
+    if (exe)
+    {
+        vector<int> merged;
+        set_union(pids.begin(), pids.end(), exe->begin(), exe->end(), back_inserter(merged));
+        pids.swap(merged);
+    }
+    return pids;
+}
+
+/* Basename of argv[0], which unlike comm is not truncated */
+static string exeName(const string &argv0)
+{
+    size_t slash = argv0.rfind('/');
+    return slash == string::npos ? argv0 : argv0.substr(slash + 1);
+}
+
+/* "300-350" into its bounds, which must be valid PIDs */
+static bool parseRange(const string &text, int &first, int &last)
+{
+    const char *end = text.data() + text.size();
+    auto head = from_chars(text.data(), end, first);
+    if (head.ec != errc() || head.ptr == end || *head.ptr != '-')
+        return false;
+    auto tail = from_chars(head.ptr + 1, end, last);
+    return tail.ec == errc() && tail.ptr == end && first > 0 && first <= last;
+}
+
+/*********************************************************************
+ * @fn      		  - findTargets
+ * @brief             - This function resolves a target set into PIDs
+ * @param[in]         - const procSnapshot_t &snap, const vector<string> &targets
+ * @return            - vector<int> (sorted, no duplicates)
+ * @Note              - A target is a PID, taken as is if positive, a range such as
+ *                      300-350, matching the running PIDs in it, a name
+ *                      looked up in the indexes, or a glob such as 'java*'
+ *                      matched against comm and the executable name. Ranges
+ *                      and globs are all matched in one pass over the table.
+ *                      0 and negative PIDs are dropped: kill() would take
+ *                      them as a process group or every process
+ *********************************************************************/
+vector<int> findTargets(const procSnapshot_t &snap, const vector<string> &targets)
+{
+    vector<int> pids;
+    vector<pair<int, int>> ranges;
+    vector<const char *> globs;
+
+    for (const string &target : targets)
+    {
+        int first, last;
+        auto result = from_chars(target.data(), target.data() + target.size(), first);
+        if (!target.empty() && result.ec == errc() && result.ptr == target.data() + target.size())
+        {
+            if (first > 0)
+                pids.push_back(first);
+        }
+        else if (parseRange(target, first, last))
+            ranges.emplace_back(first, last);
+        else if (target.find_first_of("*?[") != string::npos)
+            globs.push_back(target.c_str());
+        else
+        {
+            vector<int> named = findByName(snap, target);
+            pids.insert(pids.end(), named.begin(), named.end());
+        }
+    }
+
+    if (!ranges.empty() || !globs.empty())
+    {
+        for (const procEntry_t &proc : snap.procs)
+        {
+            bool match = any_of(ranges.begin(), ranges.end(), [&proc](const pair<int, int> &range) {
+                return proc.pid >= range.first && proc.pid <= range.second;
+            });
+            if (!match && !globs.empty())
+            {
+                string exe = exeName(proc.argv0);
+                match = any_of(globs.begin(), globs.end(), [&proc, &exe](const char *glob) {
+                    return fnmatch(glob, proc.comm.c_str(), 0) == 0 || (!exe.empty() && fnmatch(glob, exe.c_str(), 0) == 0);
+                });
+            }
+            if (match)
+                pids.push_back(proc.pid);
+        }
+    }
+
+    sort(pids.begin(), pids.end());
+    pids.erase(unique(pids.begin(), pids.end()), pids.end());
+    return pids;
+}
+
+/*********************************************************************
+ * @fn      		  - writable
+ * @brief             - This function returns the shard of name for writing,
+ *                      copying it first if another index shares it
+ * @param[in]         - const string &name
+ * @return            - nameBuckets_t &
+ * @Note              - Only called on a snapshot not published yet, so a
+ *                      shard held once is this index's own
+ *********************************************************************/
+nameBuckets_t &NameIndex::writable(const string &name)
+{
+    shared_ptr<nameBuckets_t> &shard = shards[shardOf(name)];
+    if (!shard)
+        shard = make_shared<nameBuckets_t>();
+    else if (shard.use_count() > 1)
+        shard = make_shared<nameBuckets_t>(*shard);
+    return *shard;
+}
+
+/* PIDs listed under name, nullptr if none */
+const vector<int> *NameIndex::find(const string &name) const
+{
+    const shared_ptr<nameBuckets_t> &shard = shards[shardOf(name)];
+    if (!shard)
+        return nullptr;
+    auto it = shard->find(name);
+    return it == shard->end() ? nullptr : &it->second;
+}
+
+void NameIndex::add(const string &name, int pid)
+{
+    if (name.empty())
+        return;
+    vector<int> &pids = writable(name)[name];
+    pids.insert(lower_bound(pids.begin(), pids.end(), pid), pid);
+}
+
+void NameIndex::remove(const string &name, int pid)
+{
+    const vector<int> *listed = find(name);
+    if (!listed || !binary_search(listed->begin(), listed->end(), pid))
+        return;
+    nameBuckets_t &buckets = writable(name);
+    auto it = buckets.find(name);
+    vector<int> &pids = it->second;
+    pids.erase(lower_bound(pids.begin(), pids.end(), pid));
+    if (pids.empty())
+        buckets.erase(it);
+}
+
+/* Adds proc to both name indexes of snap, or removes it */
+static void indexProcess(procSnapshot_t &snap, const procEntry_t &proc, bool add)
+{
+    if (add)
+    {
+        snap.byComm.add(proc.comm, proc.pid);
+        snap.byExe.add(exeName(proc.argv0), proc.pid);
+    }
+    else
+    {
+        snap.byComm.remove(proc.comm, proc.pid);
+        snap.byExe.remove(exeName(proc.argv0), proc.pid);
+    }
+}
+
+/* Same process as in the previous snapshot and it has not exec'd since */
+static bool sameImage(const procEntry_t &a, const procEntry_t &b)
+{
+    return a.starttime == b.starttime && a.comm == b.comm;
+}
+
+/*********************************************************************
+ * @fn      		  - readStat
+ * @brief             - This function fills entry from <dir>/stat
+ * @param[in]         - ProcDir &dir, int pid, procEntry_t &entry
+ * @return            - bool (false if the process is gone)
+ * @Note              -
+ *********************************************************************/
+static bool readStat(ProcDir &dir, int pid, procEntry_t &entry)
+{
+    static const long pageKb = sysconf(_SC_PAGESIZE) / 1024;
+    string_view content;
+    procStat_t stat;
+    if (!dir.read("stat", content) || !parseProcStat(content, stat))
+        return false;
+
+    entry.pid = pid;
+    entry.comm.assign(stat.comm.data(), stat.comm.size());
+    entry.state = stat.state;
+    entry.ppid = stat.ppid;
+    entry.utime = stat.utime;
+    entry.stime = stat.stime;
+    entry.starttime = stat.starttime;
+    entry.vsizeKb = static_cast<long>(stat.vsize / 1024);
+    entry.rssKb = stat.rss * pageKb;
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - readCmdline
+ * @brief             - This function fills argv0 and cmdline from <dir>/cmdline
+ * @param[in]         - ProcDir &dir, procEntry_t &entry
+ * @return            - none
+ * @Note              - Empty for kernel threads
+ *********************************************************************/
+static void readCmdline(ProcDir &dir, procEntry_t &entry)
+{
+    string_view content;
+    entry.argv0.clear();
+    entry.cmdline.clear();
+    if (!dir.read("cmdline", content))
+        return;
+
+    while (!content.empty() && content.back() == '\0')
+        content.remove_suffix(1);
+    string_view argv0 = content.substr(0, content.find('\0'));
+    entry.argv0.assign(argv0.data(), argv0.size());
+    entry.cmdline.assign(content.data(), content.size());
+    replace(entry.cmdline.begin(), entry.cmdline.end(), '\0', ' ');
+}
+
+/*********************************************************************
+ * @fn      		  - readProcStat
+ * @brief             - This function reads the fields of /proc/<pid>/stat
+ * @param[in]         - int pid, procEntry_t &entry
+ * @return            - bool (false if the process is gone)
+ * @Note              -
+ *********************************************************************/
+bool readProcStat(int pid, procEntry_t &entry)
+{
+    ProcDir dir(pid);
+    return readStat(dir, pid, entry);
+}
+
+/*********************************************************************
+ * @fn      		  - readProcEntry
+ * @brief             - This function reads one process from /proc/<pid>/stat
+ *                      and /proc/<pid>/cmdline
+ * @param[in]         - int pid, procEntry_t &entry
+ * @return            - bool (false if the process is gone)
+ * @Note              -
+ *********************************************************************/
+bool readProcEntry(int pid, procEntry_t &entry)
+{
+    ProcDir dir(pid);
+    if (!readStat(dir, pid, entry))
+        return false;
+    readCmdline(dir, entry);
+    return true;
+}
+
+/* In Constructor initialise variables of class */
+/* Versions start at the current time in µs, so a version a client kept from
+   before a server restart never matches one of the new instance */
+ProcessTable::ProcessTable() : stopping(false), intervalMs(DEFAULT_SNAPSHOT_INTERVAL_MS),
+    nextVersion(chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count())
+{
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+/*********************************************************************
+ * @fn      		  - start
+ * @brief             - This function takes the first snapshot and starts the
+ *                      background collector
+ * @param[in]         - int intervalMs, bool procEvents, int scanThreads
+ * @return            - none
+ * @Note              - Subscribes before the first scan so that no process
+ *                      started in between is missed
+ *********************************************************************/
+void ProcessTable::start(int intervalMs, bool procEvents, int scanThreads)
+{
+    this->intervalMs = max(1, intervalMs);
+    scanner.start(scanThreads);
+    if (procEvents && !events.open())
+        cerr << "Proc connector unavailable, polling /proc every " << this->intervalMs << " ms" << endl;
+    publish(scan());
+    collector = thread(&ProcessTable::collectorLoop, this);
+}
+
+/*********************************************************************
+ * @fn      		  - stop
+ * @brief             - This function stops the background collector
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void ProcessTable::stop()
+{
+    stopping = true;
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+    if (collector.joinable())
+        collector.join();
+    scanner.stop();
+}
+
+/*********************************************************************
+ * @fn      		  - snapshot
+ * @brief             - This function returns the latest published snapshot
+ * @param[in]         - none
+ * @return            - snapshotPtr_t
+ * @Note              - Lock-free for readers; takes one if none exists yet
+ *********************************************************************/
+snapshotPtr_t ProcessTable::snapshot()
+{
+    snapshotPtr_t snap = atomic_load(&current);
+    return snap ? snap : refresh();
+}
+
+/*********************************************************************
+ * @fn      		  - refresh
+ * @brief             - This function walks /proc now, publishes the result
+ *                      and returns it
+ * @param[in]         - none
+ * @return            - snapshotPtr_t
+ * @Note              - Used for requests asking for a forced fresh read
+ *********************************************************************/
+snapshotPtr_t ProcessTable::refresh()
+{
+    snapshotPtr_t snap = scan();
+    publish(snap);
+    return snap;
+}
+
+/*********************************************************************
+ * @fn      		  - scan
+ * @brief             - This function builds a new snapshot from /proc
+ * @param[in]         - none
+ * @return            - snapshotPtr_t
+ * @Note              - The PIDs are read in parallel; prev is only read
+ *********************************************************************/
+snapshotPtr_t ProcessTable::scan()
+{
+    snapshotPtr_t prev = atomic_load(&current);
+    auto snap = make_shared<procSnapshot_t>();
+    snap->version = nextVersion.fetch_add(1);
+    snap->takenAt = chrono::steady_clock::now();
+    snap->eventDriven = isEventDriven();
+
+    vector<int> pids;
+    if (!listProcPids(pids))
+    {
+#ifdef DEBUG
+        cerr << "Failed to list /proc directory." << endl;
+#endif
+        return snap;
+    }
+
+    // One result list per scanner thread, concatenated once the scan is over
+    vector<vector<procEntry_t>> found(scanner.concurrency());
+    scanner.run(pids, [&prev, &found](int slot, int pid) {
+        ProcDir dir(pid);
+        procEntry_t proc;
+        if (!readStat(dir, pid, proc))
+            return;
+
+        // cmdline only changes on exec, so unchanged processes keep the old one
+        const procEntry_t *old = prev ? findProcess(*prev, pid) : nullptr;
+        if (old && sameImage(*old, proc))
+        {
+            proc.argv0 = old->argv0;
+            proc.cmdline = old->cmdline;
+        }
+        else
+        {
+            readCmdline(dir, proc);
+        }
+        found[slot].push_back(move(proc));
+    });
+
+    size_t total = 0;
+    for (const vector<procEntry_t> &part : found)
+        total += part.size();
+    vector<procEntry_t> procs;
+    procs.reserve(total);
+    for (vector<procEntry_t> &part : found)
+        move(part.begin(), part.end(), back_inserter(procs));
+
+    // Stolen chunks arrive out of order
+    sort(procs.begin(), procs.end(), [](const procEntry_t &a, const procEntry_t &b) { return a.pid < b.pid; });
+    snap->procs.assign(move(procs));
+    reindex(*snap, prev.get());
+    return snap;
+}
+
+/*********************************************************************
+ * @fn      		  - applyChanges
+ * @brief             - This function derives a new snapshot from the current
+ *                      one by re-reading only the processes in changes
+ * @param[in]         - const procChanges_t &changes, procChangeSet_t &delta
+ * @return            - snapshotPtr_t
+ * @Note              - /proc reads, copies and index updates are
+ *                      proportional to the churn, not to the number of
+ *                      processes. delta gets the listing changes from the
+ *                      current snapshot, for publish()
+ *********************************************************************/
+snapshotPtr_t ProcessTable::applyChanges(const procChanges_t &changes, procChangeSet_t &delta)
+{
+    snapshotPtr_t prev = atomic_load(&current);
+    auto snap = make_shared<procSnapshot_t>();
+    snap->version = nextVersion.fetch_add(1);
+    snap->takenAt = chrono::steady_clock::now();
+    snap->eventDriven = true;
+
+    // pid 0 marks a process that is gone
+    vector<pair<int, procEntry_t>> updates;
+    updates.reserve(changes.size());
+    for (const auto &change : changes)
+    {
+        procEntry_t proc = {};
+        if (change.second != PROC_CHANGED || !readProcEntry(change.first, proc))
+            proc.pid = 0;
+        updates.emplace_back(change.first, move(proc));
+    }
+    sort(updates.begin(), updates.end(),
+         [](const pair<int, procEntry_t> &a, const pair<int, procEntry_t> &b) { return a.first < b.first; });
+
+    snap->byComm = prev->byComm;
+    snap->byExe = prev->byExe;
+    delta = {prev->version, snap->version, {}};
+    for (const auto &update : updates)
+    {
+        const procEntry_t *old = prev->procs.find(update.first);
+        const procEntry_t *proc = update.second.pid ? &update.second : nullptr;
+        if (!old && !proc)
+            continue;
+        if (old && proc && sameImage(*old, *proc) && old->argv0 == proc->argv0)
+            continue;
+        if (old)
+            indexProcess(*snap, *old, false);
+        if (proc)
+            indexProcess(*snap, *proc, true);
+        delta.changes.emplace_back(update.first, !old ? PROC_DELTA_ADDED : !proc ? PROC_DELTA_REMOVED : PROC_DELTA_CHANGED);
+    }
+
+    snap->procs.apply(prev->procs, updates);
+    return snap;
+}
+
+/*********************************************************************
+ * @fn      		  - reindex
+ * @brief             - This function builds the name indexes of snap by
+ *                      applying the changes since prev to prev's indexes
+ * @param[in]         - procSnapshot_t &snap, const procSnapshot_t *prev
+ * @return            - none
+ * @Note              - Both process lists are sorted by pid, so the changes
+ *                      are found with one merge pass
+ *********************************************************************/
+void ProcessTable::reindex(procSnapshot_t &snap, const procSnapshot_t *prev)
+{
+    if (!prev)
+    {
+        for (const procEntry_t &proc : snap.procs)
+            indexProcess(snap, proc, true);
+        return;
+    }
+
+    snap.byComm = prev->byComm;
+    snap.byExe = prev->byExe;
+
+    auto drop = [&snap](const procEntry_t &proc) { indexProcess(snap, proc, false); };
+    auto add = [&snap](const procEntry_t &proc) { indexProcess(snap, proc, true); };
+
+    auto oldIt = prev->procs.begin();
+    auto newIt = snap.procs.begin();
+    while (oldIt != prev->procs.end() || newIt != snap.procs.end())
+    {
+        if (newIt == snap.procs.end() || (oldIt != prev->procs.end() && oldIt->pid < newIt->pid))
+        {
+            drop(*oldIt++);
+        }
+        else if (oldIt == prev->procs.end() || newIt->pid < oldIt->pid)
+        {
+            add(*newIt++);
+        }
+        else
+        {
+            if (!sameImage(*oldIt, *newIt) || oldIt->argv0 != newIt->argv0)
+            {
+                drop(*oldIt);
+                add(*newIt);
+            }
+            ++oldIt;
+            ++newIt;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - publish
+ * @brief             - This function makes snap the current snapshot unless a
+ *                      newer one was published meanwhile
+ * @param[in]         - const snapshotPtr_t &snap, procChangeSet_t *delta
+ * @return            - none
+ * @Note              - Only writers serialise on publishMtx. The listing
+ *                      changes from the replaced snapshot are kept for
+ *                      changesSince(), and the /proc descriptors of the
+ *                      processes that left are closed. Both come from delta
+ *                      when it starts at the replaced snapshot, otherwise
+ *                      from a pass over the whole table
+ *********************************************************************/
+void ProcessTable::publish(const snapshotPtr_t &snap, procChangeSet_t *delta)
+{
+    lock_guard<mutex> guard(publishMtx);
+    snapshotPtr_t old = atomic_load(&current);
+    if (old && old->version >= snap->version)
+        return;
+
+    // Another writer may have published since delta's base was taken
+    bool incremental = old && delta && delta->fromVersion == old->version;
+    if (old)
+    {
+        procChangeSet_t set = {old->version, snap->version, {}};
+        if (incremental)
+        {
+            set.changes.swap(delta->changes);
+            for (const auto &change : set.changes)
+            {
+                if (change.second != PROC_DELTA_ADDED)
+                    procDirCache.forget(change.first);
+            }
+        }
+        else
+            diff(*old, *snap, set.changes);
+
+        lock_guard<mutex> historyGuard(historyMtx);
+        history.push_back(move(set));
+        if (history.size() > PROC_DELTA_HISTORY)
+            history.pop_front();
+    }
+    atomic_store(&current, snap);
+    if (incremental)
+        return;
+
+    // Cached /proc/<pid> descriptors live as long as their process is listed
+    procDirCache.retain([&snap](int pid, unsigned long long &starttime) {
+        const procEntry_t *proc = findProcess(*snap, pid);
+        if (proc)
+            starttime = proc->starttime;
+        return proc != nullptr;
+    });
+}
+
+/*********************************************************************
+ * @fn      		  - diff
+ * @brief             - This function lists the processes of the listing
+ *                      that differ between prev and snap
+ * @param[in]         - const procSnapshot_t &prev, const procSnapshot_t &snap,
+ *                      procDeltaList_t &changes
+ * @return            - none
+ * @Note              - One merge pass over the two pid sorted lists
+ *********************************************************************/
+void ProcessTable::diff(const procSnapshot_t &prev, const procSnapshot_t &snap, procDeltaList_t &changes)
+{
+    auto oldIt = prev.procs.begin();
+    auto newIt = snap.procs.begin();
+    while (oldIt != prev.procs.end() || newIt != snap.procs.end())
+    {
+        if (newIt == snap.procs.end() || (oldIt != prev.procs.end() && oldIt->pid < newIt->pid))
+        {
+            changes.emplace_back(oldIt->pid, PROC_DELTA_REMOVED);
+            ++oldIt;
+        }
+        else if (oldIt == prev.procs.end() || newIt->pid < oldIt->pid)
+        {
+            changes.emplace_back(newIt->pid, PROC_DELTA_ADDED);
+            ++newIt;
+        }
+        else
+        {
+            if (!sameImage(*oldIt, *newIt) || oldIt->argv0 != newIt->argv0)
+                changes.emplace_back(newIt->pid, PROC_DELTA_CHANGED);
+            ++oldIt;
+            ++newIt;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - changesSince
+ * @brief             - This function computes how the listing of snap differs
+ *                      from the published version since
+ * @param[in]         - uint64_t since, const procSnapshot_t &snap,
+ *                      procDeltaList_t &changes
+ * @return            - bool (false when since is too old or unknown, the
+ *                      client then needs the full listing)
+ * @Note              - The change sets from since to snap are folded per
+ *                      pid: whether it existed at since is told by its first
+ *                      change, whether it exists now by snap itself
+ *********************************************************************/
+bool ProcessTable::changesSince(uint64_t since, const procSnapshot_t &snap, procDeltaList_t &changes)
+{
+    map<int, procDelta_e> first;
+    {
+        lock_guard<mutex> guard(historyMtx);
+        auto it = find_if(history.begin(), history.end(),
+                          [since](const procChangeSet_t &set) { return set.fromVersion == since; });
+        if (it == history.end())
+            return false;
+
+        uint64_t reached = since;
+        for (; it != history.end() && reached != snap.version; ++it)
+        {
+            if (it->fromVersion != reached)
+                return false;
+            for (const auto &change : it->changes)
+                first.emplace(change.first, change.second);
+            reached = it->toVersion;
+        }
+        if (reached != snap.version)
+            return false;
+    }
+
+    changes.clear();
+    for (const auto &entry : first)
+    {
+        bool existed = entry.second != PROC_DELTA_ADDED;
+        bool exists = findProcess(snap, entry.first) != nullptr;
+        if (existed && exists)
+            changes.emplace_back(entry.first, PROC_DELTA_CHANGED);
+        else if (existed)
+            changes.emplace_back(entry.first, PROC_DELTA_REMOVED);
+        else if (exists)
+            changes.emplace_back(entry.first, PROC_DELTA_ADDED);
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - collectorLoop
+ * @brief             - This function keeps the snapshot current, either by
+ *                      rescanning every intervalMs or from proc connector events
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Events are coalesced for PROC_EVENTS_BATCH_MS so a fork
+ *                      storm publishes a handful of snapshots, not one per fork
+ *********************************************************************/
+void ProcessTable::collectorLoop()
+{
+    using namespace chrono;
+    bool eventDriven = isEventDriven();
+    auto rescanEvery = milliseconds(eventDriven ? PROC_RECONCILE_INTERVAL_MS : intervalMs);
+    auto nextScan = steady_clock::now() + rescanEvery;
+    auto nextApply = steady_clock::now();
+    procChanges_t changes;
+    struct pollfd fds[2] = {{wakeFd, POLLIN, 0}, {events.getFd(), POLLIN, 0}};
+
+    while (!stopping)
+    {
+        auto now = steady_clock::now();
+        if (now >= nextScan)
+        {
+            changes.clear();
+            publish(scan());
+            nextScan = now + rescanEvery;
+            continue;
+        }
+
+        if (!changes.empty() && now >= nextApply)
+        {
+            procChangeSet_t delta;
+            snapshotPtr_t snap = applyChanges(changes, delta);
+            publish(snap, &delta);
+            changes.clear();
+            nextApply = now + milliseconds(PROC_EVENTS_BATCH_MS);
+            continue;
+        }
+
+        auto wakeAt = changes.empty() ? nextScan : min(nextScan, nextApply);
+        auto timeout = duration_cast<milliseconds>(wakeAt - now).count() + 1;
+        if (poll(fds, eventDriven ? 2 : 1, static_cast<int>(timeout)) < 0 && errno != EINTR)
+            break;
+
+        if (eventDriven && (fds[1].revents & POLLIN) && !events.drain(changes))
+        {
+#ifdef DEBUG
+            cerr << "Proc connector lost events, rescanning /proc" << endl;
+#endif
+            nextScan = steady_clock::now();
+        }
+    }
+}
+
+/* In Destructor stop the collector thread */
+ProcessTable::~ProcessTable()
+{
+    stop();
+    if (wakeFd >= 0)
+        close(wakeFd);
+}
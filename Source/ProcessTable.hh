@@ -0,0 +1,216 @@
+#ifndef PROCESS_TABLE_H
+#define PROCESS_TABLE_H
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <deque>
+#include "RemoteManagement.hh"
+#include "ProcEvents.hh"
+#include "ProcScanner.hh"
+
+#define DEFAULT_SNAPSHOT_INTERVAL_MS 1000
+#define PROC_EVENTS_BATCH_MS         50
+#define PROC_RECONCILE_INTERVAL_MS   60000
+#define PROC_DELTA_HISTORY           256    /* published versions a delta can start from */
+#define PROC_CHUNK_SIZE              64     /* entries per chunk of a full scan */
+#define NAME_INDEX_SHARDS            256    /* copy-on-write shards of a name index */
+
+/* One row of the process table, as read from /proc/<pid>/{stat,cmdline} */
+typedef struct
+{
+    int pid;
+    int ppid;
+    char state;
+    string comm;
+    string argv0;
+    string cmdline;
+    long rssKb;
+    long vsizeKb;
+    unsigned long utime;
+    unsigned long stime;
+    unsigned long long starttime;
+} procEntry_t;
+
+typedef vector<procEntry_t> procChunk_t;
+typedef shared_ptr<const procChunk_t> procChunkPtr_t;
+
+/*
+ * Process list of a snapshot, sorted by pid. The entries live in immutable
+ * chunks that a derived snapshot shares with the one it came from, so
+ * applying a batch of changes copies only the chunks holding a changed pid
+ * and the chunk pointers, not every entry. Chunks are never empty; a chunk
+ * grown past twice PROC_CHUNK_SIZE is split, and full scans lay the list
+ * out again in even chunks.
+ */
+class ProcList
+{
+private:
+    vector<procChunkPtr_t> chunks;
+    vector<int> firstPids;      /* per chunk, for the binary search */
+    size_t count;
+
+    size_t chunkOf(int pid) const;
+
+public:
+    class const_iterator
+    {
+    private:
+        const vector<procChunkPtr_t> *chunks;
+        size_t chunk;
+        size_t entry;
+
+    public:
+        const_iterator(const vector<procChunkPtr_t> *chunks, size_t chunk) : chunks(chunks), chunk(chunk), entry(0) {}
+        inline const procEntry_t &operator*() const { return (*(*chunks)[chunk])[entry]; }
+        inline const procEntry_t *operator->() const { return &**this; }
+        inline bool operator==(const const_iterator &other) const { return chunk == other.chunk && entry == other.entry; }
+        inline bool operator!=(const const_iterator &other) const { return !(*this == other); }
+        inline const_iterator &operator++()
+        {
+            if (++entry == (*chunks)[chunk]->size())
+            {
+                chunk++;
+                entry = 0;
+            }
+            return *this;
+        }
+        inline const_iterator operator++(int)
+        {
+            const_iterator before = *this;
+            ++*this;
+            return before;
+        }
+    };
+
+    ProcList() : count(0) {}
+    void assign(vector<procEntry_t> &&sorted);
+    void apply(const ProcList &prev, vector<pair<int, procEntry_t>> &changes);
+    const procEntry_t *find(int pid) const;
+    inline const_iterator begin() const { return const_iterator(&chunks, 0); }
+    inline const_iterator end() const { return const_iterator(&chunks, chunks.size()); }
+    inline size_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+};
+
+typedef unordered_map<string, vector<int>> nameBuckets_t;
+
+/*
+ * Name -> PIDs; PID lists are kept sorted. The names are spread by hash
+ * over NAME_INDEX_SHARDS shards that a derived snapshot shares with the
+ * one it came from. A shard is copied on the first write to one of its
+ * names, so a batch of changes copies the buckets of the names it touched
+ * and their few shard neighbours, not the whole index.
+ */
+class NameIndex
+{
+private:
+    array<shared_ptr<nameBuckets_t>, NAME_INDEX_SHARDS> shards;
+
+    inline size_t shardOf(const string &name) const { return hash<string>()(name) % NAME_INDEX_SHARDS; }
+    nameBuckets_t &writable(const string &name);
+
+public:
+    const vector<int> *find(const string &name) const;
+    void add(const string &name, int pid);
+    void remove(const string &name, int pid);
+};
+
+/* Immutable once published; entries are sorted by pid */
+typedef struct
+{
+    uint64_t version;
+    chrono::steady_clock::time_point takenAt;
+    ProcList procs;
+    NameIndex byComm;       /* comm, truncated to 15 chars by the kernel */
+    NameIndex byExe;        /* basename of argv[0], not truncated */
+    bool eventDriven;       /* counters are only as fresh as the last full scan */
+} procSnapshot_t;
+
+typedef shared_ptr<const procSnapshot_t> snapshotPtr_t;
+
+/* How a process of the get-process listing differs from an older version */
+typedef enum
+{
+    PROC_DELTA_ADDED,
+    PROC_DELTA_REMOVED,
+    PROC_DELTA_CHANGED,     /* same pid, other program (exec or pid reuse) */
+} procDelta_e;
+
+typedef vector<pair<int, procDelta_e>> procDeltaList_t;
+
+/* Listing changes between two consecutively published snapshots */
+typedef struct
+{
+    uint64_t fromVersion;
+    uint64_t toVersion;
+    procDeltaList_t changes;
+} procChangeSet_t;
+
+const procEntry_t *findProcess(const procSnapshot_t &snap, int pid);
+vector<int> findByName(const procSnapshot_t &snap, const string &name);
+vector<int> findTargets(const procSnapshot_t &snap, const vector<string> &targets);
+bool readProcEntry(int pid, procEntry_t &entry);
+bool readProcStat(int pid, procEntry_t &entry);
+
+/*
+ * Background collector keeping a periodic snapshot of /proc. Commands read
+ * the latest snapshot through an atomically swapped shared pointer, so any
+ * number of clients share one /proc walk per interval instead of doing
+ * their own. refresh() forces a fresh walk for callers that opt in.
+ * Each snapshot is derived from the previous one: only PIDs that appeared,
+ * exited or exec'd have their cmdline re-read and their name index entries
+ * updated.
+ * With the proc connector backend the collector does not poll at all: it
+ * applies fork/exec/exit events in batches and only walks /proc on the
+ * reconcile interval or after the kernel reports lost events. A batch
+ * costs in proportion to its changes: it shares the unchanged chunks of
+ * the process list, and its listing delta and descriptor cache upkeep
+ * come from the changed PIDs instead of a pass over the whole table.
+ * Full walks list /proc with getdents64 and read the PIDs on a ProcScanner.
+ * Every publish also records which listing entries changed since the
+ * previous snapshot, so a client holding an older version of the listing
+ * can be sent only the difference.
+ */
+class ProcessTable
+{
+private:
+    snapshotPtr_t current;
+    mutex publishMtx;
+    atomic<bool> stopping;
+    int wakeFd;
+    int intervalMs;
+    atomic<uint64_t> nextVersion;
+    mutex historyMtx;
+    deque<procChangeSet_t> history;
+    ProcEvents events;
+    ProcScanner scanner;
+    thread collector;
+
+    snapshotPtr_t scan();
+    snapshotPtr_t applyChanges(const procChanges_t &changes, procChangeSet_t &delta);
+    static void reindex(procSnapshot_t &snap, const procSnapshot_t *prev);
+    static void diff(const procSnapshot_t &prev, const procSnapshot_t &snap, procDeltaList_t &changes);
+    void publish(const snapshotPtr_t &snap, procChangeSet_t *delta = nullptr);
+    void collectorLoop();
+
+public:
+    ProcessTable();
+    void start(int intervalMs, bool procEvents, int scanThreads);
+    inline bool isEventDriven() { return events.getFd() >= 0; }
+    void stop();
+    snapshotPtr_t snapshot();
+    snapshotPtr_t refresh();
+    bool changesSince(uint64_t since, const procSnapshot_t &snap, procDeltaList_t &changes);
+    ~ProcessTable();
+};
+
+extern ProcessTable processTable;
+
+#endif
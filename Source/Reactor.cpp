@@ -0,0 +1,574 @@
+#include "Reactor.hh"
+#include "ExecuteCommands.hh"
+#include "NetworkValidator.hh"
+#include "WatchHub.hh"
+#include "ServerStats.hh"
+#include <sys/epoll.h>
+#include <fcntl.h>
+
+extern serverConfig_t serverConfig;
+
+/* Backlog of a connection above the high water marks, reading must stop */
+static inline bool backlogHigh(const reactorConn_t &conn)
+{
+    return conn.txBuf.size() - conn.txOffset >= REACTOR_TX_HIGH_WATER || conn.inFlight >= REACTOR_INFLIGHT_MAX;
+}
+
+/* Backlog of a connection back to the low water marks, reading may resume */
+static inline bool backlogLow(const reactorConn_t &conn)
+{
+    return conn.txBuf.size() - conn.txOffset <= REACTOR_TX_LOW_WATER && conn.inFlight <= REACTOR_INFLIGHT_MAX / 2;
+}
+
+/*********************************************************************
+ * @fn      		  - setNonBlocking
+ * @brief             - This function switches the socket to non-blocking mode
+ * @param[in]         - int fd
+ * @return            - bool
+ * @Note              -
+ *********************************************************************/
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/*********************************************************************
+ * @fn      		  - Reactor() [parameterised constructor]
+ * @brief             - This constructor initialise the object of the class
+ *                      with the listening socket, the number of I/O threads
+ *                      and the pool the commands are executed on
+ * @param[in]         - int listenSock, int ioThreadCount, WorkerPool &pool
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+Reactor::Reactor(int listenSock, int ioThreadCount, WorkerPool &pool)
+    : listenSock(listenSock), ioThreadCount(max(1, ioThreadCount)), pool(pool), nextConnId(1)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - run
+ * @brief             - This function starts the I/O threads and waits for them
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Thread count stays constant whatever the number of clients
+ *********************************************************************/
+void Reactor::run()
+{
+    if (!setNonBlocking(listenSock))
+    {
+#ifdef DEBUG
+        cerr << "Failed to make listening socket non-blocking" << endl;
+#endif
+        return;
+    }
+
+    for (int i = 0; i < ioThreadCount; i++)
+    {
+        unique_ptr<ioContext_t> ctx(new ioContext_t());
+        ctx->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (ctx->epollFd < 0 || ctx->doneQueue.getWakeFd() < 0)
+        {
+#ifdef DEBUG
+            cerr << "Failed to create epoll/eventfd" << endl;
+#endif
+            return;
+        }
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.fd = listenSock;
+        epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, listenSock, &event);
+
+        event.events = EPOLLIN;
+        event.data.fd = ctx->doneQueue.getWakeFd();
+        epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, ctx->doneQueue.getWakeFd(), &event);
+
+        contexts.push_back(move(ctx));
+    }
+
+    for (auto &ctx : contexts)
+        ioThreads.emplace_back(&Reactor::ioLoop, this, ctx.get());
+
+    for (auto &ioThread : ioThreads)
+        ioThread.join();
+}
+
+/*********************************************************************
+ * @fn      		  - ioLoop
+ * @brief             - This function is the event loop of one I/O thread: it
+ *                      accepts clients, reads and parses frames, writes the
+ *                      responses handed back by the workers and drops clients
+ *                      that stopped heartbeating
+ * @param[in]         - ioContext_t *ctx
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Reactor::ioLoop(ioContext_t *ctx)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    auto lastSweep = chrono::steady_clock::now();
+    int wakeFd = ctx->doneQueue.getWakeFd();
+
+    while (true)
+    {
+        // Poll faster while a connection waits for room in the worker queue,
+        // and not at all if workers handed back results since the last drain
+        int timeout = ctx->stalled.empty() ? REACTOR_TICK_MS : REACTOR_RETRY_MS;
+        bool canSleep = ctx->doneQueue.prepareWait();
+        int ready = epoll_wait(ctx->epollFd, events, MAX_EPOLL_EVENTS, canSleep ? timeout : 0);
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (canSleep)
+            ctx->doneQueue.cancelWait();
+
+        for (int i = 0; i < ready; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listenSock)
+            {
+                acceptClients(*ctx);
+                continue;
+            }
+            if (fd == wakeFd)
+            {
+                ctx->doneQueue.finishWait();
+                continue;
+            }
+
+            auto it = ctx->conns.find(fd);
+            if (it == ctx->conns.end())
+                continue;
+
+            reactorConn_t &conn = it->second;
+            bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+
+            if (alive && (events[i].events & EPOLLIN))
+                alive = readClient(conn) && processFrames(*ctx, conn);
+
+            if (alive)
+                alive = flushClient(conn) && resumeClient(*ctx, conn);
+
+            if (alive)
+                updateEvents(*ctx, conn);
+            else
+                closeClient(*ctx, fd);
+        }
+
+        drainCompletions(*ctx);
+        retryStalled(*ctx);
+
+        auto now = chrono::steady_clock::now();
+        if (now - lastSweep >= chrono::milliseconds(REACTOR_TICK_MS))
+        {
+            expireIdleClients(*ctx);
+            lastSweep = now;
+        }
+    }
+
+    for (auto &entry : ctx->conns)
+        close(entry.first);
+    close(ctx->epollFd);
+}
+
+/*********************************************************************
+ * @fn      		  - acceptClients
+ * @brief             - This function accepts every pending connection and
+ *                      registers it with this thread's epoll instance
+ * @param[in]         - ioContext_t &ctx
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Reactor::acceptClients(ioContext_t &ctx)
+{
+    while (true)
+    {
+        int clientSocket = accept4(listenSock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket < 0)
+        {
+#ifdef DEBUG
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                cerr << "Accept failed" << endl;
+#endif
+            return;
+        }
+#ifdef DEBUG
+        cout << "New client connected: " << clientSocket << endl;
+#endif
+        reactorConn_t conn = {};
+        conn.fd = clientSocket;
+        conn.id = nextConnId.fetch_add(1, memory_order_relaxed);
+        conn.events = EPOLLIN | EPOLLRDHUP;
+        conn.session = {0, MESSAGE_SIZE};
+        conn.lastRx = chrono::steady_clock::now();
+
+        struct epoll_event event = {};
+        event.events = conn.events;
+        event.data.fd = clientSocket;
+        if (epoll_ctl(ctx.epollFd, EPOLL_CTL_ADD, clientSocket, &event) < 0)
+        {
+            close(clientSocket);
+            continue;
+        }
+        ctx.conns.emplace(clientSocket, move(conn));
+        serverStats.connectionOpened();
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - readClient
+ * @brief             - This function drains the socket into the receive buffer
+ * @param[in]         - reactorConn_t &conn
+ * @return            - bool (false when the client closed or errored)
+ * @Note              - Reads at most REACTOR_RX_MAX bytes ahead
+ *********************************************************************/
+bool Reactor::readClient(reactorConn_t &conn)
+{
+    char buffer[64 * 1024];
+
+    while (true)
+    {
+        uint64_t start = statNow();
+        ssize_t received = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (received > 0)
+        {
+            serverStats.record(STAT_ROW_IO, STAT_PHASE_RECEIVE, statNow() - start);
+            serverStats.count(STAT_BYTES_RECEIVED, received);
+            conn.rxBuf.append(buffer, received);
+            conn.lastRx = chrono::steady_clock::now();
+            // The rest waits in the socket, epoll reports it again
+            if (conn.rxBuf.size() >= REACTOR_RX_MAX)
+                return true;
+            continue;
+        }
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+#ifdef DEBUG
+        cerr << "Connection Close by Client\n";
+#endif
+        return false;
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - processFrames
+ * @brief             - This function handles every complete frame in the receive
+ *                      buffer and hands commands to the worker pool; a partial
+ *                      frame, or a command the full pool could not take, is kept
+ *                      until it can be handled. So are the frames after the
+ *                      backlog went above its high water mark
+ * @param[in]         - ioContext_t &ctx, reactorConn_t &conn
+ * @return            - bool (false when the stream is corrupt)
+ * @Note              - The first frame of a connection must be the hello
+ *********************************************************************/
+bool Reactor::processFrames(ioContext_t &ctx, reactorConn_t &conn)
+{
+    size_t offset = 0;
+    frameHeader_t hdr;
+    string payload;
+
+    conn.stalled = false;
+    conn.throttled = false;
+    while (true)
+    {
+        // Responses pile up faster than the client reads them
+        if (conn.handshakeDone && backlogHigh(conn))
+        {
+            conn.throttled = true;
+            break;
+        }
+
+        long consumed = decodeFrame(conn.rxBuf.data() + offset, conn.rxBuf.size() - offset, hdr, payload);
+        if (consumed < 0)
+            return false;
+        if (consumed == 0)
+            break;
+
+        MessageHeader in;
+        uint64_t start = statNow();
+        if (!in.decode(hdr, payload))
+            return false;
+        uint64_t parseNs = statNow() - start;
+#ifdef DEBUG
+        in.printHeader();
+#endif
+        if (!conn.handshakeDone)
+        {
+            MessageHeader reply;
+            if (!acceptHello(in, serverConfig.maxFrameSize, conn.session, reply))
+                return false;
+            conn.txBuf += reply.encode();
+            conn.handshakeDone = true;
+        }
+        else if (MSG_TYPE_CMD == in.getMsgType() && ((in.getOptions() & CMD_OPT_WATCH) || CMD_UNWATCH == in.getCommand()))
+        {
+            // Handled by the watch hub right here, updates come back through doneQueue
+            ioContext_t *owner = &ctx;
+            int fd = conn.fd;
+            uint64_t connId = conn.id;
+            size_t frameSize = conn.session.maxFrameSize;
+            uint32_t requestId = in.getRequestId();
+            string resp;
+
+            if (in.getOptions() & CMD_OPT_WATCH)
+                resp = watchHub.subscribe(connId, in, [owner, fd, connId, frameSize, requestId](string &&update)
+                {
+                    reactorDone_t done = {fd, connId, string(), false};
+                    appendStream(done.frames, FRAME_FLAG_FROM_SERVER, update, frameSize, requestId);
+                    if (!owner->doneQueue.push(move(done)))
+                        return OFFER_DROPPED;
+                    serverStats.count(STAT_FRAMES_SENT, statStreamFrames(update.size(), frameSize, requestId));
+                    return OFFER_DELIVERED;
+                });
+            else
+                resp = watchHub.unsubscribe(connId, in.getWatchId());
+            if (!resp.empty())
+            {
+                appendStream(conn.txBuf, FRAME_FLAG_FROM_SERVER, resp, frameSize, requestId,
+                             (in.getOptions() & CMD_OPT_WATCH) ? CMD_STATUS_INVALID : CMD_STATUS_OK);
+                serverStats.count(STAT_FRAMES_SENT, statStreamFrames(resp.size(), frameSize, requestId));
+            }
+        }
+        else if (cmdNeedsResponse(in))
+        {
+            ioContext_t *owner = &ctx;
+            int fd = conn.fd;
+            uint64_t connId = conn.id;
+            size_t frameSize = conn.session.maxFrameSize;
+            uint32_t requestId = in.getRequestId();
+            int row = statRow(in);
+
+            workItem_t item = {in, [owner, fd, connId, frameSize, requestId, row](string &&resp, cmdStatus_e status)
+            {
+                reactorDone_t done = {fd, connId, string(), true};
+                uint64_t start = statNow();
+                appendStream(done.frames, FRAME_FLAG_FROM_SERVER, resp, frameSize, requestId, status);
+                serverStats.record(row, STAT_PHASE_SERIALIZE, statNow() - start);
+                serverStats.count(STAT_FRAMES_SENT, statStreamFrames(resp.size(), frameSize, requestId));
+
+                // Parked in the spill list while the queue is full, the worker never waits
+                owner->doneQueue.pushOrSpill(move(done));
+            }};
+
+            if (!pool.trySubmit(item))
+            {
+                // Leave this frame in rxBuf and stop reading from the client
+                conn.stalled = true;
+                ctx.stalled.push_back(conn.fd);
+                break;
+            }
+            conn.inFlight++;
+        }
+        serverStats.record(statRow(in), STAT_PHASE_PARSE, parseNs);
+        serverStats.count(STAT_FRAMES_RECEIVED);
+        offset += consumed;
+    }
+
+    conn.rxBuf.erase(0, offset);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - flushClient
+ * @brief             - This function writes as much of the pending responses as
+ *                      the socket accepts
+ * @param[in]         - reactorConn_t &conn
+ * @return            - bool (false on write error)
+ * @Note              -
+ *********************************************************************/
+bool Reactor::flushClient(reactorConn_t &conn)
+{
+    while (conn.txOffset < conn.txBuf.size())
+    {
+        uint64_t start = statNow();
+        ssize_t sent = send(conn.fd, conn.txBuf.data() + conn.txOffset,
+                            conn.txBuf.size() - conn.txOffset, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            serverStats.record(STAT_ROW_IO, STAT_PHASE_SEND, statNow() - start);
+            serverStats.count(STAT_BYTES_SENT, sent);
+        }
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        conn.txOffset += sent;
+    }
+
+    if (conn.txOffset == conn.txBuf.size())
+    {
+        conn.txBuf.clear();
+        conn.txOffset = 0;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - resumeClient
+ * @brief             - This function handles the frames parked while the
+ *                      backlog was high, once it is back to the low marks
+ * @param[in]         - ioContext_t &ctx, reactorConn_t &conn
+ * @return            - bool (false when the stream is corrupt or a write failed)
+ * @Note              -
+ *********************************************************************/
+bool Reactor::resumeClient(ioContext_t &ctx, reactorConn_t &conn)
+{
+    if (!conn.throttled || !backlogLow(conn))
+        return true;
+    return processFrames(ctx, conn) && flushClient(conn);
+}
+
+/*********************************************************************
+ * @fn      		  - updateEvents
+ * @brief             - This function watches EPOLLIN only while the connection
+ *                      is neither stalled on a full worker queue nor throttled
+ *                      by its backlog, and EPOLLOUT only
+ *                      while something is left to send
+ * @param[in]         - ioContext_t &ctx, reactorConn_t &conn
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Reactor::updateEvents(ioContext_t &ctx, reactorConn_t &conn)
+{
+    uint32_t events = EPOLLRDHUP;
+    if (!conn.stalled && !conn.throttled)
+        events |= EPOLLIN;
+    if (!conn.txBuf.empty())
+        events |= EPOLLOUT;
+
+    if (events != conn.events)
+    {
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.fd = conn.fd;
+        epoll_ctl(ctx.epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+        conn.events = events;
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - drainCompletions
+ * @brief             - This function moves the frames produced by the workers
+ *                      into the connections' send buffers; results for a
+ *                      connection that has gone away are dropped
+ * @param[in]         - ioContext_t &ctx
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Reactor::drainCompletions(ioContext_t &ctx)
+{
+    reactorDone_t result;
+
+    while (ctx.doneQueue.tryPop(result))
+    {
+        auto it = ctx.conns.find(result.fd);
+        if (it == ctx.conns.end() || it->second.id != result.connId)
+            continue;
+
+        reactorConn_t &conn = it->second;
+        conn.txBuf += result.frames;
+        if (result.answer)
+            conn.inFlight--;
+        if (flushClient(conn) && resumeClient(ctx, conn))
+            updateEvents(ctx, conn);
+        else
+            closeClient(ctx, result.fd);
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - retryStalled
+ * @brief             - This function offers the parked commands of stalled
+ *                      connections to the worker pool again
+ * @param[in]         - ioContext_t &ctx
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Reactor::retryStalled(ioContext_t &ctx)
+{
+    if (ctx.stalled.empty())
+        return;
+
+    vector<int> stalled;
+    stalled.swap(ctx.stalled);
+
+    for (int fd : stalled)
+    {
+        auto it = ctx.conns.find(fd);
+        if (it == ctx.conns.end() || !it->second.stalled)
+            continue;
+
+        reactorConn_t &conn = it->second;
+        if (processFrames(ctx, conn) && flushClient(conn))
+            updateEvents(ctx, conn);
+        else
+            closeClient(ctx, fd);
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - closeClient
+ * @brief             - This function unregisters and closes a client socket
+ * @param[in]         - ioContext_t &ctx, int fd
+ * @return            - none
+ * @Note              - The client's watches are cancelled
+ *********************************************************************/
+void Reactor::closeClient(ioContext_t &ctx, int fd)
+{
+    auto it = ctx.conns.find(fd);
+    if (it != ctx.conns.end())
+    {
+        watchHub.dropClient(it->second.id);
+        serverStats.connectionClosed();
+    }
+
+    epoll_ctl(ctx.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    ctx.conns.erase(fd);
+}
+
+/*********************************************************************
+ * @fn      		  - expireIdleClients
+ * @brief             - This function closes clients that sent nothing (not even
+ *                      a heartbeat) for two heartbeat periods
+ * @param[in]         - ioContext_t &ctx
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Reactor::expireIdleClients(ioContext_t &ctx)
+{
+    auto deadline = chrono::steady_clock::now() - chrono::seconds(2 * HEARTBEAT_TIMEOUT);
+    vector<int> expired;
+
+    for (auto &entry : ctx.conns)
+    {
+        // A stalled or throttled client is not idle, its input is parked on our side
+        if (entry.second.lastRx < deadline && !entry.second.stalled && !entry.second.throttled)
+            expired.push_back(entry.first);
+    }
+
+    for (int fd : expired)
+    {
+#ifdef DEBUG
+        cerr << "Heartbeat timeout for client " << fd << endl;
+#endif
+        closeClient(ctx, fd);
+    }
+}
+
+/* In Destructor De-initialise variables of class */
+Reactor::~Reactor()
+{
+    for (auto &ioThread : ioThreads)
+    {
+        if (ioThread.joinable())
+            ioThread.join();
+    }
+}
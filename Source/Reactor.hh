@@ -0,0 +1,104 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <vector>
+#include <thread>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+#include "WorkerPool.hh"
+#include "MpscQueue.hh"
+
+#define DEFAULT_IO_THREADS  2
+#define MAX_EPOLL_EVENTS    64
+#define REACTOR_TICK_MS     1000
+#define REACTOR_RETRY_MS    10
+#define DONE_QUEUE_SIZE     4096
+
+/* Per connection backlog: reading stops above the high marks, resumes at the low ones */
+#define REACTOR_TX_HIGH_WATER   (1024 * 1024)           /* response bytes not yet sent */
+#define REACTOR_TX_LOW_WATER    (REACTOR_TX_HIGH_WATER / 2)
+#define REACTOR_INFLIGHT_MAX    1024                    /* commands not yet answered */
+#define REACTOR_RX_MAX          (1024 * 1024)           /* request bytes read ahead */
+
+/* State of one client connection, owned by a single I/O thread */
+typedef struct
+{
+    int fd;
+    uint64_t id;
+    bool handshakeDone;
+    bool stalled;
+    bool throttled;         /* backlog above the high water mark, not reading */
+    size_t inFlight;        /* commands handed to the pool, not drained yet */
+    uint32_t events;
+    session_t session;
+    string rxBuf;
+    string txBuf;
+    size_t txOffset;
+    chrono::steady_clock::time_point lastRx;
+} reactorConn_t;
+
+/* Response frames produced by a worker for a connection of an I/O thread */
+typedef struct
+{
+    int fd;
+    uint64_t connId;
+    string frames;
+    bool answer;            /* completes a command, false for watch updates */
+} reactorDone_t;
+
+/* Everything owned by one I/O thread; only doneQueue is touched by workers */
+typedef struct
+{
+    int epollFd;
+    MpscQueue<reactorDone_t> doneQueue{DONE_QUEUE_SIZE};
+    unordered_map<int, reactorConn_t> conns;
+    vector<int> stalled;
+} ioContext_t;
+
+/*
+ * Non-blocking epoll server: a fixed number of I/O threads, each with its
+ * own epoll instance and connection table. The listening socket is shared
+ * by all of them with EPOLLEXCLUSIVE so a new client wakes only one thread,
+ * which then owns the connection for its whole lifetime.
+ * Commands run on the worker pool; their frames come back through the
+ * thread's lock-free doneQueue and its eventfd wakeup. When the pool is full the
+ * connection stops being read until there is room again. The same happens
+ * while a connection has more unsent response bytes or unanswered commands
+ * than its high water marks, until both are back to the low ones, so a
+ * client that does not read its answers holds a bounded amount of memory.
+ */
+class Reactor
+{
+private:
+    int listenSock;
+    int ioThreadCount;
+    WorkerPool &pool;
+    vector<thread> ioThreads;
+    vector<unique_ptr<ioContext_t>> contexts;
+    atomic<uint64_t> nextConnId;
+
+    void ioLoop(ioContext_t *ctx);
+    void acceptClients(ioContext_t &ctx);
+    bool readClient(reactorConn_t &conn);
+    bool processFrames(ioContext_t &ctx, reactorConn_t &conn);
+    bool flushClient(reactorConn_t &conn);
+    bool resumeClient(ioContext_t &ctx, reactorConn_t &conn);
+    void updateEvents(ioContext_t &ctx, reactorConn_t &conn);
+    void drainCompletions(ioContext_t &ctx);
+    void retryStalled(ioContext_t &ctx);
+    void closeClient(ioContext_t &ctx, int fd);
+    void expireIdleClients(ioContext_t &ctx);
+
+public:
+    Reactor(int listenSock, int ioThreadCount, WorkerPool &pool);
+    void run();
+    ~Reactor();
+};
+
+#endif
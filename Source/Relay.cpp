@@ -0,0 +1,639 @@
+#include "Relay.hh"
+#include "ExecuteCommands.hh"
+#include "NetworkValidator.hh"
+#include <fcntl.h>
+#include <poll.h>
+
+extern appType_e appType;
+extern serverConfig_t serverConfig;
+
+/* Whether a client is too far behind to be read, with hysteresis between the marks */
+static bool backlogged(relayClient_t &client)
+{
+    if (client.throttled)
+        client.throttled = client.txBuf.size() > RELAY_TX_LOW_WATER || client.pending > RELAY_PENDING_MAX / 2;
+    else
+        client.throttled = client.txBuf.size() >= RELAY_TX_HIGH_WATER || client.pending >= RELAY_PENDING_MAX;
+    return client.throttled;
+}
+
+/* In Constructor initialise variables of class */
+Relay::Relay(int listenFd, uint32_t ttlMs, uint32_t timeoutMs)
+    : listenFd(listenFd), ttlMs(ttlMs), timeoutMs(timeoutMs), nextQueryId(1), nextClientId(1)
+{
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+}
+
+/*********************************************************************
+ * @fn      		  - addAgents
+ * @brief             - This function adds the downstream agents of a list,
+ *                      see parseHostList
+ * @param[in]         - const string &list, uint16_t defaultPort
+ * @return            - bool
+ * @Note              - Agents that cannot be resolved are never retried
+ *********************************************************************/
+bool Relay::addAgents(const string &list, uint16_t defaultPort)
+{
+    if (!parseHostList(list, defaultPort, agents))
+        return false;
+    for (const fanoutHost_t &agent : agents)
+        reachable.push_back(agent.state != HOST_DOWN);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - cacheKey
+ * @brief             - This function names what a request asks for, so equal
+ *                      requests share one query and its cached answer
+ * @param[in]         - MessageHeader &in
+ * @return            - string
+ * @Note              - The request ID is not part of it
+ *********************************************************************/
+string Relay::cacheKey(MessageHeader &in)
+{
+    if (MSG_TYPE_BATCH != in.getMsgType())
+        return in.describe() + "|" + to_string(in.getWindowMs()) + "|" + to_string(in.getOptions());
+
+    string key = "batch";
+    for (MessageHeader &item : in.getBatch())
+        key += ";" + cacheKey(item);
+    return key;
+}
+
+/*********************************************************************
+ * @fn      		  - sharable
+ * @brief             - This function tells whether a request only reads, so
+ *                      its answer may be shared and cached
+ * @param[in]         - MessageHeader &in
+ * @return            - bool
+ * @Note              - kill, restart-process and --fresh are never shared
+ *********************************************************************/
+bool Relay::sharable(MessageHeader &in)
+{
+    if (MSG_TYPE_BATCH == in.getMsgType())
+    {
+        for (MessageHeader &item : in.getBatch())
+        {
+            if (!sharable(item))
+                return false;
+        }
+        return true;
+    }
+    return CMD_KILL_PROCESS != in.getCommand() && CMD_RESTART_PROCESS != in.getCommand() &&
+           !(in.getOptions() & CMD_OPT_FRESH);
+}
+
+/*********************************************************************
+ * @fn      		  - acceptClients
+ * @brief             - This function accepts every pending client connection
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Relay::acceptClients()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        relayClient_t client = {};
+        client.fd = fd;
+        client.id = nextClientId++;
+        clients[fd] = move(client);
+#ifdef DEBUG
+        cout << "Relay: client connected on fd " << fd << endl;
+#endif
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - flushClient
+ * @brief             - This function writes as much of the pending responses as
+ *                      the socket accepts
+ * @param[in]         - relayClient_t &client
+ * @return            - bool (false on write error)
+ * @Note              -
+ *********************************************************************/
+bool Relay::flushClient(relayClient_t &client)
+{
+    size_t offset = 0;
+    while (offset < client.txBuf.size())
+    {
+        ssize_t sent = send(client.fd, client.txBuf.data() + offset, client.txBuf.size() - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+            break;
+        }
+        offset += sent;
+    }
+    client.txBuf.erase(0, offset);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - processClientFrames
+ * @brief             - This function handles the complete frames buffered for
+ *                      a client
+ * @param[in]         - relayClient_t &client
+ * @return            - bool (false if the client must be closed)
+ * @Note              - While an untagged request is answered the following
+ *                      frames stay buffered, the client expects its answers
+ *                      in order. So do they while the client is backlogged
+ *********************************************************************/
+bool Relay::processClientFrames(relayClient_t &client)
+{
+    size_t offset = 0;
+    frameHeader_t hdr;
+    string payload;
+    while (!client.waiting && !backlogged(client))
+    {
+        long consumed = decodeFrame(client.rxBuf.data() + offset, client.rxBuf.size() - offset, hdr, payload);
+        if (consumed < 0)
+            return false;
+        if (consumed == 0)
+            break;
+        offset += consumed;
+
+        MessageHeader in;
+        if (!in.decode(hdr, payload))
+            return false;
+        if (!client.handshakeDone)
+        {
+            MessageHeader reply;
+            if (!acceptHello(in, serverConfig.maxFrameSize, client.session, reply))
+                return false;
+            // Only what the relay itself implements is offered
+            client.session.caps &= RELAY_CAPS;
+            reply.MessageHello(APPTYPE_SERVER, client.session.caps, client.session.maxFrameSize);
+            client.txBuf += reply.encode();
+            client.handshakeDone = true;
+        }
+        else if (cmdNeedsResponse(in))
+            handleRequest(client, in);
+    }
+    client.rxBuf.erase(0, offset);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - handleRequest
+ * @brief             - This function answers a client request from the cache,
+ *                      joins it to the same query in flight or sends it to
+ *                      the agents
+ * @param[in]         - relayClient_t &client, MessageHeader &in
+ * @return            - none
+ * @Note              - Watches are not relayed
+ *********************************************************************/
+void Relay::handleRequest(relayClient_t &client, MessageHeader &in)
+{
+    relayWaiter_t waiter = {client.fd, client.id, in.getRequestId()};
+    if (!waiter.requestId)
+        client.waiting = true;
+    client.pending++;
+
+    if (MSG_TYPE_CMD == in.getMsgType() && ((in.getOptions() & CMD_OPT_WATCH) || CMD_UNWATCH == in.getCommand()))
+    {
+        if (in.getOptions() & CMD_OPT_WATCH)
+            answer(waiter, "Error: watch is not available through a relay\n", CMD_STATUS_INVALID);
+        else
+            answer(waiter, "No watch running\n", CMD_STATUS_OK);
+        return;
+    }
+
+    if (!sharable(in))
+    {
+        startQuery(in, string(), waiter);
+        return;
+    }
+
+    string key = cacheKey(in);
+    auto cached = cache.find(key);
+    if (cached != cache.end() && cached->second.expires > chrono::steady_clock::now())
+    {
+        answer(waiter, cached->second.text, cached->second.status);
+        return;
+    }
+    auto running = sharedQueries.find(key);
+    if (running != sharedQueries.end())
+    {
+        queries[running->second].waiters.push_back(waiter);
+        return;
+    }
+    startQuery(in, key, waiter);
+}
+
+/*********************************************************************
+ * @fn      		  - startQuery
+ * @brief             - This function sends a request to every ready agent
+ * @param[in]         - MessageHeader &in, const string &key,
+ *                      const relayWaiter_t &waiter
+ * @return            - none
+ * @Note              - Agents that are not connected are reported DOWN in
+ *                      the answer
+ *********************************************************************/
+void Relay::startQuery(MessageHeader &in, const string &key, const relayWaiter_t &waiter)
+{
+    uint32_t id = nextQueryId++;
+    if (!nextQueryId)
+        nextQueryId = 1;        // 0 means untagged
+
+    relayQuery_t &query = queries[id];
+    query.key = key;
+    query.outputs.resize(agents.size());
+    query.statuses.assign(agents.size(), CMD_STATUS_OK);
+    query.notes.resize(agents.size());
+    query.pending.assign(agents.size(), 0);
+    query.outstanding = 0;
+    query.timedOut = false;
+    query.deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    query.waiters.push_back(waiter);
+    if (!key.empty())
+        sharedQueries[key] = id;
+
+    in.setRequestId(id);
+    string frame = in.encode();
+    for (size_t i = 0; i < agents.size(); i++)
+    {
+        if (agents[i].state != HOST_READY)
+        {
+            query.notes[i] = "DOWN (" + agents[i].error + ")";
+            continue;
+        }
+        query.pending[i] = 1;
+        query.outstanding++;
+    }
+
+    // Sending may take an agent down, which settles its part right away
+    size_t sendTo = query.outstanding;
+    for (size_t i = 0; i < agents.size() && sendTo; i++)
+    {
+        if (queries.find(id) == queries.end() || !queries[id].pending[i])
+            continue;
+        sendTo--;
+        agents[i].txBuf += frame;
+        if (!flushHost(agents[i]))
+            agentDown(i, "send failed");
+    }
+    if (queries.find(id) != queries.end() && queries[id].outstanding == 0)
+        finishQuery(id);
+}
+
+/*********************************************************************
+ * @fn      		  - handleAgentFrame
+ * @brief             - This function adds a frame received from an agent to
+ *                      the query it answers
+ * @param[in]         - size_t agent, MessageHeader &in
+ * @return            - none
+ * @Note              - Answers to a query that timed out are dropped
+ *********************************************************************/
+void Relay::handleAgentFrame(size_t agent, MessageHeader &in)
+{
+    if (MSG_TYPE_HELLO == in.getMsgType())
+    {
+        if (!(agents[agent].session.caps & CAP_REQUEST_ID))
+            agentDown(agent, "agent does not support request IDs");
+#ifdef DEBUG
+        else
+            cout << "Relay: agent " << agents[agent].name << " ready" << endl;
+#endif
+        return;
+    }
+
+    auto found = queries.find(in.getRequestId());
+    if (found == queries.end() || !found->second.pending[agent])
+        return;
+    relayQuery_t &query = found->second;
+    if (MSG_TYPE_RESPONSE == in.getMsgType())
+        query.outputs[agent] += in.getResponseMsg();
+    else if (MSG_TYPE_END_OF_RESPONSE == in.getMsgType())
+    {
+        query.statuses[agent] = in.getStatus();
+        query.pending[agent] = 0;
+        if (--query.outstanding == 0)
+            finishQuery(found->first);
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - agentDown
+ * @brief             - This function closes the connection of an agent and
+ *                      settles its part of every query in flight
+ * @param[in]         - size_t agent, const string &reason
+ * @return            - none
+ * @Note              - It is connected again after RELAY_RECONNECT_MS
+ *********************************************************************/
+void Relay::agentDown(size_t agent, const string &reason)
+{
+    fanoutHost_t &host = agents[agent];
+    if (host.fd >= 0)
+        close(host.fd);
+    host.fd = -1;
+    host.state = HOST_DOWN;
+    host.error = reason;
+    host.rxBuf.clear();
+    host.txBuf.clear();
+    host.deadline = chrono::steady_clock::now() + chrono::milliseconds(RELAY_RECONNECT_MS);
+#ifdef DEBUG
+    cout << "Relay: agent " << host.name << " down (" << reason << ")" << endl;
+#endif
+
+    vector<uint32_t> settled;
+    for (auto &entry : queries)
+    {
+        relayQuery_t &query = entry.second;
+        if (!query.pending[agent])
+            continue;
+        query.pending[agent] = 0;
+        query.notes[agent] = "DOWN (" + reason + ")";
+        if (--query.outstanding == 0)
+            settled.push_back(entry.first);
+    }
+    for (uint32_t id : settled)
+        finishQuery(id);
+}
+
+/*********************************************************************
+ * @fn      		  - finishQuery
+ * @brief             - This function composes the answer of a query, caches
+ *                      it and sends it to every waiting client
+ * @param[in]         - uint32_t id
+ * @return            - none
+ * @Note              - Agents are listed in the order they were given; the
+ *                      status is the worst one an agent reported. Answers
+ *                      with an agent timed out are not cached
+ *********************************************************************/
+void Relay::finishQuery(uint32_t id)
+{
+    auto found = queries.find(id);
+    if (found == queries.end())
+        return;
+    relayQuery_t query = move(found->second);
+    queries.erase(found);
+
+    string text;
+    cmdStatus_e status = CMD_STATUS_OK;
+    for (size_t i = 0; i < agents.size(); i++)
+    {
+        if (!query.notes[i].empty())
+        {
+            text += agents[i].name + ": " + query.notes[i] + "\n";
+            continue;
+        }
+        text += hostReport(agents[i].name, query.outputs[i], query.statuses[i]);
+        status = max(status, query.statuses[i]);
+    }
+
+    if (!query.key.empty())
+        sharedQueries.erase(query.key);
+    if (!query.key.empty() && !query.timedOut)
+    {
+        auto now = chrono::steady_clock::now();
+        if (cache.size() >= RELAY_CACHE_ENTRIES)
+        {
+            for (auto entry = cache.begin(); entry != cache.end();)
+                entry = (entry->second.expires <= now) ? cache.erase(entry) : next(entry);
+            if (cache.size() >= RELAY_CACHE_ENTRIES)
+                cache.erase(cache.begin());
+        }
+        cache[query.key] = {text, status, now + chrono::milliseconds(ttlMs)};
+    }
+
+    for (const relayWaiter_t &waiter : query.waiters)
+        answer(waiter, text, status);
+}
+
+/*********************************************************************
+ * @fn      		  - answer
+ * @brief             - This function sends an answer to a waiting client
+ * @param[in]         - const relayWaiter_t &waiter, const string &text,
+ *                      cmdStatus_e status
+ * @return            - none
+ * @Note              - Dropped if the client went away meanwhile
+ *********************************************************************/
+void Relay::answer(const relayWaiter_t &waiter, const string &text, cmdStatus_e status)
+{
+    auto found = clients.find(waiter.fd);
+    if (found == clients.end() || found->second.id != waiter.clientId)
+        return;
+    relayClient_t &client = found->second;
+    appendStream(client.txBuf, FRAME_FLAG_FROM_SERVER, text, client.session.maxFrameSize, waiter.requestId,
+                 (client.session.caps & CAP_CMD_STATUS) ? status : CMD_STATUS_OK);
+    client.pending--;
+    if (!waiter.requestId)
+        client.waiting = false;
+}
+
+/*********************************************************************
+ * @fn      		  - sendHeartbeats
+ * @brief             - This function keeps the agent connections alive
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Relay::sendHeartbeats()
+{
+    MessageHeader heartbeat;
+    heartbeat.MessageHeartBeat(appType);
+    string frame = heartbeat.encode();
+    for (size_t i = 0; i < agents.size(); i++)
+    {
+        if (agents[i].state != HOST_READY)
+            continue;
+        agents[i].txBuf += frame;
+        if (!flushHost(agents[i]))
+            agentDown(i, "send failed");
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - run
+ * @brief             - This function serves clients and keeps the agents
+ *                      connected until the process is stopped
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void Relay::run()
+{
+    auto now = chrono::steady_clock::now();
+    for (size_t i = 0; i < agents.size(); i++)
+    {
+        string error;
+        agents[i].deadline = now + chrono::milliseconds(timeoutMs);
+        if (reachable[i] && !connectHost(agents[i], error))
+            agentDown(i, error);
+    }
+    auto nextHeartbeat = now + chrono::milliseconds(HEARTBEAT_INTERVAL_MS);
+    vector<struct pollfd> fds;
+    vector<size_t> owners;      // agent index, or agents.size() for clients
+
+#ifdef DEBUG
+    cout << "Relay serving " << agents.size() << " agent(s)" << endl;
+#endif
+    while (true)
+    {
+        now = chrono::steady_clock::now();
+        for (size_t i = 0; i < agents.size(); i++)
+        {
+            fanoutHost_t &agent = agents[i];
+            if (!reachable[i] || agent.deadline > now)
+                continue;
+            if (agent.state == HOST_DOWN)
+            {
+                string error;
+                agent.deadline = now + chrono::milliseconds(timeoutMs);
+                if (!connectHost(agent, error))
+                    agentDown(i, error);
+            }
+            else if (agent.state != HOST_READY)
+                agentDown(i, "timed out connecting");
+        }
+
+        vector<uint32_t> expired;
+        for (auto &entry : queries)
+        {
+            if (entry.second.deadline <= now)
+                expired.push_back(entry.first);
+        }
+        for (uint32_t id : expired)
+        {
+            relayQuery_t &query = queries[id];
+            for (size_t i = 0; i < agents.size(); i++)
+            {
+                if (query.pending[i])
+                    query.notes[i] = "TIMEOUT after " + to_string(timeoutMs) + " ms";
+                query.pending[i] = 0;
+            }
+            query.timedOut = true;
+            finishQuery(id);
+        }
+
+        if (now >= nextHeartbeat)
+        {
+            sendHeartbeats();
+            nextHeartbeat = now + chrono::milliseconds(HEARTBEAT_INTERVAL_MS);
+        }
+
+        // Frames held back behind an answered untagged request or a backlog
+        vector<int> closed;
+        for (auto &entry : clients)
+        {
+            relayClient_t &client = entry.second;
+            bool open = client.txBuf.empty() || flushClient(client);
+            if (open && !client.waiting && !client.rxBuf.empty())
+                open = processClientFrames(client) && (client.txBuf.empty() || flushClient(client));
+            if (!open)
+                closed.push_back(entry.first);
+        }
+        for (int fd : closed)
+        {
+            close(fd);
+            clients.erase(fd);
+        }
+
+        fds.clear();
+        owners.clear();
+        fds.push_back({listenFd, POLLIN, 0});
+        owners.push_back(agents.size());
+        auto wakeAt = nextHeartbeat;
+        for (auto &entry : clients)
+        {
+            short events = entry.second.waiting || backlogged(entry.second) ? 0 : POLLIN;
+            if (!entry.second.txBuf.empty())
+                events |= POLLOUT;
+            fds.push_back({entry.first, events, 0});
+            owners.push_back(agents.size());
+        }
+        for (size_t i = 0; i < agents.size(); i++)
+        {
+            fanoutHost_t &agent = agents[i];
+            if (reachable[i] && agent.state != HOST_READY)
+                wakeAt = min(wakeAt, agent.deadline);
+            if (agent.fd < 0)
+                continue;
+            short events = POLLIN;
+            if (agent.state == HOST_CONNECTING || !agent.txBuf.empty())
+                events |= POLLOUT;
+            fds.push_back({agent.fd, events, 0});
+            owners.push_back(i);
+        }
+        for (auto &entry : queries)
+            wakeAt = min(wakeAt, entry.second.deadline);
+        int waitMs = static_cast<int>(max<long>(0, chrono::duration_cast<chrono::milliseconds>(wakeAt - now).count() + 1));
+
+        if (poll(fds.data(), fds.size(), waitMs) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (!fds[i].revents)
+                continue;
+            if (owners[i] < agents.size())
+            {
+                size_t index = owners[i];
+                fanoutHost_t &agent = agents[index];
+                if (agent.fd != fds[i].fd)
+                    continue;       // closed by an earlier event of this round
+                string error;
+                if (!serviceHost(agent, fds[i].revents, [this, index](MessageHeader &in) { handleAgentFrame(index, in); }, error))
+                    agentDown(index, error);
+                continue;
+            }
+            if (fds[i].fd == listenFd)
+            {
+                acceptClients();
+                continue;
+            }
+
+            auto found = clients.find(fds[i].fd);
+            if (found == clients.end())
+                continue;
+            relayClient_t &client = found->second;
+            bool open = true;
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                char buffer[64 * 1024];
+                ssize_t len = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (len > 0)
+                {
+                    client.rxBuf.append(buffer, len);
+                    open = processClientFrames(client);
+                }
+                else if (len == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))
+                    open = false;
+            }
+            if (open && !client.txBuf.empty())
+                open = flushClient(client);
+            if (!open)
+            {
+#ifdef DEBUG
+                cout << "Relay: client on fd " << client.fd << " disconnected" << endl;
+#endif
+                close(client.fd);
+                clients.erase(found);
+            }
+        }
+    }
+}
+
+/* In Destructor close the connections */
+Relay::~Relay()
+{
+    for (fanoutHost_t &agent : agents)
+    {
+        if (agent.fd >= 0)
+            close(agent.fd);
+    }
+    for (auto &entry : clients)
+        close(entry.first);
+}
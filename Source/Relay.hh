@@ -0,0 +1,109 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <chrono>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+#include "FanoutClient.hh"
+
+#define DEFAULT_RELAY_TTL_MS    2000
+#define RELAY_RECONNECT_MS      2000
+#define RELAY_CACHE_ENTRIES     4096
+#define RELAY_CAPS              (CAP_HEARTBEAT | CAP_REQUEST_ID | CAP_CMD_STATUS)
+
+/* Per client backlog: reading stops above the high marks, resumes at the low ones */
+#define RELAY_TX_HIGH_WATER     (1024 * 1024)       /* answer bytes not yet sent */
+#define RELAY_TX_LOW_WATER      (RELAY_TX_HIGH_WATER / 2)
+#define RELAY_PENDING_MAX       1024                /* requests not answered yet */
+
+/* A client connected to the relay */
+typedef struct
+{
+    int fd;
+    uint64_t id;                /* connection serial, so a reused fd is told apart */
+    session_t session;
+    bool handshakeDone;
+    bool waiting;               /* an untagged request is being answered */
+    bool throttled;             /* backlog above the high water mark, not reading */
+    size_t pending;             /* requests not answered yet */
+    string rxBuf;
+    string txBuf;
+} relayClient_t;
+
+/* A client request waiting for a query */
+typedef struct
+{
+    int fd;
+    uint64_t clientId;
+    uint32_t requestId;
+} relayWaiter_t;
+
+/* One command sent to every agent */
+typedef struct
+{
+    string key;                 /* cache key, empty for commands never shared */
+    vector<string> outputs;     /* per agent */
+    vector<cmdStatus_e> statuses;
+    vector<string> notes;       /* per agent, why it did not answer */
+    vector<char> pending;       /* per agent, answer still owed */
+    size_t outstanding;
+    bool timedOut;              /* an agent did not answer in time, not cached */
+    chrono::steady_clock::time_point deadline;
+    vector<relayWaiter_t> waiters;
+} relayQuery_t;
+
+/* Combined answer of every agent, served until it expires */
+typedef struct
+{
+    string text;
+    cmdStatus_e status;
+    chrono::steady_clock::time_point expires;
+} relayCacheEntry_t;
+
+/*
+ * Relay mode (-r): a server for clients that runs their commands on a set
+ * of downstream agents over persistent connections, reconnecting to
+ * agents that go away. A command goes out to every agent once however
+ * many clients ask for it at the same time, and the combined answer, one
+ * "<agent>:" prefixed line per line of output, is cached for a short TTL
+ * so operators repeating the same query do not add load on the managed
+ * hosts. kill, restart-process and --fresh reads always reach the agents.
+ * A client with too many unanswered requests or unsent answer bytes is not
+ * read until it has caught up. Everything runs on one thread around poll().
+ */
+class Relay
+{
+private:
+    int listenFd;
+    vector<fanoutHost_t> agents;
+    vector<char> reachable;     /* per agent, worth reconnecting to */
+    map<int, relayClient_t> clients;
+    map<uint32_t, relayQuery_t> queries;
+    map<string, uint32_t> sharedQueries;    /* cache key -> query in flight */
+    map<string, relayCacheEntry_t> cache;
+    uint32_t ttlMs;
+    uint32_t timeoutMs;
+    uint32_t nextQueryId;
+    uint64_t nextClientId;
+
+    static string cacheKey(MessageHeader &in);
+    static bool sharable(MessageHeader &in);
+    void acceptClients();
+    bool flushClient(relayClient_t &client);
+    bool processClientFrames(relayClient_t &client);
+    void handleRequest(relayClient_t &client, MessageHeader &in);
+    void startQuery(MessageHeader &in, const string &key, const relayWaiter_t &waiter);
+    void handleAgentFrame(size_t agent, MessageHeader &in);
+    void agentDown(size_t agent, const string &reason);
+    void finishQuery(uint32_t id);
+    void answer(const relayWaiter_t &waiter, const string &text, cmdStatus_e status);
+    void sendHeartbeats();
+
+public:
+    Relay(int listenFd, uint32_t ttlMs, uint32_t timeoutMs);
+    bool addAgents(const string &list, uint16_t defaultPort);
+    void run();
+    ~Relay();
+};
+
+#endif
@@ -2,187 +2,28 @@
 #include "History.hh"
 #include "NetworkSettings.hh"
 #include "MessageHandle.hh"
+#include <sstream>
 
 // Global history object
 History commandHistory;
 int history_index = -1;
-deque<MessageHeader> responseDeque;
-deque<MessageHeader> requestDeque;
-mutex mtx;
+volatile sig_atomic_t interruptPending = 0;
 
-/*********************************************************************
- * @fn      		  - read_input() 
- * @brief             - This function reads the input from the user from terminal
- * @param[in]         - none
- * @return            - string
- * @Note              - 
- *********************************************************************/
-string read_input()
+/* Client side state of a request sent with a request ID */
+typedef struct
 {
-    struct termios oldt, newt;
-    string input;
-    int cursor_pos = 0;
-
-    // Save current terminal settings
-    if (tcgetattr(STDIN_FILENO, &oldt) != 0)
-    {
-        perror("tcgetattr");
-        exit(EXIT_FAILURE);
-    }
-
-    // Modify terminal settings for character-by-character input
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &newt) != 0)
-    {
-        perror("tcsetattr");
-        exit(EXIT_FAILURE);
-    }
-
-    while (true)
-    {
-        char ch;
-        if (read(STDIN_FILENO, &ch, 1) != 1)
-        {
-            perror("read");
-            exit(EXIT_FAILURE);
-        }
-
-        if (ch == '\n')
-        { // End of input
-            cout << endl;
-            break;
-        }
-        else if (ch == 127)
-        { // Backspace
-            if (cursor_pos > 0)
-            {
-                input.erase(cursor_pos - 1, 1);
-                cursor_pos--;
-                cout << "\b \b";
-                cout.flush();
-                cout << input.substr(cursor_pos) << " ";
-                cout.flush();
-                cout << "\b";
-                cout.flush();
-                for (int i = cursor_pos; i < (int)input.size(); i++)
-                {
-                    cout << "\b";
-                    cout.flush();
-                }
-            }
-        }
-        else if (ch == 27) // ESC before Arrow key
-        {                  // Arrow keys
-            char seq[2];
-            if (read(STDIN_FILENO, &seq[0], 1) != 1 || read(STDIN_FILENO, &seq[1], 1) != 1)
-            {
-                perror("read");
-                exit(EXIT_FAILURE);
-            }
-            if (seq[0] == '[')
-            {
-                if (seq[1] == 'A')
-                { // Up arrow - previous command
-                    if (history_index > 0)
-                    {
-                        history_index--;
-                        refreshLine(cursor_pos);
-                        input = commandHistory.getCommand(history_index);
-                        cursor_pos = input.length();
-                        cout << "\r" << CMDPROMPT << input;
-                        cout.flush();
-                    }
-                }
-                else if (seq[1] == 'B')
-                { // Down arrow - next command
-                    if (history_index < commandHistory.size() - 1)
-                    {
-                        history_index++;
-                        refreshLine(cursor_pos);
-                        input = commandHistory.getCommand(history_index);
-                        cursor_pos = input.length();
-                        cout << "\r" << CMDPROMPT << input; 
-                        cout.flush();
-                    }
-                    else
-                    {
-                        history_index = commandHistory.size();
-                        refreshLine(cursor_pos);
-                        input.clear();
-                        cursor_pos = 0;
-                        cout << "\r" << CMDPROMPT;
-                        cout.flush();
-                    }
-                }
-                else if (seq[1] == 'C')
-                { // Right arrow
-                    if (cursor_pos < (int)input.size())
-                    {
-                        cout << input[cursor_pos];
-                        cout.flush();
-                        cursor_pos++;
-                    }
-                }
-                else if (seq[1] == 'D')
-                { // Left arrow
-                    if (cursor_pos > 0)
-                    {
-                        cout << "\b";
-                        cout.flush();
-                        cursor_pos--;
-                    }
-                }
-            }
-        }
-        else
-        {
-            // Regular character input
-            if (cursor_pos < (int)input.size())
-            {
-                input.insert(cursor_pos, 1, ch);
-            }
-            else
-            {
-                input += ch;
-            }
-            cursor_pos++;
-            cout << "\r" << CMDPROMPT << input;
-            cout.flush();
-
-            for (int i = cursor_pos; i < (int)input.size(); i++)
-            {
-                cout << "\b";
-                cout.flush();
-            }
-        }
-    }
+    string label;           /* the command line as typed */
+    bool overlapped;        /* other requests were in flight at some point */
+    requestKind_e kind;
+    string output;
+} pendingRequest_t;
 
-    // Restore original terminal settings
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &oldt) != 0)
-    {
-        perror("tcsetattr");
-        exit(EXIT_FAILURE);
-    }
-
-    return input;
-}
+static map<uint32_t, pendingRequest_t> pendingRequests;
+static uint32_t nextRequestId = 1;
 
-/*********************************************************************
- * @fn      		  - refreshLine() 
- * @brief             - This function Clears the current line by moving the cursor back and erasing characters.
- * @param[in]         - int cursor_pos
- * @return            - none
- * @Note              - 
- *********************************************************************/
-void refreshLine(int cursor_pos)
-{
-    for (int i = cursor_pos; i; i--)
-    {
-        cout << "\b \b";
-        cout.flush();
-    }
-}
+/* Local copy of the server's process listing, kept current with deltas */
+static uint64_t listingVersion = 0;
+static map<int, string> listing;
 
 /*********************************************************************
  * @fn      		  - add_to_history() 
@@ -243,16 +84,17 @@ vector<string> parse_input(const string &input)
         }
         else
         {
-            if (quote_char)
-            {
-                cout << "Error: Unclosed quote detected." << endl;
-                args.clear();
-                return args;
-            }
             current_arg += c;
         }
     }
 
+    if (in_quote)
+    {
+        cout << "Error: Unclosed quote detected." << endl;
+        args.clear();
+        return args;
+    }
+
     if (!current_arg.empty())
     {
         args.push_back(expandArguments(current_arg));
@@ -303,7 +145,8 @@ void exitFun()
  * @brief             - This function handles the different signal actions entered by user
  * @param[in]         - int signo
  * @return            - none
- * @Note              - 
+ * @Note              - Only flags the signal; the client's event loop wakes
+ *                      up from poll() with EINTR and drops the typed line
  *********************************************************************/
 void signal_handler(int signo)
 {
@@ -313,92 +156,174 @@ void signal_handler(int signo)
     case SIGTERM:
     case SIGTSTP:
     default:
-        cout << "\n"
-             << CMDPROMPT;
-        cout.flush();
+        interruptPending = 1;
         break;
     }
 }
 
 /*********************************************************************
- * @fn      		  - sendResponse() 
- * @brief             - This function sends the response to client as soon as 
- *                      response is available in responseDeque
- * @param[in]         - none
- * @return            - none
- * @Note              - 
+ * @fn      		  - trackRequest() 
+ * @brief             - This function allocates the ID of a new request and
+ *                      remembers it until its response has been printed
+ * @param[in]         - const string &label, requestKind_e kind
+ * @return            - uint32_t
+ * @Note              - Only used when the server supports CAP_REQUEST_ID.
+ *                      Watches are remembered until forgetRequests()
  *********************************************************************/
-void sendResponse()
+uint32_t trackRequest(const string &label, requestKind_e kind)
 {
-    while (true)
-    {
-        lock_guard<mutex> guard(mtx);
-        if (!responseDeque.empty())
-        {
-            MessageHeader responseToBeSent = responseDeque.front();
-            responseDeque.pop_front();
+    uint32_t id = nextRequestId++;
+    if (nextRequestId == 0)
+        nextRequestId = 1;
 
-            //responseToBeSent.printResponse();
-            send(responseToBeSent.getSocketIdToSendResponse(), &responseToBeSent, sizeof(responseToBeSent), 0);
-        }
+    bool overlapped = false;
+    for (auto &pending : pendingRequests)
+    {
+        if (pending.second.kind == REQUEST_WATCH)
+            continue;
+        pending.second.overlapped = true;
+        overlapped = true;
     }
+    pendingRequests[id] = {label, overlapped, kind, string()};
+    return id;
 }
 
 /*********************************************************************
- * @fn      		  - sendResponse() 
- * @brief             - This function sends the request to server as soon as 
- *                      request is available in requestDeque
- * @param[in]         - int iSocketId
+ * @fn      		  - forgetRequests() 
+ * @brief             - This function stops waiting for a request, or for
+ *                      every watch when id is 0
+ * @param[in]         - uint32_t id
  * @return            - none
- * @Note              - 
+ * @Note              - Updates of a forgotten watch still in flight are dropped
  *********************************************************************/
-void sendRequest(int iSocketId)
+void forgetRequests(uint32_t id)
 {
-    while(true)
+    if (id)
     {
-        if(!requestDeque.empty())
-        {
-            MessageHeader requestToBeSent = requestDeque.front();
-            requestDeque.pop_front();
+        pendingRequests.erase(id);
+        return;
+    }
+    for (auto it = pendingRequests.begin(); it != pendingRequests.end();)
+        it = it->second.kind == REQUEST_WATCH ? pendingRequests.erase(it) : next(it);
+}
 
-            //responseToBeSent.printResponse();
-            send(iSocketId, &requestToBeSent, sizeof(requestToBeSent), 0);
-            if(requestToBeSent.getMsgType() != MSG_HEARTBEAT)
-            {
-                cout << endl;
-            }
-        }
+/*********************************************************************
+ * @fn      		  - heldListingVersion() 
+ * @brief             - This function returns the version of the process
+ *                      listing the client holds, 0 for none
+ * @param[in]         - none
+ * @return            - uint64_t
+ * @Note              - Sent with get-process so only changes come back
+ *********************************************************************/
+uint64_t heldListingVersion()
+{
+    return listingVersion;
+}
+
+/*********************************************************************
+ * @fn      		  - applyListing() 
+ * @brief             - This function applies a get-process delta response to
+ *                      the local listing and renders the whole listing
+ * @param[in]         - const string &resp
+ * @return            - string
+ * @Note              - A delta from another
+ *                      version than the one held (two get-process in flight)
+ *                      drops the listing, the next get-process resyncs
+ *********************************************************************/
+static string applyListing(const string &resp)
+{
+    istringstream lines(resp);
+    string line;
+    getline(lines, line);
+
+    char kind[16] = "";
+    unsigned long long base = 0, version = 0;
+    if (sscanf(line.c_str(), "#%15s %llu %llu", kind, &base, &version) < 2)
+        return resp;
+    if (strcmp(kind, "delta") != 0)
+        version = base;
+
+    if ((strcmp(kind, "delta") == 0 || strcmp(kind, "not-modified") == 0) && base != listingVersion)
+    {
+        listing.clear();
+        listingVersion = 0;
+        return "Process list changed meanwhile, run get-process again\n";
+    }
+    if (strcmp(kind, "full") == 0)
+        listing.clear();
+
+    while (getline(lines, line))
+    {
+        if (line.size() < 2)
+            continue;
+        int pid = atoi(line.c_str() + 1);
+        size_t name = line.find(" : ");
+        if (line[0] == '-')
+            listing.erase(pid);
+        else if (name != string::npos)
+            listing[pid] = line.substr(name + 3);
     }
+    listingVersion = version;
+
+    if (listing.empty())
+        return "No process available\n";
+    string text;
+    for (const auto &proc : listing)
+        text += to_string(proc.first) + " : " + proc.second + "\n";
+    return text;
 }
 
 /*********************************************************************
- * @fn      		  - receiveResponse() 
- * @brief             - This function receives the response forom server as prints it
- * @param[in]         - int iSocketId
- * @return            - none
- * @Note              - 
+ * @fn      		  - handleResponse() 
+ * @brief             - This function reassembles the response frames received
+ *                      from server
+ * @param[in]         - MessageHeader &incomingMessage, string &text
+ * @return            - bool (true when a response is complete, text then
+ *                      holds what to print)
+ * @Note              - Frames tagged with a request ID are collected per
+ *                      request; a response that overlapped with others and
+ *                      every watch update are printed under a "[#id] command"
+ *                      heading
  *********************************************************************/
-void receiveResponse(int iSocketId)
+bool handleResponse(MessageHeader &incomingMessage, string &text)
 {
-    MessageHeader incomingMessage;
+    static string pending;
+    uint32_t id = incomingMessage.getRequestId();
 
-    size_t received_size = 0;
-    while (true)
+    if(MSG_TYPE_RESPONSE == incomingMessage.getMsgType())
     {
-        received_size = recv(iSocketId, &incomingMessage, sizeof(incomingMessage), 0);
-        // If recv returns 0, client disconnected
-        
-        // If the full message is received (based on expected message size)
-        if (received_size == sizeof(incomingMessage))
+        if(!id)
+            pending += incomingMessage.getResponseMsg();
+        else
         {
-            // Process the received message
-            incomingMessage.printResponse();
+            auto it = pendingRequests.find(id);
+            if(it != pendingRequests.end())
+                it->second.output += incomingMessage.getResponseMsg();
         }
+        return false;
+    }
+    if(MSG_TYPE_END_OF_RESPONSE != incomingMessage.getMsgType())
+        return false;
 
-        if(MSG_TYPE_END_OF_RESPONSE == incomingMessage.getMsgType())
-        {
-            cout << CMDPROMPT;
-            cout.flush();    
-        }
+    text.clear();
+    if(!id)
+    {
+        text.swap(pending);
+        return true;
     }
+
+    auto it = pendingRequests.find(id);
+    if(it == pendingRequests.end())
+        return false;
+    if(it->second.overlapped || it->second.kind == REQUEST_WATCH)
+        text = "[#" + to_string(id) + "] " + it->second.label + "\n";
+    if(it->second.kind == REQUEST_LISTING)
+        text += applyListing(it->second.output);
+    else
+        text += it->second.output;
+    if(it->second.kind == REQUEST_WATCH)
+        it->second.output.clear();
+    else
+        pendingRequests.erase(it);
+    return true;
 }
@@ -16,11 +16,15 @@
 #include <array>
 #include <algorithm>
 #include <mutex>
+#include <map>
 
 #define MESSAGE_SIZE 100
 #define CMD_SIZE 15
+#define DEFAULT_FRAME_SIZE (64 * 1024)
+#define DEFAULT_PORT 8080
 using namespace std;
 class NetworkSettings;
+struct MessageHeader;
 
 #define		ENUM(ENUM, STRING)		ENUM,
 #define		STRING(ENUM, STRING)	STRING,
@@ -35,15 +39,39 @@ typedef enum
     APPTYPE_MAX,
 } appType_e;
 
-void refreshLine(int cursor_pos);
-string read_input();
+/* Server tunables, filled from the command line in main() */
+typedef struct
+{
+    uint32_t maxFrameSize;
+    bool reactor;
+    int ioThreads;
+    int workers;
+    size_t queueDepth;
+    int snapshotIntervalMs;
+    bool procEvents;
+    bool sockDiag;
+    int scanThreads;
+    uint16_t port;
+    uint16_t metricsPort;       /* 0: no Prometheus endpoint */
+} serverConfig_t;
+
+/* How the client handles the response to a request it sent */
+typedef enum
+{
+    REQUEST_ONCE,           /* printed once, then forgotten */
+    REQUEST_WATCH,          /* printed on every update until unwatched */
+    REQUEST_LISTING,        /* get-process delta, applied to the local listing */
+} requestKind_e;
+
 string expandArguments(const string &arg);
 vector<string> parse_input(const string &input);
 void signal_handler(int signo);
+extern volatile sig_atomic_t interruptPending;
 void add_to_history(const string &command);
 void exitFun();
-void sendResponse();
-void sendRequest(int iSocketId);
-void receiveResponse(int iSocketId);
+bool handleResponse(MessageHeader &incomingMessage, string &text);
+uint32_t trackRequest(const string &label, requestKind_e kind);
+void forgetRequests(uint32_t id);
+uint64_t heldListingVersion();
 
 #endif
@@ -0,0 +1,204 @@
+#include "ScriptRunner.hh"
+#include "NetworkValidator.hh"
+#include "History.hh"
+#include <poll.h>
+
+/* In Constructor initialise variables of class */
+ScriptRunner::ScriptRunner(int sock, const session_t &session) : sock(sock), session(session), inFlight(0), lastSent(0), failed(0)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - load
+ * @brief             - This function reads and parses the commands of a
+ *                      script
+ * @param[in]         - istream &in
+ * @return            - bool (false if nothing could be read)
+ * @Note              - Invalid lines are reported and counted as failed
+ *                      right away, the others are kept to be sent
+ *********************************************************************/
+bool ScriptRunner::load(istream &in)
+{
+    string line;
+    int lineNo = 0;
+    while (getline(in, line))
+    {
+        lineNo++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == string::npos || line[start] == '#')
+            continue;
+        line = line.substr(start, line.find_last_not_of(" \t\r") - start + 1);
+
+        vector<string> args = parse_input(line);
+        if (!args.empty() && args[0] == "exit")
+            break;
+
+        scriptCommand_t cmd = {lineNo, line, MessageHeader(), string(), false};
+        bool valid = false;
+        if (line.length() >= MAX_INPUT_SIZE - 1)
+            cerr << "Error: Command line too long" << endl;
+        else if (!args.empty())
+        {
+            // The usage text printed for unknown commands is not wanted here
+            streambuf *console = cout.rdbuf(nullptr);
+            valid = cmd.request.parseArgumentAndPrepareCommand(args);
+            cout.rdbuf(console);
+        }
+        if (valid && (cmd.request.getOptions() & CMD_OPT_WATCH))
+        {
+            cerr << "Error: watch never completes and cannot be used in a script" << endl;
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            string out;
+            report(cmd, CMD_STATUS_INVALID, out);
+            cout << out;
+            continue;
+        }
+        commands.push_back(move(cmd));
+    }
+    cout.flush();
+    return !in.bad();
+}
+
+/*********************************************************************
+ * @fn      		  - report
+ * @brief             - This function formats the result of a command
+ * @param[in]         - scriptCommand_t &cmd, cmdStatus_e status, string &out
+ * @return            - none
+ * @Note              - The collected output is released
+ *********************************************************************/
+void ScriptRunner::report(scriptCommand_t &cmd, cmdStatus_e status, string &out)
+{
+    if (status != CMD_STATUS_OK)
+        failed++;
+    out += "[" + to_string(cmd.lineNo) + "] " + cmd.text + ": " + cmdStatusStr[status] + "\n" + cmd.output;
+    if (!cmd.output.empty() && cmd.output.back() != '\n')
+        out += "\n";
+    string().swap(cmd.output);
+}
+
+/*********************************************************************
+ * @fn      		  - receiveResults
+ * @brief             - This function reads what the server sent and reports
+ *                      every command it completes
+ * @param[in]         - string &out
+ * @return            - bool (false once the connection is closed or corrupt)
+ * @Note              - Responses without a request ID belong to the only
+ *                      command in flight, the one sent last
+ *********************************************************************/
+bool ScriptRunner::receiveResults(string &out)
+{
+    char buffer[64 * 1024];
+    ssize_t len = recv(sock, buffer, sizeof(buffer), 0);
+    if (len < 0 && errno == EINTR)
+        return true;
+    if (len <= 0)
+        return false;
+    rxBuf.append(buffer, len);
+
+    size_t offset = 0;
+    frameHeader_t hdr;
+    string payload;
+    MessageHeader in;
+    while (true)
+    {
+        long consumed = decodeFrame(rxBuf.data() + offset, rxBuf.size() - offset, hdr, payload);
+        if (consumed < 0)
+            return false;
+        if (consumed == 0)
+            break;
+        offset += consumed;
+
+        if (!in.decode(hdr, payload))
+            return false;
+        if (MSG_TYPE_RESPONSE != in.getMsgType() && MSG_TYPE_END_OF_RESPONSE != in.getMsgType())
+            continue;
+
+        // Request IDs are positions in commands, counted from 1
+        size_t index = in.getRequestId() ? in.getRequestId() - 1 : lastSent;
+        if (index >= commands.size() || commands[index].done)
+            continue;
+
+        scriptCommand_t &cmd = commands[index];
+        if (MSG_TYPE_RESPONSE == in.getMsgType())
+        {
+            cmd.output += in.getResponseMsg();
+            continue;
+        }
+        report(cmd, in.getStatus(), out);
+        cmd.done = true;
+        inFlight--;
+    }
+    rxBuf.erase(0, offset);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - run
+ * @brief             - This function sends the loaded commands and prints
+ *                      the results until all of them completed
+ * @param[in]         - none
+ * @return            - int (SCRIPT_EXIT_* code)
+ * @Note              - Sending stops at SCRIPT_WINDOW requests in flight so
+ *                      the server's queues bound how much is outstanding
+ *                      and responses are read while requests still go out
+ *********************************************************************/
+int ScriptRunner::run()
+{
+    bool tagged = session.caps & CAP_REQUEST_ID;
+    size_t window = tagged ? SCRIPT_WINDOW : 1;
+    if (!commands.empty() && !(session.caps & CAP_CMD_STATUS))
+        cerr << "Warning: The server does not report command status, only invalid lines count as failed" << endl;
+
+    NetworkValidator validator(sock);
+    struct pollfd fds[2];
+    fds[0] = {sock, POLLIN, 0};
+    fds[1] = {validator.StartValidator(), POLLIN, 0};
+
+    size_t next = 0;
+    string out;
+    while (next < commands.size() || inFlight > 0)
+    {
+        for (; next < commands.size() && inFlight < window; next++)
+        {
+            MessageHeader &request = commands[next].request;
+            if (tagged)
+                request.setRequestId(static_cast<uint32_t>(next + 1));
+            if (!sendMessage(sock, request))
+            {
+                cerr << "Error: Failed to send request" << endl;
+                return SCRIPT_EXIT_ERROR;
+            }
+            lastSent = next;
+            inFlight++;
+        }
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return SCRIPT_EXIT_ERROR;
+        }
+        if (fds[1].revents & POLLIN)
+            validator.SendHeartbeat();
+        if (fds[0].revents && !receiveResults(out))
+        {
+            cout << out;
+            cerr << "Connection closed by server with " << inFlight << " command(s) unanswered" << endl;
+            return SCRIPT_EXIT_ERROR;
+        }
+
+        cout << out;
+        cout.flush();
+        out.clear();
+    }
+    return failed ? SCRIPT_EXIT_FAILED : SCRIPT_EXIT_OK;
+}
+
+/* In Destructor De-initialise variables of class */
+ScriptRunner::~ScriptRunner()
+{
+}
@@ -0,0 +1,54 @@
+#ifndef SCRIPT_RUNNER_H
+#define SCRIPT_RUNNER_H
+
+#include <istream>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+
+#define SCRIPT_WINDOW       128     /* requests in flight at once */
+
+/* Exit codes of the client in script mode */
+#define SCRIPT_EXIT_OK      0       /* every command succeeded */
+#define SCRIPT_EXIT_FAILED  1       /* a command was invalid or found no process */
+#define SCRIPT_EXIT_ERROR   2       /* unreadable script or connection lost */
+
+/* One command of a script */
+typedef struct
+{
+    int lineNo;
+    string text;
+    MessageHeader request;
+    string output;              /* response collected so far */
+    bool done;
+} scriptCommand_t;
+
+/*
+ * Non-interactive client: runs the commands of a file or a pipe, one per
+ * line. Up to SCRIPT_WINDOW requests are kept in flight, each tagged with
+ * its position in the script, and results are printed as they complete,
+ * headed "[line] <command>: <status>" like the sections of a batch. Blank
+ * lines and lines starting with '#' are skipped; "exit" ends the script.
+ * Against a server without request IDs the commands run one at a time.
+ */
+class ScriptRunner
+{
+private:
+    int sock;
+    session_t session;
+    vector<scriptCommand_t> commands;
+    string rxBuf;
+    size_t inFlight;
+    size_t lastSent;
+    int failed;
+
+    void report(scriptCommand_t &cmd, cmdStatus_e status, string &out);
+    bool receiveResults(string &out);
+
+public:
+    ScriptRunner(int sock, const session_t &session);
+    bool load(istream &in);
+    int run();
+    ~ScriptRunner();
+};
+
+#endif
@@ -0,0 +1,359 @@
+#include "ServerStats.hh"
+#include "WorkerPool.hh"
+#include <sstream>
+#include <netinet/in.h>
+
+ServerStats serverStats;
+thread_local statSlotHolder_t statLocalSlot;
+extern WorkerPool *workerPool;
+
+static const char *const statRowStr[STAT_ROWS] = {CMD_GENERATOR(STRING) "batch", "io"};
+static const char *const statPhaseStr[STAT_PHASE_MAX] = {"receive", "parse", "queue", "execute", "serialize", "send"};
+
+/* In Constructor initialise variables of class */
+ServerStats::ServerStats() : activeConnections(0), metricsSock(-1)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - acquireSlot
+ * @brief             - This function gives a thread a slot to record into,
+ *                      reusing the slot of a thread that exited
+ * @param[in]         - none
+ * @return            - statSlot_t *
+ * @Note              -
+ *********************************************************************/
+statSlot_t *ServerStats::acquireSlot()
+{
+    lock_guard<mutex> guard(mtx);
+    if (!freeSlots.empty())
+    {
+        statSlot_t *slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+    statSlot_t *slot = new statSlot_t();
+    slots.push_back(slot);
+    return slot;
+}
+
+/*********************************************************************
+ * @fn      		  - releaseSlot
+ * @brief             - This function takes back the slot of an exiting thread
+ * @param[in]         - statSlot_t *slot
+ * @return            - none
+ * @Note              - Its counts stay part of the totals
+ *********************************************************************/
+void ServerStats::releaseSlot(statSlot_t *slot)
+{
+    lock_guard<mutex> guard(mtx);
+    freeSlots.push_back(slot);
+}
+
+/*********************************************************************
+ * @fn      		  - summarize
+ * @brief             - This function merges one histogram of every slot
+ * @param[in]         - int row, statPhase_e phase, statSummary_t &summary
+ * @return            - none
+ * @Note              - Slots are read while their threads keep recording, so
+ *                      the totals may be a few samples apart
+ *********************************************************************/
+void ServerStats::summarize(int row, statPhase_e phase, statSummary_t &summary)
+{
+    memset(&summary, 0, sizeof(summary));
+    lock_guard<mutex> guard(mtx);
+    for (statSlot_t *slot : slots)
+    {
+        statHistogram_t *histogram = slot->histograms[row][phase].load(memory_order_acquire);
+        if (!histogram)
+            continue;
+        for (int i = 0; i < STAT_BUCKETS; i++)
+        {
+            uint64_t n = histogram->counts[i].load(memory_order_relaxed);
+            summary.counts[i] += n;
+            summary.count += n;
+        }
+        summary.sumNs += histogram->sumNs.load(memory_order_relaxed);
+        summary.maxNs = max(summary.maxNs, histogram->maxNs.load(memory_order_relaxed));
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - counter
+ * @brief             - This function adds up a traffic counter of every slot
+ * @param[in]         - statCounter_e counter
+ * @return            - uint64_t
+ * @Note              -
+ *********************************************************************/
+uint64_t ServerStats::counter(statCounter_e counter)
+{
+    uint64_t total = 0;
+    lock_guard<mutex> guard(mtx);
+    for (statSlot_t *slot : slots)
+        total += slot->counters[counter].load(memory_order_relaxed);
+    return total;
+}
+
+/*********************************************************************
+ * @fn      		  - bucketUpperNs
+ * @brief             - This function returns the largest value of a bucket
+ * @param[in]         - int bucket
+ * @return            - uint64_t
+ * @Note              -
+ *********************************************************************/
+static uint64_t bucketUpperNs(int bucket)
+{
+    if (bucket < STAT_SUB_BUCKETS)
+        return bucket;
+    int range = bucket / STAT_SUB_BUCKETS;
+    uint64_t width = 1ULL << (range - 1);
+    return (static_cast<uint64_t>(STAT_SUB_BUCKETS + bucket % STAT_SUB_BUCKETS) << (range - 1)) + width - 1;
+}
+
+/*********************************************************************
+ * @fn      		  - percentileNs
+ * @brief             - This function returns the value below which a share
+ *                      of the recorded durations falls
+ * @param[in]         - const statSummary_t &summary, double percent
+ * @return            - uint64_t
+ * @Note              - Accurate to the bucket width, at most the maximum
+ *********************************************************************/
+static uint64_t percentileNs(const statSummary_t &summary, double percent)
+{
+    uint64_t rank = static_cast<uint64_t>(summary.count * percent / 100.0 + 0.5);
+    uint64_t seen = 0;
+    for (int i = 0; i < STAT_BUCKETS; i++)
+    {
+        seen += summary.counts[i];
+        if (seen >= max<uint64_t>(rank, 1))
+            return min(bucketUpperNs(i), summary.maxNs);
+    }
+    return summary.maxNs;
+}
+
+/*********************************************************************
+ * @fn      		  - formatNs
+ * @brief             - This function prints a duration with a fitting unit
+ * @param[in]         - uint64_t ns
+ * @return            - string
+ * @Note              -
+ *********************************************************************/
+static string formatNs(uint64_t ns)
+{
+    char text[32];
+    if (ns < 1000)
+        snprintf(text, sizeof(text), "%lluns", static_cast<unsigned long long>(ns));
+    else if (ns < 1000000)
+        snprintf(text, sizeof(text), "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(text, sizeof(text), "%.2fms", ns / 1e6);
+    else
+        snprintf(text, sizeof(text), "%.2fs", ns / 1e9);
+    return text;
+}
+
+/*********************************************************************
+ * @fn      		  - report
+ * @brief             - This function prints the counters and the latency
+ *                      percentiles of every phase that recorded something
+ * @param[in]         - WorkerPool *pool
+ * @return            - string
+ * @Note              - Answer of the stats command
+ *********************************************************************/
+string ServerStats::report(WorkerPool *pool)
+{
+    ostringstream out;
+    out << "Connections: " << activeConnections.load(memory_order_relaxed) << " active, "
+        << counter(STAT_CONNECTIONS_ACCEPTED) << " accepted\n"
+        << "Frames: " << counter(STAT_FRAMES_RECEIVED) << " received, " << counter(STAT_FRAMES_SENT) << " sent\n"
+        << "Bytes: " << counter(STAT_BYTES_RECEIVED) << " received, " << counter(STAT_BYTES_SENT) << " sent\n";
+    if (pool)
+        out << "Worker queue: " << pool->getDepth() << " of " << pool->getCapacity() << " queued, peak "
+            << pool->getPeakDepth() << ", " << pool->getRejected() << " rejected, " << pool->getCompleted()
+            << " completed\n";
+
+    out << "\n" << left << setw(16) << "Latency" << setw(11) << "phase" << right << setw(10) << "count"
+        << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "max" << "\n";
+    statSummary_t summary;
+    for (int row = 0; row < STAT_ROWS; row++)
+    {
+        for (int phase = 0; phase < STAT_PHASE_MAX; phase++)
+        {
+            summarize(row, static_cast<statPhase_e>(phase), summary);
+            if (!summary.count)
+                continue;
+            out << left << setw(16) << statRowStr[row] << setw(11) << statPhaseStr[phase] << right << setw(10)
+                << summary.count << setw(10) << formatNs(percentileNs(summary, 50)) << setw(10)
+                << formatNs(percentileNs(summary, 90)) << setw(10) << formatNs(percentileNs(summary, 99))
+                << setw(10) << formatNs(summary.maxNs) << "\n";
+        }
+    }
+    return out.str();
+}
+
+/*********************************************************************
+ * @fn      		  - prometheus
+ * @brief             - This function prints the statistics in the Prometheus
+ *                      text exposition format
+ * @param[in]         - WorkerPool *pool
+ * @return            - string
+ * @Note              - Histograms are exported with fixed bounds from 1us to
+ *                      5s; a bucket is counted under the first bound holding
+ *                      its largest value
+ *********************************************************************/
+string ServerStats::prometheus(WorkerPool *pool)
+{
+    static const double bounds[] = {1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 0.1, 0.5, 1, 5};
+    ostringstream out;
+
+    out << "# HELP tcpapp_request_phase_seconds Time spent in each phase of a request.\n"
+        << "# TYPE tcpapp_request_phase_seconds histogram\n";
+    statSummary_t summary;
+    for (int row = 0; row < STAT_ROWS; row++)
+    {
+        for (int phase = 0; phase < STAT_PHASE_MAX; phase++)
+        {
+            summarize(row, static_cast<statPhase_e>(phase), summary);
+            if (!summary.count)
+                continue;
+            string labels = string("command=\"") + statRowStr[row] + "\",phase=\"" + statPhaseStr[phase] + "\"";
+            uint64_t below = 0;
+            int bucket = 0;
+            for (double bound : bounds)
+            {
+                for (; bucket < STAT_BUCKETS && bucketUpperNs(bucket) <= bound * 1e9; bucket++)
+                    below += summary.counts[bucket];
+                out << "tcpapp_request_phase_seconds_bucket{" << labels << ",le=\"" << bound << "\"} " << below << "\n";
+            }
+            out << "tcpapp_request_phase_seconds_bucket{" << labels << ",le=\"+Inf\"} " << summary.count << "\n"
+                << "tcpapp_request_phase_seconds_sum{" << labels << "} " << summary.sumNs / 1e9 << "\n"
+                << "tcpapp_request_phase_seconds_count{" << labels << "} " << summary.count << "\n";
+        }
+    }
+
+    static const struct
+    {
+        statCounter_e counter;
+        const char *name;
+        const char *help;
+    } counters[] = {
+        {STAT_FRAMES_RECEIVED, "tcpapp_frames_received_total", "Frames received from clients."},
+        {STAT_FRAMES_SENT, "tcpapp_frames_sent_total", "Frames queued to clients."},
+        {STAT_BYTES_RECEIVED, "tcpapp_bytes_received_total", "Bytes received from clients."},
+        {STAT_BYTES_SENT, "tcpapp_bytes_sent_total", "Bytes sent to clients."},
+        {STAT_CONNECTIONS_ACCEPTED, "tcpapp_connections_accepted_total", "Client connections accepted."},
+    };
+    for (const auto &entry : counters)
+        out << "# HELP " << entry.name << " " << entry.help << "\n# TYPE " << entry.name << " counter\n"
+            << entry.name << " " << counter(entry.counter) << "\n";
+
+    out << "# HELP tcpapp_connections_active Clients connected.\n# TYPE tcpapp_connections_active gauge\n"
+        << "tcpapp_connections_active " << activeConnections.load(memory_order_relaxed) << "\n";
+    if (pool)
+        out << "# HELP tcpapp_worker_queue_depth Commands waiting for a worker.\n"
+            << "# TYPE tcpapp_worker_queue_depth gauge\ntcpapp_worker_queue_depth " << pool->getDepth() << "\n"
+            << "# HELP tcpapp_worker_queue_peak_depth Most commands ever waiting for a worker.\n"
+            << "# TYPE tcpapp_worker_queue_peak_depth gauge\ntcpapp_worker_queue_peak_depth " << pool->getPeakDepth() << "\n"
+            << "# HELP tcpapp_worker_queue_capacity Size of the worker queue.\n"
+            << "# TYPE tcpapp_worker_queue_capacity gauge\ntcpapp_worker_queue_capacity " << pool->getCapacity() << "\n"
+            << "# HELP tcpapp_worker_rejected_total Commands refused by the full worker queue.\n"
+            << "# TYPE tcpapp_worker_rejected_total counter\ntcpapp_worker_rejected_total " << pool->getRejected() << "\n"
+            << "# HELP tcpapp_worker_completed_total Commands run by the workers.\n"
+            << "# TYPE tcpapp_worker_completed_total counter\ntcpapp_worker_completed_total " << pool->getCompleted() << "\n";
+    return out.str();
+}
+
+/*********************************************************************
+ * @fn      		  - startEndpoint
+ * @brief             - This function serves the Prometheus text on
+ *                      http://127.0.0.1:<port>/metrics from a thread of its own
+ * @param[in]         - uint16_t port
+ * @return            - bool (false if the port cannot be bound)
+ * @Note              - Bound to localhost only, anything further away goes
+ *                      through a proxy or the stats command
+ *********************************************************************/
+bool ServerStats::startEndpoint(uint16_t port)
+{
+    int opt = 1;
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    metricsSock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metricsSock < 0 || setsockopt(metricsSock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        bind(metricsSock, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(metricsSock, 8) < 0)
+    {
+        cerr << "Cannot serve metrics on port " << port << ": " << strerror(errno) << endl;
+        if (metricsSock >= 0)
+            close(metricsSock);
+        metricsSock = -1;
+        return false;
+    }
+    endpoint = thread(&ServerStats::endpointLoop, this);
+#ifdef DEBUG
+    cout << "Metrics on http://127.0.0.1:" << port << "/metrics" << endl;
+#endif
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - endpointLoop
+ * @brief             - This function answers HTTP requests one at a time
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Returns once the listening socket is shut down
+ *********************************************************************/
+void ServerStats::endpointLoop()
+{
+    while (true)
+    {
+        int client = accept4(metricsSock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+
+        // A scraper sends its whole request at once; give up on slow ones
+        struct timeval timeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        string request;
+        char buffer[2048];
+        while (request.find("\r\n\r\n") == string::npos && request.size() < 8192)
+        {
+            ssize_t len = recv(client, buffer, sizeof(buffer), 0);
+            if (len <= 0)
+                break;
+            request.append(buffer, len);
+        }
+
+        string status = "200 OK";
+        string body;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+            body = prometheus(workerPool);
+        else
+        {
+            status = "404 Not Found";
+            body = "Try /metrics\n";
+        }
+        string response = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                          to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        sendAll(client, response.data(), response.size());
+        close(client);
+    }
+}
+
+/* In Destructor stop the endpoint; slots are left to the process exit, detached client threads may still record */
+ServerStats::~ServerStats()
+{
+    if (metricsSock >= 0)
+    {
+        shutdown(metricsSock, SHUT_RDWR);
+        if (endpoint.joinable())
+            endpoint.join();
+        close(metricsSock);
+    }
+}
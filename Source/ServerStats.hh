@@ -0,0 +1,267 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+
+#define STAT_SUB_BUCKET_BITS    3       /* 8 buckets per power of two, within 12.5% */
+#define STAT_SUB_BUCKETS        (1 << STAT_SUB_BUCKET_BITS)
+#define STAT_MAX_BITS           40      /* about 18 minutes in ns, longer is clamped */
+#define STAT_BUCKETS            ((STAT_MAX_BITS - STAT_SUB_BUCKET_BITS + 1) * STAT_SUB_BUCKETS)
+
+/* Histogram rows: one per command_e, then these */
+#define STAT_ROW_BATCH          CMD_MAX
+#define STAT_ROW_IO             (CMD_MAX + 1)   /* socket reads and writes, shared by all commands */
+#define STAT_ROWS               (CMD_MAX + 2)
+
+/* Stages a request goes through on the server */
+typedef enum
+{
+    STAT_PHASE_RECEIVE,         /* reading the socket */
+    STAT_PHASE_PARSE,           /* decoding the frame */
+    STAT_PHASE_QUEUE,           /* waiting for a worker */
+    STAT_PHASE_EXECUTE,         /* running the command */
+    STAT_PHASE_SERIALIZE,       /* framing the response */
+    STAT_PHASE_SEND,            /* writing the socket */
+    STAT_PHASE_MAX,
+} statPhase_e;
+
+typedef enum
+{
+    STAT_FRAMES_RECEIVED,
+    STAT_FRAMES_SENT,
+    STAT_BYTES_RECEIVED,
+    STAT_BYTES_SENT,
+    STAT_CONNECTIONS_ACCEPTED,
+    STAT_COUNTER_MAX,
+} statCounter_e;
+
+/*
+ * Log-linear latency histogram in nanoseconds, HDR style: values below
+ * STAT_SUB_BUCKETS get a bucket each, above that every power of two is
+ * split into STAT_SUB_BUCKETS buckets.
+ */
+typedef struct
+{
+    atomic<uint64_t> counts[STAT_BUCKETS];
+    atomic<uint64_t> sumNs;
+    atomic<uint64_t> maxNs;
+} statHistogram_t;
+
+/* Everything one thread records; only that thread writes it */
+typedef struct
+{
+    atomic<statHistogram_t *> histograms[STAT_ROWS][STAT_PHASE_MAX];   /* allocated on first use */
+    atomic<uint64_t> counters[STAT_COUNTER_MAX];
+} statSlot_t;
+
+/* Merged view of one histogram */
+typedef struct
+{
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+    uint64_t counts[STAT_BUCKETS];
+} statSummary_t;
+
+class WorkerPool;
+
+/*
+ * Server wide latency histograms and traffic counters. Every recording
+ * thread gets a slot of its own the first time it records, so recording
+ * is a few plain loads and stores without locks or shared cache lines;
+ * readers add up all slots with relaxed loads. A slot only holds the
+ * histograms its thread used so far, which keeps the per-client threads
+ * of the thread-per-client server small. The slot of a thread that exits
+ * is handed to the next new thread, keeping its counts, so the number of
+ * slots stays at the number of threads alive at once.
+ * Reported by the stats command and, with --metrics-port, as Prometheus
+ * text over HTTP on localhost.
+ */
+class ServerStats
+{
+private:
+    mutex mtx;
+    vector<statSlot_t *> slots;
+    vector<statSlot_t *> freeSlots;
+    atomic<int64_t> activeConnections;
+    int metricsSock;
+    thread endpoint;
+
+    statSlot_t *localSlot();
+    void summarize(int row, statPhase_e phase, statSummary_t &summary);
+    uint64_t counter(statCounter_e counter);
+    void endpointLoop();
+
+public:
+    ServerStats();
+    statSlot_t *acquireSlot();
+    void releaseSlot(statSlot_t *slot);
+    inline void record(int row, statPhase_e phase, uint64_t ns);
+    inline void count(statCounter_e counter, uint64_t n = 1);
+    inline void connectionOpened();
+    inline void connectionClosed();
+    string report(WorkerPool *pool);
+    string prometheus(WorkerPool *pool);
+    bool startEndpoint(uint16_t port);
+    ~ServerStats();
+};
+
+extern ServerStats serverStats;
+
+/*********************************************************************
+ * @fn      		  - statNow
+ * @brief             - This function returns a monotonic timestamp in ns
+ * @param[in]         - none
+ * @return            - uint64_t
+ * @Note              -
+ *********************************************************************/
+inline uint64_t statNow()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*********************************************************************
+ * @fn      		  - statBucket
+ * @brief             - This function returns the histogram bucket of a value
+ * @param[in]         - uint64_t ns
+ * @return            - int
+ * @Note              -
+ *********************************************************************/
+inline int statBucket(uint64_t ns)
+{
+    if (ns < STAT_SUB_BUCKETS)
+        return static_cast<int>(ns);
+    int msb = 63 - __builtin_clzll(ns);
+    int bucket = (msb - STAT_SUB_BUCKET_BITS + 1) * STAT_SUB_BUCKETS +
+                 static_cast<int>((ns >> (msb - STAT_SUB_BUCKET_BITS)) & (STAT_SUB_BUCKETS - 1));
+    return min(bucket, STAT_BUCKETS - 1);
+}
+
+/*********************************************************************
+ * @fn      		  - statRow
+ * @brief             - This function returns the histogram row of a request
+ * @param[in]         - MessageHeader &in
+ * @return            - int
+ * @Note              - Heartbeats, hellos and invalid commands count as I/O
+ *********************************************************************/
+inline int statRow(MessageHeader &in)
+{
+    if (MSG_TYPE_BATCH == in.getMsgType())
+        return STAT_ROW_BATCH;
+    if (MSG_TYPE_CMD == in.getMsgType() && in.getCommand() < CMD_MAX)
+        return in.getCommand();
+    return STAT_ROW_IO;
+}
+
+/*********************************************************************
+ * @fn      		  - statStreamFrames
+ * @brief             - This function returns the number of frames a response
+ *                      is sent in, end frame included
+ * @param[in]         - size_t bodySize, size_t frameSize, uint32_t requestId
+ * @return            - size_t
+ * @Note              -
+ *********************************************************************/
+inline size_t statStreamFrames(size_t bodySize, size_t frameSize, uint32_t requestId)
+{
+    size_t chunk = requestId ? frameSize - REQUEST_ID_SIZE : frameSize;
+    return (bodySize + chunk - 1) / chunk + 1;
+}
+
+/*********************************************************************
+ * @fn      		  - statAdd
+ * @brief             - This function adds to a value only the calling thread
+ *                      writes
+ * @param[in]         - atomic<uint64_t> &value, uint64_t n
+ * @return            - none
+ * @Note              - A plain load and store, no locked instruction
+ *********************************************************************/
+inline void statAdd(atomic<uint64_t> &value, uint64_t n)
+{
+    value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/*********************************************************************
+ * @fn      		  - record
+ * @brief             - This function adds one duration to a histogram
+ * @param[in]         - int row, statPhase_e phase, uint64_t ns
+ * @return            - none
+ * @Note              - row is a command_e or a STAT_ROW_* value
+ *********************************************************************/
+inline void ServerStats::record(int row, statPhase_e phase, uint64_t ns)
+{
+    atomic<statHistogram_t *> &entry = localSlot()->histograms[row][phase];
+    statHistogram_t *histogram = entry.load(memory_order_relaxed);
+    if (!histogram)
+    {
+        histogram = new statHistogram_t();
+        entry.store(histogram, memory_order_release);
+    }
+    statAdd(histogram->counts[statBucket(ns)], 1);
+    statAdd(histogram->sumNs, ns);
+    if (ns > histogram->maxNs.load(memory_order_relaxed))
+        histogram->maxNs.store(ns, memory_order_relaxed);
+}
+
+/*********************************************************************
+ * @fn      		  - count
+ * @brief             - This function adds to a traffic counter
+ * @param[in]         - statCounter_e counter, uint64_t n
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+inline void ServerStats::count(statCounter_e counter, uint64_t n)
+{
+    statAdd(localSlot()->counters[counter], n);
+}
+
+/*********************************************************************
+ * @fn      		  - connectionOpened / connectionClosed
+ * @brief             - These functions track the connected clients
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+inline void ServerStats::connectionOpened()
+{
+    count(STAT_CONNECTIONS_ACCEPTED);
+    activeConnections.fetch_add(1, memory_order_relaxed);
+}
+
+inline void ServerStats::connectionClosed()
+{
+    activeConnections.fetch_sub(1, memory_order_relaxed);
+}
+
+/* Owner of the calling thread's slot, returns it when the thread exits */
+typedef struct statSlotHolder
+{
+    statSlot_t *slot = nullptr;
+    ~statSlotHolder()
+    {
+        if (slot)
+            serverStats.releaseSlot(slot);
+    }
+} statSlotHolder_t;
+
+extern thread_local statSlotHolder_t statLocalSlot;
+
+/*********************************************************************
+ * @fn      		  - localSlot
+ * @brief             - This function returns the calling thread's slot
+ * @param[in]         - none
+ * @return            - statSlot_t *
+ * @Note              - Takes the lock only on a thread's first record
+ *********************************************************************/
+inline statSlot_t *ServerStats::localSlot()
+{
+    if (!statLocalSlot.slot)
+        statLocalSlot.slot = acquireSlot();
+    return statLocalSlot.slot;
+}
+
+#endif
@@ -0,0 +1,301 @@
+#include "WatchHub.hh"
+#include <cmath>
+
+WatchHub watchHub;
+
+/* In Constructor initialise variables of class */
+WatchHub::WatchHub() : stopping(false)
+{
+}
+
+/*********************************************************************
+ * @fn      		  - start
+ * @brief             - This function starts the scheduler thread
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void WatchHub::start()
+{
+    scheduler = thread(&WatchHub::schedulerLoop, this);
+}
+
+/*********************************************************************
+ * @fn      		  - stop
+ * @brief             - This function stops the scheduler thread
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void WatchHub::stop()
+{
+    {
+        lock_guard<mutex> guard(mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (scheduler.joinable())
+        scheduler.join();
+}
+
+/*********************************************************************
+ * @fn      		  - collectionKey
+ * @brief             - This function names what a watch collects, so equal
+ *                      watches of any client map to the same collection
+ * @param[in]         - MessageHeader &in
+ * @return            - string
+ * @Note              - The threshold is per subscriber and not part of it
+ *********************************************************************/
+string WatchHub::collectionKey(MessageHeader &in)
+{
+    return in.describe() + "|" + to_string(in.getWindowMs()) + "|" + to_string(in.getOptions() & CMD_OPT_FRESH) +
+           "|" + to_string(in.getIntervalMs());
+}
+
+/*********************************************************************
+ * @fn      		  - subscribe
+ * @brief             - This function adds a watch of a client to the
+ *                      collection of its command, creating it if needed
+ * @param[in]         - uint64_t clientId, MessageHeader &in, watchSink_t sink
+ * @return            - string (empty, or the error to answer the request with)
+ * @Note              - A subscriber joining a running collection gets its
+ *                      latest result at once instead of waiting a period
+ *********************************************************************/
+string WatchHub::subscribe(uint64_t clientId, MessageHeader &in, watchSink_t sink)
+{
+    if (in.getRequestId() == 0)
+        return "Error: watch needs a client using request IDs\n";
+    if (in.getIntervalMs() < MIN_WATCH_INTERVAL_MS || in.getIntervalMs() > MAX_WATCH_INTERVAL_MS)
+        return "Error: Invalid watch period\n";
+    switch (in.getCommand())
+    {
+        case CMD_GET_PROCESS:
+        case CMD_GET_MEMORY:
+        case CMD_GET_CPU_USAGE:
+        case CMD_GET_PORT_USED:
+        case CMD_WHO_LISTENS:
+            break;
+        default:
+            return "Error: Only get-* and who-listens commands can be watched\n";
+    }
+
+    lock_guard<mutex> guard(mtx);
+    size_t owned = 0;
+    for (auto &entry : collections)
+    {
+        for (const watchSubscriber_t &sub : entry.second.subscribers)
+            owned += sub.clientId == clientId;
+    }
+    if (owned >= MAX_CLIENT_WATCHES)
+        return "Error: At most " + to_string(MAX_CLIENT_WATCHES) + " watches per client\n";
+
+    auto result = collections.try_emplace(collectionKey(in));
+    watchCollection_t &collection = result.first->second;
+    if (result.second)
+    {
+        collection.cmd = in;
+        collection.cmd.setOptions(in.getOptions() & ~CMD_OPT_WATCH);
+        collection.cmd.setRequestId(0);
+        collection.intervalMs = in.getIntervalMs();
+        collection.due = chrono::steady_clock::now();
+        collection.sampled = false;
+    }
+    collection.subscribers.push_back({clientId, in.getRequestId(), in.getThreshold(), move(sink), false, string(), {}});
+
+    if (!collection.sampled)
+    {
+        wake.notify_one();
+        return string();
+    }
+
+    watchSubscriber_t &sub = collection.subscribers.back();
+    switch (sub.sink(string(collection.text)))
+    {
+        case OFFER_DELIVERED:
+            sub.sent = true;
+            sub.lastText = collection.text;
+            sub.lastMetrics = collection.metrics;
+            break;
+        case OFFER_GONE:
+            collection.subscribers.pop_back();
+            break;
+        default:
+            break;
+    }
+    return string();
+}
+
+/*********************************************************************
+ * @fn      		  - unsubscribe
+ * @brief             - This function cancels a watch of a client, or all of
+ *                      them when watchId is 0
+ * @param[in]         - uint64_t clientId, uint32_t watchId
+ * @return            - string (the response to the unwatch command)
+ * @Note              - A collection left without subscribers is dropped
+ *********************************************************************/
+string WatchHub::unsubscribe(uint64_t clientId, uint32_t watchId)
+{
+    lock_guard<mutex> guard(mtx);
+    size_t stopped = 0;
+    for (auto it = collections.begin(); it != collections.end();)
+    {
+        vector<watchSubscriber_t> &subs = it->second.subscribers;
+        auto last = remove_if(subs.begin(), subs.end(), [clientId, watchId](const watchSubscriber_t &sub)
+        {
+            return sub.clientId == clientId && (watchId == 0 || sub.requestId == watchId);
+        });
+        stopped += subs.end() - last;
+        subs.erase(last, subs.end());
+        it = subs.empty() ? collections.erase(it) : next(it);
+    }
+
+    if (stopped == 0)
+        return watchId ? "No watch #" + to_string(watchId) + "\n" : string("No watch running\n");
+    return "Stopped " + to_string(stopped) + " watch(es)\n";
+}
+
+/*********************************************************************
+ * @fn      		  - dropClient
+ * @brief             - This function cancels every watch of a client that
+ *                      disconnected
+ * @param[in]         - uint64_t clientId
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void WatchHub::dropClient(uint64_t clientId)
+{
+    unsubscribe(clientId, 0);
+}
+
+/*********************************************************************
+ * @fn      		  - changedEnough
+ * @brief             - This function tells whether a result differs enough
+ *                      from the last update a subscriber got to send it
+ * @param[in]         - command_e command, const watchSubscriber_t &sub,
+ *                      const string &text, const metricList_t &metrics
+ * @return            - bool
+ * @Note              - The memory threshold is relative to the value last
+ *                      sent, so slow drifts are reported once they add up.
+ *                      A process appearing or going away is always sent
+ *********************************************************************/
+bool WatchHub::changedEnough(command_e command, const watchSubscriber_t &sub,
+                             const string &text, const metricList_t &metrics)
+{
+    if (!sub.sent)
+        return true;
+    if (metrics.empty() && sub.lastMetrics.empty())
+        return text != sub.lastText;
+    if (metrics.size() != sub.lastMetrics.size())
+        return true;
+
+    double limit = sub.threshold / 1000.0;
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        if (metrics[i].first != sub.lastMetrics[i].first)
+            return true;
+        double delta = fabs(metrics[i].second - sub.lastMetrics[i].second);
+        if (command == CMD_GET_MEMORY)
+            delta = 100.0 * delta / max(sub.lastMetrics[i].second, 1.0);
+        if (delta > limit)
+            return true;
+    }
+    return false;
+}
+
+/*********************************************************************
+ * @fn      		  - publish
+ * @brief             - This function sends the latest result of a collection
+ *                      to the subscribers it changed enough for
+ * @param[in]         - watchCollection_t &collection
+ * @return            - none
+ * @Note              - Called with mtx held; subscribers whose client has
+ *                      gone away are removed
+ *********************************************************************/
+void WatchHub::publish(watchCollection_t &collection)
+{
+    vector<watchSubscriber_t> &subs = collection.subscribers;
+    for (auto it = subs.begin(); it != subs.end();)
+    {
+        if (!changedEnough(collection.cmd.getCommand(), *it, collection.text, collection.metrics))
+        {
+            ++it;
+            continue;
+        }
+        offerResult_e result = it->sink(string(collection.text));
+        if (result == OFFER_GONE)
+        {
+            it = subs.erase(it);
+            continue;
+        }
+        // A dropped update leaves the last one the client got to compare with
+        if (result == OFFER_DELIVERED)
+        {
+            it->sent = true;
+            it->lastText = collection.text;
+            it->lastMetrics = collection.metrics;
+        }
+        ++it;
+    }
+}
+
+/*********************************************************************
+ * @fn      		  - schedulerLoop
+ * @brief             - This function runs the collection that is due next,
+ *                      then sleeps until the one after it
+ * @param[in]         - none
+ * @return            - none
+ * @Note              - Commands run without the lock, so subscribing is never
+ *                      held up by a slow collection. A collection that
+ *                      overran its period skips the missed runs
+ *********************************************************************/
+void WatchHub::schedulerLoop()
+{
+    unique_lock<mutex> lock(mtx);
+    while (!stopping)
+    {
+        if (collections.empty())
+        {
+            wake.wait(lock);
+            continue;
+        }
+
+        auto due = collections.begin();
+        for (auto it = collections.begin(); it != collections.end(); ++it)
+        {
+            if (it->second.due < due->second.due)
+                due = it;
+        }
+        auto now = chrono::steady_clock::now();
+        if (due->second.due > now)
+        {
+            wake.wait_until(lock, due->second.due);
+            continue;
+        }
+
+        string key = due->first;
+        MessageHeader cmd = due->second.cmd;
+        chrono::milliseconds period(due->second.intervalMs);
+        due->second.due = max(due->second.due + period, now);
+
+        lock.unlock();
+        metricList_t metrics;
+        string text = dispatchCmd(cmd, &metrics);
+        lock.lock();
+
+        auto it = collections.find(key);
+        if (it == collections.end())
+            continue;
+        it->second.text = move(text);
+        it->second.metrics = move(metrics);
+        it->second.sampled = true;
+        publish(it->second);
+        if (it->second.subscribers.empty())
+            collections.erase(it);
+    }
+}
+
+/* In Destructor stop the scheduler thread */
+WatchHub::~WatchHub()
+{
+    stop();
+}
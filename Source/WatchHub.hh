@@ -0,0 +1,82 @@
+#ifndef WATCH_HUB_H
+#define WATCH_HUB_H
+
+#include <map>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+#include "ExecuteCommands.hh"
+
+#define MAX_CLIENT_WATCHES  64
+
+/* Hands one update to a subscriber's connection, without blocking */
+typedef function<offerResult_e(string &&update)> watchSink_t;
+
+/* One client's subscription to a collection */
+typedef struct
+{
+    uint64_t clientId;
+    uint32_t requestId;         /* the watch request, tags every update */
+    uint32_t threshold;         /* thousandths, see MessageHeader::parseWatch */
+    watchSink_t sink;
+    bool sent;                  /* an update was delivered */
+    string lastText;            /* last update delivered */
+    metricList_t lastMetrics;
+} watchSubscriber_t;
+
+/* A command collected on a schedule for all its subscribers */
+typedef struct
+{
+    MessageHeader cmd;
+    uint32_t intervalMs;
+    chrono::steady_clock::time_point due;
+    bool sampled;
+    string text;                /* latest result, handed to new subscribers */
+    metricList_t metrics;
+    vector<watchSubscriber_t> subscribers;
+} watchCollection_t;
+
+/*
+ * Server side of "watch": runs every watched command once per period on
+ * its own thread and pushes the result on the subscribers' connections as
+ * a response tagged with the watch's request ID. Subscriptions to the same
+ * command, targets and period share one collection whichever client they
+ * come from. An update is only sent to a subscriber when the result moved
+ * by more than its threshold since the last update it got, or when the
+ * output changed for commands without a numeric result. Sinks must not
+ * block: an update a slow client has no room for is dropped, and as the
+ * subscriber's last update stays the one it got, the next result is
+ * compared with that and sent if it still differs.
+ */
+class WatchHub
+{
+private:
+    mutex mtx;
+    condition_variable wake;
+    map<string, watchCollection_t> collections;
+    bool stopping;
+    thread scheduler;
+
+    static string collectionKey(MessageHeader &in);
+    static bool changedEnough(command_e command, const watchSubscriber_t &sub,
+                              const string &text, const metricList_t &metrics);
+    void publish(watchCollection_t &collection);
+    void schedulerLoop();
+
+public:
+    WatchHub();
+    void start();
+    void stop();
+    string subscribe(uint64_t clientId, MessageHeader &in, watchSink_t sink);
+    string unsubscribe(uint64_t clientId, uint32_t watchId);
+    void dropClient(uint64_t clientId);
+    ~WatchHub();
+};
+
+extern WatchHub watchHub;
+
+#endif
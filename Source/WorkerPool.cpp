@@ -0,0 +1,129 @@
+#include "WorkerPool.hh"
+#include "ExecuteCommands.hh"
+#include "ServerStats.hh"
+
+/*********************************************************************
+ * @fn      		  - WorkerPool() [parameterised constructor]
+ * @brief             - This constructor starts workerCount threads serving a
+ *                      queue bounded to capacity entries
+ * @param[in]         - int workerCount, size_t capacity
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+WorkerPool::WorkerPool(int workerCount, size_t capacity)
+    : capacity(max(static_cast<size_t>(1), capacity)), stopping(false),
+      peakDepth(0), rejected(0), completed(0)
+{
+    for (int i = 0; i < max(1, workerCount); i++)
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+}
+
+/*********************************************************************
+ * @fn      		  - submit
+ * @brief             - This function queues a command, waiting while the queue
+ *                      is full
+ * @param[in]         - workItem_t item
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void WorkerPool::submit(workItem_t item)
+{
+    unique_lock<mutex> lock(mtx);
+    notFull.wait(lock, [this] { return queue.size() < capacity || stopping; });
+    if (stopping)
+        return;
+
+    item.queuedAt = statNow();
+    queue.push_back(move(item));
+    peakDepth = max(peakDepth.load(memory_order_relaxed), queue.size());
+    lock.unlock();
+    notEmpty.notify_one();
+}
+
+/*********************************************************************
+ * @fn      		  - trySubmit
+ * @brief             - This function queues a command only if there is room
+ * @param[in]         - workItem_t &item
+ * @return            - bool (false when the queue is full, item is left untouched)
+ * @Note              -
+ *********************************************************************/
+bool WorkerPool::trySubmit(workItem_t &item)
+{
+    unique_lock<mutex> lock(mtx);
+    if (queue.size() >= capacity || stopping)
+    {
+        rejected.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    item.queuedAt = statNow();
+    queue.push_back(move(item));
+    peakDepth = max(peakDepth.load(memory_order_relaxed), queue.size());
+    lock.unlock();
+    notEmpty.notify_one();
+    return true;
+}
+
+/*********************************************************************
+ * @fn      		  - getDepth
+ * @brief             - This function returns the number of queued commands
+ * @param[in]         - none
+ * @return            - size_t
+ * @Note              -
+ *********************************************************************/
+size_t WorkerPool::getDepth()
+{
+    lock_guard<mutex> guard(mtx);
+    return queue.size();
+}
+
+/*********************************************************************
+ * @fn      		  - workerLoop
+ * @brief             - This function runs queued commands and hands the output
+ *                      to the completion of the item
+ * @param[in]         - none
+ * @return            - none
+ * @Note              -
+ *********************************************************************/
+void WorkerPool::workerLoop()
+{
+    while (true)
+    {
+        unique_lock<mutex> lock(mtx);
+        notEmpty.wait(lock, [this] { return !queue.empty() || stopping; });
+        if (queue.empty())
+            return;
+
+        workItem_t item = move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+
+        int row = statRow(item.cmd);
+        uint64_t start = statNow();
+        serverStats.record(row, STAT_PHASE_QUEUE, start - item.queuedAt);
+
+        cmdStatus_e status;
+        string resp = dispatchCmd(item.cmd, nullptr, &status);
+        serverStats.record(row, STAT_PHASE_EXECUTE, statNow() - start);
+        item.done(move(resp), status);
+        completed.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+/* In Destructor stop the workers once the queue is drained */
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> guard(mtx);
+        stopping = true;
+    }
+    notEmpty.notify_all();
+    notFull.notify_all();
+
+    for (auto &worker : workers)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include "RemoteManagement.hh"
+#include "MessageHandle.hh"
+
+#define DEFAULT_WORKERS      4
+#define DEFAULT_QUEUE_DEPTH  256
+
+/* Called on the worker thread with the command output and outcome */
+typedef function<void(string &&resp, cmdStatus_e status)> completion_t;
+
+typedef struct
+{
+    MessageHeader cmd;
+    completion_t done;
+    uint64_t queuedAt;          /* set by the pool, for the queue wait statistics */
+} workItem_t;
+
+/*
+ * Bounded pool running the exec* commands away from the socket I/O threads.
+ * submit() blocks while the queue is full so a thread-per-client reader
+ * stops reading (TCP backpressure); trySubmit() fails instead so the
+ * reactor can park the connection without blocking its event loop.
+ */
+class WorkerPool
+{
+private:
+    mutex mtx;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    deque<workItem_t> queue;
+    size_t capacity;
+    bool stopping;
+    vector<thread> workers;
+
+    atomic<size_t> peakDepth;
+    atomic<uint64_t> rejected;
+    atomic<uint64_t> completed;
+
+    void workerLoop();
+
+public:
+    WorkerPool(int workerCount, size_t capacity);
+    void submit(workItem_t item);
+    bool trySubmit(workItem_t &item);
+    size_t getDepth();
+    inline size_t getCapacity() { return capacity; }
+    inline size_t getPeakDepth() { return peakDepth.load(memory_order_relaxed); }
+    inline uint64_t getRejected() { return rejected.load(memory_order_relaxed); }
+    inline uint64_t getCompleted() { return completed.load(memory_order_relaxed); }
+    ~WorkerPool();
+};
+
+#endif